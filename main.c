@@ -1,6 +1,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "modbus.h"
+#include "modbus_crc.h"
+#include "modbus_tcp.h"
+#include "modbus_poll.h"
+#include "modbus_linux.h"
+#include "modbus_bench.h"
+#include "modbus_trace.h"
+#include "modbus_gateway.h"
+#include "modbus_farm.h"
 
 void unit_test();
 
@@ -8,5 +16,35 @@ int main()
 {
     printf("Hello world!\n");
     unit_test();
+#ifdef _UNIT_TEST
+    ModBus_Poll_unitTest();
+#endif
+#if defined(_UNIT_TEST) && defined(MODBUS_TRACE)
+    ModBus_Trace_unitTest();
+#endif
+#if defined(_UNIT_TEST) && !defined(_WIN32)
+    ModBus_TCP_unitTest();
+#endif
+#if defined(_UNIT_TEST) && defined(__linux__)
+    ModBus_Linux_unitTest();
+    ModBus_Gateway_unitTest();
+    ModBus_Farm_unitTest();
+#endif
+#ifdef _BENCHMARK
+    ModBus_CRC16_benchmark();
+    ModBus_queue_benchmark();
+    ModBus_prepared_benchmark();
+    ModBus_diff_benchmark();
+#ifdef MODBUS_TRACE
+    ModBus_Trace_benchmark();
+#endif
+#ifdef MODBUS_SLAVE
+    ModBus_Bench_loopback();
+#endif
+#if defined(MODBUS_SLAVE) && defined(__linux__)
+    ModBus_Gateway_benchmark();
+    ModBus_Farm_benchmark();
+#endif
+#endif
     return 0;
 }
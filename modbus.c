@@ -1,6 +1,66 @@
 #include "modbus.h"
+#include "modbus_crc.h"
+#ifdef MODBUS_TRACE
+#include "modbus_trace.h"
+#endif
 #include <stdarg.h>
 
+static uint64_t(*s_clockUs)() = NULL; // Источник времени, NULL - millis()
+
+// millis() с учетом переполнения 32-битного счетчика. Вызывается из цикла и из приема (прерывание, поток чтения):
+// старшие 32 бита состояния - число переполнений, младшие - последнее значение millis(), изменяются одним CAS
+static uint64_t ModBus_millisClock()
+{
+    static MODBUS_ATOMIC(uint64_t) state = 0;
+    uint32_t ms = millis();
+    uint64_t current = atomic_load_explicit(&state, memory_order_relaxed);
+    uint64_t next;
+    do
+    {
+        int32_t delta = (int32_t)(ms - (uint32_t)current);
+        if (delta < 0) // Значение прочитано до сохраненного другим контекстом, состояние не откатывается
+        {
+            return (current + (uint64_t)(int64_t)delta) * 1000u;
+        }
+        next = current + (uint32_t)delta;
+    } while (!atomic_compare_exchange_weak_explicit(&state, &current, next, memory_order_relaxed, memory_order_relaxed));
+    return next * 1000u;
+}
+
+void ModBus_setClock(uint64_t(*clockUs)())
+{
+    s_clockUs = clockUs;
+}
+
+uint64_t ModBus_now()
+{
+    return s_clockUs ? s_clockUs() : ModBus_millisClock();
+}
+
+#ifdef _BENCHMARK
+#include <time.h>
+
+uint64_t ModBus_benchNowNs()
+{
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+int ModBus_benchCompareU32(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+#endif // _BENCHMARK
+
+// Тайм-аут ответа: передача запроса и ответа наибольшей длины плюс запас на обработку, мкс
+static uint32_t ModBus_responseTimeout(uint32_t registerLimit, uint32_t baud, uint32_t marginMs)
+{
+    uint64_t timeout = (((uint64_t)registerLimit * 4u + 20u) * 2000u + 7000u) * 8000u / baud + (uint64_t)marginMs * 1000u;
+    return timeout > UINT32_MAX ? UINT32_MAX : (uint32_t)timeout;
+}
+
 /** Конфигурирование экземпляров ModBus **/
 /*** Параметры ***
 ** address: Адрес устройства
@@ -10,14 +70,49 @@
 void ModBus_setup( ModBus_parameter* ModBus_para, ModBus_Setting_T setting)
 {
     ModBus_para->m_address = setting.address;
-    ModBus_para->m_receiveFrameBufferLen = 0;
+    ModBus_para->m_receiveScanned = 0;
+    ModBus_CRC16_init();
+#ifdef MODBUS_MASTER
+    ModBus_para->m_sendFrames = ModBus_para->m_sendFramesDefault;
+    ModBus_para->m_sendFramesSize = MODBUS_WAITFRAME_N;
+    ModBus_para->m_sendFramesHead = 0;
     ModBus_para->m_sendFramesN = 0;
     ModBus_para->m_nextFrameIndex = 1; // Порядковый номер пакета, начиная с 1
+    ModBus_para->m_waitingResponse = 0;
+    ModBus_para->m_window = 1;
+    ModBus_para->m_sendFramesSent = 0;
+    ModBus_para->m_inFlight = 0;
+    ModBus_para->m_nextTransaction = 1;
+    ModBus_para->m_skipUnitOnTimeout = 0;
+    ModBus_para->m_coalesce = 0;
+    ModBus_para->m_coalesceGap = 0;
+    ModBus_para->m_status = MODBUS_STATUS_OK;
+    ModBus_para->m_unitTiming = NULL;
+    ModBus_para->m_unitTimingN = 0;
+    ModBus_para->m_unitTimingNext = 0;
+    ModBus_para->m_minTimeout = 0;
+    ModBus_para->m_maxTimeout = 0;
+    ModBus_para->m_retries = 0;
+    ModBus_para->m_offlineAfter = 0;
+    ModBus_para->m_offlineTime = 0;
+    ModBus_para->m_cache = NULL;
+    ModBus_para->m_cacheMask = 0;
+    ModBus_para->m_cacheRanges = NULL;
+    ModBus_para->m_cacheRangesN = 0;
+    ModBus_para->m_subscriptions = NULL;
+    ModBus_para->m_subscriptionsN = 0;
+#endif
 
-    //ModBus_para->m_receiveBufferTmpLen = 0;
-    ModBus_para->m_pBeginReceiveBufferTmp = ModBus_para->m_receiveBufferTmp;
-    ModBus_para->m_pEndReceiveBufferTmp = ModBus_para->m_receiveBufferTmp;
+    atomic_init(&ModBus_para->m_receiveHead, 0);
+    atomic_init(&ModBus_para->m_receiveTail, 0);
+    atomic_init(&ModBus_para->m_receiveOverflow, 0);
     ModBus_para->m_hasDetectedBufferStart = 0;
+#ifdef MODBUS_STATS
+    ModBus_resetStats(ModBus_para);
+#endif
+#ifdef MODBUS_TRACE
+    ModBus_para->m_trace = NULL;
+#endif
 
     ModBus_para->m_registerCount = 0;
     if (setting.register_access_limit > 0 && setting.register_access_limit <= MODBUS_REGISTER_LIMIT)
@@ -33,22 +128,36 @@ void ModBus_setup( ModBus_parameter* ModBus_para, ModBus_Setting_T setting)
     {
         setting.baudRate = MODBUS_DEFAULT_BAUD;
     }
-    ModBus_para->m_receiveTimeout = 4000u * 8u / setting.baudRate + 2u;
-    ModBus_para->m_sendTimeout = ((ModBus_para->m_registerAcessLimit * 4u + 20u) * 2000u + 7000u) * 8u / setting.baudRate + 5u;
+    ModBus_para->m_receiveTimeout = ModBus_T35(setting.baudRate);
+    ModBus_para->m_sendTimeout = ModBus_responseTimeout(ModBus_para->m_registerAcessLimit, setting.baudRate, 5u);
+    ModBus_para->m_charTime = (11000000u + setting.baudRate - 1) / setting.baudRate;
 
-    ModBus_para->m_lastReceivedTime = ModBus_para->m_lastSentTime = millis();
+    ModBus_para->m_lastSentTime = ModBus_now();
+    atomic_init(&ModBus_para->m_lastReceivedTime, (uint32_t)ModBus_para->m_lastSentTime);
 
     ModBus_para->m_faston = 0; // Быстрый режим по умолчанию отключен, чтобы гарантировать, что инструкции могут выполняться по порядку во время инициализации
 
     ModBus_para->m_SendHandler = setting.sendHandler;
+    ModBus_para->m_SendHandlerEx = NULL;
+    ModBus_para->m_sendContext = NULL;
+    ModBus_para->m_mode = MODBUS_MODE_RTU;
 
 #ifdef MODBUS_MASTER // Master
 
 #endif
 
 #ifdef MODBUS_SLAVE // Slave
+    ModBus_para->m_receiveTransaction = 0;
+    ModBus_para->m_receiveUnit = setting.address;
     ModBus_para->m_GetRegisterHandler = NULL;
     ModBus_para->m_SetRegisterHandler = NULL;
+    ModBus_para->m_bank = NULL;
+    ModBus_para->m_GetInputHandler = NULL;
+    ModBus_para->m_GetBitsHandler = NULL;
+    ModBus_para->m_SetBitsHandler = NULL;
+    ModBus_para->m_units = NULL;
+    ModBus_para->m_replyDelay = 0;
+    ModBus_para->m_replyPending = 0;
 #endif
 
 }
@@ -62,8 +171,9 @@ void ModBus_setBitRate(ModBus_parameter* ModBus_para, uint32_t baud)
 {
     if (baud > 0)
     {
-        ModBus_para->m_receiveTimeout = 4000u * 8u / baud + 2u;
-        ModBus_para->m_sendTimeout = ((ModBus_para->m_registerAcessLimit * 4u + 20u) * 2000u + 7000u) * 8u / baud + 15u;
+        ModBus_para->m_receiveTimeout = ModBus_T35(baud);
+        ModBus_para->m_sendTimeout = ModBus_responseTimeout(ModBus_para->m_registerAcessLimit, baud, 15u);
+        ModBus_para->m_charTime = (11000000u + baud - 1) / baud;
     }
 }
 
@@ -75,10 +185,15 @@ void ModBus_setBitRate(ModBus_parameter* ModBus_para, uint32_t baud)
 ***/
 void ModBus_setTimeout(ModBus_parameter* ModBus_para, uint32_t receiveTimeout, uint32_t sendTimeout)
 {
-    if (receiveTimeout > 0)
-        ModBus_para->m_receiveTimeout = receiveTimeout;
-    if (sendTimeout > 0)
-        ModBus_para->m_sendTimeout = sendTimeout;
+    ModBus_setTimeoutUs(ModBus_para, receiveTimeout * 1000u, sendTimeout * 1000u);
+}
+
+void ModBus_setTimeoutUs(ModBus_parameter* ModBus_para, uint32_t receiveTimeoutUs, uint32_t sendTimeoutUs)
+{
+    if (receiveTimeoutUs > 0)
+        ModBus_para->m_receiveTimeout = receiveTimeoutUs;
+    if (sendTimeoutUs > 0)
+        ModBus_para->m_sendTimeout = sendTimeoutUs;
 }
 
 // В режиме RTU генерируется контрольная сумма CRC, которая добавляется в конец данных.
@@ -87,65 +202,158 @@ void ModBus_setTimeout(ModBus_parameter* ModBus_para, uint32_t receiveTimeout, u
 // return total length
 static size_t GenCRC16(uint8_t* buff, size_t len)
 {
-    uint16_t crc = 0xFFFF;
-    uint16_t pos = 0;
-    uint8_t i = 0;
-    uint8_t lo = 0;
-    uint8_t hi = 0;
+    uint16_t crc = ModBus_CRC16(buff, len);
 
-    for (pos = 0; pos < len; pos++)
+    buff[len++] = crc & 0xFF;
+    buff[len++] = (crc >> 8) & 0xFF;
+    return len;
+}
+
+
+
+// Принятые байты от m_receiveTail в виде области кольцевого буфера, возвращает их количество
+static size_t ModBus_receiveView(ModBus_parameter* ModBus_para, ModBus_RingView_T* view)
+{
+    size_t head = atomic_load_explicit(&ModBus_para->m_receiveHead, memory_order_acquire); // Байты до head записаны производителем
+    size_t tail = atomic_load_explicit(&ModBus_para->m_receiveTail, memory_order_relaxed);
+    view->first = ModBus_para->m_receiveBufferTmp + tail;
+    view->second = ModBus_para->m_receiveBufferTmp;
+    if (head >= tail)
+    {
+        view->firstLen = head - tail;
+        view->secondLen = 0;
+    }
+    else
     {
-        crc ^= buff[pos];
+        view->firstLen = MODBUS_RECEIVE_RING_SIZE - tail;
+        view->secondLen = head;
+    }
+    return view->firstLen + view->secondLen;
+}
 
-        for (i = 8; i != 0; i--)
-        {
-            if ((crc & 0x0001) != 0)
-            {
-                crc >>= 1;
-                crc ^= 0xA001;
-            }
-            else
-                crc >>= 1;
-        }
+// Количество непрочитанных байтов кольцевого буфера
+static size_t ModBus_receiveAvailable(ModBus_parameter* ModBus_para)
+{
+    ModBus_RingView_T view;
+    return ModBus_receiveView(ModBus_para, &view);
+}
+
+// После последнего разбора приняты новые байты
+static uint8_t ModBus_receivePending(ModBus_parameter* ModBus_para)
+{
+    return ModBus_receiveAvailable(ModBus_para) > ModBus_para->m_receiveScanned;
+}
+
+// Время от последнего приема до now, мкс. Метка, сохраненная приемом после выборки now, дает 0, а не переполнение
+static uint32_t ModBus_sinceReceived(ModBus_parameter* ModBus_para, uint64_t now)
+{
+    uint32_t elapsed = (uint32_t)now - atomic_load_explicit(&ModBus_para->m_lastReceivedTime, memory_order_relaxed);
+    return (int32_t)elapsed < 0 ? 0 : elapsed;
+}
+
+// Освобождение первых n байтов для производителя, индекс потребителя сдвигается только после обработки кадра
+static void ModBus_consumeReceived(ModBus_parameter* ModBus_para, size_t n)
+{
+    size_t tail = atomic_load_explicit(&ModBus_para->m_receiveTail, memory_order_relaxed) + n;
+    if (tail >= MODBUS_RECEIVE_RING_SIZE)
+    {
+        tail -= MODBUS_RECEIVE_RING_SIZE;
     }
-    lo = crc & 0xFF;
-    hi = (crc >> 8) & 0xFF;
+    atomic_store_explicit(&ModBus_para->m_receiveTail, tail, memory_order_release); // Освобожденное место доступно производителю
+    ModBus_para->m_receiveScanned = ModBus_para->m_receiveScanned > n ? ModBus_para->m_receiveScanned - n : 0;
+}
 
-    buff[len++] = lo;
-    buff[len++] = hi;
-    return len;
+// Сброс разбора: просмотренные байты незавершенного кадра отбрасываются, байты, принятые позже, сохраняются
+static void ModBus_resetReceiveFrame(ModBus_parameter* ModBus_para)
+{
+    ModBus_consumeReceived(ModBus_para, ModBus_para->m_receiveScanned);
+    ModBus_para->m_hasDetectedBufferStart = 0;
 }
 
-// В режиме RTU контрольная сумма CRC вычисляется, учитывая начальное значение
-// Calculate CRC fro incoming buffer
-// Return 1 - if CRC is correct, overwise return 0
-static uint8_t CheckCRC16(uint8_t* buff, size_t len)
+// Отбросить все непрочитанные байты кольцевого буфера
+static void ModBus_dropReceived(ModBus_parameter* ModBus_para)
+{
+    atomic_store_explicit(&ModBus_para->m_receiveTail, atomic_load_explicit(&ModBus_para->m_receiveHead, memory_order_acquire), memory_order_release);
+    ModBus_para->m_receiveScanned = 0;
+    ModBus_para->m_hasDetectedBufferStart = 0;
+}
+
+// Ограничение области первыми size байтами
+static void ModBus_viewTrim(ModBus_RingView_T* view, size_t size)
 {
-    uint16_t crc = 0xFFFF;
-    uint16_t pos = 0;
-    uint8_t i = 0;
-    uint8_t lo = 0;
-    uint8_t hi = 0;
+    if (size <= view->firstLen)
+    {
+        view->firstLen = size;
+        view->secondLen = 0;
+    }
+    else
+    {
+        view->secondLen = size - view->firstLen;
+    }
+}
 
-    for (pos = 0; pos < len - 2; pos++)
+// Пропуск первых n байтов области
+static void ModBus_viewAdvance(ModBus_RingView_T* view, size_t n)
+{
+    if (n < view->firstLen)
     {
-        crc ^= buff[pos];
+        view->first += n;
+        view->firstLen -= n;
+        return;
+    }
+    n -= view->firstLen;
+    view->first = view->second + n;
+    view->firstLen = view->secondLen - n;
+    view->secondLen = 0;
+}
 
-        for (i = 8; i != 0; i--)
-        {
-            if ((crc & 0x0001) != 0)
-            {
-                crc >>= 1;
-                crc ^= 0xA001;
-            }
-            else
-                crc >>= 1;
-        }
+// Копирование size байтов области, начиная с offset (не больше двух вызовов memcpy)
+static void ModBus_viewCopy(const ModBus_RingView_T* view, size_t offset, uint8_t* dst, size_t size)
+{
+    if (offset < view->firstLen)
+    {
+        size_t n = size < view->firstLen - offset ? size : view->firstLen - offset;
+        memcpy(dst, view->first + offset, n);
+        dst += n;
+        size -= n;
+        offset = 0;
+    }
+    else
+    {
+        offset -= view->firstLen;
+    }
+    memcpy(dst, view->second + offset, size);
+}
+
+// Непрерывный указатель на size байтов области с offset: внутри одной части - прямо в кольцевой буфер,
+// на переходе через конец буфера - копия в scratch (нужна только функциям обратного вызова, принимающим указатель)
+static const uint8_t* ModBus_viewLinear(const ModBus_RingView_T* view, size_t offset, size_t size, uint8_t* scratch)
+{
+    if (offset + size <= view->firstLen)
+    {
+        return view->first + offset;
+    }
+    if (offset >= view->firstLen)
+    {
+        return view->second + (offset - view->firstLen);
+    }
+    ModBus_viewCopy(view, offset, scratch, size);
+    return scratch;
+}
+
+// В режиме RTU контрольная сумма CRC первых len байтов области, считается по обеим частям без копирования
+// Return 1 - if CRC is correct, overwise return 0
+static uint8_t CheckCRC16(const ModBus_RingView_T* view, size_t len)
+{
+    size_t n = len < view->firstLen ? len : view->firstLen;
+    uint16_t crc;
+    if (len < 2)
+    {
+        return 0;
     }
-    lo = crc & 0xFF;
-    hi = (crc >> 8) & 0xFF;
-    if ((buff[len - 2] == lo) &&
-        (buff[len - 1] == hi))
+    crc = ModBus_CRC16_update(MODBUS_CRC16_INIT, view->first, n);
+    crc = ModBus_CRC16_update(crc, view->second, len - n);
+    if (crc == MODBUS_CRC16_RESIDUE)
     {
         return 1;
     }
@@ -155,669 +363,2904 @@ static uint8_t CheckCRC16(uint8_t* buff, size_t len)
     return 0;
 }
 
+/** Установка режима кадров **/
+/*** Параметры ***
+** mode: MODBUS_MODE_RTU или MODBUS_MODE_TCP
+** window: Количество запросов Modbus TCP, одновременно ожидающих ответа
+***/
+void ModBus_setMode(ModBus_parameter* ModBus_para, MODBUS_MODE_TYPE mode, uint8_t window)
+{
+    ModBus_para->m_mode = (uint8_t)mode;
+#ifdef MODBUS_MASTER
+    ModBus_para->m_window = window > 0 ? window : 1;
+#endif
+#ifdef MODBUS_SLAVE
+    ModBus_para->m_replyPending = 0; // Задержанный ответ относится к прежнему соединению
+#endif
+    ModBus_resetReceiveFrame(ModBus_para);
+}
 
+void ModBus_attachSendHandler(ModBus_parameter* ModBus_para, void(*SendHandler)(void*, uint8_t*, size_t), void* context)
+{
+    ModBus_para->m_SendHandlerEx = SendHandler;
+    ModBus_para->m_sendContext = context;
+}
 
-static MODBUS_FRAME_T* addFrame(ModBus_parameter* ModBus_para)
+// Передача кадра через привязанную функцию отправки, возвращает 1, если кадр передан
+static uint8_t ModBus_send(ModBus_parameter* ModBus_para, uint8_t* data, size_t size)
 {
-    MODBUS_FRAME_T* pFrame;
-    if (ModBus_para->m_sendFramesN >= MODBUS_WAITFRAME_N)
+    if (ModBus_para->m_SendHandlerEx != NULL)
     {
-        memcpy(ModBus_para->m_sendFrames, ModBus_para->m_sendFrames + 1, (ModBus_para->m_sendFramesN - 1) * sizeof(MODBUS_FRAME_T));
-        pFrame = ModBus_para->m_sendFrames + (ModBus_para->m_sendFramesN - 1);
+        (*ModBus_para->m_SendHandlerEx)(ModBus_para->m_sendContext, data, size);
+    }
+    else if (ModBus_para->m_SendHandler != NULL)
+    {
+        (*ModBus_para->m_SendHandler)(data, size);
     }
     else
     {
-        pFrame = ModBus_para->m_sendFrames + (ModBus_para->m_sendFramesN++);
+        return 0;
     }
-    pFrame->index = ModBus_para->m_nextFrameIndex++;
-    if (ModBus_para->m_nextFrameIndex == 0) // Номер инструкции не равен 0
+    ModBus_para->m_lastSentTime = ModBus_now();
+    MODBUS_STAT_INC(ModBus_para, framesSent);
+#ifdef MODBUS_TRACE
+    if (ModBus_para->m_trace != NULL)
     {
-        ModBus_para->m_nextFrameIndex = 1;
+        ModBus_Trace_record(ModBus_para->m_trace, MODBUS_TRACE_TX, data[ModBus_para->m_mode == MODBUS_MODE_TCP ? MODBUS_MBAP_SIZE - 1 : 0], ModBus_para->m_lastSentTime, data, size);
     }
-    pFrame->size = 0;
-    pFrame->getResponseHandler = NULL;
-    pFrame->setResponseHandler = NULL;
-    //pFrame->responseHandler = NULL;
-    pFrame->time = millis();
-    MODBUS_DELAY_DEBUG("Frames Num: %d\n", ModBus_para->m_sendFramesN);
-    return pFrame;
+#endif
+    return 1;
+}
+
+// Заголовок кадра: адрес устройства (RTU) или заголовок MBAP (TCP), возвращает длину заголовка
+static size_t ModBus_beginFrame(ModBus_parameter* ModBus_para, uint8_t* buff, uint8_t unit, uint16_t transaction)
+{
+    size_t size = 0;
+    if (ModBus_para->m_mode == MODBUS_MODE_TCP)
+    {
+        buff[size++] = (transaction >> 8) & 0x0FF; // Идентификатор транзакции
+        buff[size++] = transaction & 0x0FF;
+        buff[size++] = 0; // Идентификатор протокола, всегда 0
+        buff[size++] = 0;
+        buff[size++] = 0; // Длина, заполняется в ModBus_endFrame
+        buff[size++] = 0;
+    }
+    buff[size++] = unit; // Адрес устройства
+    return size;
 }
 
+// Завершение кадра: CRC (RTU) или длина в заголовке MBAP (TCP), возвращает полную длину кадра
+static size_t ModBus_endFrame(ModBus_parameter* ModBus_para, uint8_t* buff, size_t size)
+{
+    if (ModBus_para->m_mode == MODBUS_MODE_TCP)
+    {
+        buff[4] = ((size - 6) >> 8) & 0x0FF; // Длина считается от адреса устройства
+        buff[5] = (size - 6) & 0x0FF;
+        return size;
+    }
+    return GenCRC16(buff, size);
+}
 
-// Получение байтовых данных по протоколу ModBus, обычно вызывается в функциях прерывания (например, прерывание приема последовательного порта).
-void ModBus_readbyteFromOuter(ModBus_parameter* ModBus_para, uint8_t receiveduint8_t)
+// Длина служебной части кадра (все, кроме PDU)
+static size_t ModBus_frameOverhead(ModBus_parameter* ModBus_para)
 {
-#ifdef _UNIT_TEST
-    printf("address %02x read uint8_t: %02x\n", ModBus_para->m_address, receiveduint8_t);
-#endif // _UNIT_TEST
+    return ModBus_para->m_mode == MODBUS_MODE_TCP ? MODBUS_MBAP_SIZE : 3;
+}
+
+// Максимальное количество регистров в одной команде записи: limit экземпляра, но не больше maxCount спецификации (FC16, FC23)
+static uint16_t ModBus_writeLimit(ModBus_parameter* ModBus_para, uint16_t maxCount)
+{
+    return ModBus_para->m_registerAcessLimit < maxCount ? ModBus_para->m_registerAcessLimit : maxCount;
+}
+
+// Максимальное количество битов в одной команде: упакованные биты занимают не больше места, чем register_access_limit регистров
+static uint16_t ModBus_bitLimit(ModBus_parameter* ModBus_para, uint16_t maxCount)
+{
+    uint32_t limit = 16u * ModBus_para->m_registerAcessLimit;
+    return limit < maxCount ? (uint16_t)limit : maxCount;
+}
+
 
-    /*** Значение ModBus_para->m_pBeginReceiveBufferTmp не может быть изменено внутри этой функции!!!!!!!!!!!!!
-    **** Значение ModBus_para->m_pEndReceiveBufferTmp не может быть изменено вне этой функции!!!!!!!!!!!!!!!
-    **** Избегайте конфликтов при записи в память и обеспечивайте целостность данных***/
-    *ModBus_para->m_pEndReceiveBufferTmp = receiveduint8_t;
-    if (ModBus_para->m_pEndReceiveBufferTmp >= ModBus_para->m_receiveBufferTmp + MODBUS_BUFFER_SIZE - 1)
+// Проверка входящих пакетов Modbus TCP: кадр завершен, когда принято столько байтов, сколько указано в заголовке MBAP.
+// Возвращает 1, если кадр принят: frame - область кадра в кольцевом буфере, освобождается вызывающим после обработки
+static uint8_t ModBus_detectFrame_TCP(ModBus_parameter* ModBus_para, ModBus_RingView_T* frame)
+{
+    size_t frameSize;
+    size_t len = ModBus_receiveView(ModBus_para, frame);
+    if (len < MODBUS_MBAP_SIZE)
     {
-        ModBus_para->m_pEndReceiveBufferTmp = ModBus_para->m_receiveBufferTmp;
+        return 0;
     }
-    else
+    frameSize = 6 + (size_t)ModBus_viewWord(frame, 4);
+    if (ModBus_viewWord(frame, 2) != 0 // Идентификатор протокола не Modbus
+        || frameSize < MODBUS_MBAP_SIZE + 1 || frameSize > MODBUS_BUFFER_SIZE)
     {
-        ModBus_para->m_pEndReceiveBufferTmp++;
+        // Поток TCP нельзя синхронизировать повторно, данные отбрасываются
+        ModBus_dropReceived(ModBus_para);
+        return 0;
     }
-    if (ModBus_para->m_pEndReceiveBufferTmp == ModBus_para->m_pBeginReceiveBufferTmp)
+    if (len < frameSize)
     {
-        ModBus_para->m_pEndReceiveBufferTmp--;
-        if (ModBus_para->m_pEndReceiveBufferTmp < ModBus_para->m_receiveBufferTmp)
-        {
-            ModBus_para->m_pEndReceiveBufferTmp = ModBus_para->m_receiveBufferTmp + (MODBUS_BUFFER_SIZE - 1);
-        }
+        return 0;
     }
-    ModBus_para->m_lastReceivedTime = millis();
+    ModBus_viewTrim(frame, frameSize);
+    MODBUS_STAT_INC(ModBus_para, framesReceived);
+    return 1;
 }
 
-void ModBus_fastMode(ModBus_parameter* ModBus_para, uint8_t faston)
+#ifdef MODBUS_MASTER
+// Первая команда очереди (отправляется или ожидает ответа)
+static MODBUS_FRAME_T* frontFrame(ModBus_parameter* ModBus_para)
 {
-    ModBus_para->m_faston = faston;
+    return ModBus_para->m_sendFrames + ModBus_para->m_sendFramesHead;
 }
 
-
-// Проверка входящих пакетов, возвращает 1, если есть достоверные данные, в противном случае возвращает 0
-static uint8_t ModBus_detectFrame(ModBus_parameter* ModBus_para, size_t* restSize)
+// Команда с номером n от начала очереди
+static MODBUS_FRAME_T* queueFrame(ModBus_parameter* ModBus_para, size_t n)
 {
-    size_t i = 0, j = 0;
-    uint8_t* pEnd, *pBegin;
-    size_t lenBufferTmp;
-    uint8_t frameSize = 0;
-
-#ifdef MODBUS_MASTER
-    if (ModBus_para->m_sendFramesN > 0)
+    n += ModBus_para->m_sendFramesHead;
+    if (n >= ModBus_para->m_sendFramesSize)
     {
-        frameSize = ModBus_para->m_sendFrames[0].responseSize;
+        n -= ModBus_para->m_sendFramesSize;
     }
-#endif
+    return ModBus_para->m_sendFrames + n;
+}
 
-    pEnd = ModBus_para->m_pEndReceiveBufferTmp;
-    pBegin = ModBus_para->m_pBeginReceiveBufferTmp; // volatile переменные должны быть присвоены энергонезависимым переменным, прежде чем ими можно будет манипулировать, иначе существует вероятность неполноты данных
-    lenBufferTmp = pEnd - pBegin;
-    if (pEnd < pBegin)
+// Удаление первой команды из очереди
+static void popFrame(ModBus_parameter* ModBus_para)
+{
+    if (++ModBus_para->m_sendFramesHead == ModBus_para->m_sendFramesSize)
     {
-        lenBufferTmp = (size_t)MODBUS_BUFFER_SIZE - (pBegin - pEnd);
+        ModBus_para->m_sendFramesHead = 0;
     }
-    *restSize = 0;
-
+    ModBus_para->m_sendFramesN--;
+}
 
-    
-    uint8_t isTimeout = 0;
-    if (lenBufferTmp == 0) // Данные не получены из-за тайм-аута приема
+// Серийный номер следующей команды
+static uint8_t ModBus_nextIndex(ModBus_parameter* ModBus_para)
+{
+    uint8_t index = ModBus_para->m_nextFrameIndex++;
+    if (ModBus_para->m_nextFrameIndex == 0) // Номер инструкции не равен 0
     {
-        isTimeout = 1;
-    }
-    if (!ModBus_para->m_hasDetectedBufferStart)
-    {// Определение начального байта
-        for (i = 0; i < lenBufferTmp; i++, pBegin++)
-        {
-            if (*pBegin == ModBus_para->m_address) // Адрес обнаружен
-            {
-                ModBus_para->m_hasDetectedBufferStart = 1;
-                ModBus_para->m_receiveFrameBuffer[ModBus_para->m_receiveFrameBufferLen++] = *pBegin;
-                i++;
-                pBegin++;
-                break;
-            }
-        }
+        ModBus_para->m_nextFrameIndex = 1;
     }
-    if (ModBus_para->m_hasDetectedBufferStart)
+    return index;
+}
+
+// Добавление команды в конец очереди, возвращает NULL, если очередь заполнена
+static MODBUS_FRAME_T* addFrame(ModBus_parameter* ModBus_para)
+{
+    MODBUS_FRAME_T* pFrame;
+    size_t tail;
+    if (ModBus_para->m_sendFramesN >= ModBus_para->m_sendFramesSize)
     {
-        // Копирование всех данных из временного буфера в буфер данных приема
-        size_t newSize = lenBufferTmp - i;
-        if (ModBus_para->m_receiveFrameBufferLen + newSize > MODBUS_BUFFER_SIZE)
-        {
-            newSize = MODBUS_BUFFER_SIZE - ModBus_para->m_receiveFrameBufferLen;
-        }
-        if (pBegin <= pEnd)
-        {
-            memcpy(ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen, pBegin, newSize);
-        }
-        else
+        // В быстром режиме выполняется только последняя команда, поэтому она заменяется, если еще не отправлена
+        if (!ModBus_para->m_faston || ModBus_para->m_mode == MODBUS_MODE_TCP || (ModBus_para->m_sendFramesN == 1 && ModBus_para->m_waitingResponse))
         {
-            memcpy(ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen, pBegin, 
-                    (size_t)MODBUS_BUFFER_SIZE - (pBegin - ModBus_para->m_receiveBufferTmp));
-
-            memcpy(ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen + (size_t)MODBUS_BUFFER_SIZE - (pBegin - ModBus_para->m_receiveBufferTmp), 
-                    (void*)ModBus_para->m_receiveBufferTmp, pEnd - ModBus_para->m_receiveBufferTmp);
+            MODBUS_DELAY_DEBUG("Frames queue full\n");
+            MODBUS_STAT_INC(ModBus_para, queueFull);
+            return NULL;
         }
-        ModBus_para->m_receiveFrameBufferLen += newSize;
-        ModBus_para->m_pBeginReceiveBufferTmp = pEnd;
+        ModBus_para->m_sendFramesN--;
+        MODBUS_STAT_INC(ModBus_para, evictions);
     }
-    else // Если начальный символ не обнаружен, полученные данные являются ненормальными
+    tail = ModBus_para->m_sendFramesHead + ModBus_para->m_sendFramesN;
+    if (tail >= ModBus_para->m_sendFramesSize)
     {
-        ModBus_para->m_pBeginReceiveBufferTmp = pEnd;
-        ModBus_para->m_receiveFrameBufferLen = 0;
-        return 0;
+        tail -= ModBus_para->m_sendFramesSize;
     }
-    if (!(isTimeout // Тайм-аут приема
-        || frameSize > 0 && ModBus_para->m_receiveFrameBufferLen >= frameSize // Достаточное количество пакетов данных
-        || ModBus_para->m_receiveFrameBufferLen >= MODBUS_BUFFER_SIZE)) // Буфер заполнен
+    pFrame = ModBus_para->m_sendFrames + tail;
+    ModBus_para->m_sendFramesN++;
+
+    pFrame->index = ModBus_nextIndex(ModBus_para);
+    pFrame->transaction = ModBus_para->m_nextTransaction++;
+    pFrame->state = MODBUS_FRAME_PENDING;
+    pFrame->size = 0;
+    pFrame->getResponseHandler = NULL;
+    pFrame->getResponseHandlerEx = NULL;
+    pFrame->context = NULL;
+    pFrame->setResponseHandler = NULL;
+    pFrame->getBitsResponseHandler = NULL;
+    pFrame->pduResponseHandler = NULL;
+    pFrame->timeout = ModBus_para->m_sendTimeout;
+    pFrame->retries = 0;
+    //pFrame->responseHandler = NULL;
+    pFrame->time = ModBus_now();
+    MODBUS_DELAY_DEBUG("Frames Num: %d\n", (int)ModBus_para->m_sendFramesN);
+    return pFrame;
+}
+
+/** Установка памяти очереди команд **/
+/*** Параметры ***
+** frames: Массив кадров, используемый как кольцевая очередь
+** size: Количество элементов массива
+***/
+uint8_t ModBus_setFrameQueue(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* frames, size_t size)
+{
+    if (ModBus_para->m_sendFramesN > 0 || frames == NULL || size == 0)
     {
-        // Прием не завершен, вернитесь для продолжения приема данных
         return 0;
     }
-    if (ModBus_para->m_receiveFrameBufferLen < 2) // Получение тайм-аута и недостаточного количества данных является ненормальным
+    ModBus_para->m_sendFrames = frames;
+    ModBus_para->m_sendFramesSize = size;
+    ModBus_para->m_sendFramesHead = 0;
+    return 1;
+}
+
+void ModBus_skipUnitOnTimeout(ModBus_parameter* ModBus_para, uint8_t on)
+{
+    ModBus_para->m_skipUnitOnTimeout = on;
+}
+
+void ModBus_setAdaptiveTimeout(ModBus_parameter* ModBus_para, ModBus_UnitTiming_T* units, size_t n, uint32_t minTimeoutUs, uint32_t maxTimeoutUs)
+{
+    ModBus_para->m_unitTiming = n > 0 ? units : NULL;
+    ModBus_para->m_unitTimingN = units != NULL ? n : 0;
+    ModBus_para->m_unitTimingNext = 0;
+    ModBus_para->m_minTimeout = minTimeoutUs;
+    ModBus_para->m_maxTimeout = maxTimeoutUs;
+    for (size_t i = 0; i < ModBus_para->m_unitTimingN; i++)
     {
-        ModBus_para->m_pBeginReceiveBufferTmp = pEnd;
-        ModBus_para->m_receiveFrameBufferLen = 0;
-        return 0;
+        units[i].used = 0;
     }
-    if (!CheckCRC16(ModBus_para->m_receiveFrameBuffer, ModBus_para->m_receiveFrameBufferLen)) // Если проверка не проходит
+}
+
+void ModBus_setRetries(ModBus_parameter* ModBus_para, uint8_t retries)
+{
+    ModBus_para->m_retries = retries;
+}
+
+void ModBus_setUnitOffline(ModBus_parameter* ModBus_para, uint8_t failures, uint32_t holdoffUs)
+{
+    ModBus_para->m_offlineAfter = failures;
+    ModBus_para->m_offlineTime = holdoffUs;
+}
+
+// Запись оценки устройства unit; create - занять запись (свободную или следующую по кругу), если устройства нет
+static ModBus_UnitTiming_T* ModBus_unitTiming(ModBus_parameter* ModBus_para, uint8_t unit, uint8_t create)
+{
+    ModBus_UnitTiming_T* empty = NULL;
+    for (size_t i = 0; i < ModBus_para->m_unitTimingN; i++)
     {
-        if (frameSize > 0 && frameSize < ModBus_para->m_receiveFrameBufferLen)  // Если длина данных больше, чем m_responseFrameLen, попробуйте получить их с длиной m_responseFrameLen
+        ModBus_UnitTiming_T* timing = ModBus_para->m_unitTiming + i;
+        if (!timing->used)
         {
-            if (!CheckCRC16(ModBus_para->m_receiveFrameBuffer, frameSize)) // Если проверка не проходит, это не тайм-аут или буфер заполнен, затем вернитесь, чтобы продолжить прием
-            {
-                if (isTimeout || ModBus_para->m_receiveFrameBufferLen >= MODBUS_BUFFER_SIZE)
-                    ModBus_para->m_receiveFrameBufferLen = 0;
-                return 0;
-            }
-
-            *restSize = ModBus_para->m_receiveFrameBufferLen - frameSize;// Объем сохраняемых данных
-            ModBus_para->m_receiveFrameBufferLen = frameSize;
+            empty = empty ? empty : timing;
         }
-        else
+        else if (timing->unit == unit)
         {
-            ModBus_para->m_receiveFrameBufferLen = 0;
-            return 0;
+            return timing;
         }
     }
-    ModBus_para->m_receiveFrameBufferLen--; // Удаление контрольной суммы
-    ModBus_para->m_hasDetectedBufferStart = 0;
-
+    if (!create || ModBus_para->m_unitTimingN == 0)
+    {
+        return NULL;
+    }
+    if (empty == NULL)
+    {
+        empty = ModBus_para->m_unitTiming + ModBus_para->m_unitTimingNext;
+        ModBus_para->m_unitTimingNext = (ModBus_para->m_unitTimingNext + 1) % ModBus_para->m_unitTimingN;
+    }
+    memset(empty, 0, sizeof(*empty));
+    empty->unit = unit;
+    empty->used = 1;
+    return empty;
+}
 
-    return 1;
+const ModBus_UnitTiming_T* ModBus_getUnitTiming(ModBus_parameter* ModBus_para, uint8_t unit)
+{
+    return ModBus_unitTiming(ModBus_para, unit, 0);
 }
 
+#define MODBUS_RTT_GRANULARITY 1000u // Минимальный запас на отклонение, мкс (точность millis())
 
-#ifdef MODBUS_MASTER
-/** Чтение регистра **/
-/*** Параметры ***
-** address: Адрес первого регистра
-** count: Количество считываемых регистров
-** GetReponseHandler: Функция обратного вызова для чтения результатов, входящие параметры(uint16_t* buff, uint16_t buffLen)
-** Возвращает серийный номер команды (больше 0), так что в функции обратного вызова можно определить, какая команда завершена, и не может быть отправлена обратно в 0
-***/
-uint8_t ModBus_getRegister(ModBus_parameter* ModBus_para, uint16_t address, uint16_t count, void(*GetReponseHandler)(uint16_t*, uint16_t))
+// Тайм-аут попытки отправки команды pFrame: оценка устройства и удвоение на каждый повтор
+static uint32_t ModBus_frameTimeout(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* pFrame)
 {
-    MODBUS_FRAME_T* pFrame = addFrame(ModBus_para);
-    pFrame->type = READ_REGISTER;
-    pFrame->responseSize = 0;
-    pFrame->getResponseHandler = GetReponseHandler;
-    pFrame->address = address;
-    pFrame->count = count;
+    uint32_t maxTimeout = ModBus_para->m_maxTimeout ? ModBus_para->m_maxTimeout : ModBus_para->m_sendTimeout;
+    uint64_t timeout = ModBus_para->m_sendTimeout;
+    uint8_t shift = pFrame->retries < 8 ? pFrame->retries : 8;
+    ModBus_UnitTiming_T* timing = ModBus_unitTiming(ModBus_para, pFrame->unit, 0);
+    if (ModBus_para->m_unitTiming == NULL)
+    {
+        timeout <<= shift;
+        return (uint32_t)(timeout > UINT32_MAX ? UINT32_MAX : timeout);
+    }
+    if (timing != NULL && timing->samples > 0)
+    {
+        uint64_t wire = ModBus_para->m_mode == MODBUS_MODE_TCP ? 0
+            : (uint64_t)(pFrame->size + (pFrame->responseSize ? pFrame->responseSize : pFrame->size)) * ModBus_para->m_charTime;
+        uint32_t deviation = 4u * timing->rttvar;
+        timeout = wire + timing->srtt + (deviation > MODBUS_RTT_GRANULARITY ? deviation : MODBUS_RTT_GRANULARITY);
+    }
+    timeout <<= shift;
+    if (timeout < ModBus_para->m_minTimeout)
+    {
+        timeout = ModBus_para->m_minTimeout;
+    }
+    return (uint32_t)(timeout > maxTimeout ? maxTimeout : timeout);
+}
 
-    
-    pFrame->data[pFrame->size++] = ModBus_para->m_address; // Адрес устройства
-    pFrame->data[pFrame->size++] = READ_REGISTER; // Код функции - чтение регистров
-    pFrame->data[pFrame->size++] = (address >> 8) & 0x0FF; // Старший байт адреса первого регистра
-    pFrame->data[pFrame->size++] = address & 0x0FF; // Младший байт адреса первого регистра
-    pFrame->data[pFrame->size++] = (count >> 8) & 0x0FF; // Старший байт количества запрашиваемых регистров
-    pFrame->data[pFrame->size++] = count & 0x0FF; // Младший байт количества запрашиваемых регистров
+// Устройство команды pFrame пропускается (ModBus_setUnitOffline)
+static uint8_t ModBus_unitOffline(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* pFrame, uint64_t now)
+{
+    ModBus_UnitTiming_T* timing;
+    if (ModBus_para->m_offlineAfter == 0 || (timing = ModBus_unitTiming(ModBus_para, pFrame->unit, 0)) == NULL)
+    {
+        return 0;
+    }
+    return timing->offlineUntil > now;
+}
 
-    pFrame->size = GenCRC16(pFrame->data, pFrame->size);
-    pFrame->responseSize = 5 + 2 * count; // Количество байт, которые должны быть в ответном кадре
+// Устройство ответило на команду pFrame (в том числе исключением): новое измерение времени ответа
+static void ModBus_unitResponded(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* pFrame)
+{
+    ModBus_UnitTiming_T* timing = ModBus_unitTiming(ModBus_para, pFrame->unit, 1);
+    uint64_t rtt, wire;
+    if (timing == NULL)
+    {
+        return;
+    }
+    timing->failures = 0;
+    timing->offlineUntil = 0;
+    if (pFrame->retries > 0) // Неизвестно, на какую попытку пришел ответ (алгоритм Карна)
+    {
+        return;
+    }
+    rtt = ModBus_now() - pFrame->sentTime;
+    wire = ModBus_para->m_mode == MODBUS_MODE_TCP ? 0
+        : (uint64_t)(pFrame->size + (pFrame->responseSize ? pFrame->responseSize : pFrame->size)) * ModBus_para->m_charTime;
+    rtt = rtt > wire ? rtt - wire : 0;
+    rtt = rtt > UINT32_MAX / 8 ? UINT32_MAX / 8 : rtt;
+    if (timing->samples == 0)
+    {
+        timing->srtt = (uint32_t)rtt;
+        timing->rttvar = (uint32_t)rtt / 2;
+    }
+    else
+    {
+        uint32_t delta = timing->srtt > rtt ? timing->srtt - (uint32_t)rtt : (uint32_t)rtt - timing->srtt;
+        timing->rttvar = timing->rttvar - timing->rttvar / 4 + delta / 4;
+        timing->srtt = timing->srtt - timing->srtt / 8 + (uint32_t)rtt / 8;
+    }
+    if (timing->samples < UINT16_MAX)
+    {
+        timing->samples++;
+    }
+}
 
+// Команда pFrame осталась без ответа после всех повторов: устройство пропускается после m_offlineAfter таких команд подряд
+static void ModBus_unitTimedOut(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* pFrame)
+{
+    ModBus_UnitTiming_T* timing = ModBus_unitTiming(ModBus_para, pFrame->unit, 1);
+    if (timing == NULL)
+    {
+        return;
+    }
+    if (timing->failures < UINT8_MAX)
+    {
+        timing->failures++;
+    }
+    if (ModBus_para->m_offlineAfter > 0 && timing->failures >= ModBus_para->m_offlineAfter)
+    {
+        uint8_t shift = timing->failures - ModBus_para->m_offlineAfter;
+        timing->offlineUntil = ModBus_now() + ((uint64_t)ModBus_para->m_offlineTime << (shift < 5 ? shift : 5));
+    }
+}
 
-    return pFrame->index;
+uint8_t ModBus_attachCache(ModBus_parameter* ModBus_para, ModBus_CacheEntry_T* entries, size_t n, const ModBus_CacheRange_T* ranges, size_t rangesN)
+{
+    if (entries != NULL && (n == 0 || (n & (n - 1)) != 0))
+    {
+        return 0;
+    }
+    ModBus_para->m_cache = entries;
+    ModBus_para->m_cacheMask = entries != NULL ? n - 1 : 0;
+    ModBus_para->m_cacheRanges = ranges;
+    ModBus_para->m_cacheRangesN = ranges != NULL ? rangesN : 0;
+    for (size_t i = 0; entries != NULL && i < n; i++)
+    {
+        entries[i].used = 0;
+    }
+    return 1;
 }
 
-/** Запись одного регистра **/
+// Начальная позиция регистра в таблице кэша: адрес устройства попадает в младшие биты через старшую половину произведения
+static size_t ModBus_cacheHome(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address)
+{
+    uint32_t hash = ((uint32_t)unit << 16 | address) * 0x9E3779B1u;
+    return (hash ^ (hash >> 16)) & ModBus_para->m_cacheMask;
+}
+
+// Количество позиций поиска: MODBUS_CACHE_PROBE, но не больше размера таблицы
+static size_t ModBus_cacheProbe(ModBus_parameter* ModBus_para)
+{
+    return ModBus_para->m_cacheMask < MODBUS_CACHE_PROBE ? ModBus_para->m_cacheMask + 1 : MODBUS_CACHE_PROBE;
+}
+
+// Запись регистра в кэше, NULL - нет. Записи лежат не дальше MODBUS_CACHE_PROBE позиций от начальной, между ними нет свободных
+static ModBus_CacheEntry_T* ModBus_cacheFind(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address)
+{
+    size_t slot = ModBus_cacheHome(ModBus_para, unit, address);
+    for (size_t i = 0; i < ModBus_cacheProbe(ModBus_para); i++)
+    {
+        ModBus_CacheEntry_T* entry = ModBus_para->m_cache + ((slot + i) & ModBus_para->m_cacheMask);
+        if (!entry->used)
+        {
+            return NULL;
+        }
+        if (entry->unit == unit && entry->address == address)
+        {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+// Время жизни значения регистра, 0 - регистр не кэшируется
+static uint32_t ModBus_cacheTtl(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address)
+{
+    for (size_t i = 0; i < ModBus_para->m_cacheRangesN; i++)
+    {
+        const ModBus_CacheRange_T* range = ModBus_para->m_cacheRanges + i;
+        if (range->unit == unit && address >= range->address && (uint32_t)address - range->address < range->count)
+        {
+            return range->ttl;
+        }
+    }
+    return 0;
+}
+
+// Сохранение значения регистра: в свою запись, в свободную позицию или вместо записи, устаревающей первой
+static void ModBus_cacheStore(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t value, uint64_t now)
+{
+    uint32_t ttl = ModBus_cacheTtl(ModBus_para, unit, address);
+    size_t slot = ModBus_cacheHome(ModBus_para, unit, address);
+    ModBus_CacheEntry_T* victim = NULL;
+    if (ttl == 0)
+    {
+        return;
+    }
+    for (size_t i = 0; i < ModBus_cacheProbe(ModBus_para); i++)
+    {
+        ModBus_CacheEntry_T* entry = ModBus_para->m_cache + ((slot + i) & ModBus_para->m_cacheMask);
+        if (!entry->used || (entry->unit == unit && entry->address == address))
+        {
+            victim = entry;
+            break;
+        }
+        if (victim == NULL || entry->expires < victim->expires)
+        {
+            victim = entry;
+        }
+    }
+    victim->used = 1;
+    victim->unit = unit;
+    victim->address = address;
+    victim->value = value;
+    victim->expires = now + ttl;
+}
+
+// Удаление записи со сдвигом следующих назад, чтобы между записью и ее начальной позицией не оставалось свободных
+static void ModBus_cacheRemove(ModBus_parameter* ModBus_para, ModBus_CacheEntry_T* entry)
+{
+    size_t hole = (size_t)(entry - ModBus_para->m_cache);
+    size_t next = hole;
+    for (size_t i = 0; i < ModBus_para->m_cacheMask; i++)
+    {
+        ModBus_CacheEntry_T* moved;
+        size_t home;
+        next = (next + 1) & ModBus_para->m_cacheMask;
+        moved = ModBus_para->m_cache + next;
+        if (!moved->used)
+        {
+            break;
+        }
+        home = ModBus_cacheHome(ModBus_para, moved->unit, moved->address);
+        if (((next - home) & ModBus_para->m_cacheMask) >= ((next - hole) & ModBus_para->m_cacheMask)) // Освободившаяся позиция между начальной и текущей
+        {
+            ModBus_para->m_cache[hole] = *moved;
+            hole = next;
+        }
+    }
+    ModBus_para->m_cache[hole].used = 0;
+}
+
+void ModBus_invalidateCache(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count)
+{
+    for (uint32_t i = 0; ModBus_para->m_cache != NULL && i < count; i++)
+    {
+        ModBus_CacheEntry_T* entry = ModBus_cacheFind(ModBus_para, unit, (uint16_t)(address + i));
+        if (entry != NULL)
+        {
+            ModBus_cacheRemove(ModBus_para, entry);
+        }
+    }
+}
+
+// Чтение count регистров из кэша в data: 1, если все значения есть и не устарели, а записей этому устройству в очереди нет
+static uint8_t ModBus_cacheRead(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, uint16_t* data)
+{
+    uint64_t now;
+    if (ModBus_para->m_cache == NULL)
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < ModBus_para->m_sendFramesN; i++)
+    {
+        MODBUS_FRAME_T* pFrame = queueFrame(ModBus_para, i);
+        if (pFrame->unit == unit && pFrame->state != MODBUS_FRAME_DONE
+            && (pFrame->pduResponseHandler || pFrame->type == WRITE_SINGLE_REGISTER || pFrame->type == WRITE_MULTI_REGISTER || pFrame->type == READ_WRITE_REGISTERS))
+        {
+            MODBUS_STAT_INC(ModBus_para, cacheMisses);
+            return 0;
+        }
+    }
+    now = ModBus_now();
+    for (uint16_t i = 0; i < count; i++)
+    {
+        ModBus_CacheEntry_T* entry = ModBus_cacheFind(ModBus_para, unit, (uint16_t)(address + i));
+        if (entry == NULL || now >= entry->expires)
+        {
+            MODBUS_STAT_INC(ModBus_para, cacheMisses);
+            return 0;
+        }
+        data[i] = entry->value;
+    }
+    MODBUS_STAT_INC(ModBus_para, cacheHits);
+    return 1;
+}
+
+// Записанные командой pFrame регистры хранения (FC06, FC16, FC23, в том числе через ModBus_sendUnitPdu):
+// ok - запись выполнена, значения из запроса сохраняются в кэше; иначе значения удаляются
+static void ModBus_cacheWritten(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* pFrame, uint8_t ok)
+{
+    const uint8_t* sent = pFrame->data + (ModBus_para->m_mode == MODBUS_MODE_TCP ? MODBUS_MBAP_SIZE - 1 : 0);
+    uint16_t address, count;
+    size_t values;
+    uint64_t now;
+    if (ModBus_para->m_cache == NULL)
+    {
+        return;
+    }
+    switch (sent[1])
+    {
+    case WRITE_SINGLE_REGISTER:
+        address = (uint16_t)(sent[2] << 8 | sent[3]);
+        count = 1;
+        values = 4;
+        break;
+    case WRITE_MULTI_REGISTER:
+        address = (uint16_t)(sent[2] << 8 | sent[3]);
+        count = (uint16_t)(sent[4] << 8 | sent[5]);
+        values = 7;
+        break;
+    case READ_WRITE_REGISTERS:
+        address = (uint16_t)(sent[6] << 8 | sent[7]);
+        count = (uint16_t)(sent[8] << 8 | sent[9]);
+        values = 11;
+        break;
+    default:
+        return;
+    }
+    if (!ok || pFrame->pduResponseHandler)
+    {
+        ModBus_invalidateCache(ModBus_para, pFrame->unit, address, count);
+        return;
+    }
+    now = ModBus_now();
+    for (uint16_t i = 0; i < count; i++)
+    {
+        ModBus_cacheStore(ModBus_para, pFrame->unit, (uint16_t)(address + i), (uint16_t)(sent[values + 2 * i] << 8 | sent[values + 2 * i + 1]), now);
+    }
+}
+
+/** Подписки на изменения регистров **/
 /*** Параметры ***
-** address: Адрес регистра
-** data: Данные для записи
-** SetReponseHandler: Функция обратного вызова результата записи, входящие параметры(uint16_t address, uint16_t count), параметры включают первый адрес и количество регистров
-** Возвращает серийный номер инструкции, чтобы определить, какая команда была завершена в функции обратного вызова
+** subscriptions, n: Подписки приложения, NULL - отключить; биты seen очищаются
+** Возвращает 0, если у подписки нет памяти, функции или диапазон недопустим
 ***/
-uint8_t ModBus_setRegister(ModBus_parameter* ModBus_para, uint16_t address, uint16_t data, void(*SetReponseHandler)(uint16_t, uint16_t))
+uint8_t ModBus_attachSubscriptions(ModBus_parameter* ModBus_para, ModBus_Subscription_T* subscriptions, size_t n)
 {
-    MODBUS_FRAME_T* pFrame = addFrame(ModBus_para);
-    pFrame->type = WRITE_SINGLE_REGISTER;
-    pFrame->responseSize = 0;
-    pFrame->setResponseHandler = SetReponseHandler;
-    pFrame->address = address;
-    pFrame->count = 1;
+    for (size_t i = 0; subscriptions != NULL && i < n; i++)
+    {
+        ModBus_Subscription_T* sub = &subscriptions[i];
+        if (sub->count == 0 || (uint32_t)sub->address + sub->count > 0x10000 || sub->snapshot == NULL || sub->seen == NULL || sub->handler == NULL
+            || (sub->type != READ_REGISTER && sub->type != READ_INPUT_REGISTER))
+        {
+            return 0;
+        }
+    }
+    ModBus_para->m_subscriptions = subscriptions;
+    ModBus_para->m_subscriptionsN = subscriptions != NULL ? n : 0;
+    for (size_t i = 0; i < ModBus_para->m_subscriptionsN; i++)
+    {
+        memset(subscriptions[i].seen, 0, (subscriptions[i].count + 7u) / 8);
+        subscriptions[i].seenN = 0;
+    }
+    return 1;
+}
 
-    
-    pFrame->data[pFrame->size++] = ModBus_para->m_address; // Адрес устройства
-    pFrame->data[pFrame->size++] = WRITE_SINGLE_REGISTER; // Код функции - запись одного регистра
-    pFrame->data[pFrame->size++] = (address >> 8) & 0x0FF; // Старший байт адреса регистра
-    pFrame->data[pFrame->size++] = address & 0x0FF; // Младший байт адреса первого регистра
-    pFrame->data[pFrame->size++] = (data >> 8) & 0x0FF; // Старший байт записываемых данных
-    pFrame->data[pFrame->size++] = data & 0x0FF; // Младший байт записываемых данных
+// Индексы регистров from..n-1, значения которых в a и b различаются. Сравнение по 4 регистра в uint64_t, возвращает количество
+static size_t ModBus_diffScalar(const uint16_t* a, const uint16_t* b, size_t from, size_t n, uint16_t* changed)
+{
+    size_t found = 0, i = from;
+    for (; i + 4 <= n; i += 4)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x == y) // Обычный случай: блок не изменился
+        {
+            continue;
+        }
+        for (size_t j = i; j < i + 4; j++)
+        {
+            if (a[j] != b[j])
+                changed[found++] = (uint16_t)j;
+        }
+    }
+    for (; i < n; i++)
+    {
+        if (a[i] != b[i])
+            changed[found++] = (uint16_t)i;
+    }
+    return found;
+}
 
-    pFrame->size = GenCRC16(pFrame->data, pFrame->size);
-    pFrame->responseSize = 8; // Количество байт, которые должны быть в ответном кадре
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
+// Индексы регистров, значения которых в a и b различаются: SIMD по 16 (AVX2) или 8 (SSE2, NEON) регистров, остаток - ModBus_diffScalar
+static size_t ModBus_diffRegisters(const uint16_t* a, const uint16_t* b, size_t n, uint16_t* changed)
+{
+    size_t found = 0, i = 0;
+#if defined(__AVX2__)
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i eq = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(eq); // Два бита на регистр
+        while (mask != 0)
+        {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            changed[found++] = (uint16_t)(i + bit / 2);
+            mask &= ~(3u << bit);
+        }
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i eq = _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i)));
+        uint32_t mask = ~(uint32_t)_mm_movemask_epi8(eq) & 0xFFFFu; // Два бита на регистр
+        while (mask != 0)
+        {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            changed[found++] = (uint16_t)(i + bit / 2);
+            mask &= ~(3u << bit);
+        }
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t eq = vceqq_u16(vld1q_u16(a + i), vld1q_u16(b + i));
+        if (vminvq_u16(eq) == 0xFFFF) // Все регистры блока равны
+        {
+            continue;
+        }
+        for (size_t j = i; j < i + 8; j++)
+        {
+            if (a[j] != b[j])
+                changed[found++] = (uint16_t)j;
+        }
+    }
+#endif
+    return found + ModBus_diffScalar(a, b, i, n, changed + found);
+}
 
-    return pFrame->index;
+// Отличие нового значения регистра подписки от снимка по модулю
+static uint32_t ModBus_subscriptionDelta(const ModBus_Subscription_T* sub, uint16_t old, uint16_t value)
+{
+    int32_t delta = sub->signedValues ? (int32_t)(int16_t)value - (int16_t)old : (int32_t)value - old;
+    return (uint32_t)(delta < 0 ? -delta : delta);
 }
 
-/** Запись нескольких регистров **/
+// Сравнение прочитанных регистров устройства (area: READ_REGISTER или READ_INPUT_REGISTER) со снимками подписок, вызов handler с изменениями
+static void ModBus_notifySubscriptions(ModBus_parameter* ModBus_para, uint8_t unit, uint8_t area, uint16_t address, const uint16_t* data, size_t count)
+{
+    uint16_t changed[MODBUS_REGISTER_LIMIT]; // count не больше register_access_limit
+    for (size_t s = 0; s < ModBus_para->m_subscriptionsN; s++)
+    {
+        ModBus_Subscription_T* sub = &ModBus_para->m_subscriptions[s];
+        uint32_t begin = sub->address > address ? sub->address : address;
+        uint32_t end = (uint32_t)sub->address + sub->count < (uint32_t)address + count ? (uint32_t)sub->address + sub->count : (uint32_t)address + count;
+        const uint16_t* values;
+        uint16_t* snapshot;
+        size_t found = 0;
+        if (sub->unit != unit || sub->type != area || begin >= end)
+        {
+            continue;
+        }
+        values = data + (begin - address);
+        snapshot = sub->snapshot + (begin - sub->address);
+        if (sub->seenN < sub->count) // Не все регистры получены: впервые прочитанные передаются без сравнения
+        {
+            for (size_t i = 0; i < end - begin; i++)
+            {
+                uint16_t index = (uint16_t)(begin - sub->address + i);
+                if (!ModBus_getBit(sub->seen, index))
+                {
+                    ModBus_setBit(sub->seen, index, 1);
+                    sub->seenN++;
+                }
+                else if (snapshot[i] == values[i]
+                    || (sub->deadband != NULL && ModBus_subscriptionDelta(sub, snapshot[i], values[i]) <= sub->deadband[index]))
+                {
+                    continue;
+                }
+                snapshot[i] = values[i];
+                changed[found++] = index;
+            }
+        }
+        else
+        {
+            size_t n = ModBus_diffRegisters(snapshot, values, end - begin, changed);
+            for (size_t k = 0; k < n; k++) // Отбор по зоне нечувствительности на месте: found <= k
+            {
+                uint16_t i = changed[k];
+                if (sub->deadband != NULL && ModBus_subscriptionDelta(sub, snapshot[i], values[i]) <= sub->deadband[begin - sub->address + i])
+                {
+                    continue;
+                }
+                snapshot[i] = values[i];
+                changed[found++] = (uint16_t)(begin - sub->address + i);
+            }
+        }
+        if (found > 0)
+        {
+            sub->handler(sub, changed, (uint16_t)found);
+        }
+    }
+}
+
+/** Объединение команд чтения **/
 /*** Параметры ***
-** address: Адрес первого регистра
-** data: Данные для записи
-** count: Количество записываемых регистров
-** SetReponseHandler: Функция обратного вызова результата записи, входящие параметры(uint16_t address, uint16_t count), параметры включают в себя первый адрес и количество регистров
-** Возврат 0 означает успешную отправку, возврат 1 означает занято, но не отправлено
+** on: 1 - включить объединение
+** maxGap: Максимальное количество непрочитанных регистров между объединяемыми диапазонами
 ***/
-uint8_t ModBus_setRegisters(ModBus_parameter* ModBus_para, uint16_t address, uint16_t* data, uint16_t count, void(*SetReponseHandler)(uint16_t, uint16_t))
+void ModBus_setReadCoalescing(ModBus_parameter* ModBus_para, uint8_t on, uint16_t maxGap)
 {
-    MODBUS_FRAME_T* pFrame = addFrame(ModBus_para);
-    pFrame->type = WRITE_MULTI_REGISTER;
-    pFrame->responseSize = 0;
-    pFrame->setResponseHandler = SetReponseHandler;
-    pFrame->address = address;
-    pFrame->count = count;
+    ModBus_para->m_coalesce = on;
+    ModBus_para->m_coalesceGap = maxGap;
+}
 
-    
-    pFrame->data[pFrame->size++] = ModBus_para->m_address; // Адрес устройства
-    pFrame->data[pFrame->size++] = WRITE_MULTI_REGISTER; // Код функции, запись в несколько регистров
-    pFrame->data[pFrame->size++] = (address >> 8) & 0x0FF; // Зарегистрируйте первый адрес старшим битом
-    pFrame->data[pFrame->size++] = address & 0x0FF; // Зарегистрируйте первый адрес младший бит
-    pFrame->data[pFrame->size++] = (count >> 8) & 0x0FF; // Количество регистров высокого уровня
-    pFrame->data[pFrame->size++] = count & 0x0FF; // Количество регистров низкого уровня
+uint8_t ModBus_getStatus(ModBus_parameter* ModBus_para)
+{
+    return ModBus_para->m_status;
+}
+#endif
+
+
+// Получение байтовых данных по протоколу ModBus, обычно вызывается в функциях прерывания (например, прерывание приема последовательного порта).
+void ModBus_readbyteFromOuter(ModBus_parameter* ModBus_para, uint8_t receiveduint8_t)
+{
+#ifdef _UNIT_TEST
+    printf("address %02x read uint8_t: %02x\n", ModBus_para->m_address, receiveduint8_t);
+#endif // _UNIT_TEST
+
+    ModBus_readbytesFromOuter(ModBus_para, &receiveduint8_t, 1);
+}
 
-    pFrame->data[pFrame->size++] = count * 2; // Количество байт данных
+size_t ModBus_receiveSpace(ModBus_parameter* ModBus_para)
+{
+    size_t head = atomic_load_explicit(&ModBus_para->m_receiveHead, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ModBus_para->m_receiveTail, memory_order_acquire);
+    return (tail > head ? tail - head : MODBUS_RECEIVE_RING_SIZE - head + tail) - 1; // Одна позиция всегда свободна
+}
+
+uint32_t ModBus_receiveOverflows(ModBus_parameter* ModBus_para)
+{
+    return atomic_load_explicit(&ModBus_para->m_receiveOverflow, memory_order_relaxed);
+}
 
-    if (count > ModBus_para->m_registerAcessLimit || pFrame->size + 2 * count + 2 > MODBUS_BUFFER_SIZE) // Если максимальный объем данных превышен, они не отправляются, а сразу вызывается функция обратного вызова
+size_t ModBus_readbytesFromOuter(ModBus_parameter* ModBus_para, const uint8_t* data, size_t size)
+{
+    /*** Функция - единственный производитель: изменяет только m_receiveHead, m_receiveTail изменяет только цикл экземпляра ***/
+    size_t head = atomic_load_explicit(&ModBus_para->m_receiveHead, memory_order_relaxed);
+    size_t n = ModBus_receiveSpace(ModBus_para);
+    size_t first;
+    uint64_t now;
+    if (size == 0)
     {
-        if (SetReponseHandler)
+        return 0;
+    }
+    now = ModBus_now();
+#ifdef MODBUS_TRACE
+    if (ModBus_para->m_trace != NULL)
+    {
+        ModBus_Trace_record(ModBus_para->m_trace, MODBUS_TRACE_RX, ModBus_para->m_address, now, data, size); // Как принято, включая отброшенные байты
+    }
+#endif
+    if (n < size) // Буфер заполнен: новые байты отбрасываются, кадр с потерями не пройдет проверку CRC
+    {
+        atomic_fetch_add_explicit(&ModBus_para->m_receiveOverflow, (uint32_t)(size - n), memory_order_relaxed);
+    }
+    else
+    {
+        n = size;
+    }
+    first = n < MODBUS_RECEIVE_RING_SIZE - head ? n : MODBUS_RECEIVE_RING_SIZE - head; // Часть до конца кольцевого буфера
+    memcpy(ModBus_para->m_receiveBufferTmp + head, data, first);
+    memcpy(ModBus_para->m_receiveBufferTmp, data + first, n - first);
+    head += n;
+    if (head >= MODBUS_RECEIVE_RING_SIZE)
+    {
+        head -= MODBUS_RECEIVE_RING_SIZE;
+    }
+    atomic_store_explicit(&ModBus_para->m_lastReceivedTime, (uint32_t)now, memory_order_relaxed); // Одна метка времени на блок
+    atomic_store_explicit(&ModBus_para->m_receiveHead, head, memory_order_release); // Публикация байтов и метки времени потребителю
+    return n;
+}
+
+void ModBus_fastMode(ModBus_parameter* ModBus_para, uint8_t faston)
+{
+    ModBus_para->m_faston = faston;
+}
+
+
+// Ожидаемая длина кадра RTU вместе с CRC по уже принятым байтам (адрес, код функции, счетчик байтов).
+// isRequest - кадр запроса (прием Slave), иначе ответа (прием Master). 0 - длина еще неизвестна или код функции незнаком
+static size_t ModBus_predictFrameSize(const ModBus_RingView_T* frame, size_t len, uint8_t isRequest)
+{
+    uint8_t function;
+    if (len < 2)
+    {
+        return 0;
+    }
+    function = ModBus_viewByte(frame, 1);
+    if (function & MODBUS_EXCEPTION_FLAG) // Ответ с исключением: адрес, код функции, код исключения, CRC
+    {
+        return isRequest ? 0 : 5;
+    }
+    switch (function)
+    {
+    case READ_COILS:
+    case READ_DISCRETE_INPUTS:
+    case READ_REGISTER:
+    case READ_INPUT_REGISTER:
+        if (isRequest)
+        {
+            return 8;
+        }
+        return len < 3 ? 0 : 5 + (size_t)ModBus_viewByte(frame, 2);
+    case WRITE_SINGLE_COIL:
+    case WRITE_SINGLE_REGISTER:
+        return 8;
+    case WRITE_MULTI_COIL:
+    case WRITE_MULTI_REGISTER:
+        if (!isRequest)
+        {
+            return 8;
+        }
+        return len < 7 ? 0 : 9 + (size_t)ModBus_viewByte(frame, 6);
+    case READ_WRITE_REGISTERS: // Запрос: адрес и количество чтения, адрес и количество записи, счетчик байтов, данные
+        if (isRequest)
+        {
+            return len < 11 ? 0 : 13 + (size_t)ModBus_viewByte(frame, 10);
+        }
+        return len < 3 ? 0 : 5 + (size_t)ModBus_viewByte(frame, 2);
+    default:
+        return 0;
+    }
+}
+
+// Проверка входящих пакетов RTU прямо в кольцевом буфере. Длина кадра определяется по его заголовку, кадр принимается сразу после последнего байта.
+// Кадры с незнакомым кодом функции завершаются тишиной на линии (вызов без новых байтов).
+// isRequest - ожидается запрос (Slave), иначе ответ (Master).
+// Возвращает 1, если кадр принят: frame - область кадра с CRC от m_receiveTail, освобождается вызывающим после обработки
+static uint8_t ModBus_detectFrame(ModBus_parameter* ModBus_para, uint8_t isRequest, ModBus_RingView_T* frame)
+{
+    uint8_t address = ModBus_para->m_address; // Адрес, по которому определяется начало кадра
+    uint8_t isTimeout = !ModBus_receivePending(ModBus_para); // Новых байтов нет - вызов по тайм-ауту приема
+    const uint8_t* units = NULL; // Slave с несколькими адресами: кадр начинается с любого адреса таблицы
+
+#ifdef MODBUS_SLAVE
+    if (isRequest && ModBus_para->m_units != NULL)
+    {
+        units = ModBus_para->m_units->index;
+    }
+#endif
+
+#ifdef MODBUS_MASTER
+    if (!isRequest && ModBus_para->m_sendFramesN > 0)
+    {
+        address = frontFrame(ModBus_para)->unit; // Ответ ожидается от устройства, которому отправлена команда
+    }
+#endif
+
+    for (;;)
+    {
+        size_t len = ModBus_receiveView(ModBus_para, frame);
+        size_t frameSize;
+        if (!ModBus_para->m_hasDetectedBufferStart)
+        {
+            // Определение начального байта, байты до него освобождаются
+            size_t start = 0;
+            while (start < len && (units != NULL ? units[ModBus_viewByte(frame, start)] == 0 : ModBus_viewByte(frame, start) != address))
+            {
+                start++;
+            }
+            ModBus_para->m_receiveScanned = start;
+            ModBus_consumeReceived(ModBus_para, start);
+            if (start == len) // Начальный символ не обнаружен, полученные данные являются ненормальными
+            {
+                return 0;
+            }
+            ModBus_viewAdvance(frame, start);
+            ModBus_para->m_hasDetectedBufferStart = 1;
+            len -= start;
+        }
+        ModBus_para->m_receiveScanned = len;
+
+        frameSize = ModBus_predictFrameSize(frame, len, isRequest);
+        if (frameSize > MODBUS_BUFFER_SIZE)
+        {
+            // Такой кадр не помещается в буфер, начало найдено неверно
+        }
+        else if (frameSize > 0 && len >= frameSize) // Кадр принят целиком
+        {
+            if (CheckCRC16(frame, frameSize))
+            {
+                ModBus_viewTrim(frame, frameSize);
+                ModBus_para->m_hasDetectedBufferStart = 0;
+                MODBUS_STAT_INC(ModBus_para, framesReceived);
+                return 1;
+            }
+            MODBUS_STAT_INC(ModBus_para, crcErrors);
+        }
+        else if (frameSize == 0 && isTimeout) // Длина неизвестна, кадр завершен тишиной на линии
+        {
+            if (len >= 4 && CheckCRC16(frame, len))
+            {
+                ModBus_para->m_hasDetectedBufferStart = 0;
+                MODBUS_STAT_INC(ModBus_para, framesReceived);
+                return 1;
+            }
+            MODBUS_STAT_INC(ModBus_para, crcErrors);
+        }
+        else if (!isTimeout && len < MODBUS_BUFFER_SIZE)
+        {
+            // Прием не завершен, вернитесь для продолжения приема данных
+            return 0;
+        }
+        // Байт адреса оказался частью данных или кадр поврежден: поиск начала со следующего байта
+        ModBus_consumeReceived(ModBus_para, 1);
+        ModBus_para->m_hasDetectedBufferStart = 0;
+    }
+}
+
+
+#ifdef MODBUS_MASTER
+// Постановка в очередь команды чтения type (FC01-FC04): адрес первого регистра (бита) и количество. Возвращает NULL, если очередь заполнена
+static MODBUS_FRAME_T* ModBus_addReadFrame(ModBus_parameter* ModBus_para, uint8_t unit, MODBUS_FUNCTION_TYPE type, uint16_t address, uint16_t count)
+{
+    MODBUS_FRAME_T* pFrame = addFrame(ModBus_para);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return NULL;
+    }
+    pFrame->unit = unit;
+    pFrame->type = type;
+    pFrame->responseSize = 0;
+    pFrame->address = address;
+    pFrame->count = count;
+    pFrame->spanAddress = address;
+    pFrame->spanCount = count;
+
+    pFrame->size = ModBus_beginFrame(ModBus_para, pFrame->data, unit, pFrame->transaction); // Адрес устройства
+    pFrame->data[pFrame->size++] = type; // Код функции
+    pFrame->data[pFrame->size++] = (address >> 8) & 0x0FF; // Старший байт адреса первого регистра
+    pFrame->data[pFrame->size++] = address & 0x0FF; // Младший байт адреса первого регистра
+    pFrame->data[pFrame->size++] = (count >> 8) & 0x0FF; // Старший байт количества запрашиваемых регистров
+    pFrame->data[pFrame->size++] = count & 0x0FF; // Младший байт количества запрашиваемых регистров
+
+    pFrame->size = ModBus_endFrame(ModBus_para, pFrame->data, pFrame->size);
+    return pFrame;
+}
+
+// Ответ на чтение FC03 из кэша до возврата из функции: серийный номер команды, 0 - значений в кэше нет
+static uint8_t ModBus_cacheAnswer(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count,
+    void(*GetReponseHandler)(uint16_t*, uint16_t), void(*GetReponseHandlerEx)(void*, uint16_t*, uint16_t), void* context)
+{
+    uint16_t cached[MODBUS_REGISTER_LIMIT];
+    uint8_t index;
+    if (!ModBus_cacheRead(ModBus_para, unit, address, count, cached)) // Копия на стеке: функция может вызываться из обратного вызова, получившего m_registerData
+    {
+        return 0;
+    }
+    index = ModBus_nextIndex(ModBus_para);
+    ModBus_para->m_status = MODBUS_STATUS_OK;
+    if (GetReponseHandlerEx)
+        GetReponseHandlerEx(context, cached, count);
+    else if (GetReponseHandler)
+        GetReponseHandler(cached, count);
+    return index;
+}
+
+// Чтение регистров FC03 с функцией обратного вызова без контекста или с контекстом: из кэша, если значения в нем есть, иначе в очередь
+static uint8_t ModBus_getUnitRegisterCached(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count,
+    void(*GetReponseHandler)(uint16_t*, uint16_t), void(*GetReponseHandlerEx)(void*, uint16_t*, uint16_t), void* context)
+{
+    MODBUS_FRAME_T* pFrame;
+    uint8_t index;
+    if (count == 0 || count > ModBus_para->m_registerAcessLimit) // Ответ не поместится в буфер экземпляра
+    {
+        return 0;
+    }
+    index = ModBus_cacheAnswer(ModBus_para, unit, address, count, GetReponseHandler, GetReponseHandlerEx, context);
+    if (index != 0)
+    {
+        return index;
+    }
+    pFrame = ModBus_addReadFrame(ModBus_para, unit, READ_REGISTER, address, count);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->getResponseHandler = GetReponseHandler;
+    pFrame->getResponseHandlerEx = GetReponseHandlerEx;
+    pFrame->context = context;
+    pFrame->responseSize = ModBus_frameOverhead(ModBus_para) + 2 + 2 * count; // Количество байт, которые должны быть в ответном кадре
+
+    return pFrame->index;
+}
+
+/** Чтение регистра **/
+/*** Параметры ***
+** unit: Адрес устройства на шине
+** address: Адрес первого регистра
+** count: Количество считываемых регистров
+** GetReponseHandler: Функция обратного вызова для чтения результатов, входящие параметры(uint16_t* buff, uint16_t buffLen)
+** Возвращает серийный номер команды (больше 0), так что в функции обратного вызова можно определить, какая команда завершена, и не может быть отправлена обратно в 0
+***/
+uint8_t ModBus_getUnitRegister(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(uint16_t*, uint16_t))
+{
+    return ModBus_getUnitRegisterCached(ModBus_para, unit, address, count, GetReponseHandler, NULL, NULL);
+}
+
+// Чтение входных регистров FC04
+uint8_t ModBus_getUnitInputRegister(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(uint16_t*, uint16_t))
+{
+    MODBUS_FRAME_T* pFrame;
+    if (count == 0 || count > ModBus_para->m_registerAcessLimit) // Ответ не поместится в буфер экземпляра
+    {
+        return 0;
+    }
+    pFrame = ModBus_addReadFrame(ModBus_para, unit, READ_INPUT_REGISTER, address, count);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->getResponseHandler = GetReponseHandler;
+    return pFrame->index;
+}
+
+// Чтение битов FC01/FC02, count - количество битов
+static uint8_t ModBus_getUnitBits(ModBus_parameter* ModBus_para, uint8_t unit, MODBUS_FUNCTION_TYPE type, uint16_t address, uint16_t count, void(*GetReponseHandler)(const uint8_t*, uint16_t))
+{
+    MODBUS_FRAME_T* pFrame;
+    if (count == 0 || count > ModBus_bitLimit(ModBus_para, MODBUS_MAX_READ_BITS))
+    {
+        return 0;
+    }
+    pFrame = ModBus_addReadFrame(ModBus_para, unit, type, address, count);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->getBitsResponseHandler = GetReponseHandler;
+    return pFrame->index;
+}
+
+uint8_t ModBus_getUnitCoils(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(const uint8_t*, uint16_t))
+{
+    return ModBus_getUnitBits(ModBus_para, unit, READ_COILS, address, count, GetReponseHandler);
+}
+
+uint8_t ModBus_getUnitDiscreteInputs(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(const uint8_t*, uint16_t))
+{
+    return ModBus_getUnitBits(ModBus_para, unit, READ_DISCRETE_INPUTS, address, count, GetReponseHandler);
+}
+
+// Команда устройству с адресом, заданным в ModBus_setup
+uint8_t ModBus_getRegister(ModBus_parameter* ModBus_para, uint16_t address, uint16_t count, void(*GetReponseHandler)(uint16_t*, uint16_t))
+{
+    return ModBus_getUnitRegister(ModBus_para, ModBus_para->m_address, address, count, GetReponseHandler);
+}
+
+// Чтение с функцией обратного вызова, получающей контекст
+uint8_t ModBus_getUnitRegisterEx(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(void*, uint16_t*, uint16_t), void* context)
+{
+    return ModBus_getUnitRegisterCached(ModBus_para, unit, address, count, NULL, GetReponseHandler, context);
+}
+
+/** Время до следующего события Master **/
+/*** Возвращает количество микросекунд, через которое нужно вызвать ModBus_Master_loop (тайм-аут ответа или приема),
+** 0 - вызвать сразу, MODBUS_TIME_NEVER - нет ожидаемых событий (цикл нужен только после приема байтов или новой команды)
+***/
+uint64_t ModBus_Master_nextWakeup(ModBus_parameter* ModBus_para)
+{
+    uint64_t now = ModBus_now();
+    uint64_t wakeup = MODBUS_TIME_NEVER;
+    if (ModBus_receivePending(ModBus_para))
+    {
+        return 0;
+    }
+    if (ModBus_para->m_mode != MODBUS_MODE_TCP && ModBus_para->m_receiveScanned > 0) // Конец кадра RTU по тишине на линии
+    {
+        uint32_t elapsed = ModBus_sinceReceived(ModBus_para, now);
+        wakeup = elapsed > ModBus_para->m_receiveTimeout ? 0 : ModBus_para->m_receiveTimeout + 1 - elapsed;
+    }
+    for (size_t i = 0; i < ModBus_para->m_sendFramesN; i++)
+    {
+        MODBUS_FRAME_T* pFrame = queueFrame(ModBus_para, i);
+        uint64_t elapsed, left;
+        if (pFrame->state == MODBUS_FRAME_PENDING)
+        {
+            if (ModBus_para->m_mode == MODBUS_MODE_TCP ? ModBus_para->m_inFlight < ModBus_para->m_window : !ModBus_para->m_waitingResponse)
+            {
+                return 0; // Команду можно отправить сейчас
+            }
+            break;
+        }
+        if (pFrame->state != MODBUS_FRAME_SENT)
+        {
+            continue;
+        }
+        elapsed = now - pFrame->sentTime;
+        left = elapsed >= pFrame->timeout ? 0 : pFrame->timeout - elapsed;
+        if (left < wakeup)
+        {
+            wakeup = left;
+        }
+    }
+    return wakeup;
+}
+
+/** Запись одного регистра **/
+/*** Параметры ***
+** unit: Адрес устройства на шине
+** address: Адрес регистра
+** data: Данные для записи
+** SetReponseHandler: Функция обратного вызова результата записи, входящие параметры(uint16_t address, uint16_t count), параметры включают первый адрес и количество регистров
+** Возвращает серийный номер инструкции, чтобы определить, какая команда была завершена в функции обратного вызова
+***/
+uint8_t ModBus_setUnitRegister(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t data, void(*SetReponseHandler)(uint16_t, uint16_t))
+{
+    MODBUS_FRAME_T* pFrame = addFrame(ModBus_para);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->unit = unit;
+    pFrame->type = WRITE_SINGLE_REGISTER;
+    pFrame->responseSize = 0;
+    pFrame->setResponseHandler = SetReponseHandler;
+    pFrame->address = address;
+    pFrame->count = 1;
+
+    
+    pFrame->size = ModBus_beginFrame(ModBus_para, pFrame->data, unit, pFrame->transaction); // Адрес устройства
+    pFrame->data[pFrame->size++] = WRITE_SINGLE_REGISTER; // Код функции - запись одного регистра
+    pFrame->data[pFrame->size++] = (address >> 8) & 0x0FF; // Старший байт адреса регистра
+    pFrame->data[pFrame->size++] = address & 0x0FF; // Младший байт адреса первого регистра
+    pFrame->data[pFrame->size++] = (data >> 8) & 0x0FF; // Старший байт записываемых данных
+    pFrame->data[pFrame->size++] = data & 0x0FF; // Младший байт записываемых данных
+
+    pFrame->size = ModBus_endFrame(ModBus_para, pFrame->data, pFrame->size);
+    pFrame->responseSize = ModBus_frameOverhead(ModBus_para) + 5; // Количество байт, которые должны быть в ответном кадре
+
+
+    return pFrame->index;
+}
+
+// Команда устройству с адресом, заданным в ModBus_setup
+uint8_t ModBus_setRegister(ModBus_parameter* ModBus_para, uint16_t address, uint16_t data, void(*SetReponseHandler)(uint16_t, uint16_t))
+{
+    return ModBus_setUnitRegister(ModBus_para, ModBus_para->m_address, address, data, SetReponseHandler);
+}
+
+/** Запись нескольких регистров **/
+/*** Параметры ***
+** unit: Адрес устройства на шине
+** address: Адрес первого регистра
+** data: Данные для записи
+** count: Количество записываемых регистров
+** SetReponseHandler: Функция обратного вызова результата записи, входящие параметры(uint16_t address, uint16_t count), параметры включают в себя первый адрес и количество регистров
+** Возврат 0 означает успешную отправку, возврат 1 означает занято, но не отправлено
+***/
+uint8_t ModBus_setUnitRegisters(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t* data, uint16_t count, void(*SetReponseHandler)(uint16_t, uint16_t))
+{
+    MODBUS_FRAME_T* pFrame;
+    if (count == 0 || count > ModBus_writeLimit(ModBus_para, MODBUS_MAX_WRITE_REGISTERS)) // Если максимальный объем данных превышен, они не отправляются, а сразу вызывается функция обратного вызова
+    {
+        if (SetReponseHandler)
+        {
+            (*(SetReponseHandler))(address, 0);
+        }
+        return 0;
+    }
+    pFrame = addFrame(ModBus_para);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->unit = unit;
+    pFrame->type = WRITE_MULTI_REGISTER;
+    pFrame->responseSize = 0;
+    pFrame->setResponseHandler = SetReponseHandler;
+    pFrame->address = address;
+    pFrame->count = count;
+
+    
+    pFrame->size = ModBus_beginFrame(ModBus_para, pFrame->data, unit, pFrame->transaction); // Адрес устройства
+    pFrame->data[pFrame->size++] = WRITE_MULTI_REGISTER; // Код функции, запись в несколько регистров
+    pFrame->data[pFrame->size++] = (address >> 8) & 0x0FF; // Зарегистрируйте первый адрес старшим битом
+    pFrame->data[pFrame->size++] = address & 0x0FF; // Зарегистрируйте первый адрес младший бит
+    pFrame->data[pFrame->size++] = (count >> 8) & 0x0FF; // Количество регистров высокого уровня
+    pFrame->data[pFrame->size++] = count & 0x0FF; // Количество регистров низкого уровня
+
+    pFrame->data[pFrame->size++] = (uint8_t)(count * 2); // Количество байт данных
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        pFrame->data[pFrame->size++] = (data[i] >> 8) & 0x0FF; // Высокий уровень данных
+        pFrame->data[pFrame->size++] = data[i] & 0x0FF; // Низкие данные
+    }
+
+    pFrame->size = ModBus_endFrame(ModBus_para, pFrame->data, pFrame->size);
+    pFrame->responseSize = ModBus_frameOverhead(ModBus_para) + 5; // Возвращает количество байт, требуемое для фрейма
+
+
+    return pFrame->index;
+}
+
+// Команда устройству с адресом, заданным в ModBus_setup
+uint8_t ModBus_setRegisters(ModBus_parameter* ModBus_para, uint16_t address, uint16_t* data, uint16_t count, void(*SetReponseHandler)(uint16_t, uint16_t))
+{
+    return ModBus_setUnitRegisters(ModBus_para, ModBus_para->m_address, address, data, count, SetReponseHandler);
+}
+
+// Запись одного бита FC05, on - значение бита
+uint8_t ModBus_setUnitCoil(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint8_t on, void(*SetReponseHandler)(uint16_t, uint16_t))
+{
+    MODBUS_FRAME_T* pFrame = addFrame(ModBus_para);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->unit = unit;
+    pFrame->type = WRITE_SINGLE_COIL;
+    pFrame->responseSize = 0;
+    pFrame->setResponseHandler = SetReponseHandler;
+    pFrame->address = address;
+    pFrame->count = 1;
+
+    pFrame->size = ModBus_beginFrame(ModBus_para, pFrame->data, unit, pFrame->transaction); // Адрес устройства
+    pFrame->data[pFrame->size++] = WRITE_SINGLE_COIL; // Код функции - запись одного бита
+    pFrame->data[pFrame->size++] = (address >> 8) & 0x0FF; // Старший байт адреса бита
+    pFrame->data[pFrame->size++] = address & 0x0FF; // Младший байт адреса бита
+    pFrame->data[pFrame->size++] = on ? (MODBUS_COIL_ON >> 8) : 0; // 0xFF00 - включен, 0x0000 - выключен
+    pFrame->data[pFrame->size++] = 0;
+
+    pFrame->size = ModBus_endFrame(ModBus_para, pFrame->data, pFrame->size);
+    return pFrame->index;
+}
+
+// Запись нескольких битов FC15, bits - упакованные биты, count - их количество
+uint8_t ModBus_setUnitCoils(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, const uint8_t* bits, uint16_t count, void(*SetReponseHandler)(uint16_t, uint16_t))
+{
+    MODBUS_FRAME_T* pFrame;
+    uint8_t size = (uint8_t)((count + 7) / 8); // Количество байтов упакованных битов
+    if (count == 0 || count > ModBus_bitLimit(ModBus_para, MODBUS_MAX_WRITE_BITS)) // Как и для FC16, неверная команда сразу завершается
+    {
+        if (SetReponseHandler)
+        {
+            (*(SetReponseHandler))(address, 0);
+        }
+        return 0;
+    }
+    pFrame = addFrame(ModBus_para);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->unit = unit;
+    pFrame->type = WRITE_MULTI_COIL;
+    pFrame->responseSize = 0;
+    pFrame->setResponseHandler = SetReponseHandler;
+    pFrame->address = address;
+    pFrame->count = count;
+
+    pFrame->size = ModBus_beginFrame(ModBus_para, pFrame->data, unit, pFrame->transaction); // Адрес устройства
+    pFrame->data[pFrame->size++] = WRITE_MULTI_COIL; // Код функции - запись нескольких битов
+    pFrame->data[pFrame->size++] = (address >> 8) & 0x0FF; // Старший байт адреса первого бита
+    pFrame->data[pFrame->size++] = address & 0x0FF; // Младший байт адреса первого бита
+    pFrame->data[pFrame->size++] = (count >> 8) & 0x0FF; // Старший байт количества битов
+    pFrame->data[pFrame->size++] = count & 0x0FF; // Младший байт количества битов
+    pFrame->data[pFrame->size++] = size; // Количество байт данных
+
+    memcpy(pFrame->data + pFrame->size, bits, size);
+    if (count % 8 != 0) // Неиспользуемые биты последнего байта передаются нулями
+    {
+        pFrame->data[pFrame->size + size - 1] &= (uint8_t)((1 << (count % 8)) - 1);
+    }
+    pFrame->size += size;
+
+    pFrame->size = ModBus_endFrame(ModBus_para, pFrame->data, pFrame->size);
+    return pFrame->index;
+}
+
+// Запись и чтение регистров FC23: ответ содержит регистры, прочитанные после записи
+uint8_t ModBus_readWriteUnitRegisters(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t readAddress, uint16_t readCount,
+    uint16_t writeAddress, const uint16_t* data, uint16_t writeCount, void(*GetReponseHandler)(uint16_t*, uint16_t))
+{
+    MODBUS_FRAME_T* pFrame;
+    if (readCount == 0 || readCount > ModBus_para->m_registerAcessLimit
+        || writeCount == 0 || writeCount > ModBus_writeLimit(ModBus_para, MODBUS_MAX_READ_WRITE_REGISTERS))
+    {
+        return 0;
+    }
+    pFrame = addFrame(ModBus_para);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->unit = unit;
+    pFrame->type = READ_WRITE_REGISTERS;
+    pFrame->responseSize = 0;
+    pFrame->getResponseHandler = GetReponseHandler;
+    pFrame->address = readAddress;
+    pFrame->count = readCount;
+    pFrame->spanAddress = readAddress;
+    pFrame->spanCount = readCount;
+
+    pFrame->size = ModBus_beginFrame(ModBus_para, pFrame->data, unit, pFrame->transaction); // Адрес устройства
+    pFrame->data[pFrame->size++] = READ_WRITE_REGISTERS; // Код функции - запись и чтение регистров
+    pFrame->data[pFrame->size++] = (readAddress >> 8) & 0x0FF; // Адрес первого читаемого регистра
+    pFrame->data[pFrame->size++] = readAddress & 0x0FF;
+    pFrame->data[pFrame->size++] = (readCount >> 8) & 0x0FF; // Количество читаемых регистров
+    pFrame->data[pFrame->size++] = readCount & 0x0FF;
+    pFrame->data[pFrame->size++] = (writeAddress >> 8) & 0x0FF; // Адрес первого записываемого регистра
+    pFrame->data[pFrame->size++] = writeAddress & 0x0FF;
+    pFrame->data[pFrame->size++] = (writeCount >> 8) & 0x0FF; // Количество записываемых регистров
+    pFrame->data[pFrame->size++] = writeCount & 0x0FF;
+    pFrame->data[pFrame->size++] = (uint8_t)(writeCount * 2); // Количество байт данных
+
+    for (uint16_t i = 0; i < writeCount; i++)
+    {
+        pFrame->data[pFrame->size++] = (data[i] >> 8) & 0x0FF; // Старший байт данных
+        pFrame->data[pFrame->size++] = data[i] & 0x0FF; // Младший байт данных
+    }
+
+    pFrame->size = ModBus_endFrame(ModBus_para, pFrame->data, pFrame->size);
+    return pFrame->index;
+}
+
+uint8_t ModBus_sendUnitPdu(ModBus_parameter* ModBus_para, uint8_t unit, const uint8_t* pdu, uint16_t size,
+    void(*PduResponseHandler)(void*, const uint8_t*, uint16_t), void* context)
+{
+    MODBUS_FRAME_T* pFrame;
+    size_t n;
+    if (size == 0 || size + ModBus_frameOverhead(ModBus_para) > MODBUS_BUFFER_SIZE || (pdu[0] & MODBUS_EXCEPTION_FLAG))
+    {
+        return 0;
+    }
+    pFrame = addFrame(ModBus_para);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->unit = unit;
+    pFrame->type = (MODBUS_FUNCTION_TYPE)pdu[0];
+    pFrame->responseSize = 0;
+    pFrame->address = 0;
+    pFrame->count = 0;
+    pFrame->spanAddress = 0;
+    pFrame->spanCount = 0;
+    pFrame->pduResponseHandler = PduResponseHandler;
+    pFrame->context = context;
+
+    n = ModBus_beginFrame(ModBus_para, pFrame->data, unit, pFrame->transaction);
+    memcpy(pFrame->data + n, pdu, size);
+    pFrame->size = (uint16_t)ModBus_endFrame(ModBus_para, pFrame->data, n + size);
+    return pFrame->index;
+}
+
+uint8_t ModBus_prepareRead(ModBus_parameter* ModBus_para, ModBus_Prepared_T* prepared, uint8_t unit, MODBUS_FUNCTION_TYPE type, uint16_t address, uint16_t count)
+{
+    size_t size;
+    prepared->size = 0;
+    if ((type != READ_REGISTER && type != READ_INPUT_REGISTER) || count == 0 || count > ModBus_para->m_registerAcessLimit)
+    {
+        return 0;
+    }
+    size = ModBus_beginFrame(ModBus_para, prepared->data, unit, 0);
+    prepared->data[size++] = type;
+    prepared->data[size++] = (address >> 8) & 0x0FF;
+    prepared->data[size++] = address & 0x0FF;
+    prepared->data[size++] = (count >> 8) & 0x0FF;
+    prepared->data[size++] = count & 0x0FF;
+    prepared->size = (uint16_t)ModBus_endFrame(ModBus_para, prepared->data, size);
+    prepared->responseSize = (uint16_t)(ModBus_frameOverhead(ModBus_para) + 2 + 2 * count);
+    prepared->headerCrc = 0;
+    prepared->headerSize = 0;
+    prepared->mode = ModBus_para->m_mode;
+    prepared->unit = unit;
+    prepared->type = type;
+    prepared->address = address;
+    prepared->count = count;
+    return 1;
+}
+
+uint8_t ModBus_prepareWrite(ModBus_parameter* ModBus_para, ModBus_Prepared_T* prepared, uint8_t unit, uint16_t address, uint16_t count)
+{
+    size_t size;
+    prepared->size = 0;
+    if (count == 0 || count > ModBus_writeLimit(ModBus_para, MODBUS_MAX_WRITE_REGISTERS))
+    {
+        return 0;
+    }
+    size = ModBus_beginFrame(ModBus_para, prepared->data, unit, 0);
+    prepared->data[size++] = WRITE_MULTI_REGISTER;
+    prepared->data[size++] = (address >> 8) & 0x0FF;
+    prepared->data[size++] = address & 0x0FF;
+    prepared->data[size++] = (count >> 8) & 0x0FF;
+    prepared->data[size++] = count & 0x0FF;
+    prepared->data[size++] = (uint8_t)(count * 2);
+    prepared->headerSize = (uint8_t)size;
+    prepared->headerCrc = ModBus_CRC16(prepared->data, size);
+    if (ModBus_para->m_mode == MODBUS_MODE_TCP)
+    {
+        prepared->size = (uint16_t)ModBus_endFrame(ModBus_para, prepared->data, size + 2 * count); // Длина в заголовке MBAP, данные не нужны
+    }
+    else
+    {
+        prepared->size = (uint16_t)(size + 2 * count + 2);
+    }
+    prepared->responseSize = (uint16_t)(ModBus_frameOverhead(ModBus_para) + 5);
+    prepared->mode = ModBus_para->m_mode;
+    prepared->unit = unit;
+    prepared->type = WRITE_MULTI_REGISTER;
+    prepared->address = address;
+    prepared->count = count;
+    return 1;
+}
+
+// Команда из подготовленного запроса: первые copy байтов кадра, в Modbus TCP - идентификатор транзакции команды. NULL, если очередь заполнена
+static MODBUS_FRAME_T* ModBus_addPreparedFrame(ModBus_parameter* ModBus_para, const ModBus_Prepared_T* prepared, size_t copy)
+{
+    MODBUS_FRAME_T* pFrame = addFrame(ModBus_para);
+    if (pFrame == NULL)
+    {
+        return NULL;
+    }
+    pFrame->unit = prepared->unit;
+    pFrame->type = (MODBUS_FUNCTION_TYPE)prepared->type;
+    pFrame->responseSize = prepared->responseSize;
+    pFrame->address = prepared->address;
+    pFrame->count = prepared->count;
+    if (prepared->type == WRITE_MULTI_REGISTER)
+    {
+        pFrame->spanAddress = 0;
+        pFrame->spanCount = 0;
+    }
+    else // Диапазон кадра для присоединения команд чтения
+    {
+        pFrame->spanAddress = prepared->address;
+        pFrame->spanCount = prepared->count;
+    }
+    memcpy(pFrame->data, prepared->data, copy);
+    pFrame->size = prepared->size;
+    if (ModBus_para->m_mode == MODBUS_MODE_TCP)
+    {
+        pFrame->data[0] = (pFrame->transaction >> 8) & 0x0FF;
+        pFrame->data[1] = pFrame->transaction & 0x0FF;
+    }
+    return pFrame;
+}
+
+uint8_t ModBus_submitRead(ModBus_parameter* ModBus_para, const ModBus_Prepared_T* prepared, void(*GetReponseHandler)(void*, uint16_t*, uint16_t), void* context)
+{
+    MODBUS_FRAME_T* pFrame;
+    if (prepared->size == 0 || prepared->mode != ModBus_para->m_mode || prepared->type == WRITE_MULTI_REGISTER
+        || prepared->count > ModBus_para->m_registerAcessLimit) // Кадр, построенный при компиляции, может превышать ограничение экземпляра
+    {
+        return 0;
+    }
+    if (prepared->type == READ_REGISTER)
+    {
+        uint8_t index = ModBus_cacheAnswer(ModBus_para, prepared->unit, prepared->address, prepared->count, NULL, GetReponseHandler, context);
+        if (index != 0)
+        {
+            return index;
+        }
+    }
+    pFrame = ModBus_addPreparedFrame(ModBus_para, prepared, prepared->size);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->getResponseHandlerEx = GetReponseHandler;
+    pFrame->context = context;
+    return pFrame->index;
+}
+
+uint8_t ModBus_submitWrite(ModBus_parameter* ModBus_para, const ModBus_Prepared_T* prepared, const uint16_t* data, void(*SetReponseHandler)(uint16_t, uint16_t))
+{
+    MODBUS_FRAME_T* pFrame;
+    size_t size = prepared->headerSize;
+    if (prepared->size == 0 || prepared->mode != ModBus_para->m_mode || prepared->type != WRITE_MULTI_REGISTER
+        || prepared->count > ModBus_writeLimit(ModBus_para, MODBUS_MAX_WRITE_REGISTERS))
+    {
+        return 0;
+    }
+    pFrame = ModBus_addPreparedFrame(ModBus_para, prepared, size);
+    if (pFrame == NULL) // Очередь заполнена
+    {
+        return 0;
+    }
+    pFrame->setResponseHandler = SetReponseHandler;
+    for (uint16_t i = 0; i < prepared->count; i++)
+    {
+        pFrame->data[size++] = (data[i] >> 8) & 0x0FF;
+        pFrame->data[size++] = data[i] & 0x0FF;
+    }
+    if (ModBus_para->m_mode != MODBUS_MODE_TCP)
+    {
+        // CRC заголовка сохранена при подготовке, считаются только данные
+        uint16_t crc = ModBus_CRC16_update(prepared->headerCrc, pFrame->data + prepared->headerSize, 2u * prepared->count);
+        pFrame->data[size++] = crc & 0xFF;
+        pFrame->data[size++] = (crc >> 8) & 0xFF;
+    }
+    return pFrame->index;
+}
+
+
+// Вызов функции обратного вызова команды чтения, (0,0) - команда не выполнена
+static void ModBus_callGetHandler(MODBUS_FRAME_T* pFrame, uint16_t* data, uint16_t count)
+{
+    if (pFrame->getResponseHandlerEx)
+    {
+        pFrame->getResponseHandlerEx(pFrame->context, data, count);
+    }
+    else if (pFrame->getResponseHandler)
+    {
+        pFrame->getResponseHandler(data, count);
+    }
+}
+
+// Объединенные команды чтения: data - прочитанный диапазон команды pFrame, NULL если команда не выполнена.
+// Каждая команда, присоединенная к pFrame, получает свою часть диапазона и завершается
+static void ModBus_finishMerged(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* pFrame, uint16_t* data)
+{
+    if (pFrame->spanCount == pFrame->count) // Нет присоединенных команд
+    {
+        return;
+    }
+    for (size_t i = 0; i < ModBus_para->m_sendFramesN; i++)
+    {
+        MODBUS_FRAME_T* pMerged = queueFrame(ModBus_para, i);
+        if (pMerged->state != MODBUS_FRAME_MERGED || pMerged->mergedTo != pFrame->transaction)
+        {
+            continue;
+        }
+        pMerged->state = MODBUS_FRAME_DONE;
+        if (data != NULL)
+            ModBus_callGetHandler(pMerged, data + (pMerged->address - pFrame->spanAddress), pMerged->count);
+        else
+            ModBus_callGetHandler(pMerged, 0, 0);
+    }
+}
+
+// Команда не выполнена (тайм-аут или исключение status): вызывается функция обратного вызова с параметрами (0,0)
+static void ModBus_failFrame(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* pFrame, uint8_t status)
+{
+    ModBus_para->m_status = status;
+    MODBUS_DELAY_DEBUG("Frame Timeout %d\n", (int)(ModBus_now() - pFrame->time));
+    if (status == MODBUS_STATUS_TIMEOUT)
+    {
+        MODBUS_STAT_INC(ModBus_para, timeouts);
+    }
+    ModBus_cacheWritten(ModBus_para, pFrame, 0); // Результат записи неизвестен
+    if (pFrame->pduResponseHandler)
+    {
+        pFrame->pduResponseHandler(pFrame->context, NULL, 0);
+        return;
+    }
+    switch (pFrame->type)
+    {
+    case READ_REGISTER:
+    case READ_INPUT_REGISTER:
+    case READ_WRITE_REGISTERS:
+        ModBus_callGetHandler(pFrame, 0, 0);
+        ModBus_finishMerged(ModBus_para, pFrame, NULL);
+        break;
+    case READ_COILS:
+    case READ_DISCRETE_INPUTS:
+        if (pFrame->getBitsResponseHandler)
+            pFrame->getBitsResponseHandler(NULL, 0);
+        break;
+    case WRITE_SINGLE_COIL:
+    case WRITE_SINGLE_REGISTER:
+    case WRITE_MULTI_COIL:
+    case WRITE_MULTI_REGISTER:
+        if (pFrame->setResponseHandler)
+            pFrame->setResponseHandler(0, 0);
+        break;
+    default:
+        break;
+    }
+}
+
+// Объединение команд чтения: команды чтения тому же устройству, стоящие в очереди после команды n, присоединяются к ней,
+// если общий диапазон не превышает m_registerAcessLimit, а промежуток между диапазонами не больше m_coalesceGap.
+// Команда записи тому же устройству прерывает поиск, чтобы чтение не обгоняло запись, чтение других областей (FC01, FC02, FC04) пропускается.
+static void ModBus_coalesceReads(ModBus_parameter* ModBus_para, size_t n)
+{
+    MODBUS_FRAME_T* pFrame = queueFrame(ModBus_para, n);
+    // Диапазон уже отправленного кадра: при повторе после тайм-аута в нем остаются ранее присоединенные команды
+    uint32_t begin = pFrame->spanAddress, end = (uint32_t)pFrame->spanAddress + pFrame->spanCount;
+    uint8_t changed = 1, merged = 0;
+    size_t size;
+
+    while (changed) // Повторные проходы: после расширения диапазона могут подойти пропущенные команды
+    {
+        changed = 0;
+        for (size_t i = n + 1; i < ModBus_para->m_sendFramesN; i++)
+        {
+            MODBUS_FRAME_T* pNext = queueFrame(ModBus_para, i);
+            uint32_t nextBegin = pNext->address, nextEnd = (uint32_t)pNext->address + pNext->count;
+            if (pNext->unit != pFrame->unit || pNext->state != MODBUS_FRAME_PENDING)
+            {
+                continue;
+            }
+            if (pNext->pduResponseHandler) // Содержимое команды PDU неизвестно, порядок сохраняется
+            {
+                break;
+            }
+            if (pNext->type != READ_REGISTER)
+            {
+                if (pNext->type == READ_COILS || pNext->type == READ_DISCRETE_INPUTS || pNext->type == READ_INPUT_REGISTER)
+                {
+                    continue;
+                }
+                break;
+            }
+            if (nextBegin > end + ModBus_para->m_coalesceGap || nextEnd + ModBus_para->m_coalesceGap < begin
+                || (nextEnd > end ? nextEnd : end) - (nextBegin < begin ? nextBegin : begin) > ModBus_para->m_registerAcessLimit)
+            {
+                continue;
+            }
+            begin = nextBegin < begin ? nextBegin : begin;
+            end = nextEnd > end ? nextEnd : end;
+            pNext->state = MODBUS_FRAME_MERGED;
+            pNext->mergedTo = pFrame->transaction;
+            changed = merged = 1;
+        }
+    }
+    if (!merged)
+    {
+        return;
+    }
+
+    // Запрос перестраивается на общий диапазон
+    pFrame->spanAddress = (uint16_t)begin;
+    pFrame->spanCount = (uint16_t)(end - begin);
+    size = ModBus_beginFrame(ModBus_para, pFrame->data, pFrame->unit, pFrame->transaction);
+    pFrame->data[size++] = READ_REGISTER;
+    pFrame->data[size++] = (pFrame->spanAddress >> 8) & 0x0FF;
+    pFrame->data[size++] = pFrame->spanAddress & 0x0FF;
+    pFrame->data[size++] = 0;
+    pFrame->data[size++] = pFrame->spanCount;
+    pFrame->size = (uint16_t)ModBus_endFrame(ModBus_para, pFrame->data, size);
+    pFrame->responseSize = (uint16_t)(ModBus_frameOverhead(ModBus_para) + 2 + 2 * pFrame->spanCount);
+}
+
+#ifdef MODBUS_STATS
+// Корзина гистограммы для времени us: количество значащих битов
+static unsigned ModBus_statsBucket(uint64_t us)
+{
+    unsigned bucket = 0;
+    while (us != 0 && bucket < MODBUS_STATS_BUCKETS - 1)
+    {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+// Время ответа на команду pFrame в гистограмму ее кода функции
+static void ModBus_statsResponse(ModBus_parameter* ModBus_para, const MODBUS_FRAME_T* pFrame)
+{
+    int slot = ModBus_statsSlot(pFrame->type);
+    if (slot >= 0)
+    {
+        ModBus_para->m_stats.rtt[slot][ModBus_statsBucket(ModBus_now() - pFrame->sentTime)]++;
+    }
+}
+#define MODBUS_STAT_RTT(para, pFrame) ModBus_statsResponse(para, pFrame)
+#else
+#define MODBUS_STAT_RTT(para, pFrame) ((void)0)
+#endif // MODBUS_STATS
+
+// Обработка ответа на команду pFrame, frame указывает на адрес устройства в принятом кадре.
+// Возвращает 1, если ответ соответствует команде и функция обратного вызова вызвана, в противном случае 0
+static uint8_t ModBus_handleResponse(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* pFrame, const ModBus_RingView_T* frame)
+{
+    uint8_t function = ModBus_viewByte(frame, 1);
+    MODBUS_DELAY_DEBUG("Frame Delay %d\n", (int)(ModBus_now() - pFrame->time));
+    if (pFrame->pduResponseHandler) // Команда PDU: ответ передается без разбора, исключение - тоже
+    {
+        uint16_t size = (uint16_t)(frame->firstLen + frame->secondLen - (ModBus_para->m_mode == MODBUS_MODE_TCP ? 1 : 3));
+        if ((function & ~MODBUS_EXCEPTION_FLAG) != pFrame->type)
+        {
+            return 0;
+        }
+        ModBus_para->m_status = MODBUS_STATUS_OK;
+        if (function & MODBUS_EXCEPTION_FLAG)
+        {
+            MODBUS_STAT_INC(ModBus_para, exceptionsReceived);
+            ModBus_para->m_status = size > 1 && ModBus_viewByte(frame, 2) != MODBUS_STATUS_OK ? ModBus_viewByte(frame, 2) : MODBUS_STATUS_DEVICE_FAILURE;
+        }
+        ModBus_cacheWritten(ModBus_para, pFrame, 0);
+        // Запрос уже отправлен, поэтому PDU ответа собирается в памяти команды, если переходит через конец кольца
+        pFrame->pduResponseHandler(pFrame->context, ModBus_viewLinear(frame, 1, size, pFrame->data), size);
+        return 1;
+    }
+    if (function == (pFrame->type | MODBUS_EXCEPTION_FLAG)) // Устройство ответило исключением, команда завершается сразу, без ожидания тайм-аута
+    {
+        uint8_t code = ModBus_viewByte(frame, 2);
+        MODBUS_STAT_INC(ModBus_para, exceptionsReceived);
+        ModBus_failFrame(ModBus_para, pFrame, code != MODBUS_STATUS_OK ? code : MODBUS_STATUS_DEVICE_FAILURE);
+        return 1;
+    }
+    ModBus_para->m_status = MODBUS_STATUS_OK;
+    // Код функции суждения
+    switch (function)
+    {
+    case READ_COILS:
+    case READ_DISCRETE_INPUTS:
+    {
+        MODBUS_DEBUG("ModBus read bits response\n");
+        size_t size = (pFrame->count + 7) / 8;
+        if (pFrame->type != function || ModBus_viewByte(frame, 2) != size) // Ненормальные данные
+        {
+            return 0;
+        }
+        // Биты передаются в функцию обратного вызова упакованными, прямо из кольцевого буфера
+        // (копия в буфер регистров только если биты переходят через конец кольца)
+        if (pFrame->getBitsResponseHandler)
+        {
+            pFrame->getBitsResponseHandler(ModBus_viewLinear(frame, 3, size, (uint8_t*)ModBus_para->m_registerData), pFrame->count);
+        }
+        break;
+    }
+    case READ_REGISTER:
+    case READ_INPUT_REGISTER:
+    case READ_WRITE_REGISTERS: // Ответ FC23 содержит только прочитанные регистры
+    {
+        uint8_t count = ModBus_viewByte(frame, 2);
+        MODBUS_DEBUG("ModBus read reg response\n");
+        if (count % 2 != 0 || pFrame->type != function || count != pFrame->spanCount * 2) // Ненормальные данные
+        {
+            return 0;
+        }
+        count >>= 1; // Разделить на 2
+        if (count > ModBus_para->m_registerAcessLimit)
+        {
+            count = ModBus_para->m_registerAcessLimit;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            ModBus_para->m_registerData[i] = ModBus_viewWord(frame, 3 + (i << 1));
+        }
+        ModBus_para->m_registerCount = count;
+        if (ModBus_para->m_cache != NULL && function != READ_INPUT_REGISTER) // Входные регистры FC04 - другая область, не кэшируются
+        {
+            uint64_t now = ModBus_now();
+            ModBus_cacheWritten(ModBus_para, pFrame, 1); // FC23: устройство записывает до чтения
+            for (size_t i = 0; i < count; i++)
+            {
+                ModBus_cacheStore(ModBus_para, pFrame->unit, (uint16_t)(pFrame->spanAddress + i), ModBus_para->m_registerData[i], now);
+            }
+        }
+        if (ModBus_para->m_subscriptions != NULL)
+        {
+            ModBus_notifySubscriptions(ModBus_para, pFrame->unit, function == READ_INPUT_REGISTER ? READ_INPUT_REGISTER : READ_REGISTER,
+                pFrame->spanAddress, ModBus_para->m_registerData, count);
+        }
+        
+        MODBUS_DEBUG("Count read reg: %u\n", (unsigned)count);
+        // Функция обратного вызова, каждая команда получает свою часть прочитанного диапазона
+        ModBus_callGetHandler(pFrame, ModBus_para->m_registerData + (pFrame->address - pFrame->spanAddress), pFrame->count);
+        ModBus_finishMerged(ModBus_para, pFrame, ModBus_para->m_registerData);
+        break;
+    }
+    case WRITE_SINGLE_COIL:
+    case WRITE_SINGLE_REGISTER:
+    {
+        uint16_t address = ModBus_viewWord(frame, 2);
+        uint16_t data = ModBus_viewWord(frame, 4);
+        uint16_t dataSent;
+        const uint8_t* sent = pFrame->data + (ModBus_para->m_mode == MODBUS_MODE_TCP ? MODBUS_MBAP_SIZE - 1 : 0);
+        MODBUS_DEBUG("ModBus write 0x%04x %d response\n", address, data);
+
+
+        dataSent = (sent[4] << 8) + sent[5];
+    
+        if (pFrame->type != function || address != pFrame->address || dataSent != data) // Ненормальные данные
+        {
+            return 0;
+        }
+
+        ModBus_cacheWritten(ModBus_para, pFrame, 1);
+        // Функция обратного вызова
+        if (pFrame->setResponseHandler)
+        {
+            pFrame->setResponseHandler(address, 1);
+        }
+        break;
+    }
+    case WRITE_MULTI_COIL:
+    case WRITE_MULTI_REGISTER:
+    {
+        uint16_t address = ModBus_viewWord(frame, 2);
+        uint16_t count = ModBus_viewWord(frame, 4);
+        MODBUS_DEBUG("ModBus write 0x%04x %d regs response\n", address, count);
+        if (pFrame->type != function || address != pFrame->address || count != pFrame->count) // Ненормальные данные
+        {
+            return 0;
+        }
+
+        ModBus_cacheWritten(ModBus_para, pFrame, 1);
+        // Функция обратного вызова
+        if (pFrame->setResponseHandler)
+        {
+            pFrame->setResponseHandler(address, count);
+        }
+        break;
+    }
+    default:
+        return 0;
+        break;
+    }
+    return 1;
+}
+
+
+// Конец приема данных, обработка данных, возврат 1, если существуют действительные данные, в противном случае возврат 0
+static uint8_t ModBus_parseReceivedBuff(ModBus_parameter* ModBus_para)
+{
+    ModBus_RingView_T frame;
+    uint8_t result;
+    MODBUS_FRAME_T* pFrame = NULL;
+    if (ModBus_para->m_sendFramesN > 0)
+    {
+        pFrame = frontFrame(ModBus_para);
+    }
+    else // Если возвратный кадр не ожидается, данные не обрабатываются
+    {
+        ModBus_dropReceived(ModBus_para);
+        return 0;
+    }
+
+    if (!ModBus_detectFrame(ModBus_para, 0, &frame))
+    {
+        return 0;
+    }
+
+    result = ModBus_handleResponse(ModBus_para, pFrame, &frame);
+    if (result)
+    {
+        MODBUS_STAT_RTT(ModBus_para, pFrame);
+        ModBus_unitResponded(ModBus_para, pFrame);
+    }
+    // Кадр освобождается после обработки, следующие байты остаются в кольцевом буфере
+    ModBus_consumeReceived(ModBus_para, frame.firstLen + frame.secondLen);
+    if (!result)
+    {
+        return 0;
+    }
+
+    // Удалить возвращенную команду
+    popFrame(ModBus_para);
+    ModBus_para->m_waitingResponse = 0;
+
+    return 1;
+}
+
+static void sendFrame_loop(ModBus_parameter* ModBus_para)
+{
+    uint64_t now = ModBus_now();
+    if ((ModBus_para->m_waitingResponse && now - ModBus_para->m_lastSentTime < frontFrame(ModBus_para)->timeout) || ModBus_para->m_sendFramesN == 0) // Время ожидания обратного кадра не истекло, или нет данных для отправки
+    {
+        return;
+    }
+    if (ModBus_para->m_waitingResponse && frontFrame(ModBus_para)->retries < ModBus_para->m_retries) // Повтор команды с удвоенным тайм-аутом
+    {
+        MODBUS_FRAME_T* pFrame = frontFrame(ModBus_para);
+        pFrame->retries++;
+        pFrame->state = MODBUS_FRAME_PENDING;
+        ModBus_para->m_waitingResponse = 0;
+        MODBUS_STAT_INC(ModBus_para, retries);
+    }
+    else if (ModBus_para->m_waitingResponse) // Ожидание тайм-аута возвратного кадра
+    {
+        MODBUS_FRAME_T* pFrame = frontFrame(ModBus_para);
+        ModBus_failFrame(ModBus_para, pFrame, MODBUS_STATUS_TIMEOUT);
+        ModBus_unitTimedOut(ModBus_para, pFrame);
+        if (ModBus_para->m_skipUnitOnTimeout) // Остальные команды неотвечающему устройству завершаются сразу, чтобы не занимать шину
+        {
+            for (size_t i = 1; i < ModBus_para->m_sendFramesN; i++)
+            {
+                MODBUS_FRAME_T* pNext = queueFrame(ModBus_para, i);
+                if (pNext->state == MODBUS_FRAME_PENDING && pNext->unit == pFrame->unit)
+                {
+                    ModBus_failFrame(ModBus_para, pNext, MODBUS_STATUS_TIMEOUT);
+                    pNext->state = MODBUS_FRAME_DONE;
+                }
+            }
+        }
+        popFrame(ModBus_para); // Удаление отправленных пакетов
+        ModBus_para->m_waitingResponse = 0;
+    }
+    while (ModBus_para->m_sendFramesN > 0 && (frontFrame(ModBus_para)->state == MODBUS_FRAME_DONE || ModBus_unitOffline(ModBus_para, frontFrame(ModBus_para), now))) // Пропуск уже завершенных команд и команд пропускаемым устройствам
+    {
+        if (frontFrame(ModBus_para)->state != MODBUS_FRAME_DONE)
+        {
+            ModBus_failFrame(ModBus_para, frontFrame(ModBus_para), MODBUS_STATUS_UNIT_OFFLINE);
+            MODBUS_STAT_INC(ModBus_para, offline);
+        }
+        popFrame(ModBus_para);
+    }
+    if (!ModBus_para->m_waitingResponse && ModBus_para->m_sendFramesN > 0) // Если вы не ждете обратного кадра, а пакет должен быть отправлен, отправьте
+    {
+        MODBUS_FRAME_T* pFrame;
+        if (ModBus_para->m_faston) // В случае быстрого режима выполняется только последняя команда
+        {
+            ModBus_para->m_sendFramesHead = (ModBus_para->m_sendFramesHead + ModBus_para->m_sendFramesN - 1) % ModBus_para->m_sendFramesSize;
+            ModBus_para->m_sendFramesN = 1;
+            if (frontFrame(ModBus_para)->state == MODBUS_FRAME_DONE)
+            {
+                popFrame(ModBus_para);
+                return;
+            }
+        }
+        pFrame = frontFrame(ModBus_para);
+        if (pFrame->type == READ_REGISTER && !pFrame->pduResponseHandler && ModBus_para->m_coalesce && !ModBus_para->m_faston)
+        {
+            ModBus_coalesceReads(ModBus_para, 0);
+        }
+        pFrame->timeout = ModBus_frameTimeout(ModBus_para, pFrame);
+        if (ModBus_send(ModBus_para, pFrame->data, pFrame->size))
+        {
+            pFrame->state = MODBUS_FRAME_SENT;
+            pFrame->sentTime = ModBus_para->m_lastSentTime;
+            ModBus_para->m_waitingResponse = 1;
+        }
+    }
+}
+
+// Modbus TCP: команда завершена
+static void completeFrame_TCP(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* pFrame)
+{
+    pFrame->state = MODBUS_FRAME_DONE;
+    ModBus_para->m_inFlight--;
+}
+
+// Modbus TCP: удаление завершенных команд в начале очереди (ответы могут приходить не по порядку)
+static void popDoneFrames_TCP(ModBus_parameter* ModBus_para)
+{
+    while (ModBus_para->m_sendFramesSent > 0 && frontFrame(ModBus_para)->state == MODBUS_FRAME_DONE)
+    {
+        popFrame(ModBus_para);
+        ModBus_para->m_sendFramesSent--;
+    }
+}
+
+// Modbus TCP: обработка всех принятых кадров, ответ сопоставляется с командой по идентификатору транзакции
+static uint8_t ModBus_parseReceivedBuff_TCP(ModBus_parameter* ModBus_para)
+{
+    ModBus_RingView_T frame;
+    uint8_t result = 0;
+    while (ModBus_detectFrame_TCP(ModBus_para, &frame))
+    {
+        uint16_t transaction = ModBus_viewWord(&frame, 0);
+        size_t frameSize = frame.firstLen + frame.secondLen;
+        ModBus_viewAdvance(&frame, MODBUS_MBAP_SIZE - 1); // PDU с адресом устройства
+        for (size_t i = 0; i < ModBus_para->m_sendFramesSent; i++)
+        {
+            MODBUS_FRAME_T* pFrame = queueFrame(ModBus_para, i);
+            if (pFrame->state == MODBUS_FRAME_SENT && pFrame->transaction == transaction)
+            {
+                if (ModBus_handleResponse(ModBus_para, pFrame, &frame))
+                {
+                    MODBUS_STAT_RTT(ModBus_para, pFrame);
+                    ModBus_unitResponded(ModBus_para, pFrame);
+                    completeFrame_TCP(ModBus_para, pFrame);
+                    result = 1;
+                }
+                break;
+            }
+        }
+        ModBus_consumeReceived(ModBus_para, frameSize);
+    }
+    popDoneFrames_TCP(ModBus_para);
+    return result;
+}
+
+// Modbus TCP: тайм-ауты отправленных команд и отправка новых, пока количество ожидающих ответа меньше m_window
+static void sendFrame_loop_TCP(ModBus_parameter* ModBus_para)
+{
+    uint64_t now = ModBus_now();
+    for (size_t i = 0; i < ModBus_para->m_sendFramesSent; i++)
+    {
+        MODBUS_FRAME_T* pFrame = queueFrame(ModBus_para, i);
+        if (pFrame->state == MODBUS_FRAME_SENT && now - pFrame->sentTime >= pFrame->timeout)
+        {
+            ModBus_failFrame(ModBus_para, pFrame, MODBUS_STATUS_TIMEOUT);
+            ModBus_unitTimedOut(ModBus_para, pFrame);
+            completeFrame_TCP(ModBus_para, pFrame);
+        }
+    }
+    popDoneFrames_TCP(ModBus_para);
+    while (ModBus_para->m_inFlight < ModBus_para->m_window && ModBus_para->m_sendFramesSent < ModBus_para->m_sendFramesN)
+    {
+        MODBUS_FRAME_T* pFrame = queueFrame(ModBus_para, ModBus_para->m_sendFramesSent);
+        if (pFrame->state != MODBUS_FRAME_PENDING) // Команда присоединена к другой или уже завершена
+        {
+            ModBus_para->m_sendFramesSent++;
+            continue;
+        }
+        if (ModBus_unitOffline(ModBus_para, pFrame, now)) // Устройство пропускается, команда завершается без отправки
+        {
+            ModBus_failFrame(ModBus_para, pFrame, MODBUS_STATUS_UNIT_OFFLINE);
+            MODBUS_STAT_INC(ModBus_para, offline);
+            pFrame->state = MODBUS_FRAME_DONE;
+            ModBus_para->m_sendFramesSent++;
+            continue;
+        }
+        if (pFrame->type == READ_REGISTER && !pFrame->pduResponseHandler && ModBus_para->m_coalesce)
+        {
+            ModBus_coalesceReads(ModBus_para, ModBus_para->m_sendFramesSent);
+        }
+        pFrame->timeout = ModBus_frameTimeout(ModBus_para, pFrame);
+        if (!ModBus_send(ModBus_para, pFrame->data, pFrame->size))
+        {
+            break;
+        }
+        pFrame->state = MODBUS_FRAME_SENT;
+        pFrame->sentTime = ModBus_para->m_lastSentTime;
+        ModBus_para->m_sendFramesSent++;
+        ModBus_para->m_inFlight++;
+    }
+}
+
+void ModBus_Master_loop(ModBus_parameter* ModBus_para)
+{
+    uint64_t now = ModBus_now();
+
+    if (ModBus_para->m_mode == MODBUS_MODE_TCP) // В Modbus TCP конец кадра определяется по заголовку MBAP, тайм-аут приема не используется
+    {
+        ModBus_parseReceivedBuff_TCP(ModBus_para);
+        sendFrame_loop_TCP(ModBus_para);
+        return;
+    }
+
+    if (ModBus_receivePending(ModBus_para))
+    {
+        ModBus_parseReceivedBuff(ModBus_para); // Обработка входящих данных, ответ обрабатывается сразу после приема последнего байта
+    }
+    if (ModBus_sinceReceived(ModBus_para, now) > ModBus_para->m_receiveTimeout) // Таймаут приема, обработка данных и сброс
+    {
+        ModBus_parseReceivedBuff(ModBus_para); // Обработка входящих данных
+        ModBus_resetReceiveFrame(ModBus_para);
+    }
+
+    sendFrame_loop(ModBus_para);
+}
+#endif
+
+#ifdef MODBUS_SLAVE
+
+void ModBus_attachRegisterHandler(ModBus_parameter* ModBus_para, size_t(*GetRegisterHandler)(uint16_t, uint16_t, uint16_t*), size_t(*SetRegisterHandler)(uint16_t, uint16_t, uint16_t*))
+{
+    ModBus_para->m_GetRegisterHandler = GetRegisterHandler;
+    ModBus_para->m_SetRegisterHandler = SetRegisterHandler;
+}
+
+void ModBus_attachRegisterBank(ModBus_parameter* ModBus_para, ModBus_RegisterBank_T* bank)
+{
+    ModBus_para->m_bank = bank;
+}
+
+void ModBus_attachInputRegisterHandler(ModBus_parameter* ModBus_para, size_t(*GetInputHandler)(uint16_t, uint16_t, uint16_t*))
+{
+    ModBus_para->m_GetInputHandler = GetInputHandler;
+}
+
+void ModBus_attachBitHandler(ModBus_parameter* ModBus_para, size_t(*GetBitsHandler)(uint8_t, uint16_t, uint16_t, uint8_t*), size_t(*SetBitsHandler)(uint16_t, uint16_t, const uint8_t*))
+{
+    ModBus_para->m_GetBitsHandler = GetBitsHandler;
+    ModBus_para->m_SetBitsHandler = SetBitsHandler;
+}
+
+uint8_t ModBus_attachUnits(ModBus_parameter* ModBus_para, ModBus_SlaveUnits_T* table, ModBus_SlaveUnit_T* units, size_t n)
+{
+    ModBus_para->m_units = NULL;
+    if (table == NULL)
+    {
+        return 1;
+    }
+    memset(table->index, 0, sizeof(table->index));
+    for (size_t i = 0; i < n; i++)
+    {
+        if (units[i].address == 0 || units[i].address > MODBUS_MAX_UNIT || table->index[units[i].address] != 0)
+        {
+            return 0;
+        }
+        table->index[units[i].address] = (uint8_t)(i + 1);
+    }
+    table->units = units;
+    table->n = n;
+    ModBus_para->m_units = table;
+    return 1;
+}
+
+// Обмен банка и функций экземпляра с функциями устройства: первый вызов выбирает устройство для запроса, второй восстанавливает экземпляр
+static void ModBus_swapUnit_Slave(ModBus_parameter* ModBus_para, ModBus_SlaveUnit_T* unit)
+{
+    ModBus_RegisterBank_T* bank = ModBus_para->m_bank;
+    size_t(*getRegister)(uint16_t, uint16_t, uint16_t*) = ModBus_para->m_GetRegisterHandler;
+    size_t(*setRegister)(uint16_t, uint16_t, uint16_t*) = ModBus_para->m_SetRegisterHandler;
+    size_t(*getInput)(uint16_t, uint16_t, uint16_t*) = ModBus_para->m_GetInputHandler;
+    size_t(*getBits)(uint8_t, uint16_t, uint16_t, uint8_t*) = ModBus_para->m_GetBitsHandler;
+    size_t(*setBits)(uint16_t, uint16_t, const uint8_t*) = ModBus_para->m_SetBitsHandler;
+    ModBus_para->m_bank = unit->bank;
+    ModBus_para->m_GetRegisterHandler = unit->GetRegisterHandler;
+    ModBus_para->m_SetRegisterHandler = unit->SetRegisterHandler;
+    ModBus_para->m_GetInputHandler = unit->GetInputHandler;
+    ModBus_para->m_GetBitsHandler = unit->GetBitsHandler;
+    ModBus_para->m_SetBitsHandler = unit->SetBitsHandler;
+    unit->bank = bank;
+    unit->GetRegisterHandler = getRegister;
+    unit->SetRegisterHandler = setRegister;
+    unit->GetInputHandler = getInput;
+    unit->GetBitsHandler = getBits;
+    unit->SetBitsHandler = setBits;
+}
+
+// Адрес данных регистров в банке, NULL если диапазон [address, address + count) не входит в область целиком.
+// function - код функции запроса: READ_INPUT_REGISTER обращается к входным регистрам, остальные - к регистрам хранения
+static uint8_t* ModBus_bankRegisters(ModBus_parameter* ModBus_para, uint8_t function, uint16_t address, uint16_t count)
+{
+    ModBus_RegisterBank_T* bank = ModBus_para->m_bank;
+    uint8_t* regs;
+    uint16_t start, size;
+    if (bank == NULL || count == 0)
+    {
+        return NULL;
+    }
+    if (function == READ_INPUT_REGISTER)
+    {
+        regs = bank->input;
+        start = bank->inputStart;
+        size = bank->inputCount;
+    }
+    else
+    {
+        regs = bank->holding;
+        start = bank->holdingStart;
+        size = bank->holdingCount;
+    }
+    if (regs == NULL || address < start || (uint32_t)address + count > (uint32_t)start + size)
+    {
+        return NULL;
+    }
+    return regs + 2 * (address - start);
+}
+
+#define MODBUS_EXCEPTION_NO_RESPONSE 0x0B // Исключение 0B: устройство с адресом запроса отсутствует
+
+// Отправка ответа из m_sendFrameBuffer: сразу или через задержку устройства (ModBus_SlaveUnit_T.delayUs)
+static void ModBus_reply_Slave(ModBus_parameter* ModBus_para)
+{
+    if (ModBus_para->m_replyDelay > 0)
+    {
+        ModBus_para->m_replyTime = ModBus_now() + ModBus_para->m_replyDelay;
+        ModBus_para->m_replyPending = 1;
+        return;
+    }
+    ModBus_send(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
+}
+
+// Ответ с исключением: код функции запроса с установленным старшим битом и код исключения
+static void ModBus_exception_Slave(ModBus_parameter* ModBus_para, uint8_t function, uint8_t code)
+{
+    ModBus_para->m_sendFrameBufferLen = (uint16_t)ModBus_beginFrame(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_receiveUnit, ModBus_para->m_receiveTransaction); // Адрес устройства
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = function | MODBUS_EXCEPTION_FLAG;
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = code;
+    ModBus_para->m_sendFrameBufferLen = (uint16_t)ModBus_endFrame(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
+    MODBUS_STAT_INC(ModBus_para, exceptionsSent);
+
+    ModBus_reply_Slave(ModBus_para);
+}
+
+// Код исключения по результату функции чтения/записи регистров, MODBUS_STATUS_OK если обработаны все count регистров
+static uint8_t ModBus_handlerStatus(size_t result, uint16_t count)
+{
+    if (result == MODBUS_HANDLER_FAILURE)
+    {
+        return MODBUS_STATUS_DEVICE_FAILURE;
+    }
+    return result < count ? MODBUS_STATUS_ILLEGAL_ADDRESS : MODBUS_STATUS_OK;
+}
+
+// Ответ на запись: код функции, адрес и значение (FC05, FC06) или количество (FC15, FC16) из запроса
+static void ModBus_echo_Slave(ModBus_parameter* ModBus_para, uint8_t function, uint16_t address, uint16_t value)
+{
+    ModBus_para->m_sendFrameBufferLen = (uint16_t)ModBus_beginFrame(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_receiveUnit, ModBus_para->m_receiveTransaction); // Адрес устройства
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = function; // Код функции
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = (address >> 8) & 0x0FF; // Старший байт адреса
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = address & 0x0FF; // Младший байт адреса
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = (value >> 8) & 0x0FF; // Старший байт значения
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = value & 0x0FF; // Младший байт значения
+
+    ModBus_para->m_sendFrameBufferLen = (uint16_t)ModBus_endFrame(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
+
+    ModBus_reply_Slave(ModBus_para);
+}
+
+/** Кадр возврата регистра чтения **/
+/*** Параметры ***
+** function: Код функции запроса - READ_REGISTER, READ_INPUT_REGISTER или READ_WRITE_REGISTERS (чтение после записи)
+** address: Адрес первого регистра
+** count: Количество считываемых регистров
+** Примечание: При ошибке отправляется ответ с исключением.
+***/
+static void ModBus_getRegister_Slave(ModBus_parameter* ModBus_para, uint8_t function, uint16_t address, uint16_t count)
+{
+    uint8_t* regs;
+    uint8_t status = MODBUS_STATUS_OK;
+    size_t(*handler)(uint16_t, uint16_t, uint16_t*) = function == READ_INPUT_REGISTER ? ModBus_para->m_GetInputHandler : ModBus_para->m_GetRegisterHandler;
+
+    if (count == 0 || count > ModBus_para->m_registerAcessLimit || ModBus_frameOverhead(ModBus_para) + 2 + 2 * count + 2 > MODBUS_BUFFER_SIZE) // Если максимальный объем данных превышен
+    {
+        ModBus_exception_Slave(ModBus_para, function, MODBUS_STATUS_ILLEGAL_VALUE);
+        return;
+    }
+    regs = ModBus_bankRegisters(ModBus_para, function, address, count);
+    if (regs == NULL)
+    {
+        status = handler == NULL ? MODBUS_STATUS_ILLEGAL_ADDRESS
+            : ModBus_handlerStatus((*handler)(address, count, ModBus_para->m_registerData), count);
+    }
+    else if (ModBus_para->m_bank->hook)
+    {
+        ModBus_para->m_bank->hook(ModBus_para->m_bank->context, function, address, count);
+    }
+    if (status != MODBUS_STATUS_OK)
+    {
+        ModBus_exception_Slave(ModBus_para, function, status);
+        return;
+    }
+
+    ModBus_para->m_sendFrameBufferLen = (uint16_t)ModBus_beginFrame(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_receiveUnit, ModBus_para->m_receiveTransaction); // Адрес устройства
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = function; // Код функции, чтение регистров
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = (uint8_t)(count * 2); // Количество байт = количество считываемых регистров * 2
+    if (regs != NULL)
+    {
+        // Значения в банке уже в порядке передачи, ответ собирается одним копированием
+        memcpy(ModBus_para->m_sendFrameBuffer + ModBus_para->m_sendFrameBufferLen, regs, 2 * count);
+        ModBus_para->m_sendFrameBufferLen += 2 * count;
+    }
+    else
+    {
+        ModBus_para->m_registerCount = count;
+        for (uint16_t i = 0; i < count; i++)
+        {
+            ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = (ModBus_para->m_registerData[i] >> 8) & 0x0FF; // Старший байт регистра
+            ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = ModBus_para->m_registerData[i] & 0x0FF; // Младший байт регистра
+        }
+    }
+
+    ModBus_para->m_sendFrameBufferLen = (uint16_t)ModBus_endFrame(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
+
+    ModBus_reply_Slave(ModBus_para);
+}
+
+/** Запись одиночного регистра кадр возврата **/
+/*** Параметры ***
+** address: Адрес регистра
+** data: Данные для записи
+** Примечание: При ошибке записи отправляется ответ с исключением.
+***/
+static void ModBus_setRegister_Slave(ModBus_parameter* ModBus_para, uint16_t address, uint16_t data)
+{
+    uint8_t* regs = ModBus_bankRegisters(ModBus_para, WRITE_SINGLE_REGISTER, address, 1);
+    uint8_t status = MODBUS_STATUS_OK;
+    if (regs != NULL)
+    {
+        ModBus_bankWrite(regs, 0, data);
+        if (ModBus_para->m_bank->hook)
+        {
+            ModBus_para->m_bank->hook(ModBus_para->m_bank->context, WRITE_SINGLE_REGISTER, address, 1);
+        }
+    }
+    else
+    {
+        uint16_t value = data; // Функция записи может изменить данные, в ответе повторяется запрос
+        status = ModBus_para->m_SetRegisterHandler == NULL ? MODBUS_STATUS_ILLEGAL_ADDRESS
+            : ModBus_handlerStatus((*(ModBus_para->m_SetRegisterHandler))(address, 1, &value), 1);
+    }
+    if (status != MODBUS_STATUS_OK)
+    {
+        ModBus_exception_Slave(ModBus_para, WRITE_SINGLE_REGISTER, status);
+        return;
+    }
+    ModBus_echo_Slave(ModBus_para, WRITE_SINGLE_REGISTER, address, data);
+}
+
+// Запись нескольких регистров (FC16, FC23), данные в порядке передачи начинаются с байта offset кадра. Возвращает MODBUS_STATUS_TYPE
+static uint8_t ModBus_writeRegisters_Slave(ModBus_parameter* ModBus_para, uint8_t function, uint16_t address, const ModBus_RingView_T* frame, size_t offset, uint16_t count)
+{
+    uint8_t* regs = ModBus_bankRegisters(ModBus_para, function, address, count);
+    if (regs != NULL)
+    {
+        // Данные из кольцевого буфера копируются в банк без преобразования
+        ModBus_viewCopy(frame, offset, regs, 2 * count);
+        if (ModBus_para->m_bank->hook) // Запись FC23 сообщается как FC16: READ_WRITE_REGISTERS получает только чтение
         {
-            ModBus_para->m_sendFramesN--;
-            (*(SetReponseHandler))(address, 0);
+            ModBus_para->m_bank->hook(ModBus_para->m_bank->context, WRITE_MULTI_REGISTER, address, count);
         }
-        return 0;
+        return MODBUS_STATUS_OK;
+    }
+    if (ModBus_para->m_SetRegisterHandler == NULL)
+    {
+        return MODBUS_STATUS_ILLEGAL_ADDRESS;
     }
     for (uint16_t i = 0; i < count; i++)
     {
-        pFrame->data[pFrame->size++] = (data[i] >> 8) & 0x0FF; // Высокий уровень данных
-        pFrame->data[pFrame->size++] = data[i] & 0x0FF; // Низкие данные
+        ModBus_para->m_registerData[i] = ModBus_viewWord(frame, offset + i * 2);
     }
+    ModBus_para->m_registerCount = count;
+    return ModBus_handlerStatus((*(ModBus_para->m_SetRegisterHandler))(address, count, ModBus_para->m_registerData), count);
+}
 
-    pFrame->size = GenCRC16(pFrame->data, pFrame->size);
-    pFrame->responseSize = 8; // Возвращает количество байт, требуемое для фрейма
-
+/** Запись кадра возврата нескольких регистров **/
+/*** Параметры ***
+** address: Адрес первого регистра
+** frame: Принятый кадр от адреса устройства, данные для записи начинаются с байта 7
+** count: Количество записываемых регистров
+** size: Количество байтов данных, указанное в запросе
+** Примечание: При ошибке отправляется ответ с исключением.
+***/
+static void ModBus_setRegisters_Slave(ModBus_parameter* ModBus_para, uint16_t address, const ModBus_RingView_T* frame, uint16_t count, uint8_t size)
+{
+    uint8_t status;
 
-    return pFrame->index;
+    if (count == 0 || count > ModBus_writeLimit(ModBus_para, MODBUS_MAX_WRITE_REGISTERS) || size != 2 * count)
+    {
+        ModBus_exception_Slave(ModBus_para, WRITE_MULTI_REGISTER, MODBUS_STATUS_ILLEGAL_VALUE);
+        return;
+    }
+    status = ModBus_writeRegisters_Slave(ModBus_para, WRITE_MULTI_REGISTER, address, frame, 7, count);
+    if (status != MODBUS_STATUS_OK)
+    {
+        ModBus_exception_Slave(ModBus_para, WRITE_MULTI_REGISTER, status);
+        return;
+    }
+    ModBus_echo_Slave(ModBus_para, WRITE_MULTI_REGISTER, address, count);
 }
 
-
-// Конец приема данных, обработка данных, возврат 1, если существуют действительные данные, в противном случае возврат 0
-static uint8_t ModBus_parseReceivedBuff(ModBus_parameter* ModBus_para)
+/** Запись и чтение регистров FC23 **/
+/*** Параметры ***
+** frame: Принятый кадр от адреса устройства
+** Примечание: Запись выполняется до чтения, ответ содержит прочитанные регистры. При ошибке отправляется ответ с исключением.
+***/
+static void ModBus_readWriteRegisters_Slave(ModBus_parameter* ModBus_para, const ModBus_RingView_T* frame)
 {
-    size_t restSize;
-    MODBUS_FRAME_T* pFrame = NULL;
-    if (ModBus_para->m_sendFramesN > 0)
+    uint16_t readAddress = ModBus_viewWord(frame, 2);
+    uint16_t readCount = ModBus_viewWord(frame, 4);
+    uint16_t writeAddress = ModBus_viewWord(frame, 6);
+    uint16_t writeCount = ModBus_viewWord(frame, 8);
+    uint8_t status;
+
+    if (readCount == 0 || readCount > ModBus_para->m_registerAcessLimit
+        || writeCount == 0 || writeCount > ModBus_writeLimit(ModBus_para, MODBUS_MAX_READ_WRITE_REGISTERS) || ModBus_viewByte(frame, 10) != 2 * writeCount)
     {
-        pFrame = ModBus_para->m_sendFrames;
+        ModBus_exception_Slave(ModBus_para, READ_WRITE_REGISTERS, MODBUS_STATUS_ILLEGAL_VALUE);
+        return;
     }
-    else // Если возвратный кадр не ожидается, данные не обрабатываются
+    status = ModBus_writeRegisters_Slave(ModBus_para, READ_WRITE_REGISTERS, writeAddress, frame, 11, writeCount);
+    if (status != MODBUS_STATUS_OK)
     {
-        ModBus_para->m_pBeginReceiveBufferTmp = ModBus_para->m_pEndReceiveBufferTmp;
-        ModBus_para->m_receiveFrameBufferLen = 0;
-        return 0;
+        ModBus_exception_Slave(ModBus_para, READ_WRITE_REGISTERS, status);
+        return;
     }
+    ModBus_getRegister_Slave(ModBus_para, READ_WRITE_REGISTERS, readAddress, readCount);
+}
+
+/** Чтение битов FC01/FC02 **/
+/*** Параметры ***
+** function: READ_COILS или READ_DISCRETE_INPUTS
+** address: Адрес первого бита
+** count: Количество битов
+** Примечание: Функция чтения битов заполняет упакованные биты прямо в буфере ответа. При ошибке отправляется ответ с исключением.
+***/
+static void ModBus_getBits_Slave(ModBus_parameter* ModBus_para, uint8_t function, uint16_t address, uint16_t count)
+{
+    uint8_t size = (uint8_t)((count + 7) / 8);
+    uint8_t status;
+    uint8_t* bits;
 
-    if (!ModBus_detectFrame(ModBus_para, &restSize))
+    if (count == 0 || count > ModBus_bitLimit(ModBus_para, MODBUS_MAX_READ_BITS))
     {
-        return 0;
+        ModBus_exception_Slave(ModBus_para, function, MODBUS_STATUS_ILLEGAL_VALUE);
+        return;
     }
+    ModBus_para->m_sendFrameBufferLen = (uint16_t)ModBus_beginFrame(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_receiveUnit, ModBus_para->m_receiveTransaction); // Адрес устройства
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = function; // Код функции
+    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = size; // Количество байт упакованных битов
+    bits = ModBus_para->m_sendFrameBuffer + ModBus_para->m_sendFrameBufferLen;
+    memset(bits, 0, size);
 
-    MODBUS_DELAY_DEBUG("Frame Delay %d\n", millis() - pFrame->time);
-    // Код функции суждения
-    switch (ModBus_para->m_receiveFrameBuffer[1])
+    status = ModBus_para->m_GetBitsHandler == NULL ? MODBUS_STATUS_ILLEGAL_ADDRESS
+        : ModBus_handlerStatus((*(ModBus_para->m_GetBitsHandler))(function, address, count, bits), count);
+    if (status != MODBUS_STATUS_OK)
     {
-    case READ_REGISTER:
+        ModBus_exception_Slave(ModBus_para, function, status);
+        return;
+    }
+    ModBus_para->m_sendFrameBufferLen += size;
+
+    ModBus_para->m_sendFrameBufferLen = (uint16_t)ModBus_endFrame(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
+
+    ModBus_reply_Slave(ModBus_para);
+}
+
+/** Запись битов FC05/FC15 **/
+/*** Параметры ***
+** function: WRITE_SINGLE_COIL или WRITE_MULTI_COIL
+** address: Адрес первого бита
+** bits: Упакованные биты из принятого кадра
+** count: Количество битов
+** Примечание: Ответ повторяет value (FC05) или количество битов (FC15). При ошибке отправляется ответ с исключением.
+***/
+static void ModBus_setBits_Slave(ModBus_parameter* ModBus_para, uint8_t function, uint16_t address, const uint8_t* bits, uint16_t count, uint16_t value)
+{
+    uint8_t status = ModBus_para->m_SetBitsHandler == NULL ? MODBUS_STATUS_ILLEGAL_ADDRESS
+        : ModBus_handlerStatus((*(ModBus_para->m_SetBitsHandler))(address, count, bits), count);
+    if (status != MODBUS_STATUS_OK)
     {
-        uint8_t count = ModBus_para->m_receiveFrameBuffer[2];
-        MODBUS_DEBUG("ModBus read reg response\n");
-        if (count % 2 != 0 || pFrame->type != READ_REGISTER || count != pFrame->count * 2) // Ненормальные данные
+        ModBus_exception_Slave(ModBus_para, function, status);
+        return;
+    }
+    ModBus_echo_Slave(ModBus_para, function, address, value);
+}
+
+// Конец приема данных, обработка данных, возвращает 1, если существуют действительные данные, в противном случае возвращает 0
+static uint8_t ModBus_parseReveivedBuff_Slave(ModBus_parameter* ModBus_para)
+{
+    ModBus_RingView_T view; // Кадр в кольцевом буфере, от адреса устройства (RTU) или заголовка MBAP (TCP)
+    const ModBus_RingView_T* frame = &view; // Адрес устройства в принятом кадре
+    ModBus_SlaveUnit_T* unit = NULL; // Устройство таблицы ModBus_attachUnits, обрабатывающее запрос
+    size_t frameSize;
+    uint8_t function;
+    if (ModBus_para->m_mode == MODBUS_MODE_TCP)
+    {
+        if (!ModBus_detectFrame_TCP(ModBus_para, &view))
         {
-            // Сохраненные необработанные данные
-            memcpy(ModBus_para->m_receiveFrameBuffer, ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen, restSize);
-            ModBus_para->m_receiveFrameBufferLen = restSize;
             return 0;
         }
-        count >>= 1; // Разделить на 2
-        if (count > ModBus_para->m_registerAcessLimit)
-        {
-            count = ModBus_para->m_registerAcessLimit;
-        }
-        for (size_t i = 0; i < count; i++)
+        frameSize = view.firstLen + view.secondLen;
+        ModBus_para->m_receiveTransaction = ModBus_viewWord(&view, 0);
+        ModBus_viewAdvance(&view, MODBUS_MBAP_SIZE - 1);
+        ModBus_para->m_receiveUnit = ModBus_viewByte(&view, 0); // В Modbus TCP адрес устройства в ответе повторяет адрес из запроса
+    }
+    else
+    {
+        if (!ModBus_detectFrame(ModBus_para, 1, &view))
         {
-            ModBus_para->m_registerData[i] = (((uint16_t)ModBus_para->m_receiveFrameBuffer[3 + (i << 1)]) << 8) + ModBus_para->m_receiveFrameBuffer[4 + (i << 1)];
+            return 0;
         }
-        ModBus_para->m_registerCount = count;
-        
-        printf("Count read reg: %u\n", count);
-        // Функция обратного вызова
-        if (pFrame->getResponseHandler)
+        frameSize = view.firstLen + view.secondLen;
+        ModBus_para->m_receiveUnit = ModBus_viewByte(frame, 0); // m_address или адрес из таблицы устройств
+    }
+    function = ModBus_viewByte(frame, 1);
+    ModBus_para->m_replyDelay = 0;
+    if (ModBus_para->m_units != NULL)
+    {
+        uint8_t index = ModBus_para->m_units->index[ModBus_para->m_receiveUnit];
+        if (index == 0) // Только Modbus TCP: в RTU кадр с чужим адресом не принимается
         {
-            pFrame->getResponseHandler(ModBus_para->m_registerData, count);
+            ModBus_exception_Slave(ModBus_para, function, MODBUS_EXCEPTION_NO_RESPONSE);
+            ModBus_consumeReceived(ModBus_para, frameSize);
+            return 1;
         }
+        unit = &ModBus_para->m_units->units[index - 1];
+        ModBus_para->m_replyDelay = unit->delayUs;
+        ModBus_swapUnit_Slave(ModBus_para, unit);
+    }
+
+    // Коды функций ModBus
+    switch (function)
+    {
+    case READ_COILS:
+    case READ_DISCRETE_INPUTS:
+    {
+        uint16_t address = ModBus_viewWord(frame, 2);
+        uint16_t count = ModBus_viewWord(frame, 4);
+        ModBus_getBits_Slave(ModBus_para, function, address, count);
         break;
     }
-    case WRITE_SINGLE_REGISTER:
+    case READ_REGISTER:
+    case READ_INPUT_REGISTER:
     {
-        uint16_t address = (ModBus_para->m_receiveFrameBuffer[2] << 8) + ModBus_para->m_receiveFrameBuffer[3];
-        uint16_t data = (ModBus_para->m_receiveFrameBuffer[4] << 8) + ModBus_para->m_receiveFrameBuffer[5];
-        uint16_t dataSent;
-        MODBUS_DEBUG("ModBus write 0x%04x %d response\n", address, data);
-
-
-        dataSent = (pFrame->data[4] << 8) + pFrame->data[5];
-    
-        if (pFrame->type != WRITE_SINGLE_REGISTER || address != pFrame->address || dataSent != data) // Ненормальные данные
+        uint16_t address = ModBus_viewWord(frame, 2);
+        uint16_t count = ModBus_viewWord(frame, 4);
+        ModBus_getRegister_Slave(ModBus_para, function, address, count);
+        break;
+    }
+    case WRITE_SINGLE_COIL:
+    {
+        uint16_t address = ModBus_viewWord(frame, 2);
+        uint16_t value = ModBus_viewWord(frame, 4);
+        uint8_t bit = value == MODBUS_COIL_ON;
+        if (value != MODBUS_COIL_ON && value != 0) // Допустимы только 0xFF00 и 0x0000
         {
-            // Сохраненные необработанные данные
-            memcpy(ModBus_para->m_receiveFrameBuffer, ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen, restSize);
-            ModBus_para->m_receiveFrameBufferLen = restSize;
-            return 0;
+            ModBus_exception_Slave(ModBus_para, WRITE_SINGLE_COIL, MODBUS_STATUS_ILLEGAL_VALUE);
+            break;
         }
-
-        // Функция обратного вызова
-        if (pFrame->setResponseHandler)
+        ModBus_setBits_Slave(ModBus_para, WRITE_SINGLE_COIL, address, &bit, 1, value);
+        break;
+    }
+    case WRITE_MULTI_COIL:
+    {
+        uint16_t address = ModBus_viewWord(frame, 2);
+        uint16_t count = ModBus_viewWord(frame, 4);
+        size_t size = (count + 7) / 8;
+        if (count == 0 || count > ModBus_bitLimit(ModBus_para, MODBUS_MAX_WRITE_BITS) || ModBus_viewByte(frame, 6) != size)
         {
-            pFrame->setResponseHandler(address, 1);
+            ModBus_exception_Slave(ModBus_para, WRITE_MULTI_COIL, MODBUS_STATUS_ILLEGAL_VALUE);
+            break;
         }
+        // Биты передаются прямо из кольцевого буфера, копия - только при переходе через его конец
+        ModBus_setBits_Slave(ModBus_para, WRITE_MULTI_COIL, address, ModBus_viewLinear(frame, 7, size, (uint8_t*)ModBus_para->m_registerData), count, count);
+        break;
+    }
+    case READ_WRITE_REGISTERS:
+        ModBus_readWriteRegisters_Slave(ModBus_para, frame);
+        break;
+    case WRITE_SINGLE_REGISTER:
+    {
+        uint16_t address = ModBus_viewWord(frame, 2);
+        uint16_t data = ModBus_viewWord(frame, 4);
+        ModBus_setRegister_Slave(ModBus_para, address, data);
         break;
     }
     case WRITE_MULTI_REGISTER:
     {
-        uint16_t address = (ModBus_para->m_receiveFrameBuffer[2] << 8) + ModBus_para->m_receiveFrameBuffer[3];
-        uint16_t count = (ModBus_para->m_receiveFrameBuffer[4] << 8) + ModBus_para->m_receiveFrameBuffer[5];
-        MODBUS_DEBUG("ModBus write 0x%04x %d regs response\n", address, count);
-        if (pFrame->type != WRITE_MULTI_REGISTER || address != pFrame->address || count != pFrame->count) // Ненормальные данные
-        {
-            // Сохраненные необработанные данные
-            memcpy(ModBus_para->m_receiveFrameBuffer, ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen, restSize);
-            ModBus_para->m_receiveFrameBufferLen = restSize;
-            return 0;
-        }
-
-        // Функция обратного вызова
-        if (pFrame->setResponseHandler)
-        {
-            pFrame->setResponseHandler(address, count);
-        }
+        uint16_t address = ModBus_viewWord(frame, 2);
+        uint16_t count = ModBus_viewWord(frame, 4);
+        ModBus_setRegisters_Slave(ModBus_para, address, frame, count, ModBus_viewByte(frame, 6));
         break;
     }
-    default:
-        memcpy(ModBus_para->m_receiveFrameBuffer, ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen, restSize);
-        ModBus_para->m_receiveFrameBufferLen = restSize;
-        return 0;
+    default: // Код функции не поддерживается
+        ModBus_exception_Slave(ModBus_para, function, MODBUS_STATUS_ILLEGAL_FUNCTION);
         break;
     }
-
-    memcpy(ModBus_para->m_receiveFrameBuffer, ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen, restSize);
-    ModBus_para->m_receiveFrameBufferLen = restSize;
-
-    // Удалить возвращенную команду
-    memcpy(ModBus_para->m_sendFrames, ModBus_para->m_sendFrames + 1, (--ModBus_para->m_sendFramesN) * sizeof(MODBUS_FRAME_T));
-    ModBus_para->m_waitingResponse = 0;
-
+    if (unit != NULL)
+    {
+        ModBus_swapUnit_Slave(ModBus_para, unit);
+    }
+    ModBus_consumeReceived(ModBus_para, frameSize); // Кадр освобождается только после отправки ответа
     return 1;
 }
 
-static void sendFrame_loop(ModBus_parameter* ModBus_para)
+void ModBus_Slave_loop(ModBus_parameter* ModBus_para)
 {
-    uint32_t now = millis();
-    if (ModBus_para->m_waitingResponse && now - ModBus_para->m_lastSentTime < ModBus_para->m_sendTimeout || ModBus_para->m_sendFramesN == 0) // Время ожидания обратного кадра не истекло, или нет данных для отправки
-    {
-        return;
-    }
-    if (ModBus_para->m_waitingResponse && now - ModBus_para->m_lastSentTime >= ModBus_para->m_sendTimeout) // Ожидание тайм-аута возвратного кадра
+    uint64_t now = ModBus_now();
+
+    if (ModBus_para->m_replyPending) // Ответ с задержкой устройства
     {
-        MODBUS_FRAME_T* pFrame = ModBus_para->m_sendFrames;
-        MODBUS_DELAY_DEBUG("Frame Timeout %d\n", millis() - pFrame->time);
-        if (pFrame->getResponseHandler || pFrame->setResponseHandler) // Вызывается обратный вызов, передайте параметр (0,0)
+        if (now < ModBus_para->m_replyTime)
         {
-            switch (pFrame->type)
-            {
-            case READ_REGISTER:
-                pFrame->getResponseHandler(0, 0);
-                break;
-            case WRITE_SINGLE_REGISTER:
-                pFrame->setResponseHandler(0, 0);
-                break;
-            case WRITE_MULTI_REGISTER:
-                pFrame->setResponseHandler(0, 0);
-                break;
-            default:
-                break;
-            }
+            return;
         }
-
-        memcpy(ModBus_para->m_sendFrames, ModBus_para->m_sendFrames + 1, (--ModBus_para->m_sendFramesN) * sizeof(MODBUS_FRAME_T)); // Удаление отправленных пакетов
-        ModBus_para->m_waitingResponse = 0;
+        ModBus_para->m_replyPending = 0;
+        ModBus_send(ModBus_para, ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
     }
-    if (!ModBus_para->m_waitingResponse && ModBus_para->m_sendFramesN > 0) // Если вы не ждете обратного кадра, а пакет должен быть отправлен, отправьте
+
+    if (ModBus_para->m_mode == MODBUS_MODE_TCP) // Кадры обрабатываются сразу после приема последнего байта
     {
-        MODBUS_FRAME_T* pFrame = ModBus_para->m_sendFrames;
-        if (ModBus_para->m_faston) // В случае быстрого режима выполняется только последняя команда
+        while (!ModBus_para->m_replyPending && ModBus_parseReveivedBuff_Slave(ModBus_para))
         {
-            ModBus_para->m_sendFrames[0] = ModBus_para->m_sendFrames[ModBus_para->m_sendFramesN - 1];
-            ModBus_para->m_sendFramesN = 1;
         }
-        if (ModBus_para->m_SendHandler != NULL)
+        return;
+    }
+    
+    if (ModBus_receivePending(ModBus_para))
+    {
+        while (!ModBus_para->m_replyPending && ModBus_parseReveivedBuff_Slave(ModBus_para)) // Обработка входящих данных, кадр обрабатывается сразу после приема последнего байта
         {
-            (*ModBus_para->m_SendHandler)(pFrame->data, pFrame->size);
-            ModBus_para->m_waitingResponse = 1;
-            ModBus_para->m_lastSentTime = millis();
         }
     }
+    if (ModBus_para->m_replyPending)
+    {
+        return;
+    }
+    if (ModBus_sinceReceived(ModBus_para, now) > ModBus_para->m_receiveTimeout) // Таймаут приема, обработка данных и сброс
+    {
+        ModBus_parseReveivedBuff_Slave(ModBus_para); // Обработка входящих данных
+        ModBus_resetReceiveFrame(ModBus_para);
+    }
 }
 
-void ModBus_Master_loop(ModBus_parameter* ModBus_para)
+uint64_t ModBus_Slave_nextWakeup(ModBus_parameter* ModBus_para)
 {
-    uint32_t now = millis();
-
-    if (ModBus_para->m_pBeginReceiveBufferTmp != ModBus_para->m_pEndReceiveBufferTmp)
+    uint32_t elapsed;
+    if (ModBus_para->m_replyPending)
     {
-        ModBus_parseReceivedBuff(ModBus_para); // Обработка входящих данных
+        uint64_t now = ModBus_now();
+        return now < ModBus_para->m_replyTime ? ModBus_para->m_replyTime - now : 0;
     }
-    if (now - ModBus_para->m_lastReceivedTime > ModBus_para->m_receiveTimeout) // Таймаут приема, обработка данных и сброс
+    if (ModBus_receivePending(ModBus_para))
     {
-        ModBus_parseReceivedBuff(ModBus_para); // Обработка входящих данных
-        ModBus_para->m_receiveFrameBufferLen = 0;
-        ModBus_para->m_lastReceivedTime = millis();
+        return 0;
     }
-
-    sendFrame_loop(ModBus_para);
+    if (ModBus_para->m_mode == MODBUS_MODE_TCP || ModBus_para->m_receiveScanned == 0)
+    {
+        return MODBUS_TIME_NEVER;
+    }
+    elapsed = ModBus_sinceReceived(ModBus_para, ModBus_now());
+    return elapsed > ModBus_para->m_receiveTimeout ? 0 : ModBus_para->m_receiveTimeout + 1 - elapsed;
 }
 #endif
 
-#ifdef MODBUS_SLAVE
-
-void ModBus_attachRegisterHandler(ModBus_parameter* ModBus_para, size_t(*GetRegisterHandler)(uint16_t, uint16_t, uint16_t*), size_t(*SetRegisterHandler)(uint16_t, uint16_t, uint16_t*))
+#ifdef MODBUS_STATS
+void ModBus_getStats(ModBus_parameter* ModBus_para, ModBus_Stats_T* stats)
 {
-    ModBus_para->m_GetRegisterHandler = GetRegisterHandler;
-    ModBus_para->m_SetRegisterHandler = SetRegisterHandler;
+    *stats = ModBus_para->m_stats;
+    stats->overflows = atomic_load_explicit(&ModBus_para->m_receiveOverflow, memory_order_relaxed) - ModBus_para->m_statsOverflowBase;
 }
 
-/** Кадр возврата регистра чтения **/
-/*** Параметры ***
-** address: Адрес первого регистра
-** count: Количество считываемых регистров
-** GetReponseHandler: Функция обратного вызова результата чтения, входящие параметры(uint16_t* buff, uint16_t buffLen)
-***/
-static void ModBus_getRegister_Slave(ModBus_parameter* ModBus_para, uint16_t address, uint8_t count)
+void ModBus_resetStats(ModBus_parameter* ModBus_para)
 {
-    ModBus_para->m_sendFrameBufferLen = 0;
-
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = ModBus_para->m_address; // Адрес устройства
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = READ_REGISTER; // Код функции, чтение регистров
+    memset(&ModBus_para->m_stats, 0, sizeof(ModBus_para->m_stats));
+    // Счетчик переполнений изменяет производитель, поэтому запоминается его значение, а не обнуляется сам счетчик
+    ModBus_para->m_statsOverflowBase = atomic_load_explicit(&ModBus_para->m_receiveOverflow, memory_order_relaxed);
+}
 
-    if (count > ModBus_para->m_registerAcessLimit || ModBus_para->m_sendFrameBufferLen + 2 * count + 3 > MODBUS_BUFFER_SIZE) // Если максимальный объем данных превышен
+int ModBus_statsSlot(uint8_t function)
+{
+    switch (function)
     {
-        count = 0;
+    case READ_COILS:
+    case READ_DISCRETE_INPUTS:
+    case READ_REGISTER:
+    case READ_INPUT_REGISTER:
+    case WRITE_SINGLE_COIL:
+    case WRITE_SINGLE_REGISTER:
+        return function - READ_COILS;
+    case WRITE_MULTI_COIL:
+        return 6;
+    case WRITE_MULTI_REGISTER:
+        return 7;
+    case READ_WRITE_REGISTERS:
+        return 8;
+    default:
+        return -1;
     }
+}
 
-    count = (uint8_t)(*(ModBus_para->m_GetRegisterHandler))(address, count, ModBus_para->m_registerData);
-    ModBus_para->m_registerCount = count;
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = count * 2; // Количество байт = количество считываемых регистров * 2
-    for (uint16_t i = 0; i < count; i++)
+uint64_t ModBus_statsPercentile(const ModBus_Stats_T* stats, uint8_t function, uint16_t perMille)
+{
+    int slot = ModBus_statsSlot(function);
+    uint64_t total = 0, seen = 0;
+    if (slot < 0)
     {
-        ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = (ModBus_para->m_registerData[i] >> 8) & 0x0FF; // Старший байт регистра
-        ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = ModBus_para->m_registerData[i] & 0x0FF; // Младший байт регистра
+        return 0;
     }
-
-    ModBus_para->m_sendFrameBufferLen = GenCRC16(ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
-
-    if (ModBus_para->m_SendHandler != NULL && ModBus_para->m_sendFrameBufferLen > 0)
+    for (unsigned i = 0; i < MODBUS_STATS_BUCKETS; i++)
     {
-        (*ModBus_para->m_SendHandler)(ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
-        ModBus_para->m_lastSentTime = millis();
+        total += stats->rtt[slot][i];
     }
-}
-
-/** Запись одиночного регистра кадр возврата **/
-/*** Параметры ***
-** address: Адрес регистра
-** data: Данные для записи
-** SetReponseHandler: Функция обратного вызова результата записи, входящие параметры(uint16_t address, uint16_t count), параметры включают в себя первый адрес и количество регистров
-***/
-static void ModBus_setRegister_Slave(ModBus_parameter* ModBus_para, uint16_t address, uint16_t data)
-{
-    ModBus_para->m_sendFrameBufferLen = 0;
-
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = ModBus_para->m_address; // Адрес устройства
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = WRITE_SINGLE_REGISTER; // Функциональный код, считанный регистр
-
-    if ((*(ModBus_para->m_SetRegisterHandler))(address, 1, &data) == 0) // Если происходит ошибка записи, данные инвертируются и возвращаются, чтобы хост мог определить
+    if (total == 0)
     {
-        data = ~data;
+        return 0;
     }
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = (address >> 8) & 0x0FF; // Регистрация первого адреса высокого уровня
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = address & 0x0FF; // Регистрировать первый младший адрес
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = (data >> 8) & 0x0FF; // Высокий уровень данных
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = data & 0x0FF; // Низкие данные
-
-
-    ModBus_para->m_sendFrameBufferLen = GenCRC16(ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
-
-    if (ModBus_para->m_SendHandler != NULL && ModBus_para->m_sendFrameBufferLen > 0)
+    for (unsigned i = 0; i < MODBUS_STATS_BUCKETS; i++)
     {
-        (*ModBus_para->m_SendHandler)(ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
-        ModBus_para->m_lastSentTime = millis();
+        seen += stats->rtt[slot][i];
+        if (seen * 1000 >= total * perMille)
+        {
+            return (uint64_t)1 << i; // Верхняя граница корзины i
+        }
     }
+    return (uint64_t)1 << (MODBUS_STATS_BUCKETS - 1);
 }
+#endif // MODBUS_STATS
 
-/** Запись кадра возврата нескольких регистров **/
-/*** Параметры ***
-** address: Адрес первого регистра
-** data: Данные для записи
-** count: Количество записываемых регистров
-** SetReponseHandler: Функция обратного вызова результата записи, входящие параметры(uint16_t address, uint16_t count), параметры включают в себя первый адрес и количество регистров
-***/
-static void ModBus_setRegisters_Slave(ModBus_parameter* ModBus_para, uint16_t address, uint16_t* data, uint16_t count)
-{
-    ModBus_para->m_sendFrameBufferLen = 0;
+#if defined(_BENCHMARK) && defined(MODBUS_MASTER)
+#include <stdio.h>
 
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = ModBus_para->m_address; // Адрес устройства
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = WRITE_MULTI_REGISTER; // Коды функций, запись регистров
+// Стоимость постановки команды в очередь и ее удаления при глубине очереди depth.
+// Для сравнения измеряется прежний способ удаления - сдвиг всей очереди
+void ModBus_queue_benchmark()
+{
+    static const size_t depths[] = { 3, 16, 64, 256, 512 };
+    static MODBUS_FRAME_T frames[512];
+    static ModBus_parameter para;
+    const size_t rounds = 200000;
+    ModBus_Setting_T setting = { 0 };
+    setting.address = 0x01;
+    setting.baudRate = 115200;
 
-    count = (uint16_t)(*(ModBus_para->m_SetRegisterHandler))(address, count, data);
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = (address >> 8) & 0x0FF; // Высокий уровень первого адреса
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = address & 0x0FF; // Низкий уровень первого адреса
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = (count >> 8) & 0x0FF; // высокий номер
-    ModBus_para->m_sendFrameBuffer[ModBus_para->m_sendFrameBufferLen++] = count & 0x0FF; // низкий номер
+    printf("queue,depth,ring_ns_per_op,shift_ns_per_op\n");
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+    {
+        size_t depth = depths[d];
+        uint64_t begin, ringNs, shiftNs;
+        ModBus_setup(&para, setting);
+        ModBus_setFrameQueue(&para, frames, depth);
+        while (ModBus_getRegister(&para, 0, 1, NULL) != 0)
+        {
+        }
 
+        begin = ModBus_benchNowNs();
+        for (size_t r = 0; r < rounds; r++)
+        {
+            popFrame(&para);
+            ModBus_getRegister(&para, (uint16_t)r, 1, NULL);
+        }
+        ringNs = ModBus_benchNowNs() - begin;
 
-    ModBus_para->m_sendFrameBufferLen = GenCRC16(ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
+        begin = ModBus_benchNowNs();
+        for (size_t r = 0; r < rounds; r++)
+        {
+            memmove(frames, frames + 1, (depth - 1) * sizeof(MODBUS_FRAME_T));
+            frames[depth - 1].address = (uint16_t)r;
+        }
+        shiftNs = ModBus_benchNowNs() - begin;
 
-    if (ModBus_para->m_SendHandler != NULL && ModBus_para->m_sendFrameBufferLen > 0)
-    {
-        (*ModBus_para->m_SendHandler)(ModBus_para->m_sendFrameBuffer, ModBus_para->m_sendFrameBufferLen);
-        ModBus_para->m_lastSentTime = millis();
+        printf("queue,%u,%.2f,%.2f\n", (unsigned)depth, (double)ringNs / rounds, (double)shiftNs / rounds);
     }
 }
 
-// Конец приема данных, обработка данных, возвращает 1, если существуют действительные данные, в противном случае возвращает 0
-static uint8_t ModBus_parseReveivedBuff_Slave(ModBus_parameter* ModBus_para)
+void ModBus_prepared_benchmark()
 {
-    size_t restSize;
-    if (!ModBus_detectFrame(ModBus_para, &restSize))
-    {
-        return 0;
-    }
+    static MODBUS_FRAME_T frames[2];
+    static ModBus_parameter para;
+    static ModBus_Prepared_T prepared;
+    static uint16_t data[MODBUS_REGISTER_LIMIT];
+    const size_t rounds = 200000;
+    const uint16_t counts[] = { 1, 10, MODBUS_REGISTER_LIMIT };
+    ModBus_Setting_T setting = { 0 };
+    setting.address = 0x01;
+    setting.baudRate = 115200;
 
-    // Коды функций ModBus
-    switch (ModBus_para->m_receiveFrameBuffer[1])
-    {
-    case READ_REGISTER:
-    {
-        uint16_t address = (ModBus_para->m_receiveFrameBuffer[2] << 8) + ModBus_para->m_receiveFrameBuffer[3];
-        uint16_t count = (ModBus_para->m_receiveFrameBuffer[4] << 8) + ModBus_para->m_receiveFrameBuffer[5];
-        if (count > ModBus_para->m_registerAcessLimit)
-        {
-            count = 0;
-        }
-        ModBus_getRegister_Slave(ModBus_para, address, (uint8_t)count);
-        break;
-    }
-    case WRITE_SINGLE_REGISTER:
-    {
-        uint16_t address = (ModBus_para->m_receiveFrameBuffer[2] << 8) + ModBus_para->m_receiveFrameBuffer[3];
-        uint16_t data = (ModBus_para->m_receiveFrameBuffer[4] << 8) + ModBus_para->m_receiveFrameBuffer[5];
-        ModBus_setRegister_Slave(ModBus_para, address, data);
-        break;
-    }
-    case WRITE_MULTI_REGISTER:
+    printf("prepared,mode,function,count,encode_ns_per_op,prepared_ns_per_op\n");
+    for (int mode = MODBUS_MODE_RTU; mode <= MODBUS_MODE_TCP; mode++)
     {
-        uint16_t address = (ModBus_para->m_receiveFrameBuffer[2] << 8) + ModBus_para->m_receiveFrameBuffer[3];
-        uint16_t count = (ModBus_para->m_receiveFrameBuffer[4] << 8) + ModBus_para->m_receiveFrameBuffer[5];
-        //uint8_t size = ModBus_para->m_receiveFrameBuffer[6];
-        if (count > ModBus_para->m_registerAcessLimit)
-        {
-            count = 0;
-        }
-        for (uint16_t i = 0; i < count; i++)
+        for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
         {
-            ModBus_para->m_registerData[i] = ((uint16_t)(*(ModBus_para->m_receiveFrameBuffer + 7 + i * 2)) << 8) + (uint16_t)(*(ModBus_para->m_receiveFrameBuffer + 8 + i * 2));
+            uint16_t count = counts[c];
+            uint64_t begin, encodeNs, preparedNs;
+            ModBus_setup(&para, setting);
+            ModBus_setFrameQueue(&para, frames, 2);
+            ModBus_setMode(&para, (MODBUS_MODE_TYPE)mode, 1);
+
+            // FC03: кадр без данных, CRC (RTU) по 6 байтам
+            ModBus_prepareRead(&para, &prepared, 0x01, READ_REGISTER, 0, count);
+            begin = ModBus_benchNowNs();
+            for (size_t r = 0; r < rounds; r++)
+            {
+                ModBus_getUnitRegister(&para, 0x01, 0, count, NULL);
+                popFrame(&para);
+            }
+            encodeNs = ModBus_benchNowNs() - begin;
+            begin = ModBus_benchNowNs();
+            for (size_t r = 0; r < rounds; r++)
+            {
+                ModBus_submitRead(&para, &prepared, NULL, NULL);
+                popFrame(&para);
+            }
+            preparedNs = ModBus_benchNowNs() - begin;
+            printf("prepared,%s,3,%u,%.2f,%.2f\n", mode == MODBUS_MODE_TCP ? "tcp" : "rtu", count, (double)encodeNs / rounds, (double)preparedNs / rounds);
+
+            // FC16: CRC заголовка сохранена, считаются только данные
+            if (count > MODBUS_MAX_WRITE_REGISTERS)
+            {
+                continue;
+            }
+            ModBus_prepareWrite(&para, &prepared, 0x01, 0, count);
+            begin = ModBus_benchNowNs();
+            for (size_t r = 0; r < rounds; r++)
+            {
+                data[0] = (uint16_t)r;
+                ModBus_setUnitRegisters(&para, 0x01, 0, data, count, NULL);
+                popFrame(&para);
+            }
+            encodeNs = ModBus_benchNowNs() - begin;
+            begin = ModBus_benchNowNs();
+            for (size_t r = 0; r < rounds; r++)
+            {
+                data[0] = (uint16_t)r;
+                ModBus_submitWrite(&para, &prepared, data, NULL);
+                popFrame(&para);
+            }
+            preparedNs = ModBus_benchNowNs() - begin;
+            printf("prepared,%s,16,%u,%.2f,%.2f\n", mode == MODBUS_MODE_TCP ? "tcp" : "rtu", count, (double)encodeNs / rounds, (double)preparedNs / rounds);
         }
-        ModBus_para->m_registerCount = count;
-        ModBus_setRegisters_Slave(ModBus_para, address, ModBus_para->m_registerData, count);
-        break;
-    }
-    default:
-        assert(0);
-        memcpy(ModBus_para->m_receiveFrameBuffer, ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen, restSize);
-        ModBus_para->m_receiveFrameBufferLen = restSize;
-        return 0;
-        break;
     }
-    memcpy(ModBus_para->m_receiveFrameBuffer, ModBus_para->m_receiveFrameBuffer + ModBus_para->m_receiveFrameBufferLen, restSize);
-    ModBus_para->m_receiveFrameBufferLen = restSize;
-    return 1;
 }
 
-void ModBus_Slave_loop(ModBus_parameter* ModBus_para)
+void ModBus_diff_benchmark()
 {
-    uint32_t now = millis();
-    
-    if (ModBus_para->m_pBeginReceiveBufferTmp != ModBus_para->m_pEndReceiveBufferTmp)
-    {
-        ModBus_parseReveivedBuff_Slave(ModBus_para); // Обработка входящих данных
-    }
-    if (now - ModBus_para->m_lastReceivedTime > ModBus_para->m_receiveTimeout) // Таймаут приема, обработка данных и сброс
+    static uint16_t snapshot[4096], values[4096], changed[4096];
+    static const size_t sizes[] = { MODBUS_REGISTER_LIMIT, 4096 };
+    static const unsigned perMille[] = { 0, 10, 100 }; // Доля изменившихся регистров
+    const size_t rounds = 20000;
+    const char* simd =
+#if defined(__AVX2__)
+        "avx2";
+#elif defined(__SSE2__)
+        "sse2";
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+        "neon";
+#else
+        "none";
+#endif
+
+    printf("diff,simd,registers,changed_per_mille,simd_ns_per_reg,scalar_ns_per_reg\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
     {
-        ModBus_parseReveivedBuff_Slave(ModBus_para); // Обработка входящих данных
-        ModBus_para->m_receiveFrameBufferLen = 0;
+        for (size_t c = 0; c < sizeof(perMille) / sizeof(perMille[0]); c++)
+        {
+            size_t n = sizes[s], found = 0;
+            uint64_t begin, simdNs, scalarNs;
+            for (size_t i = 0; i < n; i++)
+            {
+                snapshot[i] = values[i] = (uint16_t)(i * 40503u);
+                if ((i * 7919u) % 1000 < perMille[c])
+                    values[i]++;
+            }
+            begin = ModBus_benchNowNs();
+            for (size_t r = 0; r < rounds; r++)
+            {
+                found += ModBus_diffRegisters(snapshot, values, n, changed);
+            }
+            simdNs = ModBus_benchNowNs() - begin;
+            begin = ModBus_benchNowNs();
+            for (size_t r = 0; r < rounds; r++)
+            {
+                found -= ModBus_diffScalar(snapshot, values, 0, n, changed);
+            }
+            scalarNs = ModBus_benchNowNs() - begin;
+            assert(found == 0);
+            printf("diff,%s,%u,%u,%.3f,%.3f\n", simd, (unsigned)n, perMille[c], (double)simdNs / rounds / n, (double)scalarNs / rounds / n);
+        }
     }
 }
-#endif
+#endif // _BENCHMARK
 
 #ifdef _UNIT_TEST
 #include <string.h>
 #include <stdio.h>
-#include <windows.h>
 ModBus_parameter modBus_master_test, modBus_slave_test;
 uint32_t t = 0;
 uint32_t millis()
@@ -825,8 +3268,11 @@ uint32_t millis()
     return t;
 }
 
+uint32_t g_masterSent = 0;
+
 static void OutputData_master(uint8_t* data, size_t len)
 {
+    g_masterSent++;
     int t = millis();
 
     char strtmp[1000];
@@ -844,8 +3290,15 @@ static void OutputData_master(uint8_t* data, size_t len)
     }
 }
 
+static void OutputData_drop(uint8_t* data, size_t len)
+{
+}
+
+uint32_t g_slaveSent = 0;
+
 static void OutputData_slave(uint8_t* data, size_t len)
 {
+    g_slaveSent++;
 
     char strtmp[1000];
     for (size_t i = 0; i < len; i++)
@@ -883,6 +3336,26 @@ static size_t setReg(uint16_t address, uint16_t n, uint16_t* data)
     return n;
 }
 
+uint16_t g_testRegisters[MODBUS_TEST_REGISTERS];
+
+size_t ModBus_testGetRegister(uint16_t address, uint16_t n, uint16_t* data)
+{
+    for (uint16_t i = 0; i < n; i++)
+    {
+        data[i] = g_testRegisters[(address + i) % MODBUS_TEST_REGISTERS];
+    }
+    return n;
+}
+
+size_t ModBus_testSetRegister(uint16_t address, uint16_t n, uint16_t* data)
+{
+    for (uint16_t i = 0; i < n; i++)
+    {
+        g_testRegisters[(address + i) % MODBUS_TEST_REGISTERS] = data[i];
+    }
+    return n;
+}
+
 void master_printReg(uint16_t* data, uint16_t count)
 {
     char strtmp[1000];
@@ -903,6 +3376,112 @@ void master_printSetReg(uint16_t address, uint16_t count)
     printf("set register: address %d, count %d\n", address, count);
 }
 
+uint16_t g_unitFailed = 0, g_unitRead = 0;
+
+void unit_countReg(uint16_t* data, uint16_t count)
+{
+    if (count == 0)
+        g_unitFailed++;
+    else
+        g_unitRead++;
+}
+
+static void unit_checkReg(uint16_t address, uint16_t count, uint16_t* data, uint16_t n)
+{
+    assert(n == count);
+    for (uint16_t i = 0; i < n; i++)
+    {
+        assert(data[i] == g_registerData[address + i]);
+    }
+    g_unitRead++;
+}
+
+void unit_checkReg0(uint16_t* data, uint16_t count) { unit_checkReg(0, 2, data, count); }
+void unit_checkReg3(uint16_t* data, uint16_t count) { unit_checkReg(3, 1, data, count); }
+void unit_checkReg1(uint16_t* data, uint16_t count) { unit_checkReg(1, 2, data, count); }
+void unit_checkReg14(uint16_t* data, uint16_t count) { unit_checkReg(14, 3, data, count); }
+void unit_checkReg5(uint16_t* data, uint16_t count) { unit_checkReg(5, 2, data, count); }
+void unit_checkReg4(uint16_t* data, uint16_t count) { unit_checkReg(4, 1, data, count); }
+void unit_checkRegEx(void* context, uint16_t* data, uint16_t count) { unit_checkReg((uint16_t)(size_t)context, 2, data, count); }
+
+uint16_t g_changed[8], g_changedN = 0, g_notified = 0;
+
+static void unit_subscription(ModBus_Subscription_T* sub, const uint16_t* changed, uint16_t n)
+{
+    for (uint16_t i = 0; i < n; i++)
+    {
+        assert(sub->snapshot[changed[i]] == (uint16_t)g_registerData[sub->address + changed[i]]);
+    }
+    memcpy(g_changed, changed, n * sizeof(uint16_t));
+    g_changedN = n;
+    g_notified++;
+}
+
+uint8_t g_coils[4]; // 32 бита Slave для FC01/FC05/FC15
+uint16_t g_bitsRead = 0;
+
+static size_t unit_getBits(uint8_t fc, uint16_t address, uint16_t n, uint8_t* bits)
+{
+    if (fc != READ_COILS || address + n > 32)
+    {
+        return 0;
+    }
+    for (uint16_t i = 0; i < n; i++)
+    {
+        ModBus_setBit(bits, i, ModBus_getBit(g_coils, address + i));
+    }
+    return n;
+}
+
+static size_t unit_setBits(uint16_t address, uint16_t n, const uint8_t* bits)
+{
+    if (address + n > 32)
+    {
+        return 0;
+    }
+    for (uint16_t i = 0; i < n; i++)
+    {
+        ModBus_setBit(g_coils, address + i, ModBus_getBit(bits, i));
+    }
+    return n;
+}
+
+void unit_checkBits(const uint8_t* bits, uint16_t count)
+{
+    assert(count == 12);
+    for (uint16_t i = 0; i < count; i++)
+    {
+        assert(ModBus_getBit(bits, i) == ModBus_getBit(g_coils, i));
+    }
+    g_bitsRead++;
+}
+
+void unit_checkInput(uint16_t* data, uint16_t count)
+{
+    assert(count == 2 && data[0] == 0x0102 && data[1] == 0x0304);
+    g_unitRead++;
+}
+
+uint8_t g_lastStatus = MODBUS_STATUS_OK;
+
+void unit_statusReg(uint16_t* data, uint16_t count)
+{
+    g_lastStatus = ModBus_getStatus(&modBus_master_test);
+}
+
+// Регистр 40 - ошибка устройства, остальные адреса отсутствуют
+static size_t unit_failReg(uint16_t address, uint16_t n, uint16_t* data)
+{
+    return address == 40 ? MODBUS_HANDLER_FAILURE : 0;
+}
+
+uint16_t g_bankHooks = 0;
+
+static void unit_bankHook(void* context, uint8_t fc, uint16_t address, uint16_t count)
+{
+    g_bankHooks++;
+}
+
 void unit_test()
 {
     // Конфигурация хоста
@@ -983,6 +3562,576 @@ void unit_test()
         ModBus_Master_loop(&modBus_master_test);
     }
 
+    // Тест переполнения очереди: лишняя команда отклоняется, а не вытесняет первую
+    for (int i = 0; i < MODBUS_WAITFRAME_N; i++)
+    {
+        assert(ModBus_getRegister(&modBus_master_test, 0, 1, NULL) != 0);
+    }
+    assert(ModBus_getRegister(&modBus_master_test, 0, 1, NULL) == 0);
+    for (int i = 0; i < MODBUS_WAITFRAME_N; i++)
+    {
+        ModBus_Master_loop(&modBus_master_test);
+        t += 10;
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+    }
+    assert(modBus_master_test.m_sendFramesN == 0);
+
+    // Тест опроса нескольких устройств: устройство 2 не отвечает, вторая команда ему завершается без ожидания,
+    // команда устройству 1 выполняется следующей
+    ModBus_skipUnitOnTimeout(&modBus_master_test, 1);
+    g_unitFailed = g_unitRead = 0;
+    ModBus_getUnitRegister(&modBus_master_test, 0x02, 0, 1, unit_countReg);
+    ModBus_getUnitRegister(&modBus_master_test, 0x02, 1, 1, unit_countReg);
+    ModBus_getUnitRegister(&modBus_master_test, 0x01, 0, 1, unit_countReg);
+    ModBus_Master_loop(&modBus_master_test);
+    t += 10;
+    ModBus_Slave_loop(&modBus_slave_test);
+    ModBus_Master_loop(&modBus_master_test); // Тайм-аут устройства 2, отправка команды устройству 1
+    assert(g_unitFailed == 2);
+    t += 1;
+    ModBus_Slave_loop(&modBus_slave_test);
+    t += 5;
+    ModBus_Slave_loop(&modBus_slave_test);
+    ModBus_Master_loop(&modBus_master_test);
+    assert(g_unitRead == 1 && modBus_master_test.m_sendFramesN == 0);
+    ModBus_skipUnitOnTimeout(&modBus_master_test, 0);
+
+    // Тест адаптивного тайм-аута: время ответа устройства 1 измеряется, неотвечающее устройство 2 после повтора пропускается
+    {
+        static ModBus_UnitTiming_T timing[2];
+        const ModBus_UnitTiming_T* unit1;
+        uint32_t sent;
+        ModBus_setAdaptiveTimeout(&modBus_master_test, timing, 2, 1000, 0);
+        ModBus_setRetries(&modBus_master_test, 1);
+        ModBus_setUnitOffline(&modBus_master_test, 1, 50000);
+        g_unitFailed = g_unitRead = 0;
+        ModBus_getUnitRegister(&modBus_master_test, 0x01, 0, 1, unit_countReg);
+        ModBus_Master_loop(&modBus_master_test);
+        t += 1;
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+        unit1 = ModBus_getUnitTiming(&modBus_master_test, 0x01);
+        assert(g_unitRead == 1 && unit1 != NULL && unit1->samples == 1 && unit1->failures == 0);
+
+        ModBus_getUnitRegister(&modBus_master_test, 0x02, 0, 1, unit_countReg);
+        ModBus_Master_loop(&modBus_master_test);
+        sent = g_masterSent;
+        t += 10;
+        ModBus_Master_loop(&modBus_master_test); // Тайм-аут, повтор
+        assert(g_masterSent == sent + 1 && g_unitFailed == 0);
+        t += 10;
+        ModBus_Master_loop(&modBus_master_test); // Тайм-аут повтора, устройство 2 пропускается 50 мс
+        assert(g_unitFailed == 1 && ModBus_getUnitTiming(&modBus_master_test, 0x02)->failures == 1);
+        ModBus_getUnitRegister(&modBus_master_test, 0x02, 0, 1, unit_countReg);
+        ModBus_Master_loop(&modBus_master_test);
+        assert(g_unitFailed == 2 && ModBus_getStatus(&modBus_master_test) == MODBUS_STATUS_UNIT_OFFLINE && g_masterSent == sent + 1);
+        assert(modBus_master_test.m_sendFramesN == 0);
+        ModBus_Slave_loop(&modBus_slave_test); // Запросы устройству 2 отбрасываются Slave
+
+        ModBus_setAdaptiveTimeout(&modBus_master_test, NULL, 0, 0, 0);
+        ModBus_setRetries(&modBus_master_test, 0);
+        ModBus_setUnitOffline(&modBus_master_test, 0, 0);
+    }
+
+    // Тест объединения команд чтения: три команды выполняются одним запросом
+    ModBus_setReadCoalescing(&modBus_master_test, 1, 1);
+    g_unitRead = 0;
+    g_masterSent = 0;
+    ModBus_getRegister(&modBus_master_test, 0, 2, unit_checkReg0);
+    ModBus_getRegister(&modBus_master_test, 3, 1, unit_checkReg3);
+    ModBus_getRegister(&modBus_master_test, 1, 2, unit_checkReg1);
+    ModBus_Master_loop(&modBus_master_test);
+    t += 10;
+    ModBus_Slave_loop(&modBus_slave_test);
+    ModBus_Master_loop(&modBus_master_test);
+    assert(g_masterSent == 1 && g_unitRead == 3);
+    ModBus_Master_loop(&modBus_master_test);
+    assert(modBus_master_test.m_sendFramesN == 0);
+
+    // Повтор объединенного запроса после тайм-аута: новая команда присоединяется, ранее присоединенные остаются в диапазоне
+    ModBus_setRetries(&modBus_master_test, 1);
+    g_unitRead = 0;
+    g_masterSent = 0;
+    modBus_master_test.m_SendHandler = OutputData_drop; // Первый запрос не доходит до Slave
+    ModBus_getRegister(&modBus_master_test, 3, 1, unit_checkReg3);
+    ModBus_getRegister(&modBus_master_test, 1, 2, unit_checkReg1);
+    ModBus_Master_loop(&modBus_master_test);
+    modBus_master_test.m_SendHandler = OutputData_master;
+    ModBus_getRegister(&modBus_master_test, 4, 1, unit_checkReg4);
+    t += 10;
+    ModBus_Master_loop(&modBus_master_test); // Тайм-аут, повтор с диапазоном 1..4
+    assert(frontFrame(&modBus_master_test)->spanAddress == 1 && frontFrame(&modBus_master_test)->spanCount == 4);
+    t += 1;
+    ModBus_Slave_loop(&modBus_slave_test);
+    ModBus_Master_loop(&modBus_master_test);
+    assert(g_masterSent == 1 && g_unitRead == 3);
+    ModBus_Master_loop(&modBus_master_test);
+    assert(modBus_master_test.m_sendFramesN == 0);
+    ModBus_setRetries(&modBus_master_test, 0);
+    ModBus_setReadCoalescing(&modBus_master_test, 0, 0);
+
+    // Тест кэша регистров: повторное чтение без обмена, запись обновляет кэш, запись в очереди и время жизни отправляют чтение устройству
+    {
+        static ModBus_CacheEntry_T cache[16];
+        static const ModBus_CacheRange_T ranges[] = { { 0x01, 0, 8, 50000 } };
+        static const ModBus_CacheRange_T wide[] = { { 0x01, 0, 64, 1000000 } };
+        uint32_t hits = modBus_master_test.m_stats.cacheHits;
+        assert(ModBus_attachCache(&modBus_master_test, cache, 12, ranges, 1) == 0);
+        assert(ModBus_attachCache(&modBus_master_test, cache, 16, ranges, 1) == 1);
+        g_unitRead = 0;
+        g_masterSent = 0;
+        ModBus_getRegister(&modBus_master_test, 0, 2, unit_checkReg0);
+        ModBus_Master_loop(&modBus_master_test);
+        t += 10;
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+        assert(g_masterSent == 1 && g_unitRead == 1);
+        assert(ModBus_getRegister(&modBus_master_test, 0, 2, unit_checkReg0) != 0);
+        assert(g_unitRead == 2 && modBus_master_test.m_sendFramesN == 0); // Ответ из кэша до возврата
+
+        ModBus_setRegister(&modBus_master_test, 1, 0x4242, NULL);
+        ModBus_Master_loop(&modBus_master_test);
+        t += 10;
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+        ModBus_getRegister(&modBus_master_test, 0, 2, unit_checkReg0); // Значение записи уже в кэше
+        assert(g_registerData[1] == 0x4242 && g_unitRead == 3 && g_masterSent == 2);
+
+        ModBus_setRegister(&modBus_master_test, 0, 0x1717, NULL);
+        ModBus_getRegister(&modBus_master_test, 0, 2, unit_checkReg0); // Запись в очереди: чтение идет устройству после нее
+        assert(g_unitRead == 3);
+        for (int i = 0; i < 2; i++)
+        {
+            ModBus_Master_loop(&modBus_master_test);
+            t += 10;
+            ModBus_Slave_loop(&modBus_slave_test);
+            ModBus_Master_loop(&modBus_master_test);
+        }
+        assert(g_unitRead == 4 && g_masterSent == 4 && modBus_master_test.m_sendFramesN == 0);
+        t += 100; // Время жизни 50 мс истекло
+        ModBus_getRegister(&modBus_master_test, 0, 2, unit_checkReg0);
+        assert(g_unitRead == 4 && modBus_master_test.m_sendFramesN == 1);
+        ModBus_Master_loop(&modBus_master_test);
+        t += 10;
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+        assert(g_unitRead == 5 && modBus_master_test.m_stats.cacheHits == hits + 2);
+
+        // Удаление со сдвигом: после удаления части записей остальные находятся, удаленные - нет
+        ModBus_attachCache(&modBus_master_test, cache, 16, wide, 1);
+        for (uint16_t i = 0; i < 14; i++)
+        {
+            ModBus_cacheStore(&modBus_master_test, 0x01, i, i, 0);
+        }
+        for (uint16_t i = 1; i < 14; i += 2)
+        {
+            ModBus_invalidateCache(&modBus_master_test, 0x01, i, 1);
+        }
+        for (uint16_t i = 0; i < 14; i++)
+        {
+            ModBus_CacheEntry_T* entry = ModBus_cacheFind(&modBus_master_test, 0x01, i);
+            assert(i % 2 ? entry == NULL : entry != NULL && entry->value == i);
+        }
+        ModBus_attachCache(&modBus_master_test, NULL, 0, NULL, 0);
+    }
+
+    // Тест подготовленных запросов: кадр чтения отправляется повторно без кодирования, FC16 получает CRC по заголовку и данным
+    {
+        static ModBus_Prepared_T read, write;
+        uint16_t data[] = { 0x1111, 0x2222, 0x3333 };
+        assert(ModBus_prepareRead(&modBus_master_test, &read, 0x01, READ_REGISTER, 0, modBus_master_test.m_registerAcessLimit + 1) == 0);
+        assert(ModBus_submitRead(&modBus_master_test, &read, unit_checkRegEx, (void*)0) == 0);
+        assert(ModBus_prepareRead(&modBus_master_test, &read, 0x01, READ_REGISTER, 1, 2) == 1);
+        assert(ModBus_prepareWrite(&modBus_master_test, &write, 0x01, 2, 3) == 1);
+        assert(ModBus_submitRead(&modBus_master_test, &write, unit_checkRegEx, (void*)1) == 0);
+        g_unitRead = 0;
+        for (int i = 0; i < 2; i++)
+        {
+            ModBus_submitWrite(&modBus_master_test, &write, data, NULL);
+            assert(ModBus_CRC16(frontFrame(&modBus_master_test)->data, frontFrame(&modBus_master_test)->size) == MODBUS_CRC16_RESIDUE);
+            ModBus_submitRead(&modBus_master_test, &read, unit_checkRegEx, (void*)1);
+            for (int j = 0; j < 2; j++)
+            {
+                ModBus_Master_loop(&modBus_master_test);
+                t += 10;
+                ModBus_Slave_loop(&modBus_slave_test);
+                ModBus_Master_loop(&modBus_master_test);
+            }
+            assert(g_registerData[2] == data[0] && g_registerData[4] == data[2]);
+            data[0]++;
+            data[2]--;
+        }
+        assert(g_unitRead == 2 && modBus_master_test.m_sendFramesN == 0);
+    }
+
+    // Тест подписки: первое чтение передает все регистры, затем только изменившиеся больше зоны нечувствительности
+    {
+        static uint16_t snapshot[8];
+        static uint8_t seen[1];
+        static const uint16_t deadband[5] = { 0, 0, 0, 10, 0 };
+        static ModBus_Subscription_T sub;
+        static uint16_t a[300], b[300], changed[300], expected[300];
+        sub.unit = 0x01;
+        sub.type = READ_REGISTER;
+        sub.address = 0;
+        sub.count = 5;
+        sub.snapshot = snapshot;
+        sub.seen = seen;
+        sub.deadband = deadband;
+        sub.signedValues = 1;
+        sub.handler = unit_subscription;
+        assert(ModBus_attachSubscriptions(&modBus_master_test, &sub, 1) == 1);
+        g_notified = 0;
+        for (int step = 0; step < 6; step++)
+        {
+            static const uint16_t addresses[6] = { 0, 0, 0, 0, 2, 4 };
+            static const uint16_t counts[6] = { 5, 5, 5, 5, 2, 1 };
+            static const uint16_t notified[6] = { 1, 1, 2, 3, 4, 4 }; // Шаг 1 - без изменений, шаг 5 - регистр 4 в зоне 0, но не изменился
+            if (step == 2)
+            {
+                g_registerData[1]++;
+                g_registerData[3] -= 6; // В зоне нечувствительности
+            }
+            if (step == 3)
+                g_registerData[3] -= 5; // Накопленное отличие 11
+            if (step == 4)
+                g_registerData[2] ^= 0x8000;
+            ModBus_getRegister(&modBus_master_test, addresses[step], counts[step], NULL);
+            ModBus_Master_loop(&modBus_master_test);
+            t += 10;
+            ModBus_Slave_loop(&modBus_slave_test);
+            ModBus_Master_loop(&modBus_master_test);
+            assert(g_notified == notified[step]);
+            assert(step != 0 || g_changedN == 5);
+            assert(step != 2 || (g_changedN == 1 && g_changed[0] == 1));
+            assert(step != 3 || (g_changedN == 1 && g_changed[0] == 3));
+            assert(step != 4 || (g_changedN == 1 && g_changed[0] == 2));
+        }
+
+        // Подписка больше одного чтения: после опроса обеих частей изменений нет
+        sub.count = 8;
+        sub.deadband = NULL;
+        assert(ModBus_attachSubscriptions(&modBus_master_test, &sub, 1) == 1);
+        g_notified = 0;
+        for (int step = 0; step < 4; step++)
+        {
+            ModBus_getRegister(&modBus_master_test, step % 2 ? 5 : 0, step % 2 ? 3 : 5, NULL);
+            ModBus_Master_loop(&modBus_master_test);
+            t += 10;
+            ModBus_Slave_loop(&modBus_slave_test);
+            ModBus_Master_loop(&modBus_master_test);
+            assert(g_notified == (step < 2 ? step + 1 : 2));
+        }
+        assert(sub.seenN == 8 && g_changedN == 3 && g_changed[0] == 5);
+        ModBus_attachSubscriptions(&modBus_master_test, NULL, 0);
+        sub.count = 0;
+        assert(ModBus_attachSubscriptions(&modBus_master_test, &sub, 1) == 0 && modBus_master_test.m_subscriptions == NULL);
+
+        // SIMD и без SIMD находят одни и те же регистры на всех длинах и позициях
+        for (size_t n = 0; n < 300; n += 7)
+        {
+            size_t expectedN = 0;
+            for (size_t i = 0; i < n; i++)
+            {
+                a[i] = b[i] = (uint16_t)(i * 40503u);
+                if ((i * 7 + n) % 11 == 0)
+                {
+                    b[i] ^= (uint16_t)(1u << (i % 16));
+                    expected[expectedN++] = (uint16_t)i;
+                }
+            }
+            assert(ModBus_diffRegisters(a, b, n, changed) == expectedN && memcmp(changed, expected, expectedN * sizeof(uint16_t)) == 0);
+            assert(ModBus_diffScalar(a, b, 0, n, changed) == expectedN && memcmp(changed, expected, expectedN * sizeof(uint16_t)) == 0);
+        }
+    }
+
+    // Количество регистров в команде ограничено register_access_limit экземпляра
+    assert(ModBus_getRegister(&modBus_master_test, 0, modBus_master_test.m_registerAcessLimit + 1, NULL) == 0);
+    assert(ModBus_getRegister(&modBus_master_test, 0, 0, NULL) == 0);
+    assert(ModBus_setRegisters(&modBus_master_test, 0, g_registerData, modBus_master_test.m_registerAcessLimit + 1, NULL) == 0);
+    assert(modBus_master_test.m_sendFramesN == 0);
+
+    // Тест банка регистров: запись FC16/FC06 попадает прямо в память банка, чтение внутри банка не вызывает getReg
+    static uint8_t bankMemory[2 * 8];
+    ModBus_RegisterBank_T bank = { 0 };
+    uint16_t bankValues[3] = { 0x1111, 0x2222, 0x3333 };
+    bank.holding = bankMemory;
+    bank.holdingStart = 10;
+    bank.holdingCount = 8;
+    bank.hook = unit_bankHook;
+    ModBus_attachRegisterBank(&modBus_slave_test, &bank);
+    g_bankHooks = 0;
+    ModBus_setRegisters(&modBus_master_test, 12, bankValues, 3, NULL);
+    ModBus_setRegister(&modBus_master_test, 17, 0xBEEF, NULL);
+    g_registerData[14] = 0x1111; // Значения, которые вернет чтение
+    g_registerData[15] = 0x2222;
+    g_registerData[16] = 0x3333;
+    ModBus_getRegister(&modBus_master_test, 12, 3, unit_checkReg14);
+    for (int i = 0; i < 3; i++)
+    {
+        ModBus_Master_loop(&modBus_master_test);
+        t += 10;
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+    }
+    assert(modBus_master_test.m_sendFramesN == 0 && g_bankHooks == 3);
+    assert(ModBus_bankRead(bankMemory, 2) == 0x1111 && ModBus_bankRead(bankMemory, 4) == 0x3333);
+    assert(ModBus_bankRead(bankMemory, 7) == 0xBEEF);
+    ModBus_attachRegisterBank(&modBus_slave_test, NULL);
+
+    // Тест нескольких адресов Slave: устройство 1 - функции getReg/setReg, устройство 5 - банк с задержкой ответа 3 мс,
+    // запрос к отсутствующему устройству 9 не принимается, функции экземпляра восстанавливаются после запроса
+    {
+        static uint8_t unitMemory[4] = { 0x01, 0x02, 0x03, 0x04 };
+        static ModBus_RegisterBank_T unitBank = { .holding = unitMemory, .holdingStart = 0, .holdingCount = 2 };
+        static ModBus_SlaveUnit_T units[2] = {
+            { .address = 0x05, .delayUs = 3000, .bank = &unitBank },
+            { .address = 0x01, .GetRegisterHandler = getReg, .SetRegisterHandler = setReg },
+        };
+        static ModBus_SlaveUnits_T table;
+        static ModBus_SlaveUnit_T duplicate[2] = { { .address = 0x05 }, { .address = 0x05 } };
+        assert(ModBus_attachUnits(&modBus_slave_test, &table, duplicate, 2) == 0);
+        assert(ModBus_attachUnits(&modBus_slave_test, &table, units, 2) == 1);
+        ModBus_attachRegisterHandler(&modBus_slave_test, unit_failReg, unit_failReg);
+        g_unitRead = 0;
+        g_unitFailed = 0;
+        g_slaveSent = 0;
+        ModBus_getUnitRegister(&modBus_master_test, 0x05, 0, 2, unit_checkInput);
+        ModBus_getUnitRegister(&modBus_master_test, 0x01, 0, 2, unit_checkReg0);
+        ModBus_getUnitRegister(&modBus_master_test, 0x09, 0, 2, unit_countReg);
+        ModBus_Master_loop(&modBus_master_test);
+        ModBus_Slave_loop(&modBus_slave_test);
+        assert(g_slaveSent == 0 && ModBus_Slave_nextWakeup(&modBus_slave_test) == 3000); // Ответ устройства 5 задержан
+        t += 3;
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+        assert(g_slaveSent == 1 && g_unitRead == 1);
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+        assert(g_slaveSent == 2 && g_unitRead == 2);
+        ModBus_Slave_loop(&modBus_slave_test);
+        t += 10;
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+        assert(g_slaveSent == 2 && g_unitFailed == 1 && modBus_master_test.m_sendFramesN == 0);
+        assert(modBus_slave_test.m_GetRegisterHandler == unit_failReg && modBus_slave_test.m_bank == NULL);
+        ModBus_attachUnits(&modBus_slave_test, NULL, NULL, 0);
+        ModBus_attachRegisterHandler(&modBus_slave_test, getReg, setReg);
+    }
+
+    // Тайм-аут ответа считается в 64 битах: 125 регистров при 9600 бит/с - около 877 мс
+    assert(ModBus_responseTimeout(75, 9600, 5) > 540000u && ModBus_responseTimeout(125, 9600, 5) > 870000u);
+    assert(ModBus_responseTimeout(125, 1, 5) == UINT32_MAX);
+
+    // Паузы RTU: T3.5 по скорости до 19200 бит/с, выше - фиксированные 1750 мкс
+    assert(ModBus_T35(9600) == 4010 && ModBus_T15(9600) == 1718);
+    assert(ModBus_T35(115200) == 1750 && ModBus_T15(115200) == 750);
+    ModBus_setBitRate(&modBus_master_test, 115200);
+    assert(modBus_master_test.m_receiveTimeout == 1750);
+    ModBus_setTimeout(&modBus_master_test, 5, 5);
+
+    // Тест определения длины кадра: запрос и ответ обрабатываются сразу после последнего байта, без тишины на линии
+    g_unitRead = 0;
+    ModBus_getRegister(&modBus_master_test, 0, 2, unit_checkReg0);
+    ModBus_Master_loop(&modBus_master_test);
+    ModBus_Slave_loop(&modBus_slave_test);
+    ModBus_Master_loop(&modBus_master_test);
+    assert(g_unitRead == 1 && modBus_master_test.m_sendFramesN == 0);
+
+    // Ответ с исключением завершает команду сразу
+    {
+        uint8_t exception[5] = { 0x01, READ_REGISTER | MODBUS_EXCEPTION_FLAG, 0x02 };
+        uint16_t crc = ModBus_CRC16(exception, 3);
+        exception[3] = crc & 0xFF;
+        exception[4] = crc >> 8;
+        g_unitFailed = 0;
+        modBus_master_test.m_SendHandler = OutputData_drop; // Запрос не доходит до Slave
+        ModBus_getRegister(&modBus_master_test, 0, 1, unit_countReg);
+        ModBus_Master_loop(&modBus_master_test);
+        modBus_master_test.m_SendHandler = OutputData_master;
+        for (int i = 0; i < 5; i++)
+        {
+            ModBus_readbyteFromOuter(&modBus_master_test, exception[i]);
+        }
+        ModBus_Master_loop(&modBus_master_test);
+        assert(g_unitFailed == 1 && modBus_master_test.m_sendFramesN == 0);
+    }
+
+    // Ложное начало кадра (байт адреса в мусоре) пропускается, следующий кадр принимается без ожидания тишины
+    {
+        uint8_t request[10] = { 0x01, READ_REGISTER, 0x01, READ_REGISTER, 0x00, 0x00, 0x00, 0x02 };
+        uint16_t crc = ModBus_CRC16(request + 2, 6);
+        request[8] = crc & 0xFF;
+        request[9] = crc >> 8;
+        g_slaveSent = 0;
+        for (int i = 0; i < 10; i++)
+        {
+            ModBus_readbyteFromOuter(&modBus_slave_test, request[i]);
+        }
+        ModBus_Slave_loop(&modBus_slave_test);
+        assert(g_slaveSent == 1 && ModBus_receiveSpace(&modBus_slave_test) == MODBUS_RECEIVE_RING_SIZE - 1); // Кольцевой буфер освобожден
+        t += 10;
+        ModBus_Master_loop(&modBus_master_test); // Ответ без запроса отбрасывается
+    }
+
+    // Тест исключений: Slave отвечает кодом исключения, команда Master завершается без тайм-аута с соответствующим статусом
+#ifdef MODBUS_STATS
+    ModBus_resetStats(&modBus_master_test);
+    ModBus_resetStats(&modBus_slave_test);
+#endif
+    ModBus_attachRegisterHandler(&modBus_slave_test, unit_failReg, unit_failReg);
+    ModBus_getRegister(&modBus_master_test, 40, 1, unit_statusReg);
+    ModBus_Master_loop(&modBus_master_test);
+    ModBus_Slave_loop(&modBus_slave_test);
+    ModBus_Master_loop(&modBus_master_test);
+    assert(g_lastStatus == MODBUS_STATUS_DEVICE_FAILURE && modBus_master_test.m_sendFramesN == 0);
+    ModBus_getRegister(&modBus_master_test, 41, 1, unit_statusReg);
+    ModBus_Master_loop(&modBus_master_test);
+    ModBus_Slave_loop(&modBus_slave_test);
+    ModBus_Master_loop(&modBus_master_test);
+    assert(g_lastStatus == MODBUS_STATUS_ILLEGAL_ADDRESS && modBus_master_test.m_sendFramesN == 0);
+    ModBus_attachRegisterHandler(&modBus_slave_test, getReg, setReg);
+    ModBus_getRegister(&modBus_master_test, 0, 1, unit_statusReg);
+    ModBus_Master_loop(&modBus_master_test);
+    t += 100; // Slave не отвечает
+    ModBus_Master_loop(&modBus_master_test);
+    assert(g_lastStatus == MODBUS_STATUS_TIMEOUT);
+    ModBus_Slave_loop(&modBus_slave_test);
+    t += 10;
+    ModBus_Master_loop(&modBus_master_test);
+#ifdef MODBUS_STATS
+    {
+        ModBus_Stats_T stats;
+        ModBus_getStats(&modBus_master_test, &stats);
+        assert(stats.framesSent == 3 && stats.exceptionsReceived == 2 && stats.timeouts == 1);
+        assert(ModBus_statsPercentile(&stats, READ_REGISTER, 500) > 0 && ModBus_statsPercentile(&stats, WRITE_SINGLE_REGISTER, 500) == 0);
+        ModBus_getStats(&modBus_slave_test, &stats);
+        assert(stats.framesReceived == 3 && stats.exceptionsSent == 2 && stats.framesSent == 3); // Запрос после тайм-аута Master тоже обработан
+    }
+#endif
+
+    // Незнакомый код функции: ответ с исключением 01 после тишины на линии
+    {
+        uint8_t request[6] = { 0x01, 0x2B, 0x0E, 0x01 };
+        uint16_t crc = ModBus_CRC16(request, 4);
+        request[4] = crc & 0xFF;
+        request[5] = crc >> 8;
+        g_slaveSent = 0;
+        for (int i = 0; i < 6; i++)
+        {
+            ModBus_readbyteFromOuter(&modBus_slave_test, request[i]);
+        }
+        ModBus_Slave_loop(&modBus_slave_test);
+        assert(g_slaveSent == 0);
+        t += 10;
+        ModBus_Slave_loop(&modBus_slave_test);
+        assert(g_slaveSent == 1);
+        ModBus_Master_loop(&modBus_master_test);
+    }
+
+    // Тест кольцевого буфера приема: блок больше свободного места принимается частично, остаток учитывается как переполнение
+    {
+        static ModBus_parameter ring;
+        static uint8_t chunk[MODBUS_RECEIVE_RING_SIZE + 3];
+        ModBus_setup(&ring, modbusSetting);
+        assert(ModBus_receiveSpace(&ring) == MODBUS_RECEIVE_RING_SIZE - 1);
+        assert(ModBus_readbytesFromOuter(&ring, chunk, 10) == 10);
+        assert(ModBus_readbytesFromOuter(&ring, chunk, sizeof(chunk)) == MODBUS_RECEIVE_RING_SIZE - 11);
+        assert(ModBus_receiveSpace(&ring) == 0 && ModBus_receiveOverflows(&ring) == 14);
+        ModBus_Slave_loop(&ring); // Потребитель освобождает буфер, запись продолжается через конец кольца
+        assert(ModBus_receiveSpace(&ring) == MODBUS_RECEIVE_RING_SIZE - 1);
+        assert(ModBus_readbytesFromOuter(&ring, chunk, 20) == 20 && ModBus_receiveOverflows(&ring) == 14);
+
+        // Кадр FC16 через конец кольца: первый записываемый регистр разделен между сегментами
+        uint8_t request[13] = { 0x01, WRITE_MULTI_REGISTER, 0x00, 0x2A, 0x00, 0x02, 0x04, 0xBE, 0xEF, 0x12, 0x34 };
+        uint16_t crc = ModBus_CRC16(request, 11);
+        request[11] = crc & 0xFF;
+        request[12] = crc >> 8;
+        ModBus_dropReceived(&ring);
+        assert(ModBus_readbytesFromOuter(&ring, chunk, MODBUS_RECEIVE_RING_SIZE - 8 - 20) == MODBUS_RECEIVE_RING_SIZE - 28);
+        ModBus_dropReceived(&ring); // Начало следующего кадра за 8 байтов до конца кольца
+        ring.m_SendHandler = OutputData_drop;
+        ModBus_attachRegisterHandler(&ring, getReg, setReg);
+        ModBus_readbytesFromOuter(&ring, request, sizeof(request));
+        ModBus_Slave_loop(&ring);
+        assert(g_registerData[42] == 0xBEEF && g_registerData[43] == 0x1234);
+        assert(ModBus_receiveSpace(&ring) == MODBUS_RECEIVE_RING_SIZE - 1);
+    }
+
+    // Тест битов: FC15 и FC05 записывают биты Slave, FC01 читает их упакованными, FC02 без адреса получает исключение
+    {
+        uint8_t bits[2] = { 0x35, 0x0A }; // Биты 0, 2, 4, 5, 9, 11
+        ModBus_attachBitHandler(&modBus_slave_test, unit_getBits, unit_setBits);
+        g_bitsRead = 0;
+        g_address = 0;
+        g_count = 12;
+        ModBus_setUnitCoils(&modBus_master_test, 0x01, 0, bits, 12, master_printSetReg);
+        for (int i = 0; i < 3; i++)
+        {
+            ModBus_Master_loop(&modBus_master_test);
+            ModBus_Slave_loop(&modBus_slave_test);
+            ModBus_Master_loop(&modBus_master_test);
+            if (i == 0)
+            {
+                assert(g_coils[0] == 0x35 && g_coils[1] == 0x0A);
+                g_address = 3;
+                g_count = 1;
+                ModBus_setUnitCoil(&modBus_master_test, 0x01, 3, 1, master_printSetReg);
+            }
+            else if (i == 1)
+            {
+                assert(g_coils[0] == 0x3D);
+                ModBus_getUnitCoils(&modBus_master_test, 0x01, 0, 12, unit_checkBits);
+            }
+        }
+        assert(g_bitsRead == 1 && modBus_master_test.m_sendFramesN == 0);
+        g_lastStatus = MODBUS_STATUS_OK;
+        ModBus_getUnitDiscreteInputs(&modBus_master_test, 0x01, 0, 8, NULL);
+        ModBus_Master_loop(&modBus_master_test);
+        ModBus_Slave_loop(&modBus_slave_test);
+        ModBus_Master_loop(&modBus_master_test);
+        assert(ModBus_getStatus(&modBus_master_test) == MODBUS_STATUS_ILLEGAL_ADDRESS && modBus_master_test.m_sendFramesN == 0);
+        assert(ModBus_getUnitCoils(&modBus_master_test, 0x01, 0, 16 * modBus_master_test.m_registerAcessLimit + 1, NULL) == 0);
+    }
+
+    // Тест FC04 из области input банка и FC23: запись выполняется до чтения, ответ содержит новые значения
+    {
+        static uint8_t inputMemory[4] = { 0x01, 0x02, 0x03, 0x04 };
+        ModBus_RegisterBank_T inputBank = { 0 };
+        uint16_t setpoint = 0x0077;
+        inputBank.input = inputMemory;
+        inputBank.inputStart = 100;
+        inputBank.inputCount = 2;
+        ModBus_attachRegisterBank(&modBus_slave_test, &inputBank);
+        g_unitRead = 0;
+        ModBus_getUnitInputRegister(&modBus_master_test, 0x01, 100, 2, unit_checkInput);
+        ModBus_readWriteUnitRegisters(&modBus_master_test, 0x01, 5, 2, 6, &setpoint, 1, unit_checkReg5);
+        for (int i = 0; i < 2; i++)
+        {
+            ModBus_Master_loop(&modBus_master_test);
+            ModBus_Slave_loop(&modBus_slave_test);
+            ModBus_Master_loop(&modBus_master_test);
+        }
+        assert(g_unitRead == 2 && g_registerData[6] == 0x0077 && modBus_master_test.m_sendFramesN == 0);
+        ModBus_attachRegisterBank(&modBus_slave_test, NULL);
+    }
+
+    // Тест переполнения millis(): перенос учитывается один раз, значение, прочитанное до переполнения, не сдвигается
+    {
+        uint32_t saved = t;
+        uint64_t before, after;
+        t = 0xFFFFFFF0u;
+        before = ModBus_now();
+        t = 5;
+        after = ModBus_now();
+        assert(after - before == 21000u);
+        t = 0xFFFFFFFFu; // Устаревшая выборка другого контекста
+        assert(ModBus_now() == after - 6000u);
+        t = 5;
+        assert(ModBus_now() == after);
+        t = saved;
+    }
 }
 
 #endif // _UNIT_TEST
@@ -8,6 +8,7 @@
 **** 1.Master
 ****** Вызов конфигурации ModBus_setup
 ****** Вызовите ModBus_readbyteFromOuter в функции прерывания приема последовательного порта
+****** (или ModBus_readbytesFromOuter для блоков DMA и read())
 ****** Циклический вызов ModBus_Master_loop
 ****** Вызовите ModBus_getRegister для считывания значения регистров целевого устройства
 ****** Вызовите ModBus_setRegister для записи одного регистра целевого устройства
@@ -26,6 +27,9 @@
 #define _UNIT_TEST
 //#define DEBUG
 //#define _DELAY_DEBUG
+//#define _BENCHMARK
+//#define MODBUS_STATS // Счетчики и гистограммы времени ответа каждого экземпляра (ModBus_getStats); без него код статистики не компилируется
+//#define MODBUS_TRACE // Двоичная трасса принятых и отправленных кадров (modbus_trace.h)
 #include <stdarg.h>
 //#include "../printf.h"
 
@@ -40,6 +44,14 @@
 #define MODBUS_SLAVE
 #endif // !MODBUS_SLAVE
 
+#ifndef MODBUS_STATS
+#define MODBUS_STATS
+#endif // !MODBUS_STATS
+
+#ifndef MODBUS_TRACE
+#define MODBUS_TRACE
+#endif // !MODBUS_TRACE
+
 #endif // _UNIT_TEST
 
 #ifdef DEBUG
@@ -54,83 +66,380 @@
 #define MODBUS_DELAY_DEBUG(...) {} 
 #endif // DEBUG
 
-#define MODBUS_REGISTER_LIMIT 50 // Максимальное количество регистров чтения и записи одновременно
+#define MODBUS_MAX_READ_REGISTERS 125 // Ограничение спецификации для чтения регистров (FC03)
+#define MODBUS_MAX_WRITE_REGISTERS 123 // Ограничение спецификации для записи нескольких регистров (FC16)
+#define MODBUS_MAX_READ_WRITE_REGISTERS 121 // Ограничение спецификации для записываемой части FC23
+#define MODBUS_MAX_READ_BITS 2000 // Ограничение спецификации для чтения битов (FC01/FC02)
+#define MODBUS_MAX_WRITE_BITS 1968 // Ограничение спецификации для записи нескольких битов (FC15)
+#define MODBUS_MAX_UNIT 247 // Наибольший адрес отдельного устройства в сети RTU
+#ifndef MODBUS_REGISTER_LIMIT
+#define MODBUS_REGISTER_LIMIT 50 // Максимальное количество регистров чтения и записи одновременно, определяет размер буферов каждого экземпляра (до MODBUS_MAX_READ_REGISTERS)
+#endif
+#if MODBUS_REGISTER_LIMIT > MODBUS_MAX_READ_REGISTERS
+#error "MODBUS_REGISTER_LIMIT exceeds the protocol maximum of 125 registers"
+#endif
 #define MODBUS_BUFFER_SIZE ((MODBUS_REGISTER_LIMIT)* 2 + 20) // Максимальная длина пакета данных (длина пакета данных для записи нескольких регистров)
-#define MODBUS_WAITFRAME_N 3  // Максимальное количество кэшей команд
+#define MODBUS_WAITFRAME_N 3  // Количество кэшей команд по умолчанию, большую очередь можно задать через ModBus_setFrameQueue
 #define MODBUS_DEFAULT_BAUD 9600 // Скорость передачи и приема данных по умолчанию, 9600 Бит/с
+#ifndef MODBUS_RECEIVE_RING_SIZE
+#define MODBUS_RECEIVE_RING_SIZE ((MODBUS_BUFFER_SIZE) * 2) // Размер кольцевого буфера приема, кадры разбираются прямо в нем; одна позиция всегда свободна
+#endif
 
 #include <assert.h>
 #include <stdint.h>
 #include <string.h>
+#ifdef __cplusplus // Заголовок подключается и из C++ (modbus_frames.hpp)
+#include <atomic>
+#define MODBUS_ATOMIC(T) std::atomic<T>
+// Поля кольца приема должны совпадать по размещению с C-версией структуры
+static_assert(sizeof(std::atomic<size_t>) == sizeof(size_t) && alignof(std::atomic<size_t>) == alignof(size_t)
+    && sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && alignof(std::atomic<uint32_t>) == alignof(uint32_t), "std::atomic layout");
+extern "C" {
+#else
+#include <stdatomic.h>
+#define MODBUS_ATOMIC(T) _Atomic(T)
+#endif
 
 // TODO: функция для получения системного времени в миллисекундах.
+// Используется источником времени по умолчанию, если ModBus_setClock не вызывалась
 uint32_t millis();
 
+#define MODBUS_TIME_NEVER UINT64_MAX // Событие не ожидается
+#define MODBUS_FIXED_TIMING_BAUD 19200 // Выше этой скорости спецификация задает фиксированные T1.5 и T3.5
+
+// Паузы RTU в микросекундах (символ - 11 бит): T1.5 - максимальный интервал между символами кадра
+// (для настройки аппаратного тайм-аута приема UART), T3.5 - минимальная тишина между кадрами.
+// Выше 19200 бит/с - фиксированные 750 и 1750 мкс
+static inline uint32_t ModBus_T15(uint32_t baud)
+{
+    return baud > MODBUS_FIXED_TIMING_BAUD ? 750u : 16500000u / baud;
+}
+
+static inline uint32_t ModBus_T35(uint32_t baud)
+{
+    return baud > MODBUS_FIXED_TIMING_BAUD ? 1750u : 38500000u / baud;
+}
+
+
+#define MODBUS_EXCEPTION_FLAG 0x80 // Старший бит кода функции в ответе с исключением
 
 typedef enum {
+    READ_COILS = 0x01,
+    READ_DISCRETE_INPUTS = 0x02,
     READ_REGISTER = 0x03,
+    READ_INPUT_REGISTER = 0x04,
+    WRITE_SINGLE_COIL = 0x05,
     WRITE_SINGLE_REGISTER = 0x06,
+    WRITE_MULTI_COIL = 0x0F,
     WRITE_MULTI_REGISTER = 0x10,
+    READ_WRITE_REGISTERS = 0x17,
 } MODBUS_FUNCTION_TYPE;
 
+#define MODBUS_COIL_ON 0xFF00 // Значение FC05 для включения бита, 0x0000 - выключение
+
+typedef enum { // Результат команды Master, доступен в функции обратного вызова через ModBus_getStatus
+    MODBUS_STATUS_OK = 0x00,
+    MODBUS_STATUS_ILLEGAL_FUNCTION = 0x01, // Исключение 01: код функции не поддерживается устройством
+    MODBUS_STATUS_ILLEGAL_ADDRESS = 0x02, // Исключение 02: недопустимый адрес регистра
+    MODBUS_STATUS_ILLEGAL_VALUE = 0x03, // Исключение 03: недопустимое значение (количество регистров, длина данных)
+    MODBUS_STATUS_DEVICE_FAILURE = 0x04, // Исключение 04: ошибка устройства при выполнении
+    MODBUS_STATUS_UNIT_OFFLINE = 0xFE, // Команда не отправлена: устройство временно пропускается после серии тайм-аутов (ModBus_setUnitOffline)
+    MODBUS_STATUS_TIMEOUT = 0xFF, // Ответ не получен
+} MODBUS_STATUS_TYPE; // Другие коды исключений (05, 06, 0A, 0B) передаются без изменений
+
+#define MODBUS_HANDLER_FAILURE ((size_t)-1) // Значение функций чтения/записи регистров Slave при ошибке устройства (исключение 04)
+
+typedef enum {
+    MODBUS_MODE_RTU = 0, // Кадр RTU: адрес устройства, PDU, CRC. Один запрос в ожидании ответа
+    MODBUS_MODE_TCP = 1, // Кадр Modbus TCP: заголовок MBAP, PDU. Несколько запросов в ожидании ответа, ответы сопоставляются по идентификатору транзакции
+} MODBUS_MODE_TYPE;
+
+#define MODBUS_MBAP_SIZE 7 // Длина заголовка MBAP: идентификатор транзакции (2), идентификатор протокола (2), длина (2), адрес устройства (1)
+
+typedef enum {
+    MODBUS_FRAME_PENDING = 0, // Команда ожидает отправки
+    MODBUS_FRAME_SENT, // Команда отправлена, ожидается ответ
+    MODBUS_FRAME_DONE, // Команда завершена (ответ получен или тайм-аут), ожидает удаления из очереди
+    MODBUS_FRAME_MERGED, // Команда чтения присоединена к другой команде (mergedTo) и будет завершена вместе с ней
+} MODBUS_FRAME_STATE;
+
 typedef struct _MODBUS_SETTING_T { // Тип для конфигурации экземпляра ModBus
     uint8_t address; // Адрес целевого устройства
     uint32_t baudRate; // Скорость передачи данных, например 9600 или 115200 и т.д.
-    uint8_t register_access_limit; // Максимальное количество регистров чтения/записи одновременно
+    uint8_t register_access_limit; // Максимальное количество регистров чтения/записи одновременно, 0 - MODBUS_REGISTER_LIMIT (запись не больше MODBUS_MAX_WRITE_REGISTERS)
     void(*sendHandler)(uint8_t*, size_t); // Функция, используемая для отправки данных, параметры функции: (uint8_t* data, size_t size), data - адрес массива данных, size - его размер
 } ModBus_Setting_T;
 
 typedef struct _MODBUS_FRAME_T {
     uint8_t index; // Номер команды
     uint8_t data[MODBUS_BUFFER_SIZE + 2]; // Данные, выделенные двумя дополнительными байтами для безопасности
-    uint8_t size; // Размер данных
+    uint16_t size; // Размер данных
     MODBUS_FUNCTION_TYPE type; // Тип команды
-    uint32_t time; // Время начала выполнения команды
+    uint64_t time; // Время начала выполнения команды, мкс
     void(*getResponseHandler)(uint16_t*, uint16_t);
+    void(*getResponseHandlerEx)(void*, uint16_t*, uint16_t); // Функция обратного вызова чтения с контекстом, имеет приоритет над getResponseHandler
+    void* context; // Контекст, передаваемый в getResponseHandlerEx
     void(*setResponseHandler)(uint16_t, uint16_t);
-    uint8_t responseSize; // Длина возвращаемого кадра
+    void(*getBitsResponseHandler)(const uint8_t*, uint16_t); // Функция обратного вызова чтения битов (FC01/FC02)
+    void(*pduResponseHandler)(void*, const uint8_t*, uint16_t); // Функция обратного вызова команды PDU (ModBus_sendUnitPdu), получает context
+    uint16_t responseSize; // Длина возвращаемого кадра
     uint16_t address; // Адрес регистра доступа
-    uint8_t count; // Количество регистров доступа
+    uint16_t count; // Количество регистров (битов) доступа
+    uint8_t unit; // Адрес устройства, которому отправлена команда
+    uint16_t transaction; // Идентификатор транзакции Modbus TCP
+    uint8_t state; // Состояние команды MODBUS_FRAME_STATE
+    uint64_t sentTime; // Время отправки команды, мкс
+    uint16_t spanAddress; // Первый регистр, запрошенный в кадре (с учетом присоединенных команд чтения)
+    uint16_t spanCount; // Количество регистров, запрошенных в кадре
+    uint16_t mergedTo; // Идентификатор транзакции команды, к которой присоединена эта
+    uint32_t timeout; // Тайм-аут ответа текущей попытки, мкс
+    uint8_t retries; // Количество выполненных повторов
 } MODBUS_FRAME_T;
 
-
+typedef struct _MODBUS_UNIT_TIMING_T { // Оценка времени ответа устройства (ModBus_setAdaptiveTimeout)
+    uint8_t unit; // Адрес устройства
+    uint8_t used; // Запись занята
+    uint8_t failures; // Команд подряд без ответа
+    uint16_t samples; // Количество измерений (до 65535)
+    uint32_t srtt; // Сглаженное время ответа без передачи по линии, мкс
+    uint32_t rttvar; // Сглаженное отклонение времени ответа, мкс
+    uint64_t offlineUntil; // Команды устройству не отправляются до этого момента, мкс
+} ModBus_UnitTiming_T;
+
+
+#define MODBUS_CACHE_PROBE 8 // Максимальное количество позиций, просматриваемых при поиске в кэше регистров
+
+typedef struct _MODBUS_CACHE_ENTRY_T { // Значение регистра хранения в кэше Master (ModBus_attachCache)
+    uint64_t expires; // Значение действительно до этого момента, мкс
+    uint16_t address;
+    uint16_t value;
+    uint8_t unit;
+    uint8_t used; // Позиция занята
+} ModBus_CacheEntry_T;
+
+typedef struct _MODBUS_CACHE_RANGE_T { // Диапазон кэшируемых регистров устройства
+    uint8_t unit;
+    uint16_t address; // Первый регистр
+    uint16_t count;
+    uint32_t ttl; // Время жизни значения, мкс
+} ModBus_CacheRange_T;
+
+typedef struct _MODBUS_SUBSCRIPTION_T { // Подписка на изменения диапазона регистров (ModBus_attachSubscriptions), память принадлежит приложению
+    uint8_t unit; // Адрес устройства
+    uint8_t type; // READ_REGISTER - регистры хранения (ответы FC03 и FC23), READ_INPUT_REGISTER - входные (FC04)
+    uint16_t address; // Первый регистр
+    uint16_t count; // Количество регистров
+    uint16_t* snapshot; // count значений: последние переданные в handler
+    uint8_t* seen; // (count + 7) / 8 байтов: биты регистров, уже полученных хотя бы раз (заполняется библиотекой)
+    const uint16_t* deadband; // count зон нечувствительности: изменение передается, если отличие от snapshot больше deadband[i]; NULL - любое изменение
+    uint8_t signedValues; // Отличие от snapshot считается для значений int16_t, 0 - uint16_t
+    void(*handler)(struct _MODBUS_SUBSCRIPTION_T*, const uint16_t*, uint16_t); // Функция обратного вызова (подписка, индексы от address, количество), новые значения в snapshot
+    void* context; // Данные приложения
+
+    uint32_t seenN; // Регистров, уже полученных хотя бы раз; пока меньше count, впервые прочитанные передаются без сравнения
+} ModBus_Subscription_T;
+
+typedef struct _MODBUS_PREPARED_T { // Подготовленный запрос (ModBus_prepareRead, ModBus_prepareWrite): кадр кодируется один раз
+    uint8_t data[MODBUS_BUFFER_SIZE]; // Кадр: RTU с CRC, TCP с заголовком MBAP (идентификатор транзакции подставляется при отправке)
+    uint16_t size; // Длина кадра, 0 - запрос не подготовлен
+    uint16_t responseSize; // Ожидаемая длина ответа
+    uint16_t headerCrc; // FC16 RTU: CRC части кадра до данных регистров, продолжается по данным при отправке
+    uint8_t headerSize; // FC16: длина части кадра до данных регистров
+    uint8_t mode; // MODBUS_MODE_TYPE, в котором закодирован кадр
+    uint8_t unit;
+    uint8_t type; // READ_REGISTER, READ_INPUT_REGISTER или WRITE_MULTI_REGISTER
+    uint16_t address;
+    uint16_t count;
+} ModBus_Prepared_T;
+
+
+typedef struct _MODBUS_REGISTER_BANK_T { // Банк регистров Slave в памяти, значения хранятся в порядке передачи (старший байт первым)
+    uint8_t* holding; // Регистры хранения (FC03/FC06/FC16), 2 байта на регистр
+    uint16_t holdingStart; // Адрес первого регистра хранения
+    uint16_t holdingCount; // Количество регистров хранения
+    uint8_t* input; // Входные регистры (FC04), 2 байта на регистр, NULL - нет
+    uint16_t inputStart; // Адрес первого входного регистра
+    uint16_t inputCount; // Количество входных регистров
+    void(*hook)(void*, uint8_t, uint16_t, uint16_t); // Необязательная функция (context, код функции, адрес, количество): вызывается перед чтением и после записи банка, запись FC23 - с кодом FC16
+    void* context; // Контекст, передаваемый в hook
+} ModBus_RegisterBank_T;
+
+typedef struct _MODBUS_SLAVE_UNIT_T { // Устройство Slave с несколькими адресами (ModBus_attachUnits)
+    uint8_t address; // Адрес устройства 1-247
+    uint32_t delayUs; // Имитация времени ответа, мкс; 0 - ответ сразу
+    ModBus_RegisterBank_T* bank; // Банк регистров устройства, NULL - нет
+    size_t(*GetRegisterHandler)(uint16_t, uint16_t, uint16_t*); // Функции устройства, как у ModBus_attachRegisterHandler и т. д., NULL - нет
+    size_t(*SetRegisterHandler)(uint16_t, uint16_t, uint16_t*);
+    size_t(*GetInputHandler)(uint16_t, uint16_t, uint16_t*);
+    size_t(*GetBitsHandler)(uint8_t, uint16_t, uint16_t, uint8_t*);
+    size_t(*SetBitsHandler)(uint16_t, uint16_t, const uint8_t*);
+} ModBus_SlaveUnit_T;
+
+typedef struct _MODBUS_SLAVE_UNITS_T { // Таблица устройств: поиск по адресу из кадра за O(1)
+    uint8_t index[256]; // Номер устройства в units + 1, 0 - адрес не обслуживается
+    ModBus_SlaveUnit_T* units;
+    size_t n;
+} ModBus_SlaveUnits_T;
+
+// Чтение и запись регистра банка в порядке передачи
+static inline uint16_t ModBus_bankRead(const uint8_t* bank, uint16_t index)
+{
+    return (uint16_t)((bank[2 * index] << 8) | bank[2 * index + 1]);
+}
+
+static inline void ModBus_bankWrite(uint8_t* bank, uint16_t index, uint16_t value)
+{
+    bank[2 * index] = (value >> 8) & 0x0FF;
+    bank[2 * index + 1] = value & 0x0FF;
+}
+
+// Бит index упакованного массива (младший бит первого байта - первый бит, как в кадре)
+static inline uint8_t ModBus_getBit(const uint8_t* bits, uint16_t index)
+{
+    return (bits[index >> 3] >> (index & 7)) & 1;
+}
+
+static inline void ModBus_setBit(uint8_t* bits, uint16_t index, uint8_t value)
+{
+    if (value)
+        bits[index >> 3] |= (uint8_t)(1 << (index & 7));
+    else
+        bits[index >> 3] &= (uint8_t)~(1 << (index & 7));
+}
+
+typedef struct _MODBUS_RING_VIEW_T { // Принятые байты в кольцевом буфере без копирования: до двух непрерывных частей (переход через конец буфера)
+    const uint8_t* first;
+    size_t firstLen;
+    const uint8_t* second; // Продолжение с начала буфера
+    size_t secondLen;
+} ModBus_RingView_T;
+
+// Байт index от начала области
+static inline uint8_t ModBus_viewByte(const ModBus_RingView_T* view, size_t index)
+{
+    return index < view->firstLen ? view->first[index] : view->second[index - view->firstLen];
+}
+
+// Слово в порядке передачи (старший байт первым), начиная с байта index
+static inline uint16_t ModBus_viewWord(const ModBus_RingView_T* view, size_t index)
+{
+    return (uint16_t)((ModBus_viewByte(view, index) << 8) | ModBus_viewByte(view, index + 1));
+}
+
+#ifdef MODBUS_STATS
+#ifndef MODBUS_STATS_BUCKETS
+#define MODBUS_STATS_BUCKETS 24 // Корзины гистограммы: 0 - меньше 1 мкс, i - [2^(i-1), 2^i) мкс, последняя - все большие (от 4 с)
+#endif
+#define MODBUS_STATS_FUNCTIONS 9 // Гистограммы для FC01-FC06, FC15, FC16, FC23, номер - ModBus_statsSlot
+
+typedef struct _MODBUS_STATS_T { // Статистика экземпляра, все счетчики с момента ModBus_setup или ModBus_resetStats
+    uint32_t framesSent; // Отправленных кадров
+    uint32_t framesReceived; // Принятых кадров (RTU - с верной CRC)
+    uint32_t crcErrors; // Кадров RTU с неверной CRC (включая ложные начала кадра при поиске адреса)
+    uint32_t timeouts; // Команд Master, завершенных по тайм-ауту (в том числе пропущенных из-за тайм-аута устройства)
+    uint32_t queueFull; // Команд Master, не поставленных в заполненную очередь
+    uint32_t evictions; // Неотправленных команд Master, вытесненных новыми в быстром режиме
+    uint32_t overflows; // Байтов, отброшенных при заполнении кольцевого буфера приема
+    uint32_t exceptionsReceived; // Ответов с исключением, принятых Master
+    uint32_t exceptionsSent; // Ответов с исключением, отправленных Slave
+    uint32_t retries; // Повторных отправок команд Master после тайм-аута
+    uint32_t offline; // Команд, завершенных без отправки, потому что устройство пропускается
+    uint32_t cacheHits; // Команд чтения, выполненных из кэша регистров без обмена
+    uint32_t cacheMisses; // Команд чтения, отправленных устройству при подключенном кэше
+    uint32_t rtt[MODBUS_STATS_FUNCTIONS][MODBUS_STATS_BUCKETS]; // Время от отправки команды до ответа по кодам функций
+} ModBus_Stats_T;
+
+#define MODBUS_STAT_INC(para, counter) ((para)->m_stats.counter++)
+#else
+#define MODBUS_STAT_INC(para, counter) ((void)0)
+#endif // MODBUS_STATS
 
 typedef struct __MODBUS_Parameter {
     uint8_t m_address; // Адрес Slave устройства
-    uint8_t m_receiveFrameBuffer[MODBUS_BUFFER_SIZE + 2]; // Получение пакетов, выделение двух дополнительных байтов для безопасности
-    size_t m_receiveFrameBufferLen;  // Количество принятых байтов данных
-
-    volatile uint8_t m_receiveBufferTmp[MODBUS_BUFFER_SIZE + 2]; // Временно хранящиеся данные приема, так как эта переменная изменяется функцией прерывания, поэтому используйте круговой доступ, чтобы избежать изменения этой переменной вне функции прерывания
-    volatile uint8_t* m_pBeginReceiveBufferTmp; // Начальное положение области циклического доступа
-    volatile uint8_t* m_pEndReceiveBufferTmp; // Следующая позиция в конце круговой зоны доступа
+    size_t m_receiveScanned; // Количество байтов от m_receiveTail, уже просмотренных разбором кадра
+
+    // Кольцевой буфер приема с одним производителем (прерывание или поток чтения) и одним потребителем (цикл экземпляра).
+    // Производитель изменяет только m_receiveHead, потребитель - только m_receiveTail; байты публикуются записью индекса с memory_order_release
+    uint8_t m_receiveBufferTmp[MODBUS_RECEIVE_RING_SIZE];
+    MODBUS_ATOMIC(size_t) m_receiveHead; // Позиция записи следующего байта
+    MODBUS_ATOMIC(size_t) m_receiveTail; // Позиция первого непрочитанного байта
+    MODBUS_ATOMIC(uint32_t) m_receiveOverflow; // Количество байтов, отброшенных из-за заполнения буфера
     uint8_t m_hasDetectedBufferStart;
 
     uint16_t m_registerData[MODBUS_REGISTER_LIMIT + 2]; // Данные регистров чтения кэша
     uint16_t m_registerCount;
     uint8_t m_registerAcessLimit;
 
-    volatile uint32_t m_lastReceivedTime; // Момент последнего получения байта данных
-    uint32_t m_lastSentTime; // Момент последней отправки данных
-    uint32_t m_receiveTimeout; // Установка таймаута ожидания приема следующего символа
-    uint32_t m_sendTimeout; // Установака тайм-аута для ожидания обратного кадра
+    MODBUS_ATOMIC(uint32_t) m_lastReceivedTime; // Младшие 32 бита ModBus_now() последнего приема, мкс (атомарно и на 32-битных контроллерах)
+    uint64_t m_lastSentTime; // Момент последней отправки данных, мкс
+    uint32_t m_receiveTimeout; // Тишина, завершающая кадр (T3.5), мкс
+    uint32_t m_sendTimeout; // Установака тайм-аута для ожидания обратного кадра, мкс
+    uint32_t m_charTime; // Время передачи одного символа (11 бит), мкс
 
     uint8_t m_faston; // Включение или выключение быстрого режима
 
     void(*m_SendHandler)(uint8_t*, size_t); // Функция отправки данных, используется для передачи данных на внешние устройства
+    void(*m_SendHandlerEx)(void*, uint8_t*, size_t); // Функция отправки данных с контекстом (сокет, порт), имеет приоритет над m_SendHandler
+    void* m_sendContext; // Контекст, передаваемый в m_SendHandlerEx
+
+    uint8_t m_mode; // Режим кадров MODBUS_MODE_TYPE
+
+#ifdef MODBUS_STATS
+    ModBus_Stats_T m_stats; // Изменяется только циклом экземпляра
+    uint32_t m_statsOverflowBase; // m_receiveOverflow на момент сброса статистики
+#endif
+#ifdef MODBUS_TRACE
+    struct _MODBUS_TRACE_T* m_trace; // Трасса кадров, NULL - не записывается
+#endif
 
 #ifdef MODBUS_MASTER // Master
-    MODBUS_FRAME_T m_sendFrames[MODBUS_WAITFRAME_N]; // Очередь отправки пакетов
+    MODBUS_FRAME_T m_sendFramesDefault[MODBUS_WAITFRAME_N]; // Память очереди по умолчанию
+    MODBUS_FRAME_T* m_sendFrames; // Кольцевая очередь отправки пакетов
+    size_t m_sendFramesSize; // Емкость очереди
+    size_t m_sendFramesHead; // Позиция первого (отправляемого) пакета в очереди
     size_t m_sendFramesN; // Длина очереди отправляемых пакетов
     uint8_t m_nextFrameIndex; // Порядковый номер следующего пакета
     uint8_t m_waitingResponse; // Ожидание ответного кадра
+    uint8_t m_window; // Modbus TCP: максимальное количество запросов в ожидании ответа
+    size_t m_sendFramesSent; // Modbus TCP: количество отправленных команд от начала очереди
+    size_t m_inFlight; // Modbus TCP: количество команд в ожидании ответа
+    uint16_t m_nextTransaction; // Modbus TCP: идентификатор следующей транзакции
+    uint8_t m_skipUnitOnTimeout; // При тайм-ауте завершать остальные команды этому устройству
+    uint8_t m_coalesce; // Объединять команды чтения соседних регистров
+    uint16_t m_coalesceGap; // Максимальный промежуток между объединяемыми диапазонами
+    uint8_t m_status; // Результат завершаемой команды MODBUS_STATUS_TYPE
+    ModBus_UnitTiming_T* m_unitTiming; // Оценки времени ответа устройств, NULL - тайм-аут m_sendTimeout для всех
+    size_t m_unitTimingN;
+    size_t m_unitTimingNext; // Следующая заменяемая запись, если свободных нет
+    uint32_t m_minTimeout; // Границы адаптивного тайм-аута, мкс
+    uint32_t m_maxTimeout;
+    uint8_t m_retries; // Повторов команды RTU после тайм-аута
+    uint8_t m_offlineAfter; // Тайм-аутов подряд, после которых устройство пропускается, 0 - не пропускать
+    uint32_t m_offlineTime; // Время первого пропуска, мкс; удваивается при каждом следующем тайм-ауте
+    ModBus_CacheEntry_T* m_cache; // Кэш регистров хранения (открытая адресация), NULL - отключен
+    size_t m_cacheMask; // Размер таблицы - 1
+    const ModBus_CacheRange_T* m_cacheRanges;
+    size_t m_cacheRangesN;
+    ModBus_Subscription_T* m_subscriptions; // Подписки на изменения, NULL - нет
+    size_t m_subscriptionsN;
 #endif // MODBUS_MASTER
 
 #ifdef MODBUS_SLAVE // Slave
     uint8_t m_sendFrameBuffer[MODBUS_BUFFER_SIZE];
-    uint8_t m_sendFrameBufferLen;
+    uint16_t m_sendFrameBufferLen;
+    uint16_t m_receiveTransaction; // Modbus TCP: идентификатор транзакции принятого запроса
+    uint8_t m_receiveUnit; // Адрес устройства для ответа на принятый запрос
 
     size_t(*m_GetRegisterHandler)(uint16_t, uint16_t, uint16_t*); // Функция чтения регистров, параметры функции (первый адрес регистра, количество регистров, считанные данные), возвращает количество успешных считываний
     size_t(*m_SetRegisterHandler)(uint16_t, uint16_t, uint16_t*); // Функция записи регистров, параметры функции (адрес регистра, количество записей, записанные данные), вернуть количество успешных установок
+    ModBus_RegisterBank_T* m_bank; // Банк регистров, запросы в его диапазоне обслуживаются без функций чтения и записи
+    size_t(*m_GetInputHandler)(uint16_t, uint16_t, uint16_t*); // Функция чтения входных регистров (FC04), параметры как у m_GetRegisterHandler
+    size_t(*m_GetBitsHandler)(uint8_t, uint16_t, uint16_t, uint8_t*); // Функция чтения битов (код функции FC01/FC02, первый адрес, количество, упакованные биты)
+    size_t(*m_SetBitsHandler)(uint16_t, uint16_t, const uint8_t*); // Функция записи битов FC05/FC15 (первый адрес, количество, упакованные биты)
+    ModBus_SlaveUnits_T* m_units; // Устройства по адресам, NULL - только m_address
+    uint32_t m_replyDelay; // Задержка ответа на обрабатываемый запрос, мкс
+    uint8_t m_replyPending; // Ответ в m_sendFrameBuffer ждет момента m_replyTime, прием следующих запросов приостановлен
+    uint64_t m_replyTime;
 #endif // MODBUS_SLAVE
 
 
@@ -139,6 +448,22 @@ typedef struct __MODBUS_Parameter {
 /************ Внешний интерфейс BEGIN ***********/
 void ModBus_setup(ModBus_parameter* ModBus_para, ModBus_Setting_T setting); // Конфигурирование экземпляров ModBus
 void ModBus_readbyteFromOuter(ModBus_parameter* ModBus_para, uint8_t receiveduint8_t); // Передача байтовых данных в протокол ModBus
+
+/** Передача блока принятых байтов **/
+/*** Параметры ***
+** data: Принятые байты (блок DMA, результат read())
+** size: Количество байтов
+** Возвращает количество принятых байтов; не поместившиеся в буфер отбрасываются и учитываются в ModBus_receiveOverflows.
+** Примечание: Время приема фиксируется один раз на блок. Может вызываться из прерывания или потока чтения одновременно
+** с циклом экземпляра в другом потоке, но только из одного производителя.
+***/
+size_t ModBus_readbytesFromOuter(ModBus_parameter* ModBus_para, const uint8_t* data, size_t size);
+
+// Свободное место в буфере приема, столько байтов можно передать без потерь (для выбора размера read())
+size_t ModBus_receiveSpace(ModBus_parameter* ModBus_para);
+
+// Количество байтов, отброшенных с момента ModBus_setup из-за заполнения буфера приема
+uint32_t ModBus_receiveOverflows(ModBus_parameter* ModBus_para);
 void ModBus_fastMode(ModBus_parameter* ModBus_para, uint8_t faston); // Следует ли включать режим быстрой команды, быстрый режим не кэширует инструкцию, выключение быстрого режима может гарантировать выполнение инструкции, но может возникнуть задержка
 
 /** Настройка скорости отправки и приема данных **/
@@ -150,34 +475,173 @@ void ModBus_setBitRate(ModBus_parameter* ModBus_para, uint32_t baud);
 
 /** Установка тайм-аута приема **/
 /*** Параметры ***
-** receiveTimeout: Время ожидания следующего байта при приеме, определяется скоростью последовательного порта
-** sendTimeout: Тайм-аут для ожидания обратного кадра после передачи, определяется скоростью последовательного порта
+** receiveTimeout: Время (мс) ожидания следующего байта при приеме, определяется скоростью последовательного порта
+** sendTimeout: Тайм-аут (мс) для ожидания обратного кадра после передачи, определяется скоростью последовательного порта
 ** Примечание: Можно не устанавливать, используйте тайм-аут по умолчанию (скорость передачи данных 9600 совместима, скорость передачи данных выше 9600 можно не устанавливать, ниже необходимо установить).
 ***/
 void ModBus_setTimeout(ModBus_parameter* ModBus_para, uint32_t receiveTimeout, uint32_t sendTimeout);
 
+// То же в микросекундах, для скоростей, на которых T3.5 меньше миллисекунды
+void ModBus_setTimeoutUs(ModBus_parameter* ModBus_para, uint32_t receiveTimeoutUs, uint32_t sendTimeoutUs);
+
+/** Источник времени **/
+/*** Параметры ***
+** clockUs: Функция, возвращающая монотонное время в микросекундах (64 бита, без переполнения), NULL - millis() * 1000
+** Примечание: Общий для всех экземпляров, задается до ModBus_setup. Точность часов определяет точность T3.5:
+** с millis() конец кадра на высоких скоростях определяется не раньше чем через 2 мс.
+***/
+void ModBus_setClock(uint64_t(*clockUs)());
+
+// Текущее время источника ModBus_setClock, мкс
+uint64_t ModBus_now();
+
+#ifdef _BENCHMARK
+uint64_t ModBus_benchNowNs(); // Реальное время для нагрузочных тестов, нс (не зависит от ModBus_setClock)
+int ModBus_benchCompareU32(const void* a, const void* b); // Сравнение uint32_t для qsort при расчете процентилей
+#endif
+
+/** Установка режима кадров **/
+/*** Параметры ***
+** mode: MODBUS_MODE_RTU (по умолчанию) или MODBUS_MODE_TCP
+** window: Для Modbus TCP - количество запросов, одновременно ожидающих ответа (не больше емкости очереди), 0 - по умолчанию 1
+** Примечание: В режиме TCP тайм-аут приема между байтами не используется, конец кадра определяется по длине в заголовке MBAP,
+** а быстрый режим не действует. Вызывается после ModBus_setup, пока очередь пуста.
+***/
+void ModBus_setMode(ModBus_parameter* ModBus_para, MODBUS_MODE_TYPE mode, uint8_t window);
+
+/** Привязка функции отправки с контекстом **/
+/*** Параметры ***
+** SendHandler: Функция отправки, входящие параметры(void* context, uint8_t* buff, size_t buffLen)
+** context: Указатель, передаваемый в функцию отправки (например, дескриптор сокета)
+***/
+void ModBus_attachSendHandler(ModBus_parameter* ModBus_para, void(*SendHandler)(void*, uint8_t*, size_t), void* context);
+
 
 #ifdef MODBUS_MASTER // ModBus Master
 // Функция Master-цикла
 void ModBus_Master_loop(ModBus_parameter* ModBus_para);
 
+/** Время до следующего события Master **/
+/*** Возвращает количество микросекунд до тайм-аута ответа или конца приема кадра, 0 - ModBus_Master_loop нужно вызвать сразу,
+** MODBUS_TIME_NEVER - событий не ожидается до приема байтов или постановки новой команды. Позволяет не вызывать цикл постоянно.
+***/
+uint64_t ModBus_Master_nextWakeup(ModBus_parameter* ModBus_para);
+
+/** Установка памяти очереди команд **/
+/*** Параметры ***
+** frames: Массив кадров, используемый как кольцевая очередь (должен существовать все время работы экземпляра)
+** size: Количество элементов массива
+** Примечание: Вызывается после ModBus_setup, пока очередь пуста. Без вызова используется встроенная очередь на MODBUS_WAITFRAME_N команд.
+** Когда очередь заполнена, новые команды не принимаются (функции возвращают 0), кроме быстрого режима, где заменяется последняя команда.
+** Возвращает 1 при успешной установке, 0 если очередь не пуста или параметры неверны.
+***/
+uint8_t ModBus_setFrameQueue(ModBus_parameter* ModBus_para, MODBUS_FRAME_T* frames, size_t size);
+
+/** Опрос нескольких устройств на одной шине **/
+/*** Параметры ***
+** on: 1 - если устройство не ответило, остальные команды ему в очереди сразу завершаются (обратный вызов с параметрами (0,0)),
+** чтобы неотвечающее устройство не задерживало опрос остальных. 0 - по умолчанию, каждая команда ждет свой тайм-аут.
+** Примечание: Адрес устройства задается для каждой команды функциями ModBus_getUnitRegister, ModBus_setUnitRegister, ModBus_setUnitRegisters.
+** Команды разным устройствам отправляются одна за другой сразу после получения ответа на предыдущую.
+***/
+void ModBus_skipUnitOnTimeout(ModBus_parameter* ModBus_para, uint8_t on);
+
+/** Адаптивный тайм-аут ответа для каждого устройства **/
+/*** Параметры ***
+** units: Память оценок (должна существовать все время работы экземпляра), n - количество устройств, NULL - отключить
+** minTimeoutUs, maxTimeoutUs: Границы тайм-аута, 0 - m_sendTimeout в качестве верхней границы
+** Примечание: Время ответа устройства измеряется по командам без повторов, из него вычитается время передачи запроса и ответа.
+** Тайм-аут команды = время передачи + сглаженное время ответа + 4 отклонения (как RTO в TCP), в пределах границ.
+** До первого измерения используется m_sendTimeout. Если записей не хватает, заменяется следующая по кругу.
+***/
+void ModBus_setAdaptiveTimeout(ModBus_parameter* ModBus_para, ModBus_UnitTiming_T* units, size_t n, uint32_t minTimeoutUs, uint32_t maxTimeoutUs);
+
+// Оценка времени ответа устройства unit, NULL если устройство не отслеживается
+const ModBus_UnitTiming_T* ModBus_getUnitTiming(ModBus_parameter* ModBus_para, uint8_t unit);
+
+/** Повтор команды после тайм-аута **/
+/*** Параметры ***
+** retries: Количество повторов команды RTU, тайм-аут каждой следующей попытки удваивается (до верхней границы)
+** Примечание: В Modbus TCP команды не повторяются, доставку обеспечивает TCP.
+***/
+void ModBus_setRetries(ModBus_parameter* ModBus_para, uint8_t retries);
+
+/** Временный пропуск неотвечающих устройств **/
+/*** Параметры ***
+** failures: Количество команд подряд без ответа (после всех повторов), после которого устройство пропускается, 0 - не пропускать
+** holdoffUs: Время первого пропуска; каждый следующий тайм-аут удваивает его (до 32 раз)
+** Примечание: Работает вместе с ModBus_setAdaptiveTimeout. Команды пропускаемому устройству завершаются сразу
+** со статусом MODBUS_STATUS_UNIT_OFFLINE. После пропуска следующая команда отправляется как проба: ответ возвращает устройство в работу.
+***/
+void ModBus_setUnitOffline(ModBus_parameter* ModBus_para, uint8_t failures, uint32_t holdoffUs);
+
+/** Кэш регистров хранения **/
+/*** Параметры ***
+** entries: Таблица кэша (должна существовать все время работы экземпляра), n - ее размер, степень двойки; NULL - отключить
+** ranges, rangesN: Кэшируемые диапазоны регистров и время жизни значений в каждом, регистры вне диапазонов не кэшируются
+** Примечание: Кэш заполняется ответами FC03 (и чтением FC23). Команда чтения FC03, все регистры которой есть в кэше и моложе
+** времени жизни, выполняется без обмена: функция обратного вызова вызывается до возврата из ModBus_getUnitRegister.
+** Пока в очереди есть запись этому устройству, чтение из кэша не выполняется. Выполненная запись FC06/FC16/FC23
+** обновляет значения в кэше, неудачная запись и запись через ModBus_sendUnitPdu удаляют их.
+** Если место в таблице не найдено за MODBUS_CACHE_PROBE позиций, вытесняется значение, устаревающее первым.
+** Возвращает 1 при успешной установке, 0 если размер не степень двойки
+***/
+uint8_t ModBus_attachCache(ModBus_parameter* ModBus_para, ModBus_CacheEntry_T* entries, size_t n, const ModBus_CacheRange_T* ranges, size_t rangesN);
+
+// Удаление значений регистров устройства unit из кэша (например, после изменения регистров другим Master)
+void ModBus_invalidateCache(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count);
+
+/** Подписки на изменения регистров **/
+/*** Параметры ***
+** subscriptions, n: Подписки с заполненными unit, type, address, count, snapshot, seen, handler (должны существовать все время работы
+** экземпляра); NULL - отключить. Подписка может быть больше одного чтения: диапазон опрашивается несколькими командами
+** Примечание: Каждый ответ на чтение (FC03, FC04, FC23, в том числе объединенное) сравнивается со снимками подписок того же
+** устройства и области, пересекающихся с прочитанным диапазоном. handler получает только индексы изменившихся регистров
+** (не больше register_access_limit за вызов) до функции обратного вызова команды. Снимок обновляется только для переданных
+** регистров, поэтому медленный дрейф внутри зоны нечувствительности накапливается и будет передан.
+** Первое чтение каждого регистра передает его без сравнения. Сравнение выполняется SIMD (SSE2, AVX2, NEON), если доступно при компиляции.
+** Подписки просматриваются по порядку, стоимость без изменений - одно сравнение блока на 8-16 регистров.
+** Возвращает 1 при успешной установке, 0 если подписка заполнена неверно
+***/
+uint8_t ModBus_attachSubscriptions(ModBus_parameter* ModBus_para, ModBus_Subscription_T* subscriptions, size_t n);
+
+/** Объединение команд чтения **/
+/*** Параметры ***
+** on: 1 - команды чтения одному устройству, стоящие в очереди, перед отправкой объединяются в один запрос FC03
+** maxGap: Максимальное количество лишних регистров между объединяемыми диапазонами
+** Примечание: Общий диапазон не превышает register_access_limit. Ответ разделяется, каждая функция обратного вызова получает
+** свои регистры. Чтение не объединяется с командами, стоящими после записи тому же устройству. В быстром режиме не действует.
+***/
+void ModBus_setReadCoalescing(ModBus_parameter* ModBus_para, uint8_t on, uint16_t maxGap);
+
+/** Результат команды **/
+/*** Возвращает MODBUS_STATUS_TYPE команды, функция обратного вызова которой выполняется:
+** MODBUS_STATUS_OK, код исключения из ответа устройства, MODBUS_STATUS_TIMEOUT или MODBUS_STATUS_UNIT_OFFLINE.
+** Примечание: Вызывается внутри функции обратного вызова, чтобы отличить исключение от тайм-аута при параметрах (0,0).
+** Команда, на которую устройство ответило исключением, завершается сразу после приема ответа.
+***/
+uint8_t ModBus_getStatus(ModBus_parameter* ModBus_para);
+
 /** Чтение регистров(-а) **/
 /*** Параметры ***
 ** address: Адрес первого регистра
 ** count: Количество регистров для чтения
 ** GetReponseHandler: Функция обратного вызова для чтения результатов, входящие параметры(uint16_t* buff, uint16_t buffLen),неудачное считывание входящих параметров (0,0)
-** Возвращает серийный номер команды (больше 0), чтобы определить, какая команда была выполнена в функции обратного вызова, и возвращает 0, если она не может быть отправлена.
+** Возвращает серийный номер команды (больше 0), чтобы определить, какая команда была выполнена в функции обратного вызова, и возвращает 0, если она не может быть отправлена (в том числе если очередь заполнена).
 ***/
 uint8_t ModBus_getRegister(ModBus_parameter* ModBus_para, uint16_t address, uint16_t count, void(*GetReponseHandler)(uint16_t*, uint16_t));
+uint8_t ModBus_getUnitRegister(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(uint16_t*, uint16_t)); // То же для устройства с адресом unit
+uint8_t ModBus_getUnitRegisterEx(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(void*, uint16_t*, uint16_t), void* context); // То же, функция обратного вызова получает context
 
 /** Запись одного регистра **/
 /*** Параметры ***
 ** address: Адрес первого регистра
 ** data: Данные для записи
 ** SetReponseHandler: Функция обратного вызова результата записи, входящие параметры(uint16_t address, uint16_t count), параметры включают в себя первый адрес и количество регистров, а время ожидания команды записи передается в параметрах (0,0).
-** Возвращает серийный номер команды (больше 0), чтобы определить, какая команда была выполнена в функции обратного вызова, и возвращает 0, если она не может быть отправлена.
+** Возвращает серийный номер команды (больше 0), чтобы определить, какая команда была выполнена в функции обратного вызова, и возвращает 0, если она не может быть отправлена (в том числе если очередь заполнена).
 ***/
 uint8_t ModBus_setRegister(ModBus_parameter* ModBus_para, uint16_t address, uint16_t data, void(*SetReponseHandler)(uint16_t, uint16_t));
+uint8_t ModBus_setUnitRegister(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t data, void(*SetReponseHandler)(uint16_t, uint16_t)); // То же для устройства с адресом unit
 
 /** Запись нескольких регистров **/
 /*** Параметры ***
@@ -185,9 +649,89 @@ uint8_t ModBus_setRegister(ModBus_parameter* ModBus_para, uint16_t address, uint
 ** data: Данные для записи
 ** count: Количество записываемых регистров
 ** SetReponseHandler: Функция обратного вызова результата записи, входящие параметры(uint16_t address, uint16_t count), параметры включают в себя первый адрес и количество регистров, а время ожидания команды записи передается в параметрах (0,0).
-** Возвращает серийный номер команды (больше 0), чтобы определить, какая команда была выполнена в функции обратного вызова, и возвращает 0, если она не может быть отправлена.
+** Возвращает серийный номер команды (больше 0), чтобы определить, какая команда была выполнена в функции обратного вызова, и возвращает 0, если она не может быть отправлена (в том числе если очередь заполнена).
 ***/
 uint8_t ModBus_setRegisters(ModBus_parameter* ModBus_para, uint16_t address, uint16_t* data, uint16_t count, void(*SetReponseHandler)(uint16_t, uint16_t));
+uint8_t ModBus_setUnitRegisters(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t* data, uint16_t count, void(*SetReponseHandler)(uint16_t, uint16_t)); // То же для устройства с адресом unit
+
+// Чтение входных регистров (FC04), параметры и функция обратного вызова как у ModBus_getUnitRegister
+uint8_t ModBus_getUnitInputRegister(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(uint16_t*, uint16_t));
+
+/** Чтение битов (FC01 - биты состояния, FC02 - дискретные входы) **/
+/*** Параметры ***
+** unit: Адрес устройства на шине (ModBus_para->m_address - устройство из ModBus_setup)
+** address: Адрес первого бита
+** count: Количество битов, не больше MODBUS_MAX_READ_BITS и 16 * register_access_limit
+** GetReponseHandler: Функция обратного вызова, входящие параметры(const uint8_t* bits, uint16_t count), биты упакованы
+** как в кадре (ModBus_getBit), неудача - (NULL, 0)
+** Возвращает серийный номер команды (больше 0), 0 если команда не поставлена в очередь
+***/
+uint8_t ModBus_getUnitCoils(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(const uint8_t*, uint16_t));
+uint8_t ModBus_getUnitDiscreteInputs(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint16_t count, void(*GetReponseHandler)(const uint8_t*, uint16_t));
+
+/** Запись битов (FC05 - один бит, FC15 - несколько битов) **/
+/*** Параметры ***
+** on: Значение бита, 0 - выключен
+** bits: Упакованные биты для записи (ModBus_setBit), count - их количество, не больше MODBUS_MAX_WRITE_BITS и 16 * register_access_limit
+** SetReponseHandler: Функция обратного вызова результата записи (address, count), неудача - (0, 0)
+** Возвращает серийный номер команды (больше 0), 0 если команда не поставлена в очередь
+***/
+uint8_t ModBus_setUnitCoil(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, uint8_t on, void(*SetReponseHandler)(uint16_t, uint16_t));
+uint8_t ModBus_setUnitCoils(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t address, const uint8_t* bits, uint16_t count, void(*SetReponseHandler)(uint16_t, uint16_t));
+
+/** Запись и чтение регистров одной командой (FC23) **/
+/*** Параметры ***
+** readAddress, readCount: Читаемые регистры, не больше register_access_limit
+** writeAddress, data, writeCount: Записываемые регистры, не больше MODBUS_MAX_READ_WRITE_REGISTERS и register_access_limit
+** GetReponseHandler: Функция обратного вызова с прочитанными регистрами, неудача - (0, 0)
+** Примечание: Устройство выполняет запись до чтения, так что уставку и состояние можно обменять за один обмен.
+** Возвращает серийный номер команды (больше 0), 0 если команда не поставлена в очередь
+***/
+uint8_t ModBus_readWriteUnitRegisters(ModBus_parameter* ModBus_para, uint8_t unit, uint16_t readAddress, uint16_t readCount,
+    uint16_t writeAddress, const uint16_t* data, uint16_t writeCount, void(*GetReponseHandler)(uint16_t*, uint16_t));
+
+/** Отправка произвольного PDU (шлюз, коды функций без отдельной функции) **/
+/*** Параметры ***
+** unit: Адрес устройства на шине
+** pdu, size: Код функции и данные запроса, не длиннее MODBUS_BUFFER_SIZE без служебной части кадра
+** PduResponseHandler: Функция обратного вызова, входящие параметры(void* context, const uint8_t* pdu, uint16_t size) - PDU ответа
+** с тем же кодом функции или исключением (ModBus_getStatus - код исключения); тайм-аут - (context, NULL, 0)
+** context: Указатель, передаваемый в функцию обратного вызова
+** Примечание: PDU ответа действителен только во время вызова. Команда не объединяется с другими командами чтения.
+** Возвращает серийный номер команды (больше 0), 0 если команда не поставлена в очередь
+***/
+uint8_t ModBus_sendUnitPdu(ModBus_parameter* ModBus_para, uint8_t unit, const uint8_t* pdu, uint16_t size,
+    void(*PduResponseHandler)(void*, const uint8_t*, uint16_t), void* context);
+
+/** Подготовка запроса для многократной отправки **/
+/*** Параметры ***
+** prepared: Память запроса, заполняется функцией
+** unit, address, count: Устройство, первый регистр и количество регистров
+** type: READ_REGISTER или READ_INPUT_REGISTER (ModBus_prepareRead)
+** Возвращает 0, если количество недопустимо. Кадр кодируется в текущем режиме экземпляра (ModBus_setMode),
+** в другом режиме запрос не отправляется. Для FC16 сохраняется заголовок и его CRC, данные задаются при отправке.
+** Кадр можно получить и при компиляции: modbus_frames.hpp (constexpr для C++14).
+***/
+uint8_t ModBus_prepareRead(ModBus_parameter* ModBus_para, ModBus_Prepared_T* prepared, uint8_t unit, MODBUS_FUNCTION_TYPE type, uint16_t address, uint16_t count);
+uint8_t ModBus_prepareWrite(ModBus_parameter* ModBus_para, ModBus_Prepared_T* prepared, uint8_t unit, uint16_t address, uint16_t count);
+
+/** Отправка подготовленного запроса **/
+/*** Параметры ***
+** prepared: Запрос ModBus_prepareRead/ModBus_prepareWrite; не изменяется, может быть const и использоваться несколькими экземплярами
+** GetReponseHandler, context: Как у ModBus_getUnitRegisterEx; чтение FC03 отвечается из кэша, как ModBus_getUnitRegister
+** data: FC16 - prepared->count значений, CRC считается только по ним
+** SetReponseHandler: Как у ModBus_setUnitRegisters
+** Возвращает серийный номер команды, 0 - очередь заполнена, запрос не подготовлен или подготовлен в другом режиме.
+** Примечание: Кадр копируется в очередь без кодирования; в Modbus TCP заменяется только идентификатор транзакции.
+***/
+uint8_t ModBus_submitRead(ModBus_parameter* ModBus_para, const ModBus_Prepared_T* prepared, void(*GetReponseHandler)(void*, uint16_t*, uint16_t), void* context);
+uint8_t ModBus_submitWrite(ModBus_parameter* ModBus_para, const ModBus_Prepared_T* prepared, const uint16_t* data, void(*SetReponseHandler)(uint16_t, uint16_t));
+
+#ifdef _BENCHMARK
+void ModBus_queue_benchmark(); // Стоимость постановки и снятия команды с очереди в зависимости от ее глубины
+void ModBus_prepared_benchmark(); // Постановка команды с кодированием кадра и из подготовленного запроса
+void ModBus_diff_benchmark(); // Сравнение снимка подписки с ответом: SIMD и по 4 регистра в uint64_t
+#endif
 
 #endif
 
@@ -196,10 +740,84 @@ uint8_t ModBus_setRegisters(ModBus_parameter* ModBus_para, uint16_t address, uin
 // Функция Slave-цикла
 void ModBus_Slave_loop(ModBus_parameter* ModBus_para);
 
-// Функция чтения и записи регистров ведомого устройства
+// Время до следующего события Slave в микросекундах (конец приема кадра по тишине), 0 - вызвать цикл сразу, MODBUS_TIME_NEVER - ждать приема байтов
+uint64_t ModBus_Slave_nextWakeup(ModBus_parameter* ModBus_para);
+
+/** Функции чтения и записи регистров ведомого устройства **/
+/*** Параметры ***
+** GetRegisterHandler, SetRegisterHandler: (первый адрес, количество, данные), возвращают количество прочитанных/записанных регистров.
+** Примечание: Меньшее количество (в том числе 0) отправляется как исключение 02 (недопустимый адрес),
+** MODBUS_HANDLER_FAILURE - как исключение 04. Без функции запросы вне банка регистров получают исключение 02.
+***/
 void ModBus_attachRegisterHandler(ModBus_parameter* ModBus_para, size_t(*GetRegisterHandler)(uint16_t, uint16_t, uint16_t*), size_t(*SetRegisterHandler)(uint16_t, uint16_t, uint16_t*));
 
+/** Привязка банка регистров **/
+/*** Параметры ***
+** bank: Банк регистров (должен существовать все время работы экземпляра), NULL - отвязать
+** Примечание: Чтение диапазона внутри банка копирует его в ответ одним блоком, запись FC06/FC16 попадает прямо в банк.
+** Запросы вне диапазона банка передаются функциям ModBus_attachRegisterHandler, если они привязаны.
+***/
+void ModBus_attachRegisterBank(ModBus_parameter* ModBus_para, ModBus_RegisterBank_T* bank);
+
+// Функция чтения входных регистров FC04 (параметры и результат как у GetRegisterHandler), используется вне области input банка
+void ModBus_attachInputRegisterHandler(ModBus_parameter* ModBus_para, size_t(*GetInputHandler)(uint16_t, uint16_t, uint16_t*));
+
+/** Функции чтения и записи битов **/
+/*** Параметры ***
+** GetBitsHandler: (код функции READ_COILS или READ_DISCRETE_INPUTS, первый адрес, количество, bits), заполняет обнуленный
+** массив упакованных битов (ModBus_setBit), возвращает количество прочитанных битов
+** SetBitsHandler: (первый адрес, количество, bits) для FC05 и FC15, возвращает количество записанных битов
+** Примечание: Результат обрабатывается как у функций регистров: меньшее количество - исключение 02, MODBUS_HANDLER_FAILURE - 04.
+***/
+void ModBus_attachBitHandler(ModBus_parameter* ModBus_para, size_t(*GetBitsHandler)(uint8_t, uint16_t, uint16_t, uint8_t*), size_t(*SetBitsHandler)(uint16_t, uint16_t, const uint8_t*));
+
+/** Обслуживание нескольких адресов одним экземпляром **/
+/*** Параметры ***
+** table: Таблица поиска (память приложения), заполняется функцией
+** units, n: Устройства с разными адресами 1-247 (должны существовать все время работы экземпляра), table = NULL - отвязать
+** Возвращает 0, если адрес устройства недопустим или повторяется.
+** Примечание: Кадр RTU начинается с любого адреса таблицы, запросы по другим адресам не принимаются;
+** в Modbus TCP на них отправляется исключение 0B. Запрос обрабатывается банком и функциями своего устройства
+** вместо привязанных к экземпляру. Ответ устройства с delayUs отправляется через delayUs после приема запроса,
+** до этого следующие запросы не обрабатываются (устройство занимает линию).
+** Память: 256 байтов таблицы и ModBus_SlaveUnit_T на устройство.
+***/
+uint8_t ModBus_attachUnits(ModBus_parameter* ModBus_para, ModBus_SlaveUnits_T* table, ModBus_SlaveUnit_T* units, size_t n);
+
 #endif
+#ifdef MODBUS_STATS
+/** Снимок статистики **/
+/*** Параметры ***
+** stats: Копия счетчиков и гистограмм экземпляра
+** Примечание: Счетчики изменяются циклом экземпляра без блокировок; снимок из другого потока может быть несогласованным между полями.
+***/
+void ModBus_getStats(ModBus_parameter* ModBus_para, ModBus_Stats_T* stats);
+
+// Обнуление статистики экземпляра
+void ModBus_resetStats(ModBus_parameter* ModBus_para);
+
+// Номер гистограммы rtt для кода функции, -1 - время ответа этой функции не учитывается
+int ModBus_statsSlot(uint8_t function);
+
+/** Оценка процентиля времени ответа **/
+/*** Параметры ***
+** function: Код функции
+** perMille: Процентиль в десятых долях процента, например 990 - p99
+** Возвращает верхнюю границу корзины гистограммы в микросекундах, 0 - ответов не было
+***/
+uint64_t ModBus_statsPercentile(const ModBus_Stats_T* stats, uint8_t function, uint16_t perMille);
+#endif // MODBUS_STATS
+#ifdef _UNIT_TEST
+#define MODBUS_TEST_REGISTERS 16
+// Общий банк регистров тестов модулей (modbus_tcp, modbus_linux, modbus_trace, modbus_gateway), адрес по модулю MODBUS_TEST_REGISTERS
+extern uint16_t g_testRegisters[MODBUS_TEST_REGISTERS];
+size_t ModBus_testGetRegister(uint16_t address, uint16_t n, uint16_t* data);
+size_t ModBus_testSetRegister(uint16_t address, uint16_t n, uint16_t* data);
+#endif // _UNIT_TEST
 /**************** Внешний интерфейс END ***************/
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,256 @@
+#include "modbus_bench.h"
+
+#if defined(_BENCHMARK) && defined(MODBUS_MASTER) && defined(MODBUS_SLAVE)
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct _MODBUS_BENCH_CASE_T { // Одна комбинация теста
+    uint8_t mode; // MODBUS_MODE_TYPE
+    uint8_t function; // READ_REGISTER, WRITE_SINGLE_REGISTER или WRITE_MULTI_REGISTER
+    uint16_t count; // Количество регистров в запросе
+    uint8_t depth; // Количество команд в очереди Master (в TCP - также окно)
+} ModBus_BenchCase_T;
+
+typedef struct _MODBUS_BENCH_WIRE_T { // Линия в одну сторону: байты ждут, пока в кольцевом буфере получателя не освободится место
+    ModBus_parameter* to;
+    uint8_t data[MODBUS_BENCH_MAX_DEPTH * (MODBUS_BUFFER_SIZE + 8)];
+    size_t head, len;
+} ModBus_BenchWire_T;
+
+static ModBus_parameter s_master, s_slave;
+static ModBus_BenchWire_T s_toSlave, s_toMaster;
+static MODBUS_FRAME_T s_frames[MODBUS_BENCH_MAX_DEPTH];
+static uint8_t s_holding[2 * MODBUS_REGISTER_LIMIT];
+static ModBus_RegisterBank_T s_bank;
+static uint16_t s_values[MODBUS_REGISTER_LIMIT];
+
+static uint64_t s_virtualNs; // Виртуальные часы, нс
+static uint32_t s_charNs; // Время передачи одного байта по линии, нс
+static uint64_t s_copied; // Байтов, записанных в кольцевые буферы приема
+static uint64_t s_frames_n; // Отправленных кадров (запросы и ответы)
+
+static uint64_t s_submitNs[MODBUS_BENCH_MAX_DEPTH]; // Время постановки ожидающих команд, команды завершаются по порядку
+static size_t s_submitHead, s_submitN;
+static uint32_t s_latencyNs[MODBUS_BENCH_TXNS];
+static size_t s_done, s_failed;
+
+static uint64_t bench_clock()
+{
+    return s_virtualNs / 1000u;
+}
+
+// Процессорное время процесса, при отсутствии CLOCK_PROCESS_CPUTIME_ID - реальное (тест однопоточный и не ждет)
+static uint64_t bench_cpuNs()
+{
+#ifdef CLOCK_PROCESS_CPUTIME_ID
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+    return ModBus_benchNowNs();
+#endif
+}
+
+// Функция отправки: кадр ставится в линию к другому экземпляру, виртуальное время сдвигается на время его передачи
+static void bench_send(void* context, uint8_t* data, size_t size)
+{
+    ModBus_BenchWire_T* wire = (ModBus_BenchWire_T*)context;
+    assert(wire->len + size <= sizeof(wire->data));
+    for (size_t i = 0; i < size; i++)
+    {
+        wire->data[(wire->head + wire->len + i) % sizeof(wire->data)] = data[i];
+    }
+    wire->len += size;
+    s_virtualNs += (uint64_t)size * s_charNs;
+    s_frames_n++;
+}
+
+// Передача байтов линии получателю, не больше свободного места в его кольцевом буфере (как при чтении из сокета)
+static size_t bench_deliver(ModBus_BenchWire_T* wire)
+{
+    size_t delivered = 0;
+    while (wire->len > 0)
+    {
+        size_t n = ModBus_receiveSpace(wire->to);
+        size_t first = sizeof(wire->data) - wire->head;
+        n = n < wire->len ? n : wire->len;
+        n = n < first ? n : first;
+        if (n == 0)
+        {
+            break;
+        }
+        n = ModBus_readbytesFromOuter(wire->to, wire->data + wire->head, n);
+        wire->head = (wire->head + n) % sizeof(wire->data);
+        wire->len -= n;
+        delivered += n;
+    }
+    s_copied += delivered;
+    return delivered;
+}
+
+static void bench_complete(uint16_t count)
+{
+    uint64_t now = ModBus_benchNowNs();
+    assert(s_submitN > 0);
+    if (count == 0)
+    {
+        s_failed++;
+    }
+    s_latencyNs[s_done++] = (uint32_t)(now - s_submitNs[s_submitHead]);
+    s_submitHead = (s_submitHead + 1) % MODBUS_BENCH_MAX_DEPTH;
+    s_submitN--;
+}
+
+static void bench_getResponse(uint16_t* data, uint16_t count)
+{
+    (void)data;
+    bench_complete(count);
+}
+
+static void bench_setResponse(uint16_t address, uint16_t count)
+{
+    (void)address;
+    bench_complete(count);
+}
+
+static uint8_t bench_submit(const ModBus_BenchCase_T* c, uint16_t address)
+{
+    uint8_t result;
+    s_submitNs[(s_submitHead + s_submitN) % MODBUS_BENCH_MAX_DEPTH] = ModBus_benchNowNs();
+    switch (c->function)
+    {
+    case READ_REGISTER:
+        result = ModBus_getRegister(&s_master, address, c->count, bench_getResponse);
+        break;
+    case WRITE_SINGLE_REGISTER:
+        result = ModBus_setRegister(&s_master, address, s_values[0], bench_setResponse);
+        break;
+    default:
+        result = ModBus_setRegisters(&s_master, address, s_values, c->count, bench_setResponse);
+        break;
+    }
+    if (result)
+    {
+        s_submitN++;
+    }
+    return result;
+}
+
+static uint32_t bench_percentile(size_t n, uint32_t perMille)
+{
+    size_t i = (size_t)((uint64_t)n * perMille / 1000);
+    return s_latencyNs[i < n ? i : n - 1];
+}
+
+static void bench_run(const ModBus_BenchCase_T* c)
+{
+    ModBus_Setting_T setting = { 0 };
+    uint64_t wallBegin, wallNs, cpuBegin, cpuNs, virtualBegin;
+    size_t submitted = 0;
+    uint16_t span = MODBUS_REGISTER_LIMIT - c->count + 1; // Адреса запросов чередуются внутри банка
+
+    setting.address = 0x01;
+    setting.baudRate = 115200;
+    setting.register_access_limit = MODBUS_REGISTER_LIMIT;
+    ModBus_setup(&s_master, setting);
+    ModBus_setup(&s_slave, setting);
+    ModBus_setMode(&s_master, c->mode, c->depth);
+    ModBus_setMode(&s_slave, c->mode, 0);
+    ModBus_setFrameQueue(&s_master, s_frames, c->depth);
+    s_toSlave.to = &s_slave;
+    s_toSlave.head = s_toSlave.len = 0;
+    s_toMaster.to = &s_master;
+    s_toMaster.head = s_toMaster.len = 0;
+    ModBus_attachSendHandler(&s_master, bench_send, &s_toSlave);
+    ModBus_attachSendHandler(&s_slave, bench_send, &s_toMaster);
+    ModBus_attachRegisterBank(&s_slave, &s_bank);
+    // RTU: 11 бит на байт при setting.baudRate; TCP: 8 бит на байт при 10 Мбит/с
+    s_charNs = c->mode == MODBUS_MODE_TCP ? 800u : (uint32_t)(11000000000ull / setting.baudRate);
+    s_copied = 0;
+    s_frames_n = 0;
+    s_submitHead = 0;
+    s_submitN = 0;
+    s_done = 0;
+    s_failed = 0;
+
+    virtualBegin = s_virtualNs;
+    wallBegin = ModBus_benchNowNs();
+    cpuBegin = bench_cpuNs();
+    while (s_done < MODBUS_BENCH_TXNS)
+    {
+        while (submitted < MODBUS_BENCH_TXNS && s_submitN < c->depth && bench_submit(c, (uint16_t)(submitted % span)))
+        {
+            submitted++;
+        }
+        uint64_t progress = s_frames_n + s_done + s_copied;
+        ModBus_Master_loop(&s_master);
+        bench_deliver(&s_toSlave);
+        ModBus_Slave_loop(&s_slave);
+        bench_deliver(&s_toMaster);
+        ModBus_Master_loop(&s_master);
+        if (s_frames_n + s_done + s_copied == progress) // Ни один экземпляр ничего не сделал: время сдвигается до следующего события
+        {
+            uint64_t wakeup = ModBus_Master_nextWakeup(&s_master);
+            uint64_t slaveWakeup = ModBus_Slave_nextWakeup(&s_slave);
+            wakeup = slaveWakeup < wakeup ? slaveWakeup : wakeup;
+            s_virtualNs += (wakeup > 0 && wakeup != MODBUS_TIME_NEVER ? wakeup : 1) * 1000u;
+        }
+    }
+    cpuNs = bench_cpuNs() - cpuBegin;
+    wallNs = ModBus_benchNowNs() - wallBegin;
+
+    qsort(s_latencyNs, s_done, sizeof(s_latencyNs[0]), ModBus_benchCompareU32);
+    printf("loopback,%s,%02u,%u,%u,%u,%.0f,%.1f,%.2f,%u,%u,%u,%.1f,%u\n",
+        c->mode == MODBUS_MODE_TCP ? "tcp" : "rtu", c->function, c->count, c->depth, (unsigned)s_done,
+        (double)s_done * 1e9 / (double)(wallNs ? wallNs : 1),
+        (double)cpuNs / (double)(s_frames_n ? s_frames_n : 1),
+        (double)s_copied / (double)(s_frames_n ? s_frames_n : 1),
+        bench_percentile(s_done, 500), bench_percentile(s_done, 990), bench_percentile(s_done, 999),
+        (double)(s_virtualNs - virtualBegin) / 1000.0 / s_done, (unsigned)s_failed);
+}
+
+void ModBus_Bench_loopback()
+{
+    static const uint8_t modes[] = { MODBUS_MODE_RTU, MODBUS_MODE_TCP };
+    static const uint8_t functions[] = { READ_REGISTER, WRITE_SINGLE_REGISTER, WRITE_MULTI_REGISTER };
+    static const uint16_t counts[] = { 1, 16, MODBUS_REGISTER_LIMIT };
+    static const uint8_t depths[] = { 1, 8, MODBUS_BENCH_MAX_DEPTH };
+
+    s_bank.holding = s_holding;
+    s_bank.holdingStart = 0;
+    s_bank.holdingCount = MODBUS_REGISTER_LIMIT;
+    for (uint16_t i = 0; i < MODBUS_REGISTER_LIMIT; i++)
+    {
+        s_values[i] = (uint16_t)(i * 0x0101u);
+        ModBus_bankWrite(s_holding, i, s_values[i]);
+    }
+    s_virtualNs = 0;
+    ModBus_setClock(bench_clock);
+
+    printf("loopback,mode,fc,count,depth,txns,txn_per_s,cpu_ns_per_frame,copied_bytes_per_frame,p50_ns,p99_ns,p999_ns,virtual_us_per_txn,failed\n");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+    {
+        for (size_t f = 0; f < sizeof(functions) / sizeof(functions[0]); f++)
+        {
+            for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++)
+            {
+                for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+                {
+                    ModBus_BenchCase_T c = { modes[m], functions[f], counts[n], depths[d] };
+                    if (functions[f] == WRITE_SINGLE_REGISTER && counts[n] != 1)
+                    {
+                        continue; // FC06 всегда пишет один регистр
+                    }
+                    if (functions[f] == WRITE_MULTI_REGISTER && counts[n] > MODBUS_MAX_WRITE_REGISTERS)
+                    {
+                        c.count = MODBUS_MAX_WRITE_REGISTERS; // Больше FC16 не принимает, команда была бы отклонена сразу
+                    }
+                    bench_run(&c);
+                }
+            }
+        }
+    }
+    ModBus_setClock(NULL);
+}
+#endif // _BENCHMARK
@@ -0,0 +1,36 @@
+#ifndef MODBUS_BENCH_H_
+#define MODBUS_BENCH_H_
+/**** Нагрузочный тест Master/Slave через память ****
+** Master и Slave соединены напрямую: функция отправки одного экземпляра записывает кадр в кольцевой буфер другого.
+** Время виртуальное (ModBus_setClock): каждый отправленный кадр сдвигает его на время передачи по линии,
+** поэтому тайм-ауты протокола не зависят от скорости процессора, а результаты повторяемы.
+** Для каждой комбинации режима (RTU/TCP), функции (FC03/FC06/FC16), количества регистров и глубины очереди
+** выводится строка CSV с префиксом "loopback":
+****** txn_per_s - транзакций в секунду (реальное время)
+****** cpu_ns_per_frame - процессорное время на кадр (запрос или ответ)
+****** copied_bytes_per_frame - байтов, скопированных транспортом в кольцевые буферы приема, на кадр (разбор кадра копий не делает)
+****** p50_ns/p99_ns/p999_ns - задержка транзакции от постановки в очередь до функции обратного вызова
+****** virtual_us_per_txn - время линии на транзакцию по виртуальным часам
+****** failed - транзакций, завершенных с ошибкой (должно быть 0)
+** Как использовать:
+****** Определить _BENCHMARK в modbus.h, вызвать ModBus_Bench_loopback (main.c делает это сам)
+****** Вывод сравнивается между сборками для поиска регрессий
+*/
+
+#include "modbus.h"
+
+#if defined(_BENCHMARK) && defined(MODBUS_MASTER) && defined(MODBUS_SLAVE)
+
+#define MODBUS_BENCH_TXNS 20000 // Количество транзакций в каждой комбинации
+#define MODBUS_BENCH_MAX_DEPTH 32 // Максимальная глубина очереди Master
+
+/************ Внешний интерфейс BEGIN ***********/
+
+// Запуск всех комбинаций и вывод результатов в stdout; источник времени ModBus_setClock сбрасывается по завершении
+void ModBus_Bench_loopback();
+
+/**************** Внешний интерфейс END ***************/
+
+#endif // _BENCHMARK
+
+#endif
@@ -0,0 +1,199 @@
+#include "modbus_crc.h"
+#include "modbus.h"
+
+// Таблица CRC для одного байта: ModBus_CRC16_table[i] - CRC байта i при нулевом начальном значении
+const uint16_t ModBus_CRC16_table[256] = {
+    0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241,
+    0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1, 0xC481, 0x0440,
+    0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40,
+    0x0A00, 0xCAC1, 0xCB81, 0x0B40, 0xC901, 0x09C0, 0x0880, 0xC841,
+    0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40,
+    0x1E00, 0xDEC1, 0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41,
+    0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
+    0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040,
+    0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1, 0xF281, 0x3240,
+    0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441,
+    0x3C00, 0xFCC1, 0xFD81, 0x3D40, 0xFF01, 0x3FC0, 0x3E80, 0xFE41,
+    0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840,
+    0x2800, 0xE8C1, 0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41,
+    0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
+    0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640,
+    0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0, 0x2080, 0xE041,
+    0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240,
+    0x6600, 0xA6C1, 0xA781, 0x6740, 0xA501, 0x65C0, 0x6480, 0xA441,
+    0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41,
+    0xAA01, 0x6AC0, 0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840,
+    0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
+    0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40,
+    0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1, 0xB681, 0x7640,
+    0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041,
+    0x5000, 0x90C1, 0x9181, 0x5140, 0x9301, 0x53C0, 0x5280, 0x9241,
+    0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440,
+    0x9C01, 0x5CC0, 0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40,
+    0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
+    0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40,
+    0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0, 0x4C80, 0x8C41,
+    0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641,
+    0x8201, 0x42C0, 0x4380, 0x8341, 0x4100, 0x81C1, 0x8081, 0x4040,
+};
+
+#if MODBUS_CRC_SLICING >= 8
+// s_sliceTable[k][i] - вклад байта i, за которым следуют еще k байт
+static uint16_t s_sliceTable[MODBUS_CRC_SLICING][256];
+static uint8_t s_sliceTableReady = 0;
+#endif
+
+void ModBus_CRC16_init()
+{
+#if MODBUS_CRC_SLICING >= 8
+    if (s_sliceTableReady)
+    {
+        return;
+    }
+    for (size_t i = 0; i < 256; i++)
+    {
+        s_sliceTable[0][i] = ModBus_CRC16_table[i];
+    }
+    for (size_t k = 1; k < MODBUS_CRC_SLICING; k++)
+    {
+        for (size_t i = 0; i < 256; i++)
+        {
+            uint16_t crc = s_sliceTable[k - 1][i];
+            s_sliceTable[k][i] = (uint16_t)((crc >> 8) ^ ModBus_CRC16_table[crc & 0xFF]);
+        }
+    }
+    s_sliceTableReady = 1;
+#endif
+}
+
+// Исходный побитовый алгоритм: 8 сдвигов на каждый байт
+uint16_t ModBus_CRC16_updateBitwise(uint16_t crc, const uint8_t* data, size_t len)
+{
+    for (size_t pos = 0; pos < len; pos++)
+    {
+        crc ^= data[pos];
+        for (uint8_t i = 8; i != 0; i--)
+        {
+            if ((crc & 0x0001) != 0)
+            {
+                crc >>= 1;
+                crc ^= 0xA001;
+            }
+            else
+                crc >>= 1;
+        }
+    }
+    return crc;
+}
+
+uint16_t ModBus_CRC16_updateTable(uint16_t crc, const uint8_t* data, size_t len)
+{
+    while (len--)
+    {
+        crc = ModBus_CRC16_updateByte(crc, *data++);
+    }
+    return crc;
+}
+
+#if MODBUS_CRC_SLICING >= 8
+uint16_t ModBus_CRC16_updateSlice8(uint16_t crc, const uint8_t* data, size_t len)
+{
+    if (!s_sliceTableReady)
+    {
+        ModBus_CRC16_init();
+    }
+    while (len >= 8)
+    {
+        // Первые два байта смешиваются с текущим CRC, остальные берутся из таблиц напрямую
+        crc ^= (uint16_t)(data[0] | (data[1] << 8));
+        crc = s_sliceTable[7][crc & 0xFF] ^ s_sliceTable[6][crc >> 8]
+            ^ s_sliceTable[5][data[2]] ^ s_sliceTable[4][data[3]]
+            ^ s_sliceTable[3][data[4]] ^ s_sliceTable[2][data[5]]
+            ^ s_sliceTable[1][data[6]] ^ s_sliceTable[0][data[7]];
+        data += 8;
+        len -= 8;
+    }
+    return ModBus_CRC16_updateTable(crc, data, len);
+}
+#endif
+
+#if MODBUS_CRC_SLICING >= 16
+uint16_t ModBus_CRC16_updateSlice16(uint16_t crc, const uint8_t* data, size_t len)
+{
+    if (!s_sliceTableReady)
+    {
+        ModBus_CRC16_init();
+    }
+    while (len >= 16)
+    {
+        crc ^= (uint16_t)(data[0] | (data[1] << 8));
+        crc = s_sliceTable[15][crc & 0xFF] ^ s_sliceTable[14][crc >> 8]
+            ^ s_sliceTable[13][data[2]] ^ s_sliceTable[12][data[3]]
+            ^ s_sliceTable[11][data[4]] ^ s_sliceTable[10][data[5]]
+            ^ s_sliceTable[9][data[6]] ^ s_sliceTable[8][data[7]]
+            ^ s_sliceTable[7][data[8]] ^ s_sliceTable[6][data[9]]
+            ^ s_sliceTable[5][data[10]] ^ s_sliceTable[4][data[11]]
+            ^ s_sliceTable[3][data[12]] ^ s_sliceTable[2][data[13]]
+            ^ s_sliceTable[1][data[14]] ^ s_sliceTable[0][data[15]];
+        data += 16;
+        len -= 16;
+    }
+    return ModBus_CRC16_updateSlice8(crc, data, len);
+}
+#endif
+
+uint16_t ModBus_CRC16_update(uint16_t crc, const uint8_t* data, size_t len)
+{
+#if MODBUS_CRC_SLICING >= 16
+    return ModBus_CRC16_updateSlice16(crc, data, len);
+#elif MODBUS_CRC_SLICING >= 8
+    return ModBus_CRC16_updateSlice8(crc, data, len);
+#else
+    return ModBus_CRC16_updateTable(crc, data, len);
+#endif
+}
+
+#ifdef _BENCHMARK
+#include <stdio.h>
+
+static void crc_benchmarkOne(const char* name, uint16_t(*update)(uint16_t, const uint8_t*, size_t), const uint8_t* data, size_t len, uint16_t expected)
+{
+    const size_t rounds = 2000000u / (len + 1) + 1000u;
+    volatile uint16_t sink = 0;
+    uint16_t crc = update(MODBUS_CRC16_INIT, data, len);
+    uint64_t begin = ModBus_benchNowNs();
+    for (size_t r = 0; r < rounds; r++)
+    {
+        sink ^= update(MODBUS_CRC16_INIT, data, len);
+    }
+    uint64_t elapsed = ModBus_benchNowNs() - begin;
+    (void)sink;
+    printf("crc,%s,%u,%.2f,%.3f,%s\n", name, (unsigned)len, (double)elapsed / rounds, (double)elapsed / rounds / len, crc == expected ? "ok" : "MISMATCH");
+}
+
+void ModBus_CRC16_benchmark()
+{
+    static const size_t sizes[] = { 8, 64, MODBUS_BUFFER_SIZE, 256 };
+    uint8_t data[256];
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 131u + 7u);
+    }
+    ModBus_CRC16_init();
+
+    printf("crc,variant,bytes,ns_per_frame,ns_per_byte,check\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t len = sizes[s];
+        uint16_t expected = ModBus_CRC16_updateBitwise(MODBUS_CRC16_INIT, data, len);
+        crc_benchmarkOne("bitwise", ModBus_CRC16_updateBitwise, data, len, expected);
+        crc_benchmarkOne("table", ModBus_CRC16_updateTable, data, len, expected);
+#if MODBUS_CRC_SLICING >= 8
+        crc_benchmarkOne("slice8", ModBus_CRC16_updateSlice8, data, len, expected);
+#endif
+#if MODBUS_CRC_SLICING >= 16
+        crc_benchmarkOne("slice16", ModBus_CRC16_updateSlice16, data, len, expected);
+#endif
+    }
+}
+#endif // _BENCHMARK
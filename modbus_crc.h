@@ -0,0 +1,78 @@
+#ifndef MODBUS_CRC_H_
+#define MODBUS_CRC_H_
+/**** Контрольная сумма CRC-16 протокола ModBus RTU ****
+** Полином 0xA001 (отраженный 0x8005), начальное значение 0xFFFF, младший байт передается первым.
+** Реализации:
+**** 1.Побитовая (исходный алгоритм, используется для сравнения)
+**** 2.Табличная, 256 записей, один шаг на байт
+**** 3.Slicing-by-8/16, 8 или 16 байт за шаг (только для хостов с достаточным объемом памяти)
+** Потоковый интерфейс: ModBus_CRC16_update можно вызывать по мере поступления байтов.
+** Если CRC посчитана по кадру вместе с его контрольной суммой, результат равен 0 (MODBUS_CRC16_RESIDUE),
+** поэтому проверка конца кадра сводится к одному сравнению.
+*/
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Количество таблиц slicing: 1 - только таблица на 256 записей (512 байт), 8 или 16 - slicing-by-8/16 (4/8 КБ ОЗУ)
+#ifndef MODBUS_CRC_SLICING
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86) || defined(__aarch64__)
+#define MODBUS_CRC_SLICING 16
+#else
+#define MODBUS_CRC_SLICING 1
+#endif
+#endif
+
+#define MODBUS_CRC16_INIT 0xFFFFu // Начальное значение CRC
+#define MODBUS_CRC16_RESIDUE 0x0000u // Значение CRC, посчитанное по кадру вместе с правильной контрольной суммой
+
+extern const uint16_t ModBus_CRC16_table[256];
+
+// Обновление CRC одним байтом, подходит для вызова на каждый принятый байт
+static inline uint16_t ModBus_CRC16_updateByte(uint16_t crc, uint8_t data)
+{
+    return (uint16_t)((crc >> 8) ^ ModBus_CRC16_table[(crc ^ data) & 0xFF]);
+}
+
+/************ Внешний интерфейс BEGIN ***********/
+void ModBus_CRC16_init(); // Подготовка таблиц slicing, вызывается из ModBus_setup, повторный вызов безопасен
+
+/** Потоковое обновление CRC **/
+/*** Параметры ***
+** crc: Текущее значение (MODBUS_CRC16_INIT для начала кадра)
+** data: Новые данные
+** len: Длина новых данных
+** Возвращает новое значение CRC, используется самая быстрая из доступных реализаций
+***/
+uint16_t ModBus_CRC16_update(uint16_t crc, const uint8_t* data, size_t len);
+
+// CRC блока данных целиком
+static inline uint16_t ModBus_CRC16(const uint8_t* data, size_t len)
+{
+    return ModBus_CRC16_update(MODBUS_CRC16_INIT, data, len);
+}
+
+// Отдельные реализации, используются в тестах производительности
+uint16_t ModBus_CRC16_updateBitwise(uint16_t crc, const uint8_t* data, size_t len);
+uint16_t ModBus_CRC16_updateTable(uint16_t crc, const uint8_t* data, size_t len);
+#if MODBUS_CRC_SLICING >= 8
+uint16_t ModBus_CRC16_updateSlice8(uint16_t crc, const uint8_t* data, size_t len);
+#endif
+#if MODBUS_CRC_SLICING >= 16
+uint16_t ModBus_CRC16_updateSlice16(uint16_t crc, const uint8_t* data, size_t len);
+#endif
+
+#ifdef _BENCHMARK
+void ModBus_CRC16_benchmark(); // Сравнение скорости реализаций CRC
+#endif
+/**************** Внешний интерфейс END ***************/
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,651 @@
+#define _GNU_SOURCE // pthread_setaffinity_np
+#include "modbus_farm.h"
+
+#if defined(__linux__) && defined(MODBUS_SLAVE)
+#include "modbus_tcp.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MODBUS_FARM_POLL_MS 50 // Период проверки флага остановки рабочим потоком
+
+// Функция отправки экземпляра: передача драйверу Linux и подсчет транзакций потока, context - точка подключения
+static void farm_send(void* context, uint8_t* data, size_t size)
+{
+    ModBus_FarmEndpoint_T* endpoint = (ModBus_FarmEndpoint_T*)context;
+    ModBus_FarmWorker_T* worker = endpoint->worker;
+    // Счетчик изменяет только свой поток, блокирующая операция не нужна. Увеличивается до передачи: получивший ответ Master видит его учтенным
+    atomic_store_explicit(&worker->transactions, atomic_load_explicit(&worker->transactions, memory_order_relaxed) + 1, memory_order_relaxed);
+    endpoint->send(endpoint->sendContext, data, size);
+}
+
+// Функция банка: перед чтением регистров генератор заполняет запрошенный диапазон (запись, в том числе часть FC23, не изменяется)
+static void farm_hook(void* context, uint8_t function, uint16_t address, uint16_t count)
+{
+    ModBus_FarmUnit_T* unit = (ModBus_FarmUnit_T*)context;
+    ModBus_Farm_T* farm = unit->farm;
+    if (farm->config.generator == NULL || function == WRITE_SINGLE_REGISTER || function == WRITE_MULTI_REGISTER)
+    {
+        return;
+    }
+    farm->config.generator(farm->config.generatorContext, unit->address, unit->bank.holding, address, count, ModBus_now() - farm->start);
+}
+
+// Добавление дескриптора точки подключения в epoll ее потока, 0 при успехе
+static int farm_attach(ModBus_FarmEndpoint_T* endpoint, int fd)
+{
+    if (ModBus_Linux_add(endpoint->worker->epollFd, &endpoint->port, &endpoint->para, fd, MODBUS_LINUX_SLAVE) != 0)
+    {
+        endpoint->port.para = NULL;
+        return -1;
+    }
+    endpoint->send = endpoint->para.m_SendHandlerEx;
+    endpoint->sendContext = endpoint->para.m_sendContext;
+    ModBus_attachSendHandler(&endpoint->para, farm_send, endpoint);
+    return 0;
+}
+
+static void farm_detach(ModBus_FarmEndpoint_T* endpoint)
+{
+    if (endpoint->port.para != NULL)
+    {
+        ModBus_Linux_remove(endpoint->worker->epollFd, &endpoint->port);
+        endpoint->port.para = NULL;
+    }
+}
+
+// Подключение к точке TCP: прежнее соединение, закрытое Master, заменяется, при действующем новое закрывается
+static void farm_accept(void* context, uint32_t events)
+{
+    ModBus_FarmEndpoint_T* endpoint = (ModBus_FarmEndpoint_T*)context;
+    int on = 1;
+    int fd = accept(endpoint->peerFd, NULL, NULL);
+    (void)events;
+    if (fd < 0)
+    {
+        return;
+    }
+    if (endpoint->fd >= 0 && endpoint->port.fd >= 0)
+    {
+        close(fd);
+        return;
+    }
+    if (endpoint->fd >= 0)
+    {
+        farm_detach(endpoint);
+        close(endpoint->fd);
+        endpoint->fd = -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    ModBus_setMode(&endpoint->para, MODBUS_MODE_TCP, 0); // Сброс приема прежнего соединения
+    if (farm_attach(endpoint, fd) != 0)
+    {
+        close(fd);
+        return;
+    }
+    endpoint->fd = fd;
+}
+
+static int farm_openPty(ModBus_FarmEndpoint_T* endpoint)
+{
+    if (openpty(&endpoint->fd, &endpoint->peerFd, NULL, NULL, NULL) != 0)
+    {
+        endpoint->fd = endpoint->peerFd = -1;
+        return -1;
+    }
+    if (ModBus_Linux_configure(endpoint->fd, 0) != 0 || ModBus_Linux_configure(endpoint->peerFd, 0) != 0
+        || ttyname_r(endpoint->peerFd, endpoint->path, sizeof(endpoint->path)) != 0)
+    {
+        return -1;
+    }
+    return farm_attach(endpoint, endpoint->fd);
+}
+
+static int farm_openTcp(ModBus_FarmEndpoint_T* endpoint, uint16_t port)
+{
+    endpoint->peerFd = ModBus_TCP_listen("127.0.0.1", port);
+    if (endpoint->peerFd < 0)
+    {
+        return -1;
+    }
+    fcntl(endpoint->peerFd, F_SETFL, fcntl(endpoint->peerFd, F_GETFL) | O_NONBLOCK);
+    endpoint->tcpPort = ModBus_TCP_localPort(endpoint->peerFd);
+    ModBus_setMode(&endpoint->para, MODBUS_MODE_TCP, 0);
+    return ModBus_Linux_watch(endpoint->worker->epollFd, &endpoint->listenWatch, endpoint->peerFd, farm_accept, endpoint);
+}
+
+int ModBus_Farm_create(ModBus_Farm_T* farm, const ModBus_FarmConfig_T* config)
+{
+    size_t units = config->unitsPerEndpoint;
+    size_t registers = config->registers;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    ModBus_Setting_T setting = { 0 };
+
+    memset(farm, 0, sizeof(*farm));
+    farm->config = *config;
+    farm->endpointsN = config->ptyEndpoints + config->tcpEndpoints;
+    if (farm->endpointsN == 0 || units == 0 || units > MODBUS_MAX_UNIT || registers == 0)
+    {
+        return -1;
+    }
+    cpus = cpus > 0 ? cpus : 1;
+    farm->workersN = config->workers > 0 ? config->workers : (size_t)cpus;
+    farm->workersN = farm->workersN < farm->endpointsN ? farm->workersN : farm->endpointsN; // Поток без точек подключения не нужен
+    farm->workers = (ModBus_FarmWorker_T*)calloc(farm->workersN, sizeof(ModBus_FarmWorker_T));
+    farm->endpoints = (ModBus_FarmEndpoint_T*)calloc(farm->endpointsN, sizeof(ModBus_FarmEndpoint_T));
+    farm->slaves = (ModBus_SlaveUnit_T*)calloc(farm->endpointsN * units, sizeof(ModBus_SlaveUnit_T));
+    farm->units = (ModBus_FarmUnit_T*)calloc(farm->endpointsN * units, sizeof(ModBus_FarmUnit_T));
+    farm->registers = (uint8_t*)calloc(farm->endpointsN * units * registers, 2);
+    if (farm->workers == NULL || farm->endpoints == NULL || farm->slaves == NULL || farm->units == NULL || farm->registers == NULL)
+    {
+        ModBus_Farm_destroy(farm);
+        return -1;
+    }
+    for (size_t i = 0; i < farm->workersN; i++)
+    {
+        farm->workers[i].farm = farm;
+        farm->workers[i].cpu = i % (size_t)cpus;
+        farm->workers[i].epollFd = ModBus_Linux_create();
+        atomic_init(&farm->workers[i].transactions, 0);
+    }
+    for (size_t i = 0; i < farm->endpointsN; i++)
+    {
+        farm->endpoints[i].fd = farm->endpoints[i].peerFd = -1;
+        farm->endpoints[i].listenWatch.fd = -1;
+    }
+
+    setting.address = 0x01;
+    setting.baudRate = config->baudRate > 0 ? config->baudRate : 115200;
+    for (size_t i = 0; i < farm->endpointsN; i++)
+    {
+        ModBus_FarmEndpoint_T* endpoint = farm->endpoints + i;
+        ModBus_SlaveUnit_T* slaves = farm->slaves + i * units;
+        endpoint->worker = farm->workers + i % farm->workersN;
+        endpoint->worker->endpointsN++;
+        ModBus_setup(&endpoint->para, setting);
+        for (size_t u = 0; u < units; u++)
+        {
+            ModBus_FarmUnit_T* unit = farm->units + i * units + u;
+            unit->farm = farm;
+            unit->address = (uint8_t)(u + 1);
+            unit->bank.holding = farm->registers + 2 * registers * (i * units + u);
+            unit->bank.holdingCount = (uint16_t)registers;
+            unit->bank.input = unit->bank.holding;
+            unit->bank.inputCount = (uint16_t)registers;
+            unit->bank.hook = farm_hook;
+            unit->bank.context = unit;
+            slaves[u].address = unit->address;
+            slaves[u].delayUs = config->delayUs;
+            slaves[u].bank = &unit->bank;
+        }
+        ModBus_attachUnits(&endpoint->para, &endpoint->table, slaves, units);
+
+        if (endpoint->worker->epollFd < 0)
+        {
+            ModBus_Farm_destroy(farm);
+            return -1;
+        }
+        if (i < config->ptyEndpoints)
+        {
+            endpoint->type = MODBUS_FARM_PTY;
+            if (farm_openPty(endpoint) != 0)
+            {
+                ModBus_Farm_destroy(farm);
+                return -1;
+            }
+        }
+        else
+        {
+            uint16_t port = config->basePort > 0 ? (uint16_t)(config->basePort + (i - config->ptyEndpoints)) : 0;
+            endpoint->type = MODBUS_FARM_TCP;
+            if (farm_openTcp(endpoint, port) != 0)
+            {
+                ModBus_Farm_destroy(farm);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+// Цикл рабочего потока: события только своих точек подключения
+static void* farm_worker(void* context)
+{
+    ModBus_FarmWorker_T* worker = (ModBus_FarmWorker_T*)context;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(worker->cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set); // Без закрепления поток работает на любом ядре
+    while (atomic_load_explicit(&worker->farm->running, memory_order_acquire))
+    {
+        ModBus_Linux_run(worker->epollFd, MODBUS_FARM_POLL_MS);
+    }
+    return NULL;
+}
+
+int ModBus_Farm_start(ModBus_Farm_T* farm)
+{
+    farm->start = ModBus_now();
+    farm->reportTime = farm->start;
+    atomic_store_explicit(&farm->running, 1, memory_order_release);
+    for (farm->started = 0; farm->started < farm->workersN; farm->started++)
+    {
+        if (pthread_create(&farm->workers[farm->started].thread, NULL, farm_worker, farm->workers + farm->started) != 0)
+        {
+            ModBus_Farm_stop(farm);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+uint64_t ModBus_Farm_report(ModBus_Farm_T* farm)
+{
+    uint64_t now = ModBus_now();
+    double seconds = (double)(now - farm->reportTime) / 1e6;
+    uint64_t total = 0;
+    seconds = seconds > 0 ? seconds : 1e-6;
+    for (size_t i = 0; i < farm->workersN; i++)
+    {
+        ModBus_FarmWorker_T* worker = farm->workers + i;
+        uint64_t transactions = atomic_load_explicit(&worker->transactions, memory_order_relaxed);
+        uint64_t delta = transactions - worker->reported;
+        worker->reported = transactions;
+        total += delta;
+        printf("farm,%zu,%zu,%zu,%llu,%.0f\n", i, worker->cpu, worker->endpointsN, (unsigned long long)delta, delta / seconds);
+    }
+    printf("farm,total,-,%zu,%llu,%.0f\n", farm->endpointsN, (unsigned long long)total, total / seconds);
+    farm->reportTime = now;
+    return total;
+}
+
+void ModBus_Farm_stop(ModBus_Farm_T* farm)
+{
+    atomic_store_explicit(&farm->running, 0, memory_order_release);
+    for (size_t i = 0; i < farm->started; i++)
+    {
+        pthread_join(farm->workers[i].thread, NULL);
+    }
+    farm->started = 0;
+}
+
+void ModBus_Farm_destroy(ModBus_Farm_T* farm)
+{
+    for (size_t i = 0; farm->endpoints != NULL && i < farm->endpointsN; i++)
+    {
+        ModBus_FarmEndpoint_T* endpoint = farm->endpoints + i;
+        if (endpoint->worker == NULL)
+        {
+            break; // Дальше точки подключения не создавались
+        }
+        farm_detach(endpoint);
+        ModBus_Linux_unwatch(endpoint->worker->epollFd, &endpoint->listenWatch);
+        if (endpoint->fd >= 0)
+        {
+            close(endpoint->fd);
+        }
+        if (endpoint->peerFd >= 0)
+        {
+            close(endpoint->peerFd);
+        }
+    }
+    for (size_t i = 0; farm->workers != NULL && i < farm->workersN; i++)
+    {
+        if (farm->workers[i].epollFd >= 0)
+        {
+            close(farm->workers[i].epollFd);
+        }
+    }
+    free(farm->workers);
+    free(farm->endpoints);
+    free(farm->slaves);
+    free(farm->units);
+    free(farm->registers);
+    farm->workers = NULL;
+    farm->endpoints = NULL;
+    farm->slaves = NULL;
+    farm->units = NULL;
+    farm->registers = NULL;
+}
+
+void ModBus_Farm_ramp(void* context, uint8_t unit, uint8_t* holding, uint16_t address, uint16_t count, uint64_t now)
+{
+    uint16_t base = (uint16_t)(now / 1000 + unit * 256u + address);
+    (void)context;
+    for (uint16_t i = 0; i < count; i++)
+    {
+        ModBus_bankWrite(holding, address + i, (uint16_t)(base + i));
+    }
+}
+
+void ModBus_Farm_script(void* context, uint8_t unit, uint8_t* holding, uint16_t address, uint16_t count, uint64_t now)
+{
+    const ModBus_FarmScript_T* script = (const ModBus_FarmScript_T*)context;
+    uint64_t at = now / 1000;
+    (void)unit;
+    at = script->period > 0 ? at % script->period : at;
+    // Сначала шаги, еще не наступившие в этом периоде (значения предыдущего периода), затем наступившие: последний шаг регистра остается
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (size_t i = 0; i < script->n; i++)
+        {
+            const ModBus_FarmStep_T* step = script->steps + i;
+            if ((step->at <= at) == pass && step->address >= address && step->address - address < count)
+            {
+                ModBus_bankWrite(holding, step->address, step->value);
+            }
+        }
+    }
+}
+
+#ifdef MODBUS_FARM_MAIN
+#include <signal.h>
+#include <time.h>
+
+static volatile sig_atomic_t s_farmInterrupted = 0;
+
+static void farm_interrupt(int signal)
+{
+    (void)signal;
+    s_farmInterrupted = 1;
+}
+
+int main(int argc, char** argv)
+{
+    static ModBus_Farm_T farm;
+    ModBus_FarmConfig_T config = { 0 };
+    unsigned seconds = 0;
+    int option;
+
+    config.ptyEndpoints = 0;
+    config.tcpEndpoints = 16;
+    config.unitsPerEndpoint = 32;
+    config.registers = 64;
+    config.generator = ModBus_Farm_ramp;
+    while ((option = getopt(argc, argv, "w:p:t:u:r:d:P:s:")) != -1)
+    {
+        switch (option)
+        {
+        case 'w': config.workers = strtoul(optarg, NULL, 0); break;
+        case 'p': config.ptyEndpoints = strtoul(optarg, NULL, 0); break;
+        case 't': config.tcpEndpoints = strtoul(optarg, NULL, 0); break;
+        case 'u': config.unitsPerEndpoint = (uint8_t)strtoul(optarg, NULL, 0); break;
+        case 'r': config.registers = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 'd': config.delayUs = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'P': config.basePort = (uint16_t)strtoul(optarg, NULL, 0); break;
+        case 's': seconds = (unsigned)strtoul(optarg, NULL, 0); break;
+        default:
+            fprintf(stderr, "usage: %s [-w workers] [-p pty] [-t tcp] [-u units] [-r registers] [-d delay_us] [-P base_port] [-s seconds]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    ModBus_setClock(ModBus_Linux_clock);
+    if (ModBus_Farm_create(&farm, &config) != 0)
+    {
+        fprintf(stderr, "modbus_farm: cannot create endpoints\n");
+        return 1;
+    }
+    for (size_t i = 0; i < farm.endpointsN; i++)
+    {
+        if (farm.endpoints[i].type == MODBUS_FARM_PTY)
+            printf("endpoint,%zu,pty,%s\n", i, farm.endpoints[i].path);
+        else
+            printf("endpoint,%zu,tcp,127.0.0.1:%u\n", i, farm.endpoints[i].tcpPort);
+    }
+    printf("farm,worker,cpu,endpoints,txns,txn_per_s\n");
+    fflush(stdout);
+    signal(SIGINT, farm_interrupt);
+    signal(SIGTERM, farm_interrupt);
+    if (ModBus_Farm_start(&farm) != 0)
+    {
+        ModBus_Farm_destroy(&farm);
+        return 1;
+    }
+    for (unsigned elapsed = 0; !s_farmInterrupted && (seconds == 0 || elapsed < seconds); elapsed++)
+    {
+        struct timespec pause = { 1, 0 };
+        nanosleep(&pause, NULL);
+        ModBus_Farm_report(&farm);
+        fflush(stdout);
+    }
+    ModBus_Farm_stop(&farm);
+    ModBus_Farm_destroy(&farm);
+    return 0;
+}
+#endif // MODBUS_FARM_MAIN
+
+#if defined(_BENCHMARK) && !defined(MODBUS_FARM_MAIN)
+#include <assert.h>
+#include <sys/epoll.h>
+
+#define MODBUS_FARM_BENCH_ENDPOINTS 64 // Точек подключения TCP
+#define MODBUS_FARM_BENCH_UNITS 8
+#define MODBUS_FARM_BENCH_DEPTH 4 // Запросов без ответа на соединение
+#define MODBUS_FARM_BENCH_MS 500 // Длительность каждой комбинации
+#define MODBUS_FARM_BENCH_RESPONSE (MODBUS_MBAP_SIZE + 2 + 2 * 8) // Ответ на чтение 8 регистров
+
+// Запрос Modbus TCP FC03 чтения 8 регистров устройства unit
+static void farm_request(int fd, uint16_t transaction, uint8_t unit)
+{
+    uint8_t frame[12] = { (uint8_t)(transaction >> 8), (uint8_t)transaction, 0, 0, 0, 6, unit, READ_REGISTER, 0, 0, 0, 8 };
+    assert(send(fd, frame, sizeof(frame), MSG_NOSIGNAL) == sizeof(frame));
+}
+
+static void farm_benchRun(size_t workers)
+{
+    static ModBus_Farm_T farm;
+    static int fds[MODBUS_FARM_BENCH_ENDPOINTS];
+    static uint8_t rx[MODBUS_FARM_BENCH_ENDPOINTS][4 * MODBUS_FARM_BENCH_RESPONSE];
+    static size_t rxLen[MODBUS_FARM_BENCH_ENDPOINTS];
+    ModBus_FarmConfig_T config = { 0 };
+    uint64_t done = 0, failed = 0, minWorker = UINT64_MAX, maxWorker = 0;
+    uint64_t begin, elapsed;
+    uint16_t transaction = 0;
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+
+    config.workers = workers;
+    config.tcpEndpoints = MODBUS_FARM_BENCH_ENDPOINTS;
+    config.unitsPerEndpoint = MODBUS_FARM_BENCH_UNITS;
+    config.registers = 16;
+    config.generator = ModBus_Farm_ramp;
+    assert(ModBus_Farm_create(&farm, &config) == 0 && ModBus_Farm_start(&farm) == 0);
+    for (size_t i = 0; i < MODBUS_FARM_BENCH_ENDPOINTS; i++)
+    {
+        struct sockaddr_in addr;
+        struct epoll_event ev;
+        int on = 1;
+        fds[i] = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(farm.endpoints[i].tcpPort);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        assert(connect(fds[i], (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u64 = i;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fds[i], &ev);
+        rxLen[i] = 0;
+    }
+    begin = ModBus_now();
+    for (size_t i = 0; i < MODBUS_FARM_BENCH_ENDPOINTS; i++)
+    {
+        for (int d = 0; d < MODBUS_FARM_BENCH_DEPTH; d++)
+        {
+            farm_request(fds[i], transaction, (uint8_t)(transaction % MODBUS_FARM_BENCH_UNITS + 1));
+            transaction++;
+        }
+    }
+    while ((elapsed = ModBus_now() - begin) < MODBUS_FARM_BENCH_MS * 1000u)
+    {
+        struct epoll_event events[16];
+        int n = epoll_wait(epollFd, events, 16, 10);
+        for (int e = 0; e < n; e++)
+        {
+            size_t i = (size_t)events[e].data.u64;
+            ssize_t len = recv(fds[i], rx[i] + rxLen[i], sizeof(rx[i]) - rxLen[i], MSG_DONTWAIT);
+            if (len <= 0)
+            {
+                continue;
+            }
+            rxLen[i] += (size_t)len;
+            while (rxLen[i] >= MODBUS_FARM_BENCH_RESPONSE)
+            {
+                if (rx[i][MODBUS_MBAP_SIZE] != READ_REGISTER)
+                {
+                    failed++;
+                }
+                done++;
+                rxLen[i] -= MODBUS_FARM_BENCH_RESPONSE;
+                memmove(rx[i], rx[i] + MODBUS_FARM_BENCH_RESPONSE, rxLen[i]);
+                farm_request(fds[i], transaction, (uint8_t)(transaction % MODBUS_FARM_BENCH_UNITS + 1));
+                transaction++;
+            }
+        }
+    }
+    ModBus_Farm_stop(&farm);
+    for (size_t i = 0; i < farm.workersN; i++)
+    {
+        uint64_t transactions = atomic_load_explicit(&farm.workers[i].transactions, memory_order_relaxed);
+        minWorker = transactions < minWorker ? transactions : minWorker;
+        maxWorker = transactions > maxWorker ? transactions : maxWorker;
+    }
+    printf("farm_bench,%zu,%u,%u,%llu,%.0f,%llu,%llu,%llu\n", farm.workersN, MODBUS_FARM_BENCH_ENDPOINTS, MODBUS_FARM_BENCH_ENDPOINTS * MODBUS_FARM_BENCH_UNITS,
+        (unsigned long long)done, done * 1e6 / (double)elapsed, (unsigned long long)minWorker, (unsigned long long)maxWorker, (unsigned long long)failed);
+    for (size_t i = 0; i < MODBUS_FARM_BENCH_ENDPOINTS; i++)
+    {
+        close(fds[i]);
+    }
+    close(epollFd);
+    ModBus_Farm_destroy(&farm);
+}
+
+void ModBus_Farm_benchmark()
+{
+    static const size_t workers[] = { 1, 2, 4 };
+    ModBus_setClock(ModBus_Linux_clock);
+    printf("farm_bench,workers,endpoints,units,txns,txn_per_s,min_worker_txns,max_worker_txns,failed\n");
+    for (size_t w = 0; w < sizeof(workers) / sizeof(workers[0]); w++)
+    {
+        farm_benchRun(workers[w]);
+    }
+    ModBus_setClock(NULL);
+}
+#endif // _BENCHMARK
+
+#if defined(_UNIT_TEST) && defined(MODBUS_MASTER) && !defined(MODBUS_FARM_MAIN)
+#include <assert.h>
+
+static const ModBus_FarmStep_T s_farmSteps[] = { { 0, 1, 0x1111 }, { 0, 2, 0x2222 } };
+static ModBus_FarmScript_T s_farmScript = { s_farmSteps, 2, 3600000 };
+static uint16_t s_farmRtu[4], s_farmTcp[4];
+static uint16_t s_farmReads, s_farmWrites;
+
+static void farm_readResponse(void* context, uint16_t* data, uint16_t count)
+{
+    assert(count == 4);
+    memcpy(context, data, 4 * sizeof(uint16_t));
+    s_farmReads++;
+}
+
+static void farm_readWriteResponse(uint16_t* data, uint16_t count)
+{
+    assert(count == 1 && data[0] == 0);
+    s_farmReads++;
+}
+
+static void farm_writeResponse(uint16_t address, uint16_t count)
+{
+    (void)address;
+    (void)count;
+    s_farmWrites++;
+}
+
+void ModBus_Farm_unitTest()
+{
+    static ModBus_Farm_T farm;
+    static ModBus_parameter rtu, tcp;
+    static ModBus_Linux_Port_T rtuPort, tcpPort;
+    ModBus_FarmConfig_T config = { 0 };
+    ModBus_Setting_T setting = { 0 };
+    uint64_t deadline;
+    int epollFd, rtuFd, tcpFd;
+
+    ModBus_setClock(ModBus_Linux_clock);
+    config.workers = 2;
+    config.ptyEndpoints = 2;
+    config.tcpEndpoints = 1;
+    config.unitsPerEndpoint = 3;
+    config.registers = 4;
+    config.generator = ModBus_Farm_script;
+    config.generatorContext = &s_farmScript;
+    assert(ModBus_Farm_create(&farm, &config) == 0 && farm.workersN == 2);
+    assert(farm.workers[0].endpointsN == 2 && farm.endpoints[2].tcpPort != 0);
+    assert(ModBus_Farm_start(&farm) == 0);
+
+    setting.address = 0x01;
+    setting.baudRate = 115200;
+    ModBus_setup(&rtu, setting);
+    ModBus_setup(&tcp, setting);
+    rtuFd = open(farm.endpoints[1].path, O_RDWR | O_NOCTTY | O_CLOEXEC);
+    assert(rtuFd >= 0 && ModBus_Linux_configure(rtuFd, 0) == 0);
+    tcpFd = ModBus_TCP_connect(&tcp, "127.0.0.1", farm.endpoints[2].tcpPort, 1);
+    assert(tcpFd >= 0);
+    epollFd = ModBus_Linux_create();
+    assert(ModBus_Linux_add(epollFd, &rtuPort, &rtu, rtuFd, MODBUS_LINUX_MASTER) == 0);
+    assert(ModBus_Linux_add(epollFd, &tcpPort, &tcp, tcpFd, MODBUS_LINUX_MASTER) == 0);
+
+    s_farmReads = s_farmWrites = 0;
+    ModBus_getUnitRegisterEx(&rtu, 0x03, 0, 4, farm_readResponse, s_farmRtu);
+    ModBus_setUnitRegister(&tcp, 0x02, 3, 0x4444, farm_writeResponse);
+    ModBus_getUnitRegisterEx(&tcp, 0x02, 0, 4, farm_readResponse, s_farmTcp);
+    ModBus_Linux_service(&rtuPort);
+    ModBus_Linux_service(&tcpPort);
+    deadline = ModBus_now() + 2000000;
+    while ((s_farmReads < 2 || s_farmWrites < 1) && ModBus_now() < deadline)
+    {
+        ModBus_Linux_run(epollFd, 10);
+    }
+    assert(s_farmReads == 2 && s_farmWrites == 1);
+    // Регистры 1 и 2 - из сценария, 3 - запись Master, которую сценарий не меняет
+    assert(s_farmRtu[0] == 0 && s_farmRtu[1] == 0x1111 && s_farmRtu[2] == 0x2222 && s_farmRtu[3] == 0);
+    assert(s_farmTcp[0] == 0 && s_farmTcp[1] == 0x1111 && s_farmTcp[2] == 0x2222 && s_farmTcp[3] == 0x4444);
+    printf("farm,worker,cpu,endpoints,txns,txn_per_s\n");
+    assert(ModBus_Farm_report(&farm) == 3);
+    assert(atomic_load(&farm.workers[0].transactions) == 2 && atomic_load(&farm.workers[1].transactions) == 1);
+
+    // FC23: запись в регистр сценария сохраняется, генератор заполняет только читаемый диапазон
+    {
+        static const uint16_t value = 0x5555;
+        ModBus_readWriteUnitRegisters(&rtu, 0x03, 0, 1, 1, &value, 1, farm_readWriteResponse);
+        ModBus_Linux_service(&rtuPort);
+        deadline = ModBus_now() + 2000000;
+        while (s_farmReads < 3 && ModBus_now() < deadline)
+        {
+            ModBus_Linux_run(epollFd, 10);
+        }
+        assert(s_farmReads == 3 && ModBus_bankRead(farm.units[1 * 3 + 2].bank.holding, 1) == value);
+    }
+
+    ModBus_Linux_remove(epollFd, &rtuPort);
+    ModBus_Linux_remove(epollFd, &tcpPort);
+    close(rtuFd);
+    close(tcpFd);
+    close(epollFd);
+    ModBus_Farm_stop(&farm);
+    ModBus_Farm_destroy(&farm);
+    printf("Modbus farm: %u reads, %u writes, %zu workers\n", s_farmReads, s_farmWrites, farm.workersN);
+    ModBus_setClock(NULL);
+}
+#endif // _UNIT_TEST
+
+#endif // __linux__ && MODBUS_SLAVE
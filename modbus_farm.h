@@ -0,0 +1,160 @@
+#ifndef MODBUS_FARM_H_
+#define MODBUS_FARM_H_
+/**** Имитатор парка устройств Slave ****
+** Тысячи имитируемых устройств для нагрузочной проверки Master и шлюзов на одной машине Linux.
+** Точка подключения (endpoint) - pty или loopback-порт Modbus TCP - обслуживается одним экземпляром Slave
+** с таблицей устройств (ModBus_attachUnits): адреса 1..unitsPerEndpoint, у каждого свой банк регистров.
+** Точки подключения распределяются между рабочими потоками, у каждого потока свой epoll (ModBus_Linux_run),
+** поток закрепляется за ядром. Общих данных между потоками нет, кроме счетчиков транзакций.
+** Значения регистров задает генератор: перед каждым чтением банка он заполняет запрошенный диапазон
+** (ModBus_Farm_ramp - значение зависит от времени, ModBus_Farm_script - сценарий по таблице шагов, или своя функция).
+** Запись Master сохраняется в банке, пока генератор не изменит тот же регистр.
+** Как использовать:
+****** Вызов ModBus_setClock(ModBus_Linux_clock)
+****** Заполнение ModBus_FarmConfig_T, вызов ModBus_Farm_create; пути pty и порты TCP - в farm.endpoints[i].path/.tcpPort
+****** Вызов ModBus_Farm_start, затем периодически ModBus_Farm_report для вывода производительности потоков
+****** ModBus_Farm_stop и ModBus_Farm_destroy по завершении
+** Отдельная программа собирается с MODBUS_FARM_MAIN (без main.c):
+****** gcc -std=gnu11 -O2 -DMODBUS_FARM_MAIN modbus.c modbus_crc.c modbus_linux.c modbus_tcp.c modbus_trace.c modbus_farm.c -o modbus_farm -lpthread -lutil
+****** modbus_farm -w потоков -p pty -t tcp -u устройств -r регистров -d задержка_мкс -P первый_порт -s секунд
+** Собирается только для Linux.
+*/
+
+#include "modbus.h"
+#include "modbus_linux.h"
+
+#if defined(__linux__) && defined(MODBUS_SLAVE)
+#include <pthread.h>
+
+#define MODBUS_FARM_PATH_SIZE 64
+
+typedef enum {
+    MODBUS_FARM_PTY = 0, // Псевдотерминал, Master открывает path
+    MODBUS_FARM_TCP = 1, // Порт Modbus TCP на 127.0.0.1, одно подключение одновременно
+} MODBUS_FARM_ENDPOINT_TYPE;
+
+/** Генератор значений регистров **/
+/*** Параметры ***
+** context: ModBus_FarmConfig_T.generatorContext
+** unit: Адрес устройства
+** holding: Банк устройства в порядке передачи (ModBus_bankWrite), регистр 0 - первый
+** address, count: Запрошенный диапазон
+** now: Время от ModBus_Farm_start, мкс
+***/
+typedef void(*ModBus_FarmGenerator_T)(void* context, uint8_t unit, uint8_t* holding, uint16_t address, uint16_t count, uint64_t now);
+
+typedef struct _MODBUS_FARM_STEP_T { // Шаг сценария: с момента at регистр address имеет значение value
+    uint32_t at; // Мс от начала периода
+    uint16_t address;
+    uint16_t value;
+} ModBus_FarmStep_T;
+
+typedef struct _MODBUS_FARM_SCRIPT_T { // Сценарий для ModBus_Farm_script, шаги по возрастанию at
+    const ModBus_FarmStep_T* steps;
+    size_t n;
+    uint32_t period; // Период повторения, мс
+} ModBus_FarmScript_T;
+
+typedef struct _MODBUS_FARM_CONFIG_T {
+    size_t workers; // Рабочих потоков, 0 - по количеству ядер
+    size_t ptyEndpoints;
+    size_t tcpEndpoints;
+    uint16_t basePort; // Порт первой точки TCP, следующие - по порядку; 0 - выбираются системой
+    uint8_t unitsPerEndpoint; // Устройств на точку подключения, 1-247
+    uint16_t registers; // Регистров хранения (и входных, та же память) на устройство, с адреса 0
+    uint32_t baudRate; // Скорость для тишины T3.5 кадров RTU
+    uint32_t delayUs; // Имитация времени ответа каждого устройства, мкс
+    ModBus_FarmGenerator_T generator; // NULL - значения меняет только Master
+    void* generatorContext;
+} ModBus_FarmConfig_T;
+
+typedef struct _MODBUS_FARM_UNIT_T { // Имитируемое устройство
+    ModBus_RegisterBank_T bank;
+    struct _MODBUS_FARM_T* farm;
+    uint8_t address;
+} ModBus_FarmUnit_T;
+
+typedef struct _MODBUS_FARM_ENDPOINT_T {
+    struct _MODBUS_FARM_WORKER_T* worker;
+    uint8_t type; // MODBUS_FARM_ENDPOINT_TYPE
+    ModBus_parameter para;
+    ModBus_Linux_Port_T port;
+    int fd; // pty: сторона имитатора; TCP: подключение, -1 - нет
+    int peerFd; // pty: сторона Master, держится открытой, чтобы отключение Master не закрывало pty; TCP: сокет приема подключений
+    ModBus_Linux_Watch_T listenWatch;
+    char path[MODBUS_FARM_PATH_SIZE]; // pty: путь для Master
+    uint16_t tcpPort;
+    ModBus_SlaveUnits_T table;
+    void(*send)(void*, uint8_t*, size_t); // Функция отправки драйвера Linux, вызывается из функции подсчета транзакций
+    void* sendContext;
+} ModBus_FarmEndpoint_T;
+
+typedef struct _MODBUS_FARM_WORKER_T {
+    struct _MODBUS_FARM_T* farm;
+    pthread_t thread;
+    int epollFd;
+    size_t cpu; // Ядро, за которым закреплен поток
+    size_t endpointsN;
+    _Atomic(uint64_t) transactions; // Отправленных ответов, изменяется только потоком
+    uint64_t reported; // transactions на момент предыдущего ModBus_Farm_report
+} ModBus_FarmWorker_T;
+
+typedef struct _MODBUS_FARM_T {
+    ModBus_FarmConfig_T config;
+    ModBus_FarmWorker_T* workers;
+    size_t workersN;
+    size_t started; // Запущенных потоков
+    ModBus_FarmEndpoint_T* endpoints;
+    size_t endpointsN;
+    ModBus_SlaveUnit_T* slaves; // Таблицы устройств точек подключения подряд
+    ModBus_FarmUnit_T* units;
+    uint8_t* registers;
+    _Atomic(uint8_t) running;
+    uint64_t start; // ModBus_now() запуска
+    uint64_t reportTime; // ModBus_now() предыдущего ModBus_Farm_report
+} ModBus_Farm_T;
+
+/************ Внешний интерфейс BEGIN ***********/
+
+/** Создание парка **/
+/*** Параметры ***
+** config: Конфигурация, копируется
+** Возвращает 0 при успехе, -1 при ошибке (недопустимая конфигурация, нет памяти, pty или порт недоступны)
+** Примечание: Точки подключения распределяются между потоками поровну, сначала pty, затем TCP.
+***/
+int ModBus_Farm_create(ModBus_Farm_T* farm, const ModBus_FarmConfig_T* config);
+
+// Запуск рабочих потоков, 0 при успехе
+int ModBus_Farm_start(ModBus_Farm_T* farm);
+
+/** Вывод производительности потоков **/
+/*** Параметры ***
+** Строки CSV с префиксом "farm" (worker,cpu,endpoints,txns,txn_per_s) за время с предыдущего вызова и итог "farm,total,...".
+** Возвращает количество транзакций всех потоков за это время.
+***/
+uint64_t ModBus_Farm_report(ModBus_Farm_T* farm);
+
+// Остановка и ожидание рабочих потоков
+void ModBus_Farm_stop(ModBus_Farm_T* farm);
+
+// Закрытие точек подключения и освобождение памяти (после ModBus_Farm_stop)
+void ModBus_Farm_destroy(ModBus_Farm_T* farm);
+
+// Генератор: значение регистра - мс от запуска + адрес устройства * 256 + адрес регистра (изменяется каждую мс), context не используется
+void ModBus_Farm_ramp(void* context, uint8_t unit, uint8_t* holding, uint16_t address, uint16_t count, uint64_t now);
+
+// Генератор по сценарию, context - ModBus_FarmScript_T. Регистр имеет значение последнего наступившего в периоде шага,
+// до первого шага - значение последнего шага предыдущего периода; регистры без шагов не изменяются
+void ModBus_Farm_script(void* context, uint8_t unit, uint8_t* holding, uint16_t address, uint16_t count, uint64_t now);
+
+#if defined(_BENCHMARK) && !defined(MODBUS_FARM_MAIN)
+void ModBus_Farm_benchmark(); // Транзакций в секунду в зависимости от количества рабочих потоков
+#endif
+#if defined(_UNIT_TEST) && defined(MODBUS_MASTER) && !defined(MODBUS_FARM_MAIN)
+void ModBus_Farm_unitTest(); // Два потока: чтение через pty, запись и чтение через TCP, сценарий значений
+#endif
+/**************** Внешний интерфейс END ***************/
+
+#endif // __linux__ && MODBUS_SLAVE
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef MODBUS_FRAMES_HPP_
+#define MODBUS_FRAMES_HPP_
+/**** Кадры запросов Master при компиляции (C++14) ****
+** constexpr-версии ModBus_prepareRead и ModBus_prepareWrite: кадр циклического опроса с CRC (RTU)
+** или заголовком MBAP (Modbus TCP) хранится в памяти программы, на устройстве не кодируется.
+** Результат - тот же ModBus_Prepared_T, отправляется ModBus_submitRead/ModBus_submitWrite.
+** Как использовать:
+****** static constexpr ModBus_Prepared_T poll = modbus::prepareRead(MODBUS_MODE_RTU, 0x01, READ_REGISTER, 0, 10);
+****** static_assert(poll.size != 0, "...");
+****** ModBus_submitRead(&master, &poll, handler, context);
+** Количество проверяется по MODBUS_REGISTER_LIMIT и MODBUS_MAX_WRITE_REGISTERS, недопустимый запрос имеет size == 0.
+** Ограничение register_access_limit экземпляра проверяется при отправке.
+*/
+
+#include "modbus.h"
+#include "modbus_crc.h"
+
+#ifdef MODBUS_MASTER
+
+namespace modbus {
+
+// CRC-16/MODBUS побитово (ModBus_CRC16_updateBitwise), при компиляции скорость не важна
+constexpr uint16_t crc16(const uint8_t* data, size_t len, uint16_t crc = MODBUS_CRC16_INIT)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        crc = (uint16_t)(crc ^ data[i]);
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (uint16_t)((crc >> 1) ^ 0xA001u) : (uint16_t)(crc >> 1);
+        }
+    }
+    return crc;
+}
+
+namespace detail {
+
+// Заголовок кадра (ModBus_beginFrame), идентификатор транзакции TCP подставляется при отправке. Возвращает длину заголовка
+constexpr size_t beginFrame(ModBus_Prepared_T& prepared, MODBUS_MODE_TYPE mode, uint8_t unit)
+{
+    size_t size = 0;
+    if (mode == MODBUS_MODE_TCP)
+    {
+        prepared.data[size++] = 0; // Идентификатор транзакции
+        prepared.data[size++] = 0;
+        prepared.data[size++] = 0; // Идентификатор протокола
+        prepared.data[size++] = 0;
+        prepared.data[size++] = 0; // Длина, заполняется endFrame
+        prepared.data[size++] = 0;
+    }
+    prepared.data[size++] = unit;
+    return size;
+}
+
+// Конец кадра (ModBus_endFrame): CRC для RTU, длина MBAP для TCP. Возвращает длину кадра
+constexpr uint16_t endFrame(ModBus_Prepared_T& prepared, MODBUS_MODE_TYPE mode, size_t size)
+{
+    if (mode == MODBUS_MODE_TCP)
+    {
+        prepared.data[4] = (uint8_t)(((size - 6) >> 8) & 0xFF);
+        prepared.data[5] = (uint8_t)((size - 6) & 0xFF);
+        return (uint16_t)size;
+    }
+    uint16_t crc = crc16(prepared.data, size);
+    prepared.data[size++] = (uint8_t)(crc & 0xFF);
+    prepared.data[size++] = (uint8_t)((crc >> 8) & 0xFF);
+    return (uint16_t)size;
+}
+
+// Служебные байты кадра (ModBus_frameOverhead)
+constexpr uint16_t frameOverhead(MODBUS_MODE_TYPE mode)
+{
+    return mode == MODBUS_MODE_TCP ? 7 : 3;
+}
+
+// PDU запроса: код функции, первый регистр, количество. Возвращает длину кадра
+constexpr size_t putRequest(ModBus_Prepared_T& prepared, size_t size, MODBUS_FUNCTION_TYPE type, uint16_t address, uint16_t count)
+{
+    prepared.data[size++] = (uint8_t)type;
+    prepared.data[size++] = (uint8_t)((address >> 8) & 0xFF);
+    prepared.data[size++] = (uint8_t)(address & 0xFF);
+    prepared.data[size++] = (uint8_t)((count >> 8) & 0xFF);
+    prepared.data[size++] = (uint8_t)(count & 0xFF);
+    return size;
+}
+
+} // namespace detail
+
+/** Подготовка чтения при компиляции **/
+/*** Параметры ***
+** mode: Режим экземпляра Master, которым отправляется запрос
+** type: READ_REGISTER или READ_INPUT_REGISTER
+** Возвращает запрос, как ModBus_prepareRead; size == 0 - недопустимый тип или количество
+***/
+constexpr ModBus_Prepared_T prepareRead(MODBUS_MODE_TYPE mode, uint8_t unit, MODBUS_FUNCTION_TYPE type, uint16_t address, uint16_t count)
+{
+    ModBus_Prepared_T prepared{};
+    if ((type != READ_REGISTER && type != READ_INPUT_REGISTER) || count == 0 || count > MODBUS_REGISTER_LIMIT)
+    {
+        return prepared;
+    }
+    size_t size = detail::beginFrame(prepared, mode, unit);
+    size = detail::putRequest(prepared, size, type, address, count);
+    prepared.size = detail::endFrame(prepared, mode, size);
+    prepared.responseSize = (uint16_t)(detail::frameOverhead(mode) + 2 + 2 * count);
+    prepared.mode = (uint8_t)mode;
+    prepared.unit = unit;
+    prepared.type = (uint8_t)type;
+    prepared.address = address;
+    prepared.count = count;
+    return prepared;
+}
+
+/** Подготовка записи FC16 при компиляции **/
+/*** Параметры ***
+** Как ModBus_prepareWrite: заголовок и его CRC сохраняются, данные регистров задаются в ModBus_submitWrite
+***/
+constexpr ModBus_Prepared_T prepareWrite(MODBUS_MODE_TYPE mode, uint8_t unit, uint16_t address, uint16_t count)
+{
+    ModBus_Prepared_T prepared{};
+    if (count == 0 || count > MODBUS_MAX_WRITE_REGISTERS || count > MODBUS_REGISTER_LIMIT)
+    {
+        return prepared;
+    }
+    size_t size = detail::beginFrame(prepared, mode, unit);
+    size = detail::putRequest(prepared, size, WRITE_MULTI_REGISTER, address, count);
+    prepared.data[size++] = (uint8_t)(count * 2);
+    prepared.headerSize = (uint8_t)size;
+    prepared.headerCrc = crc16(prepared.data, size);
+    if (mode == MODBUS_MODE_TCP)
+    {
+        prepared.size = detail::endFrame(prepared, mode, size + 2 * count);
+    }
+    else
+    {
+        prepared.size = (uint16_t)(size + 2 * count + 2);
+    }
+    prepared.responseSize = (uint16_t)(detail::frameOverhead(mode) + 5);
+    prepared.mode = (uint8_t)mode;
+    prepared.unit = unit;
+    prepared.type = (uint8_t)WRITE_MULTI_REGISTER;
+    prepared.address = address;
+    prepared.count = count;
+    return prepared;
+}
+
+// Проверка при компиляции: кадр 01 03 00 00 00 0A C5 CD
+static_assert(prepareRead(MODBUS_MODE_RTU, 0x01, READ_REGISTER, 0, 10).data[6] == 0xC5
+    && prepareRead(MODBUS_MODE_RTU, 0x01, READ_REGISTER, 0, 10).data[7] == 0xCD, "CRC-16/MODBUS");
+
+} // namespace modbus
+
+#endif // MODBUS_MASTER
+
+#endif
@@ -0,0 +1,621 @@
+#include "modbus_gateway.h"
+
+#if defined(__linux__) && defined(MODBUS_MASTER)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define MODBUS_GATEWAY_EXCEPTION_ILLEGAL_FUNCTION 0x01
+#define MODBUS_GATEWAY_EXCEPTION_ILLEGAL_VALUE 0x03
+#define MODBUS_GATEWAY_EXCEPTION_BUSY 0x06
+#define MODBUS_GATEWAY_EXCEPTION_NO_RESPONSE 0x0B // Gateway Target Device Failed to Respond
+
+static void gateway_close(ModBus_GatewayClient_T* client)
+{
+    ModBus_Gateway_T* gateway = client->gateway;
+    ModBus_Linux_unwatch(gateway->epollFd, &client->watch);
+    close(client->fd);
+    client->fd = -1;
+    client->generation++;
+    gateway->queued -= client->n;
+    gateway->connected--;
+    client->head = client->n = 0;
+    client->outstanding = 0;
+    client->deficit = 0;
+    client->rxLen = 0;
+}
+
+// Ответ клиенту: заголовок MBAP с его идентификатором транзакции и PDU. Клиент, не читающий ответы, отключается
+static void gateway_reply(ModBus_GatewayClient_T* client, uint16_t transaction, uint8_t unit, const uint8_t* pdu, uint16_t size)
+{
+    uint8_t buff[MODBUS_MBAP_SIZE + MODBUS_BUFFER_SIZE];
+    size_t len = MODBUS_MBAP_SIZE + size;
+    buff[0] = (transaction >> 8) & 0x0FF;
+    buff[1] = transaction & 0x0FF;
+    buff[2] = 0;
+    buff[3] = 0;
+    buff[4] = ((size + 1) >> 8) & 0x0FF;
+    buff[5] = (size + 1) & 0x0FF;
+    buff[6] = unit;
+    memcpy(buff + MODBUS_MBAP_SIZE, pdu, size);
+    client->gateway->responses++;
+    if (send(client->fd, buff, len, MSG_NOSIGNAL | MSG_DONTWAIT) != (ssize_t)len)
+    {
+        gateway_close(client);
+    }
+}
+
+static void gateway_exception(ModBus_GatewayClient_T* client, uint16_t transaction, uint8_t unit, uint8_t function, uint8_t code)
+{
+    uint8_t pdu[2] = { (uint8_t)(function | MODBUS_EXCEPTION_FLAG), code };
+    gateway_reply(client, transaction, unit, pdu, 2);
+}
+
+// Функция обратного вызова Master: context - слот запроса
+static void gateway_response(void* context, const uint8_t* pdu, uint16_t size)
+{
+    ModBus_GatewaySlot_T* slot = (ModBus_GatewaySlot_T*)context;
+    ModBus_Gateway_T* gateway = slot->gateway;
+    ModBus_GatewayClient_T* client = slot->client;
+    slot->client = NULL;
+    gateway->inFlight--;
+    if (client->fd < 0 || client->generation != slot->generation) // Клиент отключился, пока запрос ждал ответа
+    {
+        gateway->dropped++;
+        return;
+    }
+    client->outstanding--;
+    if (pdu == NULL)
+    {
+        gateway->failed++;
+        gateway_exception(client, slot->transaction, slot->unit, slot->function, MODBUS_GATEWAY_EXCEPTION_NO_RESPONSE);
+        return;
+    }
+    gateway_reply(client, slot->transaction, slot->unit, pdu, size);
+}
+
+// Время линии запроса в байтах: кадр запроса RTU и ожидаемый кадр ответа
+static uint32_t gateway_cost(const ModBus_GatewayRequest_T* request)
+{
+    uint32_t cost = request->size + 3u;
+    uint32_t quantity = request->size >= 5 ? (uint32_t)(request->pdu[3] << 8 | request->pdu[4]) : 0;
+    switch (request->pdu[0])
+    {
+    case READ_COILS:
+    case READ_DISCRETE_INPUTS:
+        quantity = quantity < MODBUS_MAX_READ_BITS ? quantity : MODBUS_MAX_READ_BITS;
+        return cost + 5 + (quantity + 7) / 8;
+    case READ_REGISTER:
+    case READ_INPUT_REGISTER:
+    case READ_WRITE_REGISTERS:
+        quantity = quantity < MODBUS_MAX_READ_REGISTERS ? quantity : MODBUS_MAX_READ_REGISTERS;
+        return cost + 5 + 2 * quantity;
+    default:
+        return cost + 8;
+    }
+}
+
+// Выбор клиента для следующего запроса (deficit round robin): за круг клиент получает MODBUS_GATEWAY_QUANTUM байтов линии
+// и отправляет запросы, пока их хватает. Клиенты без запросов запас не копят. NULL - запросов нет
+static ModBus_GatewayClient_T* gateway_pick(ModBus_Gateway_T* gateway)
+{
+    if (gateway->queued == 0)
+    {
+        return NULL;
+    }
+    for (;;) // Запас клиента с запросами растет каждый круг, поэтому поиск конечен
+    {
+        ModBus_GatewayClient_T* client = gateway->clients + gateway->next;
+        if (client->n > 0)
+        {
+            uint32_t cost = gateway_cost(client->queue + client->head);
+            if (!gateway->granted)
+            {
+                client->deficit += MODBUS_GATEWAY_QUANTUM;
+                gateway->granted = 1;
+            }
+            if (cost <= client->deficit)
+            {
+                client->deficit -= cost;
+                return client;
+            }
+        }
+        else
+        {
+            client->deficit = 0;
+        }
+        gateway->next = (gateway->next + 1) % gateway->clientsN;
+        gateway->granted = 0;
+    }
+}
+
+// Передача запросов Master, пока есть свободные слоты
+static void gateway_feed(ModBus_Gateway_T* gateway)
+{
+    uint8_t fed = 0;
+    while (gateway->inFlight < MODBUS_GATEWAY_INFLIGHT)
+    {
+        ModBus_GatewayClient_T* client = gateway_pick(gateway);
+        ModBus_GatewayRequest_T* request;
+        ModBus_GatewaySlot_T* slot = gateway->slots;
+        if (client == NULL)
+        {
+            break;
+        }
+        request = client->queue + client->head;
+        while (slot->client != NULL)
+        {
+            slot++;
+        }
+        slot->gateway = gateway;
+        slot->client = client;
+        slot->generation = client->generation;
+        slot->transaction = request->transaction;
+        slot->unit = request->unit;
+        slot->function = request->pdu[0];
+        if (!ModBus_sendUnitPdu(gateway->master, request->unit, request->pdu, request->size, gateway_response, slot))
+        {
+            // Очередь Master еще занята завершенной командой, запрос остается у клиента
+            client->deficit += gateway_cost(request);
+            slot->client = NULL;
+            break;
+        }
+        client->head = (client->head + 1) % MODBUS_GATEWAY_CLIENT_QUEUE;
+        client->n--;
+        gateway->queued--;
+        gateway->inFlight++;
+        fed = 1;
+    }
+    if (fed)
+    {
+        ModBus_Linux_service(gateway->port);
+    }
+}
+
+// Запрос клиента: в очередь или сразу исключение шлюза
+static void gateway_request(ModBus_GatewayClient_T* client, uint16_t transaction, uint8_t unit, const uint8_t* pdu, uint16_t size)
+{
+    ModBus_Gateway_T* gateway = client->gateway;
+    ModBus_GatewayRequest_T* request;
+    if (pdu[0] == 0 || (pdu[0] & MODBUS_EXCEPTION_FLAG))
+    {
+        gateway_exception(client, transaction, unit, pdu[0], MODBUS_GATEWAY_EXCEPTION_ILLEGAL_FUNCTION);
+        return;
+    }
+    if (size > MODBUS_GATEWAY_PDU_SIZE)
+    {
+        gateway_exception(client, transaction, unit, pdu[0], MODBUS_GATEWAY_EXCEPTION_ILLEGAL_VALUE);
+        return;
+    }
+    if (client->outstanding >= gateway->clientLimit)
+    {
+        gateway->busy++;
+        gateway_exception(client, transaction, unit, pdu[0], MODBUS_GATEWAY_EXCEPTION_BUSY);
+        return;
+    }
+    request = client->queue + (client->head + client->n) % MODBUS_GATEWAY_CLIENT_QUEUE;
+    request->transaction = transaction;
+    request->unit = unit;
+    request->size = size;
+    memcpy(request->pdu, pdu, size);
+    client->n++;
+    client->outstanding++;
+    gateway->queued++;
+    gateway->requests++;
+}
+
+// Прием данных клиента и разбор всех целых кадров Modbus TCP
+static void gateway_clientEvent(void* context, uint32_t events)
+{
+    ModBus_GatewayClient_T* client = (ModBus_GatewayClient_T*)context;
+    size_t offset = 0;
+    ssize_t n = recv(client->fd, client->rx + client->rxLen, sizeof(client->rx) - client->rxLen, MSG_DONTWAIT);
+    (void)events;
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+    {
+        gateway_close(client);
+        return;
+    }
+    if (n < 0)
+    {
+        return;
+    }
+    client->rxLen += (size_t)n;
+    while (client->rxLen - offset >= MODBUS_MBAP_SIZE)
+    {
+        const uint8_t* frame = client->rx + offset;
+        size_t length = (size_t)(frame[4] << 8 | frame[5]);
+        if ((frame[2] | frame[3]) != 0 || length < 2 || 6 + length > MODBUS_MBAP_SIZE - 1 + 254)
+        {
+            gateway_close(client); // Поток TCP нельзя синхронизировать повторно
+            return;
+        }
+        if (client->rxLen - offset < 6 + length)
+        {
+            break;
+        }
+        gateway_request(client, (uint16_t)(frame[0] << 8 | frame[1]), frame[6], frame + MODBUS_MBAP_SIZE, (uint16_t)(length - 1));
+        if (client->fd < 0) // Отключен при отправке исключения
+        {
+            return;
+        }
+        offset += 6 + length;
+    }
+    memmove(client->rx, client->rx + offset, client->rxLen - offset);
+    client->rxLen -= offset;
+}
+
+static void gateway_listenEvent(void* context, uint32_t events)
+{
+    ModBus_Gateway_T* gateway = (ModBus_Gateway_T*)context;
+    int fd;
+    (void)events;
+    while ((fd = accept(gateway->listenFd, NULL, NULL)) >= 0) // Сокет клиента блокирующий, прием и отправка - с MSG_DONTWAIT
+    {
+        ModBus_GatewayClient_T* client = NULL;
+        int on = 1;
+        for (size_t i = 0; i < gateway->clientsN && client == NULL; i++)
+        {
+            if (gateway->clients[i].fd < 0)
+            {
+                client = gateway->clients + i;
+            }
+        }
+        if (client == NULL || ModBus_Linux_watch(gateway->epollFd, &client->watch, fd, gateway_clientEvent, client) != 0)
+        {
+            gateway->refused++;
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // Ответы не должны задерживаться алгоритмом Нейгла
+        client->fd = fd;
+        gateway->connected++;
+    }
+}
+
+void ModBus_Gateway_init(ModBus_Gateway_T* gateway, ModBus_parameter* master, ModBus_Linux_Port_T* port,
+    ModBus_GatewayClient_T* clients, size_t n, uint8_t clientLimit)
+{
+    memset(gateway, 0, sizeof(*gateway));
+    gateway->master = master;
+    gateway->port = port;
+    gateway->epollFd = -1;
+    gateway->listenFd = -1;
+    gateway->listenWatch.fd = -1;
+    gateway->clients = clients;
+    gateway->clientsN = n;
+    gateway->clientLimit = clientLimit == 0 || clientLimit > MODBUS_GATEWAY_CLIENT_QUEUE ? MODBUS_GATEWAY_CLIENT_QUEUE : clientLimit;
+    for (size_t i = 0; i < n; i++)
+    {
+        memset(clients + i, 0, sizeof(clients[i]));
+        clients[i].gateway = gateway;
+        clients[i].fd = -1;
+        clients[i].watch.fd = -1;
+    }
+    ModBus_setFrameQueue(master, gateway->frames, MODBUS_GATEWAY_INFLIGHT + 1);
+}
+
+int ModBus_Gateway_start(ModBus_Gateway_T* gateway, int epollFd, int listenFd)
+{
+    int flags = fcntl(listenFd, F_GETFL);
+    gateway->epollFd = epollFd;
+    gateway->listenFd = listenFd;
+    if (flags < 0 || fcntl(listenFd, F_SETFL, flags | O_NONBLOCK) != 0) // Прием всех ожидающих подключений за одно событие
+    {
+        return -1;
+    }
+    return ModBus_Linux_watch(epollFd, &gateway->listenWatch, listenFd, gateway_listenEvent, gateway);
+}
+
+int ModBus_Gateway_run(ModBus_Gateway_T* gateway, int timeoutMs)
+{
+    int n = ModBus_Linux_run(gateway->epollFd, timeoutMs);
+    gateway_feed(gateway);
+    return n;
+}
+
+void ModBus_Gateway_stop(ModBus_Gateway_T* gateway)
+{
+    for (size_t i = 0; i < gateway->clientsN; i++)
+    {
+        if (gateway->clients[i].fd >= 0)
+        {
+            gateway_close(gateway->clients + i);
+        }
+    }
+    ModBus_Linux_unwatch(gateway->epollFd, &gateway->listenWatch);
+}
+
+#if defined(_UNIT_TEST) || defined(_BENCHMARK)
+#include <pty.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include "modbus_tcp.h"
+
+// Подключение клиента к шлюзу через loopback, сокет неблокирующий
+static int gateway_connect(uint16_t port)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    assert(fd >= 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+// Запрос клиента: кадр Modbus TCP чтения или записи одного регистра
+static size_t gateway_frame(uint8_t* buff, uint16_t transaction, uint8_t unit, uint8_t function, uint16_t address, uint16_t value)
+{
+    uint8_t frame[12] = { (uint8_t)(transaction >> 8), (uint8_t)transaction, 0, 0, 0, 6, unit, function,
+        (uint8_t)(address >> 8), (uint8_t)address, (uint8_t)(value >> 8), (uint8_t)value };
+    memcpy(buff, frame, sizeof(frame));
+    return sizeof(frame);
+}
+#endif
+
+#if defined(_BENCHMARK) && defined(MODBUS_SLAVE)
+#define MODBUS_GATEWAY_BENCH_TXNS 10000 // Транзакций в каждой комбинации
+#define MODBUS_GATEWAY_BENCH_CLIENTS 64 // Максимальное количество клиентов
+
+typedef struct _MODBUS_GATEWAY_BENCH_CLIENT_T { // Клиент нагрузочного теста: запросы отправляются, пока ответов ждут меньше depth
+    int fd;
+    uint16_t transaction;
+    uint64_t sent[MODBUS_GATEWAY_CLIENT_QUEUE]; // Время отправки запросов без ответа, ответы приходят по порядку
+    uint8_t head, n;
+    uint8_t rx[MODBUS_GATEWAY_RX_SIZE];
+    size_t rxLen;
+    uint32_t done;
+} ModBus_GatewayBenchClient_T;
+
+static ModBus_GatewayBenchClient_T s_benchClients[MODBUS_GATEWAY_BENCH_CLIENTS];
+static uint32_t s_benchLatencyUs[MODBUS_GATEWAY_BENCH_TXNS];
+
+static void gateway_benchRun(size_t clientsN, uint8_t depth)
+{
+    static ModBus_parameter master, slave;
+    static ModBus_Linux_Port_T masterPort, slavePort;
+    static ModBus_GatewayClient_T clients[MODBUS_GATEWAY_BENCH_CLIENTS];
+    static ModBus_Gateway_T gateway;
+    static uint8_t holding[2 * 8];
+    static ModBus_RegisterBank_T bank;
+    ModBus_Setting_T setting = { 0 };
+    size_t submitted = 0, done = 0, failed = 0;
+    uint32_t minDone = UINT32_MAX, maxDone = 0;
+    uint64_t begin, elapsed;
+    int ptyMaster, ptySlave, epollFd, listenFd;
+
+    setting.address = 0x01;
+    setting.baudRate = 115200;
+    ModBus_setup(&master, setting);
+    ModBus_setup(&slave, setting);
+    bank.holding = holding;
+    bank.holdingCount = 8;
+    ModBus_attachRegisterBank(&slave, &bank);
+    assert(openpty(&ptyMaster, &ptySlave, NULL, NULL, NULL) == 0);
+    assert(ModBus_Linux_configure(ptyMaster, 0) == 0 && ModBus_Linux_configure(ptySlave, 0) == 0);
+    epollFd = ModBus_Linux_create();
+    assert(ModBus_Linux_add(epollFd, &masterPort, &master, ptyMaster, MODBUS_LINUX_MASTER) == 0);
+    assert(ModBus_Linux_add(epollFd, &slavePort, &slave, ptySlave, MODBUS_LINUX_SLAVE) == 0);
+    listenFd = ModBus_TCP_listen("127.0.0.1", 0);
+    ModBus_Gateway_init(&gateway, &master, &masterPort, clients, clientsN, depth);
+    assert(ModBus_Gateway_start(&gateway, epollFd, listenFd) == 0);
+    for (size_t i = 0; i < clientsN; i++)
+    {
+        memset(s_benchClients + i, 0, sizeof(s_benchClients[i]));
+        s_benchClients[i].fd = gateway_connect(ModBus_TCP_localPort(listenFd));
+        ModBus_Gateway_run(&gateway, 0);
+    }
+    while (gateway.connected < clientsN)
+    {
+        ModBus_Gateway_run(&gateway, 100);
+    }
+
+    begin = ModBus_Linux_clock();
+    while (done < MODBUS_GATEWAY_BENCH_TXNS)
+    {
+        for (size_t i = 0; i < clientsN; i++)
+        {
+            ModBus_GatewayBenchClient_T* client = s_benchClients + i;
+            while (client->n < depth && submitted < MODBUS_GATEWAY_BENCH_TXNS)
+            {
+                uint8_t buff[12];
+                size_t len = gateway_frame(buff, client->transaction++, 0x01, READ_REGISTER, (uint16_t)(i % 8), 1);
+                assert(send(client->fd, buff, len, MSG_NOSIGNAL) == (ssize_t)len);
+                client->sent[(client->head + client->n) % MODBUS_GATEWAY_CLIENT_QUEUE] = ModBus_Linux_clock();
+                client->n++;
+                submitted++;
+            }
+        }
+        ModBus_Gateway_run(&gateway, 1);
+        for (size_t i = 0; i < clientsN; i++)
+        {
+            ModBus_GatewayBenchClient_T* client = s_benchClients + i;
+            size_t offset = 0;
+            ssize_t n = recv(client->fd, client->rx + client->rxLen, sizeof(client->rx) - client->rxLen, MSG_DONTWAIT);
+            if (n <= 0)
+            {
+                continue;
+            }
+            client->rxLen += (size_t)n;
+            while (client->rxLen - offset >= MODBUS_MBAP_SIZE && client->rxLen - offset >= 6 + (size_t)client->rx[offset + 5])
+            {
+                if (client->rx[offset + 7] & MODBUS_EXCEPTION_FLAG)
+                {
+                    failed++;
+                }
+                s_benchLatencyUs[done++] = (uint32_t)(ModBus_Linux_clock() - client->sent[client->head]);
+                client->head = (client->head + 1) % MODBUS_GATEWAY_CLIENT_QUEUE;
+                client->n--;
+                client->done++;
+                offset += 6 + (size_t)client->rx[offset + 5];
+            }
+            memmove(client->rx, client->rx + offset, client->rxLen - offset);
+            client->rxLen -= offset;
+        }
+    }
+    elapsed = ModBus_Linux_clock() - begin;
+
+    for (size_t i = 0; i < clientsN; i++)
+    {
+        minDone = s_benchClients[i].done < minDone ? s_benchClients[i].done : minDone;
+        maxDone = s_benchClients[i].done > maxDone ? s_benchClients[i].done : maxDone;
+        close(s_benchClients[i].fd);
+    }
+    qsort(s_benchLatencyUs, done, sizeof(s_benchLatencyUs[0]), ModBus_benchCompareU32);
+    printf("gateway,%u,%u,%u,%.0f,%u,%u,%u,%u,%u,%u\n", (unsigned)clientsN, depth, (unsigned)done,
+        (double)done * 1e6 / (double)(elapsed ? elapsed : 1),
+        s_benchLatencyUs[done / 2], s_benchLatencyUs[done * 99 / 100], s_benchLatencyUs[done * 999 / 1000],
+        minDone, maxDone, (unsigned)failed);
+
+    ModBus_Gateway_stop(&gateway);
+    close(listenFd);
+    ModBus_Linux_remove(epollFd, &masterPort);
+    ModBus_Linux_remove(epollFd, &slavePort);
+    close(epollFd);
+    close(ptySlave);
+    close(ptyMaster);
+}
+
+void ModBus_Gateway_benchmark()
+{
+    static const size_t clients[] = { 1, 16, MODBUS_GATEWAY_BENCH_CLIENTS };
+    static const uint8_t depths[] = { 1, MODBUS_GATEWAY_CLIENT_QUEUE };
+    ModBus_setClock(ModBus_Linux_clock);
+    printf("gateway,clients,depth,txns,txn_per_s,p50_us,p99_us,p999_us,min_client_txns,max_client_txns,failed\n");
+    for (size_t c = 0; c < sizeof(clients) / sizeof(clients[0]); c++)
+    {
+        for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+        {
+            gateway_benchRun(clients[c], depths[d]);
+        }
+    }
+    ModBus_setClock(NULL);
+}
+#endif // _BENCHMARK
+
+#if defined(_UNIT_TEST) && defined(MODBUS_SLAVE)
+static uint16_t s_gatewayLog[8]; // Адреса запросов в порядке обработки Slave
+static size_t s_gatewayLogN;
+
+static size_t gateway_getReg(uint16_t address, uint16_t n, uint16_t* data)
+{
+    s_gatewayLog[s_gatewayLogN++ % 8] = address;
+    return ModBus_testGetRegister(address, n, data);
+}
+
+static size_t gateway_setReg(uint16_t address, uint16_t n, uint16_t* data)
+{
+    s_gatewayLog[s_gatewayLogN++ % 8] = address;
+    return ModBus_testSetRegister(address, n, data);
+}
+
+// Ответы, принятые клиентом без ожидания, добавляются в buff; возвращает новую длину
+static size_t gateway_collect(int fd, uint8_t* buff, size_t len, size_t size)
+{
+    ssize_t n = recv(fd, buff + len, size - len, MSG_DONTWAIT);
+    return n > 0 ? len + (size_t)n : len;
+}
+
+void ModBus_Gateway_unitTest()
+{
+    static ModBus_parameter master, slave;
+    static ModBus_Linux_Port_T masterPort, slavePort;
+    static ModBus_GatewayClient_T clients[4];
+    static ModBus_Gateway_T gateway;
+    ModBus_Setting_T setting = { 0 };
+    uint8_t buff[64], a[64], b[64], c[64];
+    size_t len, aLen = 0, bLen = 0, cLen = 0;
+    int ptyMaster, ptySlave, epollFd, listenFd, fdA, fdB, fdC;
+
+    ModBus_setClock(ModBus_Linux_clock);
+    setting.address = 0x01;
+    ModBus_setup(&master, setting);
+    ModBus_setup(&slave, setting);
+    ModBus_setTimeout(&master, 0, 50);
+    ModBus_attachRegisterHandler(&slave, gateway_getReg, gateway_setReg);
+    memset(g_testRegisters, 0, sizeof(g_testRegisters)); // Банк общий для тестов модулей
+    g_testRegisters[0] = 0x1234;
+    g_testRegisters[1] = 0x5678;
+
+    assert(openpty(&ptyMaster, &ptySlave, NULL, NULL, NULL) == 0);
+    assert(ModBus_Linux_configure(ptyMaster, 0) == 0 && ModBus_Linux_configure(ptySlave, 9600) == 0);
+    epollFd = ModBus_Linux_create();
+    assert(epollFd >= 0);
+    assert(ModBus_Linux_add(epollFd, &masterPort, &master, ptyMaster, MODBUS_LINUX_MASTER) == 0);
+    assert(ModBus_Linux_add(epollFd, &slavePort, &slave, ptySlave, MODBUS_LINUX_SLAVE) == 0);
+    listenFd = ModBus_TCP_listen("127.0.0.1", 0);
+    assert(listenFd >= 0);
+    ModBus_Gateway_init(&gateway, &master, &masterPort, clients, 4, 2);
+    assert(ModBus_Gateway_start(&gateway, epollFd, listenFd) == 0);
+
+    fdA = gateway_connect(ModBus_TCP_localPort(listenFd));
+    fdB = gateway_connect(ModBus_TCP_localPort(listenFd));
+    fdC = gateway_connect(ModBus_TCP_localPort(listenFd));
+    for (int i = 0; i < 100 && gateway.connected < 3; i++)
+    {
+        ModBus_Gateway_run(&gateway, 100);
+    }
+    assert(gateway.connected == 3);
+
+    // Клиент A: три чтения подряд, третье сверх ограничения; B: запись; C: чтение устройства, которого нет на линии
+    len = gateway_frame(buff, 0x0A01, 0x01, READ_REGISTER, 0, 1);
+    len += gateway_frame(buff + len, 0x0A02, 0x01, READ_REGISTER, 1, 1);
+    len += gateway_frame(buff + len, 0x0A03, 0x01, READ_REGISTER, 2, 1);
+    assert(send(fdA, buff, len, 0) == (ssize_t)len);
+    len = gateway_frame(buff, 0x0B01, 0x01, WRITE_SINGLE_REGISTER, 5, 0x0077);
+    assert(send(fdB, buff, len, 0) == (ssize_t)len);
+    len = gateway_frame(buff, 0x0C01, 0x07, READ_REGISTER, 0, 1);
+    assert(send(fdC, buff, len, 0) == (ssize_t)len);
+
+    for (int i = 0; i < 1000 && (aLen < 9 + 11 + 11 || bLen < 12 || cLen < 9); i++)
+    {
+        ModBus_Gateway_run(&gateway, 100);
+        aLen = gateway_collect(fdA, a, aLen, sizeof(a));
+        bLen = gateway_collect(fdB, b, bLen, sizeof(b));
+        cLen = gateway_collect(fdC, c, cLen, sizeof(c));
+    }
+    // A: исключение 06 сразу, затем ответы по порядку с идентификаторами транзакций клиента
+    assert(aLen == 9 + 11 + 11);
+    assert(a[0] == 0x0A && a[1] == 0x03 && a[5] == 3 && a[7] == (READ_REGISTER | MODBUS_EXCEPTION_FLAG) && a[8] == 0x06);
+    assert(a[9] == 0x0A && a[10] == 0x01 && a[15] == 0x01 && a[16] == READ_REGISTER && a[17] == 2 && a[18] == 0x12 && a[19] == 0x34);
+    assert(a[20] == 0x0A && a[21] == 0x02 && a[28] == 2 && a[29] == 0x56 && a[30] == 0x78);
+    // B: эхо записи, C: исключение 0B (устройство не ответило)
+    assert(bLen == 12 && b[0] == 0x0B && b[1] == 0x01 && b[7] == WRITE_SINGLE_REGISTER && b[11] == 0x77 && g_testRegisters[5] == 0x0077);
+    assert(cLen == 9 && c[0] == 0x0C && c[6] == 0x07 && c[7] == (READ_REGISTER | MODBUS_EXCEPTION_FLAG) && c[8] == 0x0B);
+    // Запросы чередуются между клиентами: запись B выполнена раньше второго чтения A
+    assert(s_gatewayLogN == 3 && s_gatewayLog[0] == 0 && s_gatewayLog[1] == 5 && s_gatewayLog[2] == 1);
+    assert(gateway.requests == 4 && gateway.busy == 1 && gateway.failed == 1 && gateway.responses == 5);
+
+    // Отключение клиента освобождает место
+    close(fdA);
+    for (int i = 0; i < 100 && gateway.connected > 2; i++)
+    {
+        ModBus_Gateway_run(&gateway, 100);
+    }
+    assert(gateway.connected == 2 && gateway.inFlight == 0);
+    printf("Modbus gateway: %u requests, %u responses, %u busy, %u failed\n", gateway.requests, gateway.responses, gateway.busy, gateway.failed);
+
+    ModBus_Gateway_stop(&gateway);
+    close(fdB);
+    close(fdC);
+    close(listenFd);
+    ModBus_Linux_remove(epollFd, &masterPort);
+    ModBus_Linux_remove(epollFd, &slavePort);
+    close(epollFd);
+    close(ptySlave);
+    close(ptyMaster);
+    ModBus_setClock(NULL);
+}
+#endif // _UNIT_TEST
+
+#endif // __linux__ && MODBUS_MASTER
@@ -0,0 +1,121 @@
+#ifndef MODBUS_GATEWAY_H_
+#define MODBUS_GATEWAY_H_
+/**** Шлюз Modbus TCP - RTU ****
+** Клиенты Modbus TCP подключаются к шлюзу, их запросы передаются устройствам на линии RS-485 через один экземпляр Master RTU,
+** ответ возвращается клиенту с его идентификатором транзакции.
+** Очередь запросов у каждого клиента своя. Master получает не больше MODBUS_GATEWAY_INFLIGHT запросов сразу
+** (один на линии, следующий уходит сразу после ответа), очередной запрос выбирается по кругу между клиентами
+** с учетом времени линии (deficit round robin): клиент с длинными запросами не задерживает остальных.
+** Ответы шлюза вместо ответа устройства (исключения):
+****** 01 - недопустимый код функции, 03 - запрос не помещается в буфер кадра
+****** 06 - очередь клиента заполнена (ограничение ModBus_Gateway_init)
+****** 0B - устройство не ответило (тайм-аут или пропуск устройства, см. ModBus_setUnitOffline)
+** Как использовать:
+****** Настройка Master (ModBus_setup, тайм-аут, при необходимости ModBus_setAdaptiveTimeout), добавление порта ModBus_Linux_add
+****** Вызов ModBus_Gateway_init, затем ModBus_Gateway_start с сокетом ModBus_TCP_listen
+****** Циклический вызов ModBus_Gateway_run вместо ModBus_Linux_run
+** Собирается только для Linux.
+*/
+
+#include "modbus.h"
+#include "modbus_linux.h"
+
+#if defined(__linux__) && defined(MODBUS_MASTER)
+
+#ifndef MODBUS_GATEWAY_CLIENT_QUEUE
+#define MODBUS_GATEWAY_CLIENT_QUEUE 4 // Запросов в очереди одного клиента
+#endif
+#define MODBUS_GATEWAY_INFLIGHT 2 // Запросов, переданных Master одновременно
+#define MODBUS_GATEWAY_PDU_SIZE (MODBUS_BUFFER_SIZE - 3) // Максимальный PDU запроса: кадр RTU без адреса и CRC
+#define MODBUS_GATEWAY_RX_SIZE 512 // Буфер приема клиента, вмещает кадр Modbus TCP максимальной длины (260 байтов)
+#define MODBUS_GATEWAY_QUANTUM 16 // Байтов линии, добавляемых клиенту за круг: примерно одна короткая транзакция
+
+typedef struct _MODBUS_GATEWAY_REQUEST_T { // Запрос клиента в очереди
+    uint16_t transaction; // Идентификатор транзакции клиента
+    uint8_t unit;
+    uint16_t size;
+    uint8_t pdu[MODBUS_GATEWAY_PDU_SIZE];
+} ModBus_GatewayRequest_T;
+
+typedef struct _MODBUS_GATEWAY_CLIENT_T { // Клиент шлюза, память принадлежит приложению
+    struct _MODBUS_GATEWAY_T* gateway;
+    int fd; // Сокет клиента, -1 - место свободно
+    uint32_t generation; // Увеличивается при отключении: ответы на запросы прежнего клиента отбрасываются
+    ModBus_Linux_Watch_T watch;
+    uint8_t rx[MODBUS_GATEWAY_RX_SIZE];
+    size_t rxLen;
+    ModBus_GatewayRequest_T queue[MODBUS_GATEWAY_CLIENT_QUEUE];
+    uint8_t head, n; // Очередь запросов, еще не переданных Master
+    uint8_t outstanding; // Запросов без ответа: в очереди и у Master
+    uint32_t deficit; // Доступное время линии в байтах (deficit round robin)
+} ModBus_GatewayClient_T;
+
+typedef struct _MODBUS_GATEWAY_SLOT_T { // Запрос, переданный Master
+    struct _MODBUS_GATEWAY_T* gateway;
+    ModBus_GatewayClient_T* client; // NULL - слот свободен
+    uint32_t generation;
+    uint16_t transaction;
+    uint8_t unit;
+    uint8_t function;
+} ModBus_GatewaySlot_T;
+
+typedef struct _MODBUS_GATEWAY_T {
+    ModBus_parameter* master; // Master RTU линии
+    ModBus_Linux_Port_T* port; // Порт Master в epoll
+    int epollFd;
+    int listenFd;
+    ModBus_Linux_Watch_T listenWatch;
+    ModBus_GatewayClient_T* clients;
+    size_t clientsN;
+    size_t connected; // Подключенных клиентов
+    size_t queued; // Запросов в очередях клиентов
+    uint8_t clientLimit; // Запросов без ответа на одного клиента
+    size_t next; // Клиент, чья очередь сейчас (deficit round robin)
+    uint8_t granted; // Клиент next уже получил квант в этом круге
+    ModBus_GatewaySlot_T slots[MODBUS_GATEWAY_INFLIGHT];
+    size_t inFlight;
+    MODBUS_FRAME_T frames[MODBUS_GATEWAY_INFLIGHT + 1]; // Очередь Master, место для завершаемой команды
+    uint32_t requests; // Запросов, поставленных в очередь
+    uint32_t responses; // Ответов, отправленных клиентам (включая исключения шлюза)
+    uint32_t busy; // Запросов, отклоненных исключением 06
+    uint32_t failed; // Запросов без ответа устройства (исключение 0B)
+    uint32_t dropped; // Ответов отключившимся клиентам
+    uint32_t refused; // Подключений, закрытых из-за отсутствия места
+} ModBus_Gateway_T;
+
+/************ Внешний интерфейс BEGIN ***********/
+
+/** Настройка шлюза **/
+/*** Параметры ***
+** master: Экземпляр Master RTU, очередь команд которого заменяется очередью шлюза (вызывается, пока очередь пуста)
+** port: Порт Master, добавленный ModBus_Linux_add
+** clients, n: Память клиентов, n - максимальное количество одновременных подключений
+** clientLimit: Запросов без ответа на одного клиента, 0 или больше MODBUS_GATEWAY_CLIENT_QUEUE - MODBUS_GATEWAY_CLIENT_QUEUE
+***/
+void ModBus_Gateway_init(ModBus_Gateway_T* gateway, ModBus_parameter* master, ModBus_Linux_Port_T* port,
+    ModBus_GatewayClient_T* clients, size_t n, uint8_t clientLimit);
+
+// Прием подключений на listenFd (ModBus_TCP_listen) в том же epoll, что и порт Master. 0 при успехе, -1 при ошибке
+int ModBus_Gateway_start(ModBus_Gateway_T* gateway, int epollFd, int listenFd);
+
+/** Ожидание и обработка событий шлюза **/
+/*** Параметры ***
+** timeoutMs: Максимальное время ожидания, -1 - без ограничения
+** Возвращает результат ModBus_Linux_run. Запросы, принятые за вызов, передаются Master после обработки всех событий.
+***/
+int ModBus_Gateway_run(ModBus_Gateway_T* gateway, int timeoutMs);
+
+// Отключение всех клиентов и остановка приема подключений; сокет listenFd не закрывается
+void ModBus_Gateway_stop(ModBus_Gateway_T* gateway);
+
+#if defined(_BENCHMARK) && defined(MODBUS_SLAVE)
+void ModBus_Gateway_benchmark(); // Пропускная способность и задержка шлюза при разном количестве клиентов
+#endif
+#if defined(_UNIT_TEST) && defined(MODBUS_SLAVE)
+void ModBus_Gateway_unitTest(); // Клиенты через loopback, Slave на другом конце pty
+#endif
+/**************** Внешний интерфейс END ***************/
+
+#endif // __linux__ && MODBUS_MASTER
+
+#endif
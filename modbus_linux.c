@@ -0,0 +1,390 @@
+#include "modbus_linux.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+
+#define MODBUS_LINUX_EVENTS 16 // Количество событий, забираемых одним вызовом epoll_wait
+#define MODBUS_LINUX_TIMER_TAG 1u // Младший бит data.u64: событие таймера, а не порта
+#define MODBUS_LINUX_WATCH_TAG 2u // Событие постороннего дескриптора (ModBus_Linux_Watch_T)
+#define MODBUS_LINUX_TAGS (MODBUS_LINUX_TIMER_TAG | MODBUS_LINUX_WATCH_TAG)
+#define MODBUS_LINUX_SERVICE_N 4 // Сколько раз подряд вызывается цикл, пока экземпляр просит вызвать его сразу
+
+static speed_t linux_speed(uint32_t baud)
+{
+    switch (baud)
+    {
+    case 1200: return B1200;
+    case 2400: return B2400;
+    case 4800: return B4800;
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return 0;
+    }
+}
+
+// Функция отправки экземпляра, context - порт. Запись не ждет освобождения буфера: поток epoll обслуживает и другие порты.
+// Кадр, не поместившийся в буфер, закрывает сокет (остаток сбил бы поток MBAP), разрыв обрабатывает ModBus_Linux_run.
+// На tty кадр обрывается, приемник отбрасывает его по CRC, команда завершится по тайм-ауту
+static void linux_send(void* context, uint8_t* data, size_t size)
+{
+    ModBus_Linux_Port_T* port = (ModBus_Linux_Port_T*)context;
+    while (size > 0 && port->fd >= 0 && !port->closing)
+    {
+        ssize_t n = write(port->fd, data, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            if (shutdown(port->fd, SHUT_RDWR) == 0) // Для tty ENOTSOCK, порт остается открытым
+            {
+                port->closing = 1;
+            }
+            return;
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+}
+
+// Взвод таймера через wakeup микросекунд, MODBUS_TIME_NEVER - снять таймер
+static void linux_arm(ModBus_Linux_Port_T* port, uint64_t wakeup)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (wakeup != MODBUS_TIME_NEVER)
+    {
+        if (wakeup == 0)
+        {
+            wakeup = 1; // Нулевое значение снимает таймер
+        }
+        spec.it_value.tv_sec = (time_t)(wakeup / 1000000u);
+        spec.it_value.tv_nsec = (long)(wakeup % 1000000u) * 1000L;
+    }
+    timerfd_settime(port->timerFd, 0, &spec, NULL);
+}
+
+static uint64_t linux_step(ModBus_Linux_Port_T* port)
+{
+    port->wakeups++;
+#ifdef MODBUS_SLAVE
+    if (port->role == MODBUS_LINUX_SLAVE)
+    {
+        ModBus_Slave_loop(port->para);
+        return ModBus_Slave_nextWakeup(port->para);
+    }
+#endif
+#ifdef MODBUS_MASTER
+    if (port->role == MODBUS_LINUX_MASTER)
+    {
+        ModBus_Master_loop(port->para);
+        return ModBus_Master_nextWakeup(port->para);
+    }
+#endif
+    return MODBUS_TIME_NEVER;
+}
+
+void ModBus_Linux_service(ModBus_Linux_Port_T* port)
+{
+    uint64_t wakeup = 0;
+    for (int i = 0; i < MODBUS_LINUX_SERVICE_N && wakeup == 0; i++)
+    {
+        wakeup = linux_step(port);
+    }
+    linux_arm(port, wakeup);
+}
+
+// Чтение доступных байтов порта одним блоком, -1 если порт закрыт другой стороной
+static int linux_receive(ModBus_Linux_Port_T* port)
+{
+    uint8_t buff[MODBUS_RECEIVE_RING_SIZE];
+    size_t space = ModBus_receiveSpace(port->para);
+    ssize_t n;
+    if (space == 0)
+    {
+        return 0; // Остаток будет прочитан по следующему событию epoll
+    }
+    n = read(port->fd, buff, space);
+    if (n == 0)
+    {
+        return -1;
+    }
+    if (n < 0)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1; // Для pty разрыв приходит как EIO
+    }
+    ModBus_readbytesFromOuter(port->para, buff, (size_t)n); // Весь блок с одной меткой времени
+    return (int)n;
+}
+
+uint64_t ModBus_Linux_clock()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+int ModBus_Linux_configure(int fd, uint32_t baud)
+{
+    struct termios tio;
+    int flags;
+    if (tcgetattr(fd, &tio) != 0)
+    {
+        return -1;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | PARENB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (baud != 0)
+    {
+        speed_t speed = linux_speed(baud);
+        if (speed == 0 || cfsetispeed(&tio, speed) != 0 || cfsetospeed(&tio, speed) != 0)
+        {
+            return -1;
+        }
+    }
+    if (tcsetattr(fd, TCSANOW, &tio) != 0)
+    {
+        return -1;
+    }
+    flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+    {
+        return -1;
+    }
+    tcflush(fd, TCIOFLUSH);
+    return 0;
+}
+
+int ModBus_Linux_openSerial(const char* path, uint32_t baud)
+{
+    int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    if (ModBus_Linux_configure(fd, baud) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ModBus_Linux_create()
+{
+    return epoll_create1(EPOLL_CLOEXEC);
+}
+
+int ModBus_Linux_add(int epollFd, ModBus_Linux_Port_T* port, ModBus_parameter* para, int fd, uint8_t role)
+{
+    struct epoll_event ev;
+    port->para = para;
+    port->fd = fd;
+    port->role = role;
+    port->closing = 0;
+    port->wakeups = 0;
+    port->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (port->timerFd < 0)
+    {
+        return -1;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t)(uintptr_t)port;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+        close(port->timerFd);
+        return -1;
+    }
+    ev.data.u64 = (uint64_t)(uintptr_t)port | MODBUS_LINUX_TIMER_TAG;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, port->timerFd, &ev) != 0)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+        close(port->timerFd);
+        return -1;
+    }
+    ModBus_attachSendHandler(para, linux_send, port);
+    ModBus_Linux_service(port);
+    return 0;
+}
+
+void ModBus_Linux_remove(int epollFd, ModBus_Linux_Port_T* port)
+{
+    if (port->fd >= 0)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, port->fd, NULL);
+    }
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, port->timerFd, NULL);
+    close(port->timerFd);
+    port->timerFd = -1;
+    ModBus_attachSendHandler(port->para, NULL, NULL);
+}
+
+int ModBus_Linux_watch(int epollFd, ModBus_Linux_Watch_T* watch, int fd, void(*handler)(void*, uint32_t), void* context)
+{
+    struct epoll_event ev;
+    watch->fd = fd;
+    watch->handler = handler;
+    watch->context = context;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = (uint64_t)(uintptr_t)watch | MODBUS_LINUX_WATCH_TAG;
+    return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0 ? 0 : -1;
+}
+
+void ModBus_Linux_unwatch(int epollFd, ModBus_Linux_Watch_T* watch)
+{
+    if (watch->fd >= 0)
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, watch->fd, NULL);
+    }
+    watch->fd = -1;
+}
+
+int ModBus_Linux_run(int epollFd, int timeoutMs)
+{
+    struct epoll_event events[MODBUS_LINUX_EVENTS];
+    int n = epoll_wait(epollFd, events, MODBUS_LINUX_EVENTS, timeoutMs);
+    if (n < 0)
+    {
+        return errno == EINTR ? 0 : -1;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        ModBus_Linux_Port_T* port = (ModBus_Linux_Port_T*)(uintptr_t)(events[i].data.u64 & ~(uint64_t)MODBUS_LINUX_TAGS);
+        if (events[i].data.u64 & MODBUS_LINUX_WATCH_TAG)
+        {
+            ModBus_Linux_Watch_T* watch = (ModBus_Linux_Watch_T*)(void*)port;
+            if (watch->fd >= 0) // Наблюдение могло быть удалено обработкой предыдущего события
+            {
+                watch->handler(watch->context, events[i].events);
+            }
+            continue;
+        }
+        if (events[i].data.u64 & MODBUS_LINUX_TIMER_TAG)
+        {
+            uint64_t expirations;
+            if (read(port->timerFd, &expirations, sizeof(expirations)) < 0 && errno == EAGAIN)
+            {
+                continue; // Таймер перевзведен обработкой порта в этом же вызове
+            }
+        }
+        else if (port->fd >= 0 && linux_receive(port) < 0)
+        {
+            // Порт закрыт другой стороной: без удаления epoll будет постоянно сообщать EPOLLHUP
+            epoll_ctl(epollFd, EPOLL_CTL_DEL, port->fd, NULL);
+            port->fd = -1;
+        }
+        ModBus_Linux_service(port);
+    }
+    return n;
+}
+
+#ifdef _UNIT_TEST
+#include <pty.h>
+#include <stdio.h>
+
+static uint16_t s_linuxReadOk, s_linuxWriteOk;
+
+static void linux_readResponse(uint16_t* data, uint16_t count)
+{
+    assert(count == 2 && data[0] == 0xCAFE && data[1] == 0x0042);
+    s_linuxReadOk++;
+}
+
+static void linux_writeResponse(uint16_t address, uint16_t count)
+{
+    assert(address == 5 && count == 1);
+    s_linuxWriteOk++;
+}
+
+void ModBus_Linux_unitTest()
+{
+    static ModBus_parameter master, slave;
+    static ModBus_Linux_Port_T masterPort, slavePort;
+    ModBus_Setting_T setting = { 0 };
+    int ptyMaster, ptySlave, epollFd;
+
+    ModBus_setClock(ModBus_Linux_clock);
+    setting.address = 0x01;
+    ModBus_setup(&master, setting);
+    ModBus_setup(&slave, setting);
+    ModBus_setTimeout(&master, 0, 200);
+    ModBus_attachRegisterHandler(&slave, ModBus_testGetRegister, ModBus_testSetRegister);
+    memset(g_testRegisters, 0, sizeof(g_testRegisters)); // Банк общий для тестов модулей
+    g_testRegisters[0] = 0xCAFE;
+    g_testRegisters[1] = 0x0042;
+
+    assert(openpty(&ptyMaster, &ptySlave, NULL, NULL, NULL) == 0);
+    assert(ModBus_Linux_configure(ptyMaster, 0) == 0 && ModBus_Linux_configure(ptySlave, 9600) == 0);
+    epollFd = ModBus_Linux_create();
+    assert(epollFd >= 0);
+    assert(ModBus_Linux_add(epollFd, &masterPort, &master, ptyMaster, MODBUS_LINUX_MASTER) == 0);
+    assert(ModBus_Linux_add(epollFd, &slavePort, &slave, ptySlave, MODBUS_LINUX_SLAVE) == 0);
+
+    ModBus_getRegister(&master, 0, 2, linux_readResponse);
+    ModBus_setRegister(&master, 5, 0x0077, linux_writeResponse);
+    ModBus_getRegister(&master, 0, 2, linux_readResponse);
+    ModBus_Linux_service(&masterPort);
+
+    for (int i = 0; i < 1000 && master.m_sendFramesN > 0; i++)
+    {
+        assert(ModBus_Linux_run(epollFd, 1000) > 0); // Ожидание без событий означало бы потерю кадра
+    }
+    assert(s_linuxReadOk == 2 && s_linuxWriteOk == 1);
+    assert(g_testRegisters[5] == 0x0077);
+    assert(masterPort.wakeups + slavePort.wakeups < 100); // Циклы вызываются по событиям, а не постоянно
+    printf("Modbus Linux pty: %u reads, %u writes, %u wakeups\n", s_linuxReadOk, s_linuxWriteOk, masterPort.wakeups + slavePort.wakeups);
+
+    ModBus_Linux_remove(epollFd, &masterPort);
+    ModBus_Linux_remove(epollFd, &slavePort);
+    close(epollFd);
+    close(ptySlave);
+    close(ptyMaster);
+
+    // Кадр не помещается в буфер сокета: отправка не блокируется, соединение закрывается, а не обрезает поток
+    {
+        static ModBus_Linux_Port_T socketPort;
+        uint8_t frame[8] = { 0x01, 0x03, 0x00, 0x00, 0x00, 0x02, 0xC4, 0x0B };
+        uint8_t buff[256];
+        int sv[2];
+        ssize_t n;
+        assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+        fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+        while (write(sv[0], buff, sizeof(buff)) > 0)
+        {
+        }
+        socketPort.fd = sv[0];
+        socketPort.closing = 0;
+        linux_send(&socketPort, frame, sizeof(frame));
+        assert(socketPort.closing == 1);
+        linux_send(&socketPort, frame, sizeof(frame)); // Больше не пишется в закрытый сокет
+        while ((n = read(sv[1], buff, sizeof(buff))) > 0)
+        {
+        }
+        assert(n == 0); // Другая сторона видит разрыв
+        close(sv[0]);
+        close(sv[1]);
+    }
+    ModBus_setClock(NULL);
+}
+#endif // _UNIT_TEST
+
+#endif // __linux__
@@ -0,0 +1,103 @@
+#ifndef MODBUS_LINUX_H_
+#define MODBUS_LINUX_H_
+/**** Драйвер последовательного порта Linux (tty/pty) на epoll и timerfd ****
+** Экземпляр ModBus связывается с дескриптором порта, байты читаются блоками.
+** Цикл экземпляра вызывается только по событию: прием байтов или срабатывание таймера,
+** таймер взводится на время следующего события (ModBus_Master_nextWakeup/ModBus_Slave_nextWakeup).
+** Один поток epoll может обслуживать несколько портов.
+** Как использовать:
+****** Вызов ModBus_setClock(ModBus_Linux_clock), затем ModBus_setup для каждого экземпляра
+****** Вызов ModBus_Linux_openSerial (или ModBus_Linux_configure для уже открытого дескриптора, например pty)
+****** Вызов ModBus_Linux_create, затем ModBus_Linux_add для каждого порта
+****** Циклический вызов ModBus_Linux_run, поток спит в epoll_wait до события
+****** После постановки команд Master вне обработчиков вызвать ModBus_Linux_service, чтобы отправка началась сразу
+** Собирается только для Linux.
+*/
+
+#include "modbus.h"
+
+#ifdef __linux__
+
+typedef enum {
+    MODBUS_LINUX_MASTER = 0,
+    MODBUS_LINUX_SLAVE = 1,
+} MODBUS_LINUX_ROLE;
+
+typedef struct _MODBUS_LINUX_PORT_T { // Порт драйвера, память принадлежит приложению
+    ModBus_parameter* para; // Экземпляр ModBus
+    int fd; // Дескриптор tty/pty, -1 после разрыва
+    int timerFd; // timerfd времени следующего события
+    uint8_t role; // MODBUS_LINUX_ROLE
+    uint8_t closing; // Кадр не поместился в буфер сокета, соединение закрыто, ожидается разрыв в ModBus_Linux_run
+    uint32_t wakeups; // Количество вызовов цикла экземпляра
+} ModBus_Linux_Port_T;
+
+typedef struct _MODBUS_LINUX_WATCH_T { // Посторонний дескриптор в том же epoll (сокеты шлюза и т.п.), память принадлежит приложению
+    int fd;
+    void(*handler)(void*, uint32_t); // Обработчик (context, события EPOLLIN/EPOLLHUP/EPOLLERR), вызывается из ModBus_Linux_run
+    void* context;
+} ModBus_Linux_Watch_T;
+
+/************ Внешний интерфейс BEGIN ***********/
+
+/** Открытие последовательного порта **/
+/*** Параметры ***
+** path: Путь устройства, например "/dev/ttyUSB0"
+** baud: Скорость передачи данных
+** Возвращает неблокирующий дескриптор в режиме raw, 8N1, или -1 при ошибке
+***/
+int ModBus_Linux_openSerial(const char* path, uint32_t baud);
+
+// Перевод открытого дескриптора в режим raw 8N1 с заданной скоростью (0 - не менять) и неблокирующий режим, 0 при успехе
+int ModBus_Linux_configure(int fd, uint32_t baud);
+
+// Время CLOCK_MONOTONIC в микросекундах, источник для ModBus_setClock
+uint64_t ModBus_Linux_clock();
+
+// Создание дескриптора epoll для портов, -1 при ошибке
+int ModBus_Linux_create();
+
+/** Добавление порта **/
+/*** Параметры ***
+** epollFd: Дескриптор ModBus_Linux_create
+** port: Память порта, должна существовать, пока порт добавлен
+** para: Экземпляр ModBus, функция отправки которого заменяется записью в порт
+** fd: Дескриптор порта
+** role: MODBUS_LINUX_MASTER или MODBUS_LINUX_SLAVE, определяет вызываемый цикл
+** Возвращает 0 при успехе, -1 при ошибке
+***/
+int ModBus_Linux_add(int epollFd, ModBus_Linux_Port_T* port, ModBus_parameter* para, int fd, uint8_t role);
+
+/** Ожидание и обработка событий портов **/
+/*** Параметры ***
+** timeoutMs: Максимальное время ожидания, -1 - без ограничения
+** Возвращает количество обработанных событий, 0 по тайм-ауту, -1 при ошибке epoll
+***/
+int ModBus_Linux_run(int epollFd, int timeoutMs);
+
+// Вызов цикла экземпляра и перевзвод таймера, нужен после постановки команд Master вне ModBus_Linux_run
+void ModBus_Linux_service(ModBus_Linux_Port_T* port);
+
+// Удаление порта из epoll, закрытие таймера и отвязка функции отправки; дескриптор порта не закрывается
+void ModBus_Linux_remove(int epollFd, ModBus_Linux_Port_T* port);
+
+/** Наблюдение за посторонним дескриптором **/
+/*** Параметры ***
+** watch: Память наблюдения, должна существовать, пока дескриптор добавлен
+** fd: Дескриптор (сокет), ожидаются события чтения
+** handler, context: Обработчик событий и его контекст
+** Возвращает 0 при успехе, -1 при ошибке. Позволяет обслуживать порты и сокеты одним потоком epoll.
+***/
+int ModBus_Linux_watch(int epollFd, ModBus_Linux_Watch_T* watch, int fd, void(*handler)(void*, uint32_t), void* context);
+
+// Удаление наблюдения, дескриптор не закрывается
+void ModBus_Linux_unwatch(int epollFd, ModBus_Linux_Watch_T* watch);
+
+#ifdef _UNIT_TEST
+void ModBus_Linux_unitTest(); // Master и Slave на двух концах pty в одном потоке epoll
+#endif
+/**************** Внешний интерфейс END ***************/
+
+#endif // __linux__
+
+#endif
@@ -0,0 +1,278 @@
+#include "modbus_poll.h"
+
+#ifdef MODBUS_MASTER
+
+// Период элемента в микросекундах
+static uint64_t poll_period(ModBus_PollItem_T* item)
+{
+    return (uint64_t)item->period * 1000u;
+}
+
+static uint64_t poll_key(ModBus_PollItem_T* item, uint8_t byDeadline)
+{
+    return byDeadline ? item->deadline : item->release;
+}
+
+static void poll_heapPush(ModBus_PollItem_T** heap, size_t* n, ModBus_PollItem_T* item, uint8_t byDeadline)
+{
+    size_t i = (*n)++;
+    while (i > 0)
+    {
+        size_t parent = (i - 1) / 2;
+        if (poll_key(item, byDeadline) >= poll_key(heap[parent], byDeadline))
+        {
+            break;
+        }
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = item;
+}
+
+static ModBus_PollItem_T* poll_heapPop(ModBus_PollItem_T** heap, size_t* n, uint8_t byDeadline)
+{
+    ModBus_PollItem_T* top = heap[0];
+    ModBus_PollItem_T* last = heap[--(*n)];
+    size_t i = 0;
+    for (;;)
+    {
+        size_t child = 2 * i + 1;
+        if (child >= *n)
+        {
+            break;
+        }
+        if (child + 1 < *n && poll_key(heap[child + 1], byDeadline) < poll_key(heap[child], byDeadline))
+        {
+            child++;
+        }
+        if (poll_key(heap[child], byDeadline) >= poll_key(last, byDeadline))
+        {
+            break;
+        }
+        heap[i] = heap[child];
+        i = child;
+    }
+    if (*n > 0)
+    {
+        heap[i] = last;
+    }
+    return top;
+}
+
+// Очередь Master принимает новую команду: отправляется текущая и одна готова к отправке сразу после ответа.
+// Очередь держится короткой, чтобы порядок EDF определялся расписанием, а не очередью
+static uint8_t poll_masterHasRoom(ModBus_Poll_T* poll)
+{
+    ModBus_parameter* master = poll->master;
+    size_t limit = (master->m_mode == MODBUS_MODE_TCP ? master->m_window : 1) + 1;
+    return master->m_sendFramesN < limit && master->m_sendFramesN < master->m_sendFramesSize;
+}
+
+// Ответ на команду элемента: вызов функции обратного вызова и планирование следующего периода
+static void poll_response(void* context, uint16_t* data, uint16_t count)
+{
+    ModBus_PollItem_T* item = (ModBus_PollItem_T*)context;
+    ModBus_Poll_T* poll = item->poll;
+    uint64_t now = ModBus_now();
+
+    item->busy = 0;
+    if (item->handler)
+    {
+        item->handler(item, data, count);
+    }
+
+    item->release = item->deadline;
+    if (item->deadline < now) // Опрос завершен после срока, пропущенные периоды не наверстываются
+    {
+        uint32_t missed = (uint32_t)((now - item->deadline) / poll_period(item));
+        item->overruns += missed + 1;
+        poll->overruns += missed + 1;
+        item->release += missed * poll_period(item);
+    }
+    item->deadline = item->release + poll_period(item);
+    poll_heapPush(poll->waiting, &poll->waitingN, item, 0);
+}
+
+void ModBus_Poll_init(ModBus_Poll_T* poll, ModBus_parameter* master, ModBus_PollItem_T** memory, size_t capacity)
+{
+    poll->master = master;
+    poll->waiting = memory;
+    poll->waitingN = 0;
+    poll->ready = memory + capacity;
+    poll->readyN = 0;
+    poll->n = 0;
+    poll->capacity = capacity;
+    poll->overruns = 0;
+}
+
+uint8_t ModBus_Poll_add(ModBus_Poll_T* poll, ModBus_PollItem_T* item)
+{
+    if (poll->n >= poll->capacity || item->period == 0
+        || !ModBus_prepareRead(poll->master, &item->request, item->unit, READ_REGISTER, item->address, item->count))
+    {
+        return 0;
+    }
+    item->poll = poll;
+    item->release = ModBus_now();
+    item->deadline = item->release + poll_period(item);
+    item->overruns = 0;
+    item->busy = 0;
+    poll->n++;
+    poll_heapPush(poll->waiting, &poll->waitingN, item, 0);
+    return 1;
+}
+
+void ModBus_Poll_loop(ModBus_Poll_T* poll)
+{
+    uint64_t now = ModBus_now();
+
+    // Элементы, период которых начался, переходят в кучу готовых
+    while (poll->waitingN > 0 && now >= poll->waiting[0]->release)
+    {
+        ModBus_PollItem_T* item = poll_heapPop(poll->waiting, &poll->waitingN, 0);
+        poll_heapPush(poll->ready, &poll->readyN, item, 1);
+    }
+    // Готовые элементы отправляются в порядке ближайшего срока
+    while (poll->readyN > 0 && poll_masterHasRoom(poll))
+    {
+        ModBus_PollItem_T* item = poll_heapPop(poll->ready, &poll->readyN, 1);
+        // Флаг до отправки: ответ из кэша вызывает poll_response внутри ModBus_submitRead
+        item->busy = 1;
+        if (!ModBus_submitRead(poll->master, &item->request, poll_response, item))
+        {
+            item->busy = 0;
+            poll_heapPush(poll->ready, &poll->readyN, item, 1);
+            break;
+        }
+    }
+
+    ModBus_Master_loop(poll->master);
+}
+
+uint64_t ModBus_Poll_nextWakeup(ModBus_Poll_T* poll)
+{
+    uint64_t now = ModBus_now();
+    uint64_t wakeup = ModBus_Master_nextWakeup(poll->master);
+    if (poll->readyN > 0 && poll_masterHasRoom(poll))
+    {
+        return 0;
+    }
+    if (poll->waitingN > 0)
+    {
+        uint64_t release = poll->waiting[0]->release;
+        uint64_t left = now < release ? release - now : 0;
+        if (left < wakeup)
+        {
+            wakeup = left;
+        }
+    }
+    return wakeup;
+}
+
+#ifdef _UNIT_TEST
+#include <stdio.h>
+
+extern uint32_t t; // Виртуальное время теста (modbus.c)
+
+static ModBus_parameter s_pollMaster, s_pollSlave;
+static uint16_t s_pollResponses[3];
+
+static void poll_masterSend(uint8_t* data, size_t len)
+{
+    ModBus_readbytesFromOuter(&s_pollSlave, data, len);
+}
+
+static void poll_slaveSend(uint8_t* data, size_t len)
+{
+    ModBus_readbytesFromOuter(&s_pollMaster, data, len);
+}
+
+static size_t poll_getReg(uint16_t address, uint16_t n, uint16_t* data)
+{
+    for (uint16_t i = 0; i < n; i++)
+    {
+        data[i] = address + i;
+    }
+    return n;
+}
+
+static void poll_handler(ModBus_PollItem_T* item, uint16_t* data, uint16_t count)
+{
+    assert(count == item->count && data[0] == item->address);
+    s_pollResponses[(size_t)item->context]++;
+}
+
+void ModBus_Poll_unitTest()
+{
+    static ModBus_PollItem_T items[3];
+    static ModBus_PollItem_T* memory[MODBUS_POLL_MEMORY(3)];
+    static const uint32_t periods[3] = { 100, 1000, 250 };
+    static ModBus_PollItem_T extra[2];
+    static ModBus_PollItem_T* smallMemory[MODBUS_POLL_MEMORY(1)];
+    ModBus_Poll_T poll, small;
+    ModBus_Setting_T setting = { 0 };
+    uint32_t start = t;
+
+    setting.address = 0x01;
+    setting.baudRate = 9600;
+    setting.sendHandler = poll_masterSend;
+    ModBus_setup(&s_pollMaster, setting);
+    setting.sendHandler = poll_slaveSend;
+    ModBus_setup(&s_pollSlave, setting);
+    ModBus_attachRegisterHandler(&s_pollSlave, poll_getReg, NULL);
+
+    ModBus_Poll_init(&poll, &s_pollMaster, memory, 3);
+    for (size_t i = 0; i < 3; i++)
+    {
+        items[i].unit = 0x01;
+        items[i].address = (uint16_t)(10 * i);
+        items[i].count = 2;
+        items[i].period = periods[i];
+        items[i].handler = poll_handler;
+        items[i].context = (void*)i;
+        assert(ModBus_Poll_add(&poll, &items[i]));
+    }
+
+    while (t - start < 2000)
+    {
+        uint64_t wakeup;
+        ModBus_Poll_loop(&poll);
+        ModBus_Slave_loop(&s_pollSlave);
+        wakeup = ModBus_Poll_nextWakeup(&poll);
+        assert(wakeup <= 1000000u);
+        t += 1; // Без приема байтов можно было бы спать wakeup мкс
+    }
+    // Первый опрос выполняется сразу, затем по одному за период
+    assert(s_pollResponses[0] >= 19 && s_pollResponses[0] <= 21);
+    assert(s_pollResponses[1] == 2);
+    assert(s_pollResponses[2] == 8);
+    assert(poll.overruns == 0);
+
+    // Отправленный элемент занимает место: добавление сверх capacity отклоняется
+    ModBus_Poll_init(&small, &s_pollMaster, smallMemory, 1);
+    for (size_t i = 0; i < 2; i++)
+    {
+        extra[i] = items[0];
+        extra[i].handler = NULL;
+    }
+    assert(ModBus_Poll_add(&small, &extra[0]));
+    while (!extra[0].busy)
+    {
+        ModBus_Poll_loop(&small);
+        ModBus_Slave_loop(&s_pollSlave);
+        t += 1;
+    }
+    assert(small.waitingN + small.readyN == 0);
+    assert(!ModBus_Poll_add(&small, &extra[1]));
+    while (extra[0].busy)
+    {
+        ModBus_Poll_loop(&small);
+        ModBus_Slave_loop(&s_pollSlave);
+        t += 1;
+    }
+    assert(small.waitingN == 1 && small.readyN == 0);
+    printf("Poll schedule: %u/%u/%u responses\n", s_pollResponses[0], s_pollResponses[1], s_pollResponses[2]);
+}
+#endif // _UNIT_TEST
+
+#endif // MODBUS_MASTER
@@ -0,0 +1,83 @@
+#ifndef MODBUS_POLL_H_
+#define MODBUS_POLL_H_
+/**** Циклический опрос регистров по расписанию ****
+** Каждый элемент опроса - блок регистров устройства со своим периодом.
+** Готовые элементы отправляются в очередь Master в порядке ближайшего срока (EDF).
+** Стоимость планирования O(log n) на элемент: элементы хранятся в двух двоичных кучах
+** (ожидающие начала периода - по времени начала, готовые - по сроку).
+** Как использовать:
+****** Вызов ModBus_Poll_init с памятью для куч (MODBUS_POLL_MEMORY(n) указателей)
+****** Вызов ModBus_Poll_add для каждого элемента, память элементов принадлежит приложению
+****** Циклический вызов ModBus_Poll_loop вместо ModBus_Master_loop
+****** Между вызовами поток может спать ModBus_Poll_nextWakeup микросекунд (или до приема байтов)
+*/
+
+#include "modbus.h"
+
+#ifdef MODBUS_MASTER
+
+#define MODBUS_POLL_MEMORY(n) ((n) * 2) // Количество указателей памяти куч для n элементов
+
+typedef struct _MODBUS_POLL_ITEM_T {
+    uint8_t unit; // Адрес устройства
+    uint16_t address; // Адрес первого регистра
+    uint16_t count; // Количество регистров
+    uint32_t period; // Период опроса, мс
+    void(*handler)(struct _MODBUS_POLL_ITEM_T*, uint16_t*, uint16_t); // Функция обратного вызова (элемент, данные, количество), при ошибке количество равно 0
+    void* context; // Данные приложения
+
+    uint64_t release; // Начало текущего периода, мкс (ModBus_now)
+    uint64_t deadline; // Срок текущего периода (начало следующего), мкс
+    uint32_t overruns; // Количество пропущенных периодов
+    uint8_t busy; // Команда в очереди Master
+    struct _MODBUS_POLL_T* poll; // Расписание, которому принадлежит элемент
+    ModBus_Prepared_T request; // Кадр опроса, кодируется в ModBus_Poll_add
+} ModBus_PollItem_T;
+
+typedef struct _MODBUS_POLL_T {
+    ModBus_parameter* master;
+    ModBus_PollItem_T** waiting; // Куча по времени начала периода
+    size_t waitingN;
+    ModBus_PollItem_T** ready; // Куча по сроку
+    size_t readyN;
+    size_t n; // Добавленные элементы, включая отправленные Master
+    size_t capacity;
+    uint32_t overruns; // Всего пропущенных периодов
+} ModBus_Poll_T;
+
+/************ Внешний интерфейс BEGIN ***********/
+
+/** Инициализация расписания **/
+/*** Параметры ***
+** master: Экземпляр Master, настроенный ModBus_setup
+** memory: Массив из MODBUS_POLL_MEMORY(capacity) указателей
+** capacity: Максимальное количество элементов
+***/
+void ModBus_Poll_init(ModBus_Poll_T* poll, ModBus_parameter* master, ModBus_PollItem_T** memory, size_t capacity);
+
+/** Добавление элемента опроса **/
+/*** Параметры ***
+** item: Элемент с заполненными unit, address, count, period, handler; первый опрос выполняется сразу
+** Возвращает 1 при успехе, 0 если расписание заполнено, период равен 0 или count недопустим
+** Примечание: Кадр запроса кодируется один раз (ModBus_prepareRead) в текущем режиме Master,
+** режим (ModBus_setMode) задается до добавления элементов.
+***/
+uint8_t ModBus_Poll_add(ModBus_Poll_T* poll, ModBus_PollItem_T* item);
+
+// Цикл расписания: постановка готовых элементов в очередь и вызов ModBus_Master_loop
+void ModBus_Poll_loop(ModBus_Poll_T* poll);
+
+/** Время до следующего события **/
+/*** Возвращает количество микросекунд, через которое нужно вызвать ModBus_Poll_loop (начало периода элемента или событие Master),
+** 0 - вызвать сразу. Прием байтов также требует вызова цикла.
+***/
+uint64_t ModBus_Poll_nextWakeup(ModBus_Poll_T* poll);
+
+#ifdef _UNIT_TEST
+void ModBus_Poll_unitTest();
+#endif
+/**************** Внешний интерфейс END ***************/
+
+#endif // MODBUS_MASTER
+
+#endif
@@ -0,0 +1,202 @@
+#include "modbus_tcp.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// Функция отправки экземпляра, context - дескриптор сокета
+static void tcp_send(void* context, uint8_t* data, size_t size)
+{
+    int fd = (int)(intptr_t)context;
+    while (size > 0)
+    {
+        ssize_t n = send(fd, data, size, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return; // Соединение разорвано, команда завершится по тайм-ауту
+        }
+        data += n;
+        size -= (size_t)n;
+    }
+}
+
+static void tcp_setNoDelay(int fd)
+{
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)); // Запросы не должны задерживаться алгоритмом Нейгла
+}
+
+int ModBus_TCP_connect(ModBus_parameter* ModBus_para, const char* host, uint16_t port, uint8_t window)
+{
+    struct sockaddr_in addr;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    tcp_setNoDelay(fd);
+    ModBus_setMode(ModBus_para, MODBUS_MODE_TCP, window);
+    ModBus_attachSendHandler(ModBus_para, tcp_send, (void*)(intptr_t)fd);
+    return fd;
+}
+
+int ModBus_TCP_listen(const char* host, uint16_t port)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((host != NULL && inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+        || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+        || listen(fd, SOMAXCONN) != 0) // Шлюз принимает десятки клиентов сразу
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+uint16_t ModBus_TCP_localPort(int fd)
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(fd, (struct sockaddr*)&addr, &len) != 0)
+    {
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+int ModBus_TCP_accept(ModBus_parameter* ModBus_para, int listenFd)
+{
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    tcp_setNoDelay(fd);
+    ModBus_setMode(ModBus_para, MODBUS_MODE_TCP, 0);
+    ModBus_attachSendHandler(ModBus_para, tcp_send, (void*)(intptr_t)fd);
+    return fd;
+}
+
+int ModBus_TCP_receive(ModBus_parameter* ModBus_para, int fd)
+{
+    uint8_t buff[MODBUS_RECEIVE_RING_SIZE];
+    size_t space = ModBus_receiveSpace(ModBus_para);
+    ssize_t n;
+    if (space == 0)
+    {
+        return 0;
+    }
+    n = recv(fd, buff, space, MSG_DONTWAIT);
+    if (n == 0)
+    {
+        return -1; // Соединение закрыто
+    }
+    if (n < 0)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    ModBus_readbytesFromOuter(ModBus_para, buff, (size_t)n); // Весь блок с одной меткой времени
+    return (int)n;
+}
+
+void ModBus_TCP_close(ModBus_parameter* ModBus_para, int fd)
+{
+    ModBus_attachSendHandler(ModBus_para, NULL, NULL);
+    close(fd);
+}
+
+#ifdef _UNIT_TEST
+#include <stdio.h>
+
+static uint16_t s_tcpReadOk, s_tcpWriteOk;
+
+static void tcp_readResponse(uint16_t* data, uint16_t count)
+{
+    assert(count == 2 && data[0] == 0x1234 && data[1] == 0x5678);
+    s_tcpReadOk++;
+}
+
+static void tcp_writeResponse(uint16_t address, uint16_t count)
+{
+    assert(address == 4 && count == 1);
+    s_tcpWriteOk++;
+}
+
+void ModBus_TCP_unitTest()
+{
+    static ModBus_parameter master, slave;
+    static MODBUS_FRAME_T frames[8];
+    ModBus_Setting_T setting = { 0 };
+    int listenFd, masterFd, slaveFd;
+
+    setting.address = 0x01;
+    ModBus_setup(&master, setting);
+    ModBus_setup(&slave, setting);
+    ModBus_attachRegisterHandler(&slave, ModBus_testGetRegister, ModBus_testSetRegister);
+    ModBus_setFrameQueue(&master, frames, 8);
+    memset(g_testRegisters, 0, sizeof(g_testRegisters)); // Банк общий для тестов модулей
+    g_testRegisters[0] = 0x1234;
+    g_testRegisters[1] = 0x5678;
+
+    listenFd = ModBus_TCP_listen("127.0.0.1", 0);
+    assert(listenFd >= 0);
+    masterFd = ModBus_TCP_connect(&master, "127.0.0.1", ModBus_TCP_localPort(listenFd), 4);
+    assert(masterFd >= 0);
+    slaveFd = ModBus_TCP_accept(&slave, listenFd);
+    assert(slaveFd >= 0);
+
+    for (int i = 0; i < 3; i++)
+    {
+        assert(ModBus_getRegister(&master, 0, 2, tcp_readResponse) != 0);
+    }
+    assert(ModBus_setRegister(&master, 4, 0x00AA, tcp_writeResponse) != 0);
+    assert(ModBus_getRegister(&master, 0, 2, tcp_readResponse) != 0);
+
+    ModBus_Master_loop(&master);
+    assert(master.m_inFlight == 4); // Окно заполнено, пятый запрос ждет
+
+    for (int i = 0; i < 10000 && master.m_sendFramesN > 0; i++)
+    {
+        ModBus_TCP_receive(&slave, slaveFd);
+        ModBus_Slave_loop(&slave);
+        ModBus_TCP_receive(&master, masterFd);
+        ModBus_Master_loop(&master);
+    }
+    assert(s_tcpReadOk == 4 && s_tcpWriteOk == 1);
+    assert(g_testRegisters[4] == 0x00AA);
+    printf("Modbus TCP loopback: %u reads, %u writes\n", s_tcpReadOk, s_tcpWriteOk);
+
+    ModBus_TCP_close(&master, masterFd);
+    ModBus_TCP_close(&slave, slaveFd);
+    close(listenFd);
+}
+#endif // _UNIT_TEST
+
+#endif // _WIN32
@@ -0,0 +1,69 @@
+#ifndef MODBUS_TCP_H_
+#define MODBUS_TCP_H_
+/**** Транспорт Modbus TCP поверх сокетов POSIX ****
+** Связывает экземпляр ModBus в режиме MODBUS_MODE_TCP с TCP-соединением.
+** Как использовать:
+**** 1.Master
+****** Вызов конфигурации ModBus_setup, затем ModBus_setFrameQueue для очереди больше окна
+****** Вызовите ModBus_TCP_connect, экземпляр переводится в режим TCP с заданным окном
+****** Циклический вызов ModBus_TCP_receive и ModBus_Master_loop
+**** 2.Slave
+****** Вызовите ModBus_TCP_listen, затем ModBus_TCP_accept для каждого клиента
+****** Циклический вызов ModBus_TCP_receive и ModBus_Slave_loop
+** Для Windows не собирается.
+*/
+
+#include "modbus.h"
+
+#ifndef _WIN32
+
+#define MODBUS_TCP_DEFAULT_PORT 502 // Стандартный порт Modbus TCP
+
+/************ Внешний интерфейс BEGIN ***********/
+
+/** Подключение Master к устройству Modbus TCP **/
+/*** Параметры ***
+** host: IPv4-адрес устройства, например "127.0.0.1"
+** port: Порт устройства
+** window: Количество запросов, одновременно ожидающих ответа
+** Возвращает дескриптор сокета или -1 при ошибке
+***/
+int ModBus_TCP_connect(ModBus_parameter* ModBus_para, const char* host, uint16_t port, uint8_t window);
+
+/** Открытие сокета для приема подключений **/
+/*** Параметры ***
+** host: Локальный IPv4-адрес, NULL - все адреса
+** port: Порт, 0 - выбирается системой (см. ModBus_TCP_localPort)
+** Возвращает дескриптор сокета или -1 при ошибке
+***/
+int ModBus_TCP_listen(const char* host, uint16_t port);
+
+// Порт, к которому привязан сокет, 0 при ошибке
+uint16_t ModBus_TCP_localPort(int fd);
+
+/** Прием подключения для экземпляра Slave **/
+/*** Параметры ***
+** listenFd: Сокет, открытый ModBus_TCP_listen
+** Возвращает дескриптор сокета клиента или -1, экземпляр переводится в режим TCP
+***/
+int ModBus_TCP_accept(ModBus_parameter* ModBus_para, int listenFd);
+
+/** Прием данных из сокета без блокировки **/
+/*** Параметры ***
+** fd: Сокет соединения экземпляра
+** Возвращает количество принятых байтов, 0 если данных нет, -1 если соединение закрыто
+** Примечание: Читается не больше, чем помещается в буфер приема экземпляра, остальное остается в сокете до следующего вызова.
+***/
+int ModBus_TCP_receive(ModBus_parameter* ModBus_para, int fd);
+
+// Закрытие соединения и отвязка функции отправки
+void ModBus_TCP_close(ModBus_parameter* ModBus_para, int fd);
+
+#ifdef _UNIT_TEST
+void ModBus_TCP_unitTest(); // Обмен Master и Slave через loopback-соединение
+#endif
+/**************** Внешний интерфейс END ***************/
+
+#endif // _WIN32
+
+#endif
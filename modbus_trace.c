@@ -0,0 +1,309 @@
+#include "modbus_trace.h"
+
+#ifdef MODBUS_TRACE
+#include <stdio.h>
+#include <stdlib.h>
+
+void ModBus_Trace_init(ModBus_Trace_T* trace)
+{
+    atomic_init(&trace->next, 0);
+    for (size_t i = 0; i < MODBUS_TRACE_SLOTS; i++)
+    {
+        atomic_init(&trace->slots[i].sequence, 0);
+    }
+}
+
+void ModBus_attachTrace(ModBus_parameter* ModBus_para, ModBus_Trace_T* trace)
+{
+    ModBus_para->m_trace = trace;
+}
+
+void ModBus_Trace_record(ModBus_Trace_T* trace, uint8_t direction, uint8_t unit, uint64_t time, const uint8_t* data, size_t size)
+{
+    do
+    {
+        size_t n = size < MODBUS_TRACE_DATA ? size : MODBUS_TRACE_DATA;
+        uint32_t index = atomic_fetch_add_explicit(&trace->next, 1, memory_order_relaxed); // Место события занимается без блокировки
+        ModBus_TraceSlot_T* slot = trace->slots + index % MODBUS_TRACE_SLOTS;
+        // Пока событие записывается, номер равен 0: читатель пропускает его
+        atomic_store_explicit(&slot->sequence, 0, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+        slot->direction = direction;
+        slot->unit = unit;
+        slot->size = (uint16_t)n;
+        slot->time = time;
+        memcpy(slot->data, data, n);
+        atomic_store_explicit(&slot->sequence, index + 1, memory_order_release);
+        data += n;
+        size -= n;
+    } while (size > 0);
+}
+
+size_t ModBus_Trace_capture(ModBus_Trace_T* trace, uint8_t* out, size_t size)
+{
+    ModBus_TraceHeader_T header;
+    uint32_t next = atomic_load_explicit(&trace->next, memory_order_acquire);
+    uint32_t index = next > MODBUS_TRACE_SLOTS ? next - MODBUS_TRACE_SLOTS : 0;
+    size_t offset = sizeof(header);
+    if (size < sizeof(header))
+    {
+        return 0;
+    }
+    header.magic = MODBUS_TRACE_MAGIC;
+    header.version = MODBUS_TRACE_VERSION;
+    header.headerSize = sizeof(header);
+    header.count = 0;
+    header.lost = index;
+    for (; index != next; index++)
+    {
+        const ModBus_TraceSlot_T* slot = trace->slots + index % MODBUS_TRACE_SLOTS;
+        ModBus_TraceRecord_T record;
+        size_t length;
+        if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != index + 1)
+        {
+            header.lost++; // Событие еще записывается или уже перезаписано
+            continue;
+        }
+        record.time = slot->time;
+        record.size = slot->size <= MODBUS_TRACE_DATA ? slot->size : MODBUS_TRACE_DATA;
+        record.direction = slot->direction;
+        record.unit = slot->unit;
+        record.reserved = 0;
+        length = sizeof(record) + MODBUS_TRACE_ALIGN(record.size);
+        if (offset + length > size)
+        {
+            break;
+        }
+        memcpy(out + offset + sizeof(record), slot->data, record.size);
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&slot->sequence, memory_order_relaxed) != index + 1)
+        {
+            header.lost++; // Событие перезаписано во время копирования
+            continue;
+        }
+        memset(out + offset + sizeof(record) + record.size, 0, length - sizeof(record) - record.size);
+        memcpy(out + offset, &record, sizeof(record));
+        offset += length;
+        header.count++;
+    }
+    memcpy(out, &header, sizeof(header));
+    return offset;
+}
+
+int ModBus_Trace_save(ModBus_Trace_T* trace, const char* path)
+{
+    uint8_t* buff = (uint8_t*)malloc(MODBUS_TRACE_CAPTURE_MAX);
+    size_t size;
+    FILE* file;
+    int result = -1;
+    if (buff == NULL)
+    {
+        return -1;
+    }
+    size = ModBus_Trace_capture(trace, buff, MODBUS_TRACE_CAPTURE_MAX);
+    file = fopen(path, "wb");
+    if (file != NULL)
+    {
+        if (fwrite(buff, 1, size, file) == size)
+        {
+            result = (int)((const ModBus_TraceHeader_T*)buff)->count;
+        }
+        if (fclose(file) != 0)
+        {
+            result = -1;
+        }
+    }
+    free(buff);
+    return result;
+}
+
+uint8_t ModBus_Trace_open(ModBus_TraceReader_T* reader, const void* capture, size_t size)
+{
+    const ModBus_TraceHeader_T* header = (const ModBus_TraceHeader_T*)capture;
+    if (size < sizeof(*header) || header->magic != MODBUS_TRACE_MAGIC || header->version != MODBUS_TRACE_VERSION
+        || header->headerSize < sizeof(*header) || header->headerSize > size)
+    {
+        return 0;
+    }
+    reader->data = (const uint8_t*)capture;
+    reader->size = size;
+    reader->offset = header->headerSize;
+    reader->left = header->count;
+    return 1;
+}
+
+const ModBus_TraceRecord_T* ModBus_Trace_next(ModBus_TraceReader_T* reader, const uint8_t** data)
+{
+    const ModBus_TraceRecord_T* record;
+    if (reader->left == 0 || reader->size - reader->offset < sizeof(*record))
+    {
+        return NULL;
+    }
+    record = (const ModBus_TraceRecord_T*)(reader->data + reader->offset);
+    if (reader->size - reader->offset - sizeof(*record) < record->size)
+    {
+        return NULL; // Захват обрезан
+    }
+    *data = reader->data + reader->offset + sizeof(*record);
+    reader->offset += sizeof(*record) + MODBUS_TRACE_ALIGN(record->size);
+    if (reader->offset > reader->size)
+    {
+        reader->offset = reader->size;
+    }
+    reader->left--;
+    return record;
+}
+
+size_t ModBus_Trace_replay(ModBus_TraceReader_T* reader, ModBus_parameter* ModBus_para, uint8_t realTime, void(*loop)(ModBus_parameter*))
+{
+    const ModBus_TraceRecord_T* record;
+    const uint8_t* data;
+    uint64_t start = ModBus_now();
+    uint64_t first = 0;
+    uint8_t started = 0;
+    size_t total = 0;
+    while ((record = ModBus_Trace_next(reader, &data)) != NULL)
+    {
+        size_t left = record->size;
+        if (record->direction != MODBUS_TRACE_RX || record->unit != ModBus_para->m_address)
+        {
+            continue; // Ответы экземпляр сформирует сам
+        }
+        if (!started)
+        {
+            first = record->time;
+            started = 1;
+        }
+        while (realTime && ModBus_now() - start < record->time - first) // Исходный интервал до события
+        {
+            loop(ModBus_para);
+        }
+        while (left > 0)
+        {
+            size_t n = ModBus_readbytesFromOuter(ModBus_para, data, left);
+            data += n;
+            left -= n;
+            loop(ModBus_para); // Освобождение кольцевого буфера, если блок не поместился
+        }
+        total += record->size;
+    }
+    return total;
+}
+
+#ifdef _BENCHMARK
+void ModBus_Trace_benchmark()
+{
+    static const size_t sizes[] = { 8, 64, MODBUS_TRACE_DATA };
+    static ModBus_Trace_T trace;
+    static uint8_t data[MODBUS_TRACE_DATA];
+    const size_t rounds = 1000000;
+    ModBus_Trace_init(&trace);
+
+    printf("trace,bytes,ns_per_event\n");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        uint64_t begin = ModBus_benchNowNs();
+        for (size_t r = 0; r < rounds; r++)
+        {
+            ModBus_Trace_record(&trace, MODBUS_TRACE_RX, 0x01, r, data, sizes[s]);
+        }
+        printf("trace,%u,%.2f\n", (unsigned)sizes[s], (double)(ModBus_benchNowNs() - begin) / rounds);
+    }
+}
+#endif // _BENCHMARK
+
+#if defined(_UNIT_TEST) && defined(MODBUS_MASTER) && defined(MODBUS_SLAVE)
+extern uint32_t t; // Виртуальное время теста (modbus.c)
+
+static ModBus_parameter s_traceMaster, s_traceSlave, s_traceReplay;
+static uint8_t s_traceSent[4][MODBUS_BUFFER_SIZE]; // Ответы экземпляра при воспроизведении
+static uint16_t s_traceSentSize[4];
+static size_t s_traceSentN;
+
+static void trace_masterSend(uint8_t* data, size_t len)
+{
+    ModBus_readbytesFromOuter(&s_traceSlave, data, len);
+}
+
+static void trace_slaveSend(uint8_t* data, size_t len)
+{
+    ModBus_readbytesFromOuter(&s_traceMaster, data, len);
+}
+
+static void trace_replaySend(uint8_t* data, size_t len)
+{
+    assert(s_traceSentN < 4 && len <= MODBUS_BUFFER_SIZE);
+    memcpy(s_traceSent[s_traceSentN], data, len);
+    s_traceSentSize[s_traceSentN++] = (uint16_t)len;
+}
+
+void ModBus_Trace_unitTest()
+{
+    static ModBus_Trace_T trace;
+    static uint8_t capture[MODBUS_TRACE_CAPTURE_MAX];
+    ModBus_Setting_T setting = { 0 };
+    ModBus_TraceReader_T reader;
+    const ModBus_TraceRecord_T* record;
+    const uint8_t* data;
+    uint16_t values[3] = { 0x1111, 0x2222, 0x3333 };
+    size_t size, sent = 0;
+    FILE* file;
+
+    setting.address = 0x01;
+    setting.baudRate = 9600;
+    setting.sendHandler = trace_masterSend;
+    ModBus_setup(&s_traceMaster, setting);
+    setting.sendHandler = trace_slaveSend;
+    ModBus_setup(&s_traceSlave, setting);
+    setting.sendHandler = trace_replaySend;
+    ModBus_setup(&s_traceReplay, setting);
+    ModBus_attachRegisterHandler(&s_traceSlave, ModBus_testGetRegister, ModBus_testSetRegister);
+    ModBus_attachRegisterHandler(&s_traceReplay, ModBus_testGetRegister, ModBus_testSetRegister);
+    memset(g_testRegisters, 0, sizeof(g_testRegisters)); // Банк общий для тестов модулей
+    ModBus_Trace_init(&trace);
+    ModBus_attachTrace(&s_traceSlave, &trace);
+
+    // Запись: два запроса и ответы Slave, между ними мусор на линии
+    ModBus_setRegisters(&s_traceMaster, 2, values, 3, NULL);
+    ModBus_getRegister(&s_traceMaster, 2, 3, NULL);
+    for (int i = 0; i < 4; i++)
+    {
+        ModBus_Master_loop(&s_traceMaster);
+        ModBus_Slave_loop(&s_traceSlave);
+        if (i == 0)
+        {
+            ModBus_readbytesFromOuter(&s_traceSlave, (const uint8_t*)"\x00\x55", 2);
+        }
+        t += 10;
+    }
+    assert(s_traceMaster.m_sendFramesN == 0);
+
+    // Снимок в файл и обратно
+    assert(ModBus_Trace_save(&trace, "modbus_trace_test.bin") == 5);
+    file = fopen("modbus_trace_test.bin", "rb");
+    assert(file != NULL);
+    size = fread(capture, 1, sizeof(capture), file);
+    fclose(file);
+    remove("modbus_trace_test.bin");
+    assert(size == ModBus_Trace_capture(&trace, capture, sizeof(capture))); // Файл совпадает со снимком в памяти
+
+    // Воспроизведение в новом экземпляре дает те же ответы
+    memset(g_testRegisters, 0, sizeof(g_testRegisters));
+    assert(ModBus_Trace_open(&reader, capture, size));
+    assert(ModBus_Trace_replay(&reader, &s_traceReplay, 0, ModBus_Slave_loop) > 0);
+    assert(s_traceSentN == 2 && g_testRegisters[3] == 0x2222);
+    assert(ModBus_Trace_open(&reader, capture, size));
+    while ((record = ModBus_Trace_next(&reader, &data)) != NULL)
+    {
+        if (record->direction == MODBUS_TRACE_TX)
+        {
+            assert(record->size == s_traceSentSize[sent] && memcmp(data, s_traceSent[sent], record->size) == 0);
+            sent++;
+        }
+    }
+    assert(sent == 2);
+    printf("Modbus trace replay: %u responses\n", (unsigned)sent);
+}
+#endif // _UNIT_TEST
+
+#endif // MODBUS_TRACE
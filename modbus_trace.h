@@ -0,0 +1,131 @@
+#ifndef MODBUS_TRACE_H_
+#define MODBUS_TRACE_H_
+/**** Двоичная трасса кадров ****
+** Кольцо фиксированного размера из событий (направление, время, адрес устройства, байты).
+** Запись без блокировок: место занимается атомарным счетчиком, поэтому одну трассу могут использовать
+** прерывание приема и цикл экземпляра, а также несколько экземпляров. Старые события перезаписываются.
+** События:
+****** MODBUS_TRACE_RX - байты, переданные в ModBus_readbytesFromOuter (как приняты, включая мусор), unit - адрес экземпляра
+****** MODBUS_TRACE_TX - отправленный кадр, unit - адрес устройства в кадре
+** Снимок трассы сохраняется в файл захвата: заголовок ModBus_TraceHeader_T и записи ModBus_TraceRecord_T,
+** за каждой записью ее байты, выровненные до 8. Порядок байтов - как у машины записи. Файл можно отобразить в память
+** (mmap) и читать ModBus_Trace_open/ModBus_Trace_next без копирования.
+** Как использовать:
+****** Вызов ModBus_Trace_init, затем ModBus_attachTrace для каждого экземпляра
+****** ModBus_Trace_save (или ModBus_Trace_capture в память) при появлении проблемы
+****** Воспроизведение: ModBus_Trace_open для данных захвата, затем ModBus_Trace_replay для экземпляра
+*/
+
+#include "modbus.h"
+
+#ifdef MODBUS_TRACE
+
+#ifndef MODBUS_TRACE_SLOTS
+#define MODBUS_TRACE_SLOTS 128 // Количество событий в кольце
+#endif
+#ifndef MODBUS_TRACE_DATA
+#define MODBUS_TRACE_DATA MODBUS_BUFFER_SIZE // Байтов в одном событии, более длинные блоки приема занимают несколько событий
+#endif
+#define MODBUS_TRACE_MAGIC 0x5254424Du // "MBTR"
+#define MODBUS_TRACE_VERSION 1
+#define MODBUS_TRACE_ALIGN(size) (((size) + 7u) & ~(size_t)7u)
+// Максимальный размер снимка трассы
+#define MODBUS_TRACE_CAPTURE_MAX (sizeof(ModBus_TraceHeader_T) + MODBUS_TRACE_SLOTS * (sizeof(ModBus_TraceRecord_T) + MODBUS_TRACE_ALIGN(MODBUS_TRACE_DATA)))
+
+typedef enum {
+    MODBUS_TRACE_RX = 0, // Принятые байты
+    MODBUS_TRACE_TX = 1, // Отправленный кадр
+} MODBUS_TRACE_DIRECTION;
+
+typedef struct _MODBUS_TRACE_SLOT_T {
+    _Atomic(uint32_t) sequence; // Номер события + 1, 0 - событие записывается
+    uint8_t direction; // MODBUS_TRACE_DIRECTION
+    uint8_t unit;
+    uint16_t size;
+    uint64_t time; // ModBus_now(), мкс
+    uint8_t data[MODBUS_TRACE_DATA];
+} ModBus_TraceSlot_T;
+
+typedef struct _MODBUS_TRACE_T {
+    _Atomic(uint32_t) next; // Номер следующего события
+    ModBus_TraceSlot_T slots[MODBUS_TRACE_SLOTS];
+} ModBus_Trace_T;
+
+typedef struct _MODBUS_TRACE_HEADER_T { // Заголовок файла захвата
+    uint32_t magic; // MODBUS_TRACE_MAGIC
+    uint16_t version; // MODBUS_TRACE_VERSION
+    uint16_t headerSize; // sizeof(ModBus_TraceHeader_T), записи начинаются после заголовка
+    uint32_t count; // Количество записей
+    uint32_t lost; // Событий, перезаписанных до снимка
+} ModBus_TraceHeader_T;
+
+typedef struct _MODBUS_TRACE_RECORD_T { // Запись файла захвата, за ней size байтов события
+    uint64_t time; // Время события, мкс
+    uint16_t size;
+    uint8_t direction; // MODBUS_TRACE_DIRECTION
+    uint8_t unit;
+    uint32_t reserved;
+} ModBus_TraceRecord_T;
+
+typedef struct _MODBUS_TRACE_READER_T { // Чтение файла захвата
+    const uint8_t* data;
+    size_t size;
+    size_t offset; // Позиция следующей записи
+    uint32_t left; // Непрочитанных записей
+} ModBus_TraceReader_T;
+
+/************ Внешний интерфейс BEGIN ***********/
+
+// Очистка трассы
+void ModBus_Trace_init(ModBus_Trace_T* trace);
+
+// Привязка трассы к экземпляру, NULL - отвязать. Одна трасса может быть привязана к нескольким экземплярам
+void ModBus_attachTrace(ModBus_parameter* ModBus_para, ModBus_Trace_T* trace);
+
+/** Запись события **/
+/*** Параметры ***
+** direction: MODBUS_TRACE_RX или MODBUS_TRACE_TX
+** unit: Адрес устройства
+** time: Время события, мкс
+** data, size: Байты события, блок длиннее MODBUS_TRACE_DATA записывается несколькими событиями
+** Примечание: Вызывается экземпляром сам; без блокировок, можно вызывать из прерывания.
+***/
+void ModBus_Trace_record(ModBus_Trace_T* trace, uint8_t direction, uint8_t unit, uint64_t time, const uint8_t* data, size_t size);
+
+/** Снимок трассы в формате файла захвата **/
+/*** Параметры ***
+** out, size: Память снимка, MODBUS_TRACE_CAPTURE_MAX байтов достаточно для любой трассы
+** Возвращает длину снимка, 0 если не помещается даже заголовок. События, не поместившиеся в out, не записываются.
+***/
+size_t ModBus_Trace_capture(ModBus_Trace_T* trace, uint8_t* out, size_t size);
+
+// Снимок трассы в файл path, возвращает количество записей или -1 при ошибке
+int ModBus_Trace_save(ModBus_Trace_T* trace, const char* path);
+
+// Начало чтения захвата (файл в памяти или mmap), возвращает 0, если заголовок неверен
+uint8_t ModBus_Trace_open(ModBus_TraceReader_T* reader, const void* capture, size_t size);
+
+// Следующая запись захвата, data - ее байты. NULL, если записи закончились или захват поврежден
+const ModBus_TraceRecord_T* ModBus_Trace_next(ModBus_TraceReader_T* reader, const uint8_t** data);
+
+/** Воспроизведение захвата **/
+/*** Параметры ***
+** reader: Захват, открытый ModBus_Trace_open; воспроизводятся оставшиеся записи
+** ModBus_para: Экземпляр, получающий записи MODBUS_TRACE_RX с unit, равным его адресу
+** realTime: 1 - с исходными интервалами по ModBus_now(), 0 - с максимальной скоростью
+** loop: Цикл экземпляра (ModBus_Master_loop или ModBus_Slave_loop), вызывается после каждой записи и во время ожидания
+** Возвращает количество переданных байтов
+***/
+size_t ModBus_Trace_replay(ModBus_TraceReader_T* reader, ModBus_parameter* ModBus_para, uint8_t realTime, void(*loop)(ModBus_parameter*));
+
+#ifdef _BENCHMARK
+void ModBus_Trace_benchmark(); // Стоимость записи события в зависимости от его длины
+#endif
+#if defined(_UNIT_TEST) && defined(MODBUS_MASTER) && defined(MODBUS_SLAVE)
+void ModBus_Trace_unitTest(); // Трасса Slave, сохранение в файл и воспроизведение в новом экземпляре
+#endif
+/**************** Внешний интерфейс END ***************/
+
+#endif // MODBUS_TRACE
+
+#endif